@@ -24,12 +24,18 @@
 #include "icons/IconList.h"
 #include "minecraft/LwjglVersionList.h"
 #include "minecraft/MinecraftVersionList.h"
+#include "minecraft/OneSixUpdate.h"
+#include "minecraft/AssetPackStore.h"
+#include "minecraft/PackAssetsTask.h"
 #include "liteloader/LiteLoaderVersionList.h"
 
 #include "forge/ForgeVersionList.h"
 
 #include "net/HttpMetaCache.h"
 #include "net/URLConstants.h"
+#include "net/CacheGCTask.h"
+#include "net/NetScheduler.h"
+#include "net/NetJob.h"
 #include "Env.h"
 
 #include "java/JavaUtils.h"
@@ -231,10 +237,63 @@ MultiMC::MultiMC(int &argc, char **argv, bool test_mode) : QApplication(argc, ar
 
 	// init the http meta cache
 	ENV.initHttpMetaCache(rootPath, staticDataPath);
+	if (m_settings->get("CacheDeduplication").toBool())
+	{
+		ENV.metacache()->setBlobStore(
+			std::make_shared<BlobStore>(QDir("cache/blobs").absolutePath()));
+	}
+	qint64 cacheQuota = m_settings->get("CacheQuota").toLongLong() * 1024 * 1024;
+	if (cacheQuota > 0)
+	{
+		for (auto base : ENV.metacache()->bases())
+		{
+			// these aren't really caches
+			if (base == "root" || base == "translations")
+				continue;
+			ENV.metacache()->setBaseQuota(base, cacheQuota);
+		}
+	}
+	// the tasks below read the instances' versions, and those refer to the Minecraft versions
+	minecraftlist();
+	if (m_settings->get("AssetPacks").toBool())
+	{
+		ENV.setAssetPacks(std::make_shared<AssetPackStore>(QDir("assets/packs").absolutePath()));
+		m_packAssets = std::make_shared<PackAssetsTask>(ENV.assetPacks(), m_instances);
+		m_packAssets->start();
+	}
+	// after the packing started, so the GC knows to keep away from the asset objects.
+	// it also collects the blobs nothing uses any more.
+	if (cacheQuota > 0 || ENV.metacache()->blobStore())
+	{
+		m_cacheGC = std::make_shared<CacheGCTask>(m_instances,
+												  m_settings->get("CacheGCDryRun").toBool());
+		m_cacheGC->start();
+	}
 
 	// create the global network manager
 	ENV.m_qnam.reset(new QNetworkAccessManager(this));
 
+	// the bandwidth limit can change at any time
+	{
+		auto bandwidthSetting = m_settings->getSetting("BandwidthLimit");
+		ENV.netScheduler()->setRateLimit(bandwidthSetting->get().toLongLong() * 1024);
+		connect(bandwidthSetting.get(), &Setting::SettingChanged,
+				[](const Setting &, QVariant value)
+		{
+			ENV.netScheduler()->setRateLimit(value.toLongLong() * 1024);
+		});
+	}
+	if (m_settings->get("NetworkTrace").toBool())
+	{
+		NetJob::setTraceDirectory(QDir("traces").absolutePath());
+	}
+	OneSixUpdate::setVerifyAssets(m_settings->get("VerifyAssets").toBool());
+	connect(m_settings->getSetting("VerifyAssets").get(), &Setting::SettingChanged,
+			[](const Setting &, QVariant value)
+	{
+		OneSixUpdate::setVerifyAssets(value.toBool());
+	});
+
 	// init proxy settings
 	{
 		QString proxyTypeStr = settings()->get("ProxyType").toString();
@@ -501,6 +560,23 @@ void MultiMC::initGlobalSettings(bool test_mode)
 	m_settings->registerSetting({"ProxyUser", "ProxyUsername"}, "");
 	m_settings->registerSetting({"ProxyPass", "ProxyPassword"}, "");
 
+	// Cache Settings
+	m_settings->registerSetting("CacheDeduplication", false);
+	// in MiB, per cache folder. 0 means no limit.
+	m_settings->registerSetting("CacheQuota", 0);
+	// only log what the cache GC would remove
+	m_settings->registerSetting("CacheGCDryRun", false);
+	// hash every asset object on update, and download the bad ones again
+	m_settings->registerSetting("VerifyAssets", false);
+	// keep the asset objects instances don't use in a few big files
+	m_settings->registerSetting("AssetPacks", false);
+
+	// Network Settings
+	// in KiB/s, for all downloads together. 0 means no limit.
+	m_settings->registerSetting("BandwidthLimit", 0);
+	// write a trace of every network job to 'traces'. For finding out why updates are slow.
+	m_settings->registerSetting("NetworkTrace", false);
+
 	// Memory
 	m_settings->registerSetting({"MinMemAlloc", "MinMemoryAlloc"}, 512);
 	m_settings->registerSetting({"MaxMemAlloc", "MaxMemoryAlloc"}, 1024);
@@ -25,6 +25,8 @@ class UpdateChecker;
 class BaseProfilerFactory;
 class BaseDetachedToolFactory;
 class TranslationDownloader;
+class CacheGCTask;
+class PackAssetsTask;
 
 #if defined(MMC)
 #undef MMC
@@ -169,6 +171,8 @@ private:
 	std::shared_ptr<MinecraftVersionList> m_minecraftlist;
 	std::shared_ptr<JavaVersionList> m_javalist;
 	std::shared_ptr<TranslationDownloader> m_translationChecker;
+	std::shared_ptr<CacheGCTask> m_cacheGC;
+	std::shared_ptr<PackAssetsTask> m_packAssets;
 	std::shared_ptr<GenericPageProvider> m_globalSettingsProvider;
 
 	QMap<QString, std::shared_ptr<BaseProfilerFactory>> m_profilers;
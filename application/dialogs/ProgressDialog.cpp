@@ -66,9 +66,16 @@ int ProgressDialog::exec(Task *task)
 	connect(task, SIGNAL(started()), SLOT(onTaskStarted()));
 	connect(task, SIGNAL(failed(QString)), SLOT(onTaskFailed(QString)));
 	connect(task, SIGNAL(succeeded()), SLOT(onTaskSucceeded()));
+	connect(task, SIGNAL(aborted()), SLOT(onTaskAborted()));
 	connect(task, SIGNAL(status(QString)), SLOT(changeStatus(const QString &)));
 	connect(task, SIGNAL(progress(qint64, qint64)), SLOT(changeProgress(qint64, qint64)));
 
+	// tasks that can be stopped get a button for it, unless the caller wants it for something else
+	if(task->canAbort() && !ui->skipButton->isEnabled())
+	{
+		setSkipButton(true, tr("Cancel"));
+	}
+
 	// if this didn't connect to an already running task, invoke start
 	if(!task->isRunning())
 	{
@@ -121,6 +128,11 @@ void ProgressDialog::onTaskFailed(QString failure)
 	reject();
 }
 
+void ProgressDialog::onTaskAborted()
+{
+	reject();
+}
+
 void ProgressDialog::onTaskSucceeded()
 {
 	accept();
@@ -44,6 +44,7 @@ public
 slots:
 	void onTaskStarted();
 	void onTaskFailed(QString failure);
+	void onTaskAborted();
 	void onTaskSucceeded();
 
 	void changeStatus(const QString &status);
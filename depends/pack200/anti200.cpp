@@ -4,19 +4,22 @@
 
 #include <stdexcept>
 #include <iostream>
+#include <cstring>
 #include "unpack200.h"
 
 int main(int argc, char **argv)
 {
-	if (argc != 3)
+	// --store writes the jar without compressing anything
+	bool store = argc == 4 && strcmp(argv[1], "--store") == 0;
+	if (argc != 3 && !store)
 	{
 		std::cerr << "Simple pack200 unpacker!" << std::endl << "Run like this:" << std::endl
-				  << "  " << argv[0] << " input.jar.lzma output.jar" << std::endl;
+				  << "  " << argv[0] << " [--store] input.jar.lzma output.jar" << std::endl;
 		return EXIT_FAILURE;
 	}
 
-	FILE *input = fopen(argv[1], "rb");
-	FILE *output = fopen(argv[2], "wb");
+	FILE *input = fopen(argv[argc - 2], "rb");
+	FILE *output = fopen(argv[argc - 1], "wb");
 	if (!input)
 	{
 		std::cerr << "Can't open input file";
@@ -30,7 +33,24 @@ int main(int argc, char **argv)
 	}
 	try
 	{
-		unpack_200(input, output);
+		if (store)
+		{
+			unpack_200([input](void *buf, int64_t maxlen)
+			{
+				return (int64_t)fread(buf, 1, (size_t)maxlen, input);
+			},
+			[output](const void *data, size_t len)
+			{
+				return fwrite(data, 1, len, output) == len;
+			},
+			UNPACK_200_STORE);
+			fclose(input);
+			fclose(output);
+		}
+		else
+		{
+			unpack_200(input, output);
+		}
 	}
 	catch (std::runtime_error &e)
 	{
@@ -25,12 +25,94 @@
 
 #pragma once
 #include <string>
+#include <functional>
+#include <cstdio>
+#include <cstdint>
+
+/**
+ * @brief Supplies PACK200 input
+ *
+ * Fills buf with up to maxlen bytes and returns how many were written. 0 means end of input,
+ * a negative value means the input failed.
+ */
+typedef std::function<int64_t(void *buf, int64_t maxlen)> unpack_200_source;
+
+/**
+ * @brief Receives the unpacked JAR file, in order
+ *
+ * @return false if the data could not be written. Unpacking stops with an error.
+ */
+typedef std::function<bool(const void *data, size_t len)> unpack_200_sink;
+
+/**
+ * @brief How the entries of the JAR file are compressed
+ */
+enum unpack_200_compression
+{
+	/// deflate what the archive asks for, one entry after the other, like the JDK does
+	UNPACK_200_DEFLATE,
+	/// the same, deflated by worker threads that all unpackers share. The JAR file is byte for
+	/// byte the same.
+	UNPACK_200_DEFLATE_PARALLEL,
+	/// store everything. Fastest and biggest, for JAR files only the JVM reads.
+	UNPACK_200_STORE
+};
+
+/**
+ * @brief Memory used by the unpacker for one archive
+ *
+ * Bands and the constant pool are allocated from arenas owned by the unpacker.
+ */
+struct unpack_200_stats
+{
+	/// bytes requested from the arenas, in total
+	uint64_t allocated;
+	/// most bytes handed out at the same time
+	size_t peak;
+	/// most bytes the arenas held at the same time
+	size_t peak_reserved;
+	/// number of blocks the arenas took from the system
+	int blocks;
+};
+
+/**
+ * @brief Unpack PACK200 data from a source into a sink
+ *
+ * Nothing touches the disk and no state is shared with other calls.
+ *
+ * @param input Where the PACK200 data comes from.
+ * @param output Where the JAR file goes.
+ * @param compression How the entries of the JAR file are compressed.
+ * @param stats If set, receives the memory statistics of a successful unpack.
+ * @return void
+ * @throw std::runtime_error for any error encountered
+ */
+void unpack_200(const unpack_200_source &input, const unpack_200_sink &output,
+				unpack_200_compression compression = UNPACK_200_DEFLATE,
+				unpack_200_stats *stats = nullptr);
+
+/**
+ * @brief Unpack PACK200 data held in memory into a sink
+ *
+ * @param data The PACK200 data. It is not modified and has to live until the call returns.
+ * @param size Size of the data.
+ * @param output Where the JAR file goes.
+ * @param compression How the entries of the JAR file are compressed.
+ * @param stats If set, receives the memory statistics of a successful unpack.
+ * @return void
+ * @throw std::runtime_error for any error encountered
+ */
+void unpack_200(const void *data, size_t size, const unpack_200_sink &output,
+				unpack_200_compression compression = UNPACK_200_DEFLATE,
+				unpack_200_stats *stats = nullptr);
 
 /**
  * @brief Unpack a PACK200 file
  *
- * @param input_path Path to the input file in PACK200 format. System native string encoding.
- * @param output_path Path to the output file in PACK200 format. System native string encoding.
+ * Both files are closed when unpacking succeeds. If it fails, they are left to the caller.
+ *
+ * @param input File in PACK200 format, open for reading.
+ * @param output File for the JAR, open for writing.
  * @return void
  * @throw std::runtime_error for any error encountered
  */
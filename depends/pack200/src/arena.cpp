@@ -0,0 +1,139 @@
+/*
+ * Bump allocator for the unpacker. Part of MultiMC's pack200 port, same license as the rest.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+
+#include "defines.h"
+#include "utils.h"
+#include "arena.h"
+
+enum
+{
+	// what a block usually holds
+	BLOCK_SIZE = (1 << 16),
+	// anything bigger gets a block of its own instead of wasting the rest of the current one
+	BIG = (BLOCK_SIZE / 4),
+	// keeps the data after the header 16 byte aligned
+	HEADER_SIZE = (sizeof(arena::block) + 15) & ~15
+};
+
+static inline byte *data_of(arena::block *b)
+{
+	return (byte *)b + HEADER_SIZE;
+}
+
+void arena::init(arena_stats *stats_)
+{
+	blocks = nullptr;
+	spare = nullptr;
+	in_use = 0;
+	stats = stats_;
+}
+
+arena::block *arena::new_block(size_t size)
+{
+	// must_malloc hands out zeroed memory
+	block *b = (block *)must_malloc(add_size(size, HEADER_SIZE));
+	b->size = size;
+	stats->reserved += HEADER_SIZE + size;
+	if (stats->reserved > stats->peak_reserved)
+		stats->peak_reserved = stats->reserved;
+	stats->blocks++;
+	return b;
+}
+
+void arena::free_block(block *b)
+{
+	stats->reserved -= HEADER_SIZE + b->size;
+	::free(b);
+}
+
+void *arena::alloc(size_t size)
+{
+	size_t need = add_size(size, 7);
+	if (need == OVERFLOW)
+		unpack_abort(ERROR_ENOMEM);
+	need &= ~(size_t)7; // round up mod 8
+
+	block *b;
+	if (need > BIG)
+	{
+		b = new_block(need);
+		// behind the current block, which can go on filling up
+		if (blocks != nullptr)
+		{
+			b->next = blocks->next;
+			blocks->next = b;
+		}
+		else
+		{
+			blocks = b;
+		}
+	}
+	else
+	{
+		if (blocks == nullptr || blocks->size - blocks->used < need)
+		{
+			if (spare != nullptr)
+			{
+				b = spare;
+				spare = nullptr;
+			}
+			else
+			{
+				b = new_block(BLOCK_SIZE);
+			}
+			b->next = blocks;
+			blocks = b;
+		}
+		b = blocks;
+	}
+	void *res = data_of(b) + b->used;
+	b->used += need;
+
+	in_use += need;
+	stats->allocated += size;
+	stats->in_use += need;
+	if (stats->in_use > stats->peak)
+		stats->peak = stats->in_use;
+	return res;
+}
+
+void arena::reset()
+{
+	while (blocks != nullptr)
+	{
+		block *b = blocks;
+		blocks = b->next;
+		if (spare == nullptr && b->size == BLOCK_SIZE)
+		{
+			// everything handed out has to look freshly allocated again
+			memset(data_of(b), 0, b->used);
+			b->used = 0;
+			b->next = nullptr;
+			spare = b;
+		}
+		else
+		{
+			free_block(b);
+		}
+	}
+	stats->in_use -= in_use;
+	in_use = 0;
+}
+
+void arena::free()
+{
+	if (stats == nullptr)
+		return; // never used
+	reset();
+	if (spare != nullptr)
+	{
+		free_block(spare);
+		spare = nullptr;
+	}
+}
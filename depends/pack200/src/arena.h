@@ -0,0 +1,49 @@
+/*
+ * Bump allocator for the unpacker. Part of MultiMC's pack200 port, same license as the rest.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Allocation statistics, shared by all arenas of one unpacker
+struct arena_stats
+{
+	uint64_t allocated;   // bytes requested, in total
+	size_t in_use;		  // bytes handed out and not released yet
+	size_t peak;		  // highest in_use
+	size_t reserved;	  // bytes taken from the system and not given back yet
+	size_t peak_reserved; // highest reserved
+	int blocks;			  // number of system allocations
+};
+
+// Hands out zeroed memory from big blocks. Nothing is freed on its own,
+// everything goes at once with reset() or free().
+// Like the rest of the unpacker state, this must survive being cleared bytewise.
+struct arena
+{
+	struct block
+	{
+		block *next;
+		size_t size; // usable bytes
+		size_t used;
+	};
+
+	block *blocks; // newest first, the first one is being filled
+	block *spare;  // an emptied block, kept for after reset()
+	size_t in_use;
+	arena_stats *stats;
+
+	void init(arena_stats *stats_);
+	// never returns nullptr, throws like must_malloc
+	void *alloc(size_t size);
+	// release all allocations, but keep a block for the next ones
+	void reset();
+	// give all memory back to the system
+	void free();
+
+private:
+	block *new_block(size_t size);
+	void free_block(block *b);
+};
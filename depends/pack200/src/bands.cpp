@@ -43,6 +43,7 @@
 #include "bands.h"
 
 #include "constants.h"
+#include "arena.h"
 #include "unpack.h"
 
 void band::readData(int expectedLength)
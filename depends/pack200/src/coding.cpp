@@ -40,6 +40,7 @@
 #include "coding.h"
 
 #include "constants.h"
+#include "arena.h"
 #include "unpack.h"
 
 extern coding basic_codings[];
@@ -1032,6 +1033,12 @@ coding basic_codings[] = {
 	CODING_INIT(0, 0, 0, 0)};
 #define BASIC_INDEX_LIMIT (int)(sizeof(basic_codings) / sizeof(basic_codings[0]) - 1)
 
+void coding::initAll()
+{
+	for (coding *scan = &basic_codings[0]; scan->spec != 0; scan++)
+		scan->init();
+}
+
 coding *coding::findByIndex(int idx)
 {
 	int index_limit = BASIC_INDEX_LIMIT;
@@ -83,6 +83,8 @@ struct coding
 	static coding *findBySpec(int spec);
 	static coding *findBySpec(int B, int H, int S = 0, int D = 0);
 	static coding *findByIndex(int irregularCodingIndex);
+	// initialize all the shared codings, so concurrent unpackers only ever read them
+	static void initAll();
 
 	static uint32_t parse(byte *&rp, int B, int H);
 	static uint32_t parse_lgH(byte *&rp, int B, int H, int lgH);
@@ -63,6 +63,7 @@
 
 #include "zip.h"
 
+#include "arena.h"
 #include "unpack.h"
 
 // tags, in canonical order:
@@ -286,12 +287,10 @@ void unpacker::free()
 	/*
 	 * free everybody ever allocated with U_NEW or (recently) with T_NEW
 	 */
-	assert(smallbuf.base() == nullptr || mallocs.contains(smallbuf.base()));
-	assert(tsmallbuf.base() == nullptr || tmallocs.contains(tsmallbuf.base()));
 	mallocs.freeAll();
 	tmallocs.freeAll();
-	smallbuf.init();
-	tsmallbuf.init();
+	heap.free();
+	temps.free();
 	bcimap.free();
 	class_fixup_type.free();
 	class_fixup_offset.free();
@@ -491,24 +490,16 @@ enum
 	SMALL = (1 << 9)
 };
 
-// Call malloc.  Try to combine small blocks and free much later.
+// Hand out memory from the arenas, which free it all at once much later.
 void *unpacker::alloc_heap(size_t size, bool smallOK, bool temp)
 {
-	if (!smallOK || size > SMALL)
+	if (!smallOK)
 	{
 		void *res = must_malloc((int)size);
 		(temp ? &tmallocs : &mallocs)->add(res);
 		return res;
 	}
-	fillbytes &xsmallbuf = *(temp ? &tsmallbuf : &smallbuf);
-	if (!xsmallbuf.canAppend(size + 1))
-	{
-		xsmallbuf.init(CHUNK);
-		(temp ? &tmallocs : &mallocs)->add(xsmallbuf.base());
-	}
-	int growBy = (int)size;
-	growBy += -growBy & 7; // round up mod 8
-	return xsmallbuf.grow(growBy);
+	return (temp ? &temps : &heap)->alloc(size);
 }
 
 void unpacker::saveTo(bytes &b, byte *ptr, size_t len)
@@ -3473,7 +3464,7 @@ void constant_pool::computeOutputIndexes()
 // Unpacker Start
 // Deallocate all internal storage and reset to a clean state.
 // Do not disturb any input or output connections, including
-// infileptr, inbytes, read_input_fn, jarout, or errstrm.
+// insource, inbytes, read_input_fn, jarout, or errstrm.
 // Do not reset any unpack options.
 void unpacker::reset()
 {
@@ -3501,14 +3492,14 @@ void unpacker::reset()
 	}
 
 	unpacker save_u = (*this); // save bytewise image
-	infileptr = nullptr;	   // make asserts happy
+	insource = nullptr;		   // make asserts happy
 	jarout = nullptr;		  // do not close the output jar
 	gzin = nullptr;			// do not close the input gzip stream
 	this->free();
 	this->init(read_input_fn);
 
 	// restore selected interface state:
-	infileptr = save_u.infileptr;
+	insource = save_u.insource;
 	inbytes = save_u.inbytes;
 	jarout = save_u.jarout;
 	gzin = save_u.gzin;
@@ -3520,6 +3511,13 @@ void unpacker::reset()
 	files_written_before_reset = save_u.files_written_before_reset;
 	classes_written_before_reset = save_u.classes_written_before_reset;
 	segments_read_before_reset = save_u.segments_read_before_reset;
+	// the arenas start over, their statistics don't
+	alloc_stats.allocated += save_u.alloc_stats.allocated;
+	alloc_stats.blocks += save_u.alloc_stats.blocks;
+	if (save_u.alloc_stats.peak > alloc_stats.peak)
+		alloc_stats.peak = save_u.alloc_stats.peak;
+	if (save_u.alloc_stats.peak_reserved > alloc_stats.peak_reserved)
+		alloc_stats.peak_reserved = save_u.alloc_stats.peak_reserved;
 	// Note:  If we use strip_names, watch out:  They get nuked here.
 }
 
@@ -3528,6 +3526,8 @@ void unpacker::init(read_input_fn_t input_fn)
 	int i;
 	BYTES_OF(*this).clear();
 	this->u = this; // self-reference for U_NEW macro
+	heap.init(&alloc_stats);
+	temps.init(&alloc_stats);
 	read_input_fn = input_fn;
 	all_bands = band::makeBands(this);
 	// Make a default jar buffer; caller may safely overwrite it.
@@ -158,7 +158,7 @@ struct unpacker
 	};
 
 	// if running Unix-style, here are the inputs and outputs
-	FILE *infileptr; // buffered
+	void *insource;  // the caller's unpack_200_source
 	bytes inbytes;   // direct
 	gunzip *gzin;	// gunzip filter, if any
 	jar *jarout;	 // output JAR file
@@ -166,10 +166,11 @@ struct unpacker
 	// pointer to self, for U_NEW macro
 	unpacker *u;
 
-	ptrlist mallocs;	 // list of guys to free when we are all done
-	ptrlist tmallocs;	// list of guys to free on next client request
-	fillbytes smallbuf;  // supplies small alloc requests
-	fillbytes tsmallbuf; // supplies temporary small alloc requests
+	ptrlist mallocs;		 // list of guys to free when we are all done
+	ptrlist tmallocs;		 // list of guys to free on next client request
+	arena heap;				 // supplies alloc requests
+	arena temps;			 // supplies temporary alloc requests
+	arena_stats alloc_stats; // what both arenas did, over all segments
 
 	// option management members
 	int verbose;			  // verbose level, 0 means no output
@@ -378,7 +379,7 @@ struct unpacker
 	// Deallocates temporary storage (volatile after next client call).
 	void free_temps()
 	{
-		tsmallbuf.init();
+		temps.reset();
 		tmallocs.freeAll();
 	}
 
@@ -39,31 +39,26 @@
 #include "bytes.h"
 #include "coding.h"
 #include "unpack200.h"
+#include "arena.h"
 #include "unpack.h"
 #include "zip.h"
 
-// Callback for fetching data, Unix style.
-static int64_t read_input_via_stdio(unpacker *u, void *buf, int64_t minlen, int64_t maxlen)
+// Callback for fetching data from the caller's source.
+static int64_t read_input_via_source(unpacker *u, void *buf, int64_t minlen, int64_t maxlen)
 {
-	assert(u->infileptr != nullptr);
+	assert(u->insource != nullptr);
 	assert(minlen <= maxlen); // don't talk nonsense
+	const unpack_200_source &source = *(const unpack_200_source *)u->insource;
 	int64_t numread = 0;
 	char *bufptr = (char *)buf;
 	while (numread < minlen)
 	{
-		// read available input, up to buf.length or maxlen
-		int readlen = (1 << 16);
-		if (readlen > (maxlen - numread))
-			readlen = (int)(maxlen - numread);
-		int nr = 0;
-
-		nr = (int)fread(bufptr, 1, readlen, u->infileptr);
-		if (nr <= 0)
-		{
-			if (errno != EINTR)
-				break;
-			nr = 0;
-		}
+		// read available input, up to maxlen
+		int64_t nr = source(bufptr, maxlen - numread);
+		if (nr < 0)
+			unpack_abort("read on input failed");
+		if (nr == 0)
+			break;
 		numread += nr;
 		bufptr += nr;
 		assert(numread <= maxlen);
@@ -94,69 +89,136 @@ static int read_magic(unpacker *u, char peek[], int peeklen)
 	return magic;
 }
 
-void unpack_200(FILE *input, FILE *output)
+static void unpack_stream(const unpack_200_source &input, FILE *output_file,
+						  const unpack_200_sink *output_sink,
+						  unpack_200_compression compression, unpack_200_stats *stats)
 {
+	// done once, the first time anything is unpacked
+	static bool codings_ready = (coding::initAll(), true);
+	(void)codings_ready;
+
 	unpacker u;
-	u.init(read_input_via_stdio);
+	u.init(read_input_via_source);
 
 	// initialize jar output
 	// the output takes ownership of the file handle
 	jar jarout;
 	jarout.init(&u);
-	jarout.jarfp = output;
+	jarout.jarfp = output_file;
+	jarout.sink = (void *)output_sink;
+	jarout.compression = compression;
 
 	// the input doesn't
-	u.infileptr = input;
-
-	// read the magic!
-	char peek[4];
-	int magic;
-	magic = read_magic(&u, peek, (int)sizeof(peek));
+	u.insource = (void *)&input;
 
-	// if it is a gzip encoded file, we need an extra gzip input filter
-	if ((magic & GZIP_MAGIC_MASK) == GZIP_MAGIC)
+	try
 	{
-		gunzip *gzin = NEW(gunzip, 1);
-		gzin->init(&u);
-		// FIXME: why the side effects? WHY?
-		u.gzin->start(magic);
-		u.start();
-	}
-	else
-	{
-		// otherwise, feed the bytes to the unpacker directly
-		u.start(peek, sizeof(peek));
-	}
+		// read the magic!
+		char peek[4];
+		int magic;
+		magic = read_magic(&u, peek, (int)sizeof(peek));
 
-	// Note:  The checks to u.aborting() are necessary to gracefully
-	// terminate processing when the first segment throws an error.
-	for (;;)
-	{
-		// Each trip through this loop unpacks one segment
-		// and then resets the unpacker.
-		for (unpacker::file *filep; (filep = u.get_next_file()) != nullptr;)
+		// if it is a gzip encoded file, we need an extra gzip input filter
+		if ((magic & GZIP_MAGIC_MASK) == GZIP_MAGIC)
 		{
-			u.write_file_to_jar(filep);
+			gunzip *gzin = NEW(gunzip, 1);
+			gzin->init(&u);
+			// FIXME: why the side effects? WHY?
+			u.gzin->start(magic);
+			u.start();
 		}
-
-		// Peek ahead for more data.
-		magic = read_magic(&u, peek, (int)sizeof(peek));
-		if (magic != (int)JAVA_PACKAGE_MAGIC)
+		else
 		{
-			// we do not feel strongly about this kind of thing...
-			/*
-			if (magic != EOF_MAGIC)
-				unpack_abort("garbage after end of pack archive");
-			*/
-			break; // all done
+			// otherwise, feed the bytes to the unpacker directly
+			u.start(peek, sizeof(peek));
 		}
 
-		// Release all storage from parsing the old segment.
-		u.reset();
-		// Restart, beginning with the peek-ahead.
-		u.start(peek, sizeof(peek));
+		// Note:  The checks to u.aborting() are necessary to gracefully
+		// terminate processing when the first segment throws an error.
+		for (;;)
+		{
+			// Each trip through this loop unpacks one segment
+			// and then resets the unpacker.
+			for (unpacker::file *filep; (filep = u.get_next_file()) != nullptr;)
+			{
+				u.write_file_to_jar(filep);
+			}
+
+			// Peek ahead for more data.
+			magic = read_magic(&u, peek, (int)sizeof(peek));
+			if (magic != (int)JAVA_PACKAGE_MAGIC)
+			{
+				// we do not feel strongly about this kind of thing...
+				/*
+				if (magic != EOF_MAGIC)
+					unpack_abort("garbage after end of pack archive");
+				*/
+				break; // all done
+			}
+
+			// Release all storage from parsing the old segment.
+			u.reset();
+			// Restart, beginning with the peek-ahead.
+			u.start(peek, sizeof(peek));
+		}
+		u.finish();
+		if (stats)
+		{
+			stats->allocated = u.alloc_stats.allocated;
+			stats->peak = u.alloc_stats.peak;
+			stats->peak_reserved = u.alloc_stats.peak_reserved;
+			stats->blocks = u.alloc_stats.blocks;
+		}
+	}
+	catch (...)
+	{
+		// don't leak a whole segment worth of memory per failed file
+		u.free();
+		throw;
 	}
-	u.finish();
 	u.free(); // tidy up malloc blocks
+}
+
+void unpack_200(const unpack_200_source &input, const unpack_200_sink &output,
+				unpack_200_compression compression, unpack_200_stats *stats)
+{
+	unpack_stream(input, nullptr, &output, compression, stats);
+}
+
+void unpack_200(const void *data, size_t size, const unpack_200_sink &output,
+				unpack_200_compression compression, unpack_200_stats *stats)
+{
+	const char *pos = (const char *)data;
+	size_t left = size;
+	unpack_200_source input = [&pos, &left](void *buf, int64_t maxlen) -> int64_t
+	{
+		size_t len = ((uint64_t)maxlen < left) ? (size_t)maxlen : left;
+		memcpy(buf, pos, len);
+		pos += len;
+		left -= len;
+		return (int64_t)len;
+	};
+	unpack_stream(input, nullptr, &output, compression, stats);
+}
+
+void unpack_200(FILE *input, FILE *output)
+{
+	unpack_200_source source = [input](void *buf, int64_t maxlen) -> int64_t
+	{
+		int readlen = (1 << 16);
+		if (readlen > maxlen)
+			readlen = (int)maxlen;
+		for (;;)
+		{
+			int nr = (int)fread(buf, 1, readlen, input);
+			if (nr <= 0 && ferror(input) && errno == EINTR)
+			{
+				clearerr(input);
+				continue;
+			}
+			return (nr > 0) ? nr : 0;
+		}
+	};
+	unpack_stream(source, output, nullptr, UNPACK_200_DEFLATE, nullptr);
 	fclose(input);
 }
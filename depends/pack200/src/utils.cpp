@@ -46,6 +46,7 @@
 #include "bytes.h"
 #include "utils.h"
 
+#include "arena.h"
 #include "unpack.h"
 
 void *must_malloc(size_t size)
@@ -44,12 +44,23 @@
 #include "utils.h"
 
 #include "constants.h"
+#include "arena.h"
 #include "unpack.h"
 
 #include "zip.h"
+#include "unpack200.h"
 
 #include "zlib.h"
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <string>
+#include <memory>
+#include <new>
+
 inline uint32_t jar::get_crc32(uint32_t c, uchar *ptr, uint32_t len)
 {
 	return crc32(c, ptr, len);
@@ -66,6 +77,139 @@ inline uint32_t jar::get_crc32(uint32_t c, uchar *ptr, uint32_t len)
 
 #define GET_INT_HI(a) SWAP_BYTES((a >> 16) & 0xFFFF);
 
+static size_t deflate_parts(uchar *head, size_t head_len, uchar *tail, size_t tail_len,
+							uchar *out, size_t out_size);
+
+enum
+{
+	// how much the jar writer lets the workers get ahead of it
+	PENDING_BYTES_MAX = (1 << 25),
+	PENDING_ENTRIES_MAX = 1024
+};
+
+// A jar entry on its way through the deflater pool. Owns copies of everything it needs,
+// the unpacker reuses its buffers as soon as addJarEntry returns.
+struct pending_entry
+{
+	std::string name;
+	int modtime;
+	bool deflate;
+	std::vector<uchar> data; // head followed by tail
+	size_t head_len;
+	std::vector<uchar> deflated; // empty if storing is better
+	uint32_t crc;
+	bool done;
+};
+
+struct deflater_pool;
+
+// The threads that deflate jar entries. There is one set for the whole process, so unpacking
+// several jars at the same time doesn't start a set of threads for each of them.
+struct deflater_threads
+{
+	std::mutex lock;
+	std::condition_variable has_work;
+	std::deque<std::pair<deflater_pool *, pending_entry *>> work; // not picked up by a worker yet
+	std::vector<std::thread> workers;
+
+	static deflater_threads &instance()
+	{
+		// never destroyed: joining threads while the process exits can deadlock
+		static deflater_threads *threads = new deflater_threads();
+		return *threads;
+	}
+
+	deflater_threads()
+	{
+		unsigned count = std::thread::hardware_concurrency();
+		if (count < 2)
+			count = 2;
+		if (count > 8)
+			count = 8;
+		for (unsigned i = 0; i < count; i++)
+			workers.emplace_back(&deflater_threads::run, this);
+	}
+
+	void run();
+
+	static void compress(pending_entry *entry)
+	{
+		uchar *data = entry->data.data();
+		size_t len = entry->data.size();
+		entry->crc = crc32(crc32(0, Z_NULL, 0), data, (uInt)len);
+		try
+		{
+			// the same calls the single threaded writer makes
+			entry->deflated.resize(len + (len / 2));
+			size_t clen = deflate_parts(data, entry->head_len, data + entry->head_len,
+										len - entry->head_len, entry->deflated.data(),
+										entry->deflated.size());
+			entry->deflated.resize(clen);
+		}
+		catch (std::bad_alloc &)
+		{
+			entry->deflated.clear();
+		}
+	}
+};
+
+// The entries of one jar on their way through the deflater threads. The jar writer takes them
+// back in order, so the output is exactly what deflating them one by one would give.
+// Everything here is guarded by the lock of the threads.
+struct deflater_pool
+{
+	deflater_threads &threads;
+	std::mutex &lock;
+	std::condition_variable has_result;
+	std::deque<pending_entry *> entries; // in jar order, only the writer changes this
+	size_t pending_bytes = 0;
+	int in_flight = 0; // being deflated by a worker right now
+
+	deflater_pool() : threads(deflater_threads::instance()), lock(threads.lock)
+	{
+	}
+
+	~deflater_pool()
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		// the other jars' entries stay where they are
+		for (auto iter = threads.work.begin(); iter != threads.work.end();)
+		{
+			if (iter->first == this)
+				iter = threads.work.erase(iter);
+			else
+				++iter;
+		}
+		has_result.wait(guard, [this]() { return in_flight == 0; });
+		for (auto entry : entries)
+			delete entry;
+	}
+
+	void submit(pending_entry *entry)
+	{
+		threads.work.emplace_back(this, entry);
+	}
+};
+
+void deflater_threads::run()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	for (;;)
+	{
+		has_work.wait(guard, [this]() { return !work.empty(); });
+		deflater_pool *pool = work.front().first;
+		pending_entry *entry = work.front().second;
+		work.pop_front();
+		pool->in_flight++;
+		guard.unlock();
+		compress(entry);
+		guard.lock();
+		entry->done = true;
+		pool->in_flight--;
+		pool->has_result.notify_all();
+	}
+}
+
 void jar::init(unpacker *u_)
 {
 	BYTES_OF(*this).clear();
@@ -76,13 +220,19 @@ void jar::init(unpacker *u_)
 // Write data to the ZIP output stream.
 void jar::write_data(void *buff, int len)
 {
+	if (sink)
+	{
+		if (len > 0 && !(*(unpack_200_sink *)sink)(buff, len))
+			unpack_abort("write on output failed");
+		output_file_offset += len;
+		return;
+	}
 	while (len > 0)
 	{
 		int rc = (int)fwrite(buff, 1, len, jarfp);
 		if (rc <= 0)
 		{
-			fprintf(stderr, "Error: write on output file failed err=%d\n", errno);
-			exit(1); // Called only from the native standalone unpacker
+			unpack_abort("write on output file failed");
 		}
 		output_file_offset += rc;
 		buff = ((char *)buff) + rc;
@@ -241,16 +391,94 @@ void jar::write_central_directory()
 
 // Public API
 
+void jar::free()
+{
+	// unwritten entries are dropped, this only happens when unpacking failed
+	delete pool;
+	pool = nullptr;
+	central_directory.free();
+	deflated.free();
+}
+
+void jar::queue_entry(const char *fname, bool deflate, int modtime, bytes &head, bytes &tail)
+{
+	if (!pool)
+		pool = new deflater_pool();
+	std::unique_ptr<pending_entry> entry(new pending_entry());
+	entry->name = fname;
+	entry->modtime = modtime;
+	entry->deflate = deflate;
+	entry->head_len = head.len;
+	entry->data.reserve(head.len + tail.len);
+	entry->data.insert(entry->data.end(), (uchar *)head.ptr, (uchar *)head.ptr + head.len);
+	entry->data.insert(entry->data.end(), (uchar *)tail.ptr, (uchar *)tail.ptr + tail.len);
+	entry->crc = 0;
+	entry->done = !deflate;
+	if (!deflate)
+	{
+		// only waits for the ones in front of it
+		entry->crc = get_crc32(get_crc32(0, Z_NULL, 0), entry->data.data(),
+							   (uint32_t)entry->data.size());
+	}
+	{
+		std::lock_guard<std::mutex> guard(pool->lock);
+		pool->pending_bytes += entry->data.size();
+		if (deflate)
+			pool->submit(entry.get());
+		pool->entries.push_back(entry.release());
+	}
+	if (deflate)
+		pool->threads.has_work.notify_one();
+	write_finished_entries(false);
+}
+
+// Write the entries at the front of the queue that are done.
+// Waits for the workers if everything has to go out, or if they are too far ahead.
+void jar::write_finished_entries(bool all)
+{
+	if (!pool)
+		return;
+	for (;;)
+	{
+		pending_entry *next;
+		{
+			std::unique_lock<std::mutex> guard(pool->lock);
+			if (pool->entries.empty())
+				return;
+			if (!pool->entries.front()->done)
+			{
+				bool too_far = pool->pending_bytes > PENDING_BYTES_MAX ||
+							   pool->entries.size() > PENDING_ENTRIES_MAX;
+				if (!all && !too_far)
+					return;
+				pool->has_result.wait(guard, [this]() { return pool->entries.front()->done; });
+			}
+			next = pool->entries.front();
+			pool->entries.pop_front();
+			pool->pending_bytes -= next->data.size();
+		}
+		std::unique_ptr<pending_entry> entry(next);
+		bool store = entry->deflated.empty();
+		int len = (int)entry->data.size();
+		int clen = store ? len : (int)entry->deflated.size();
+		add_to_jar_directory(entry->name.c_str(), store, entry->modtime, len, clen, entry->crc);
+		write_jar_header(entry->name.c_str(), store, entry->modtime, len, clen, entry->crc);
+		if (store)
+			write_data(entry->data.data(), len);
+		else
+			write_data(entry->deflated.data(), clen);
+	}
+}
+
 // Open a Jar file and initialize.
 void jar::openJarFile(const char *fname)
 {
-	if (!jarfp)
+	if (!jarfp && !sink)
 	{
 		jarfp = fopen(fname, "wb");
 		if (!jarfp)
 		{
-			fprintf(stderr, "Error: Could not open jar file: %s\n", fname);
-			exit(3); // Called only from the native standalone unpacker
+			unpack_abort("could not open jar file");
 		}
 	}
 }
@@ -262,14 +490,20 @@ void jar::addJarEntry(const char *fname, bool deflate_hint, int modtime, bytes &
 	int len = (int)(head.len + tail.len);
 	int clen = 0;
 
+	bool deflate = (deflate_hint && len > 0 && compression != UNPACK_200_STORE);
+	// stored entries only take the detour when they have to wait their turn
+	if (compression == UNPACK_200_DEFLATE_PARALLEL && (deflate || (pool && !pool->entries.empty())))
+	{
+		queue_entry(fname, deflate, modtime, head, tail);
+		return;
+	}
+
 	uint32_t crc = get_crc32(0, Z_NULL, 0);
 	if (head.len != 0)
 		crc = get_crc32(crc, (uchar *)head.ptr, (uint32_t)head.len);
 	if (tail.len != 0)
 		crc = get_crc32(crc, (uchar *)tail.ptr, (uint32_t)tail.len);
 
-	bool deflate = (deflate_hint && len > 0);
-
 	if (deflate)
 	{
 		if (deflate_bytes(head, tail) == false)
@@ -295,6 +529,13 @@ void jar::addJarEntry(const char *fname, bool deflate_hint, int modtime, bytes &
 // Add a ZIP entry for a directory name no data
 void jar::addDirectoryToJarFile(const char *dir_name)
 {
+	if (pool && !pool->entries.empty())
+	{
+		bytes none;
+		none.set(nullptr, 0);
+		queue_entry(dir_name, false, default_modtime, none, none);
+		return;
+	}
 	bool store = true;
 	add_to_jar_directory((const char *)dir_name, store, default_modtime, 0, 0, 0);
 	write_jar_header((const char *)dir_name, store, default_modtime, 0, 0, 0);
@@ -303,7 +544,13 @@ void jar::addDirectoryToJarFile(const char *dir_name)
 // Write out the central directory and close the jar file.
 void jar::closeJarFile(bool central)
 {
-	if (jarfp)
+	write_finished_entries(true);
+	if (sink)
+	{
+		if (central)
+			write_central_directory();
+	}
+	else if (jarfp)
 	{
 		fflush(jarfp);
 		if (central)
@@ -352,13 +599,13 @@ uint32_t jar::get_dostime(int modtime)
 	return dostime_cache;
 }
 
-/* Returns true on success, and will set the clen to the compressed
-   length, the caller should verify if true and clen less than the
-   input data
-*/
-bool jar::deflate_bytes(bytes &head, bytes &tail)
+// Deflates head and tail into out, which has room for out_size bytes.
+// Returns the compressed size, 0 if deflating failed or didn't make the data smaller.
+// Only touches its arguments, so it can run on any thread.
+static size_t deflate_parts(uchar *head, size_t head_len, uchar *tail, size_t tail_len,
+							uchar *out, size_t out_size)
 {
-	int len = (int)(head.len + tail.len);
+	size_t len = head_len + tail_len;
 
 	z_stream zs;
 	BYTES_OF(zs).clear();
@@ -369,71 +616,60 @@ bool jar::deflate_bytes(bytes &head, bytes &tail)
 	int error =
 		deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
 	if (error != Z_OK)
-	{
-		/*
-		switch (error)
-		{
-		case Z_MEM_ERROR:
-			PRINTCR((2, "Error: deflate error : Out of memory \n"));
-			break;
-		case Z_STREAM_ERROR:
-			PRINTCR((2, "Error: deflate error : Invalid compression level \n"));
-			break;
-		case Z_VERSION_ERROR:
-			PRINTCR((2, "Error: deflate error : Invalid version\n"));
-			break;
-		default:
-			PRINTCR((2, "Error: Internal deflate error error = %d\n", error));
-		}
-		*/
-		return false;
-	}
+		return 0;
 
-	deflated.empty();
-	zs.next_out = (uchar *)deflated.grow(len + (len / 2));
-	zs.avail_out = (int)deflated.size();
-
-	zs.next_in = (uchar *)head.ptr;
-	zs.avail_in = (int)head.len;
+	zs.next_out = out;
+	zs.avail_out = (uInt)out_size;
 
-	bytes *first = &head;
-	bytes *last = &tail;
-	if (last->len == 0)
+	uchar *first = head;
+	size_t first_len = head_len;
+	uchar *last = tail;
+	size_t last_len = tail_len;
+	if (last_len == 0)
 	{
 		first = nullptr;
-		last = &head;
+		last = head;
+		last_len = head_len;
 	}
-	else if (first->len == 0)
+	else if (first_len == 0)
 	{
 		first = nullptr;
 	}
 
-	if (first != nullptr && error == Z_OK)
+	if (first != nullptr)
 	{
-		zs.next_in = (uchar *)first->ptr;
-		zs.avail_in = (int)first->len;
+		zs.next_in = first;
+		zs.avail_in = (uInt)first_len;
 		error = deflate(&zs, Z_NO_FLUSH);
 	}
 	if (error == Z_OK)
 	{
-		zs.next_in = (uchar *)last->ptr;
-		zs.avail_in = (int)last->len;
+		zs.next_in = last;
+		zs.avail_in = (uInt)last_len;
 		error = deflate(&zs, Z_FINISH);
 	}
-	if (error == Z_STREAM_END)
-	{
-		if (len > (int)zs.total_out)
-		{
-			deflated.b.len = zs.total_out;
-			deflateEnd(&zs);
-			return true;
-		}
-		deflateEnd(&zs);
-		return false;
-	}
-
+	size_t clen = 0;
+	if (error == Z_STREAM_END && len > zs.total_out)
+		clen = zs.total_out;
 	deflateEnd(&zs);
-	return false;
+	return clen;
+}
+
+/* Returns true on success, and will set the clen to the compressed
+   length, the caller should verify if true and clen less than the
+   input data
+*/
+bool jar::deflate_bytes(bytes &head, bytes &tail)
+{
+	size_t len = head.len + tail.len;
+	deflated.empty();
+	uchar *out = (uchar *)deflated.grow(len + (len / 2));
+	size_t clen = deflate_parts((uchar *)head.ptr, head.len, (uchar *)tail.ptr, tail.len, out,
+								deflated.size());
+	if (clen == 0)
+		return false;
+	deflated.b.len = clen;
+	return true;
 }
 
 // Callback for fetching data from a GZIP input stream
@@ -28,11 +28,15 @@ typedef unsigned int uint32_t;
 typedef unsigned char uchar;
 
 struct unpacker;
+struct deflater_pool;
 
 struct jar
 {
 	// JAR file writer
 	FILE *jarfp;
+	void *sink; // the caller's unpack_200_sink, used instead of jarfp
+	int compression;	 // an unpack_200_compression
+	deflater_pool *pool; // entries out with the deflater threads, for UNPACK_200_DEFLATE_PARALLEL
 	int default_modtime;
 
 	// Used by unix2dostime:
@@ -57,11 +61,7 @@ struct jar
 
 	void init(unpacker *u_);
 
-	void free()
-	{
-		central_directory.free();
-		deflated.free();
-	}
+	void free();
 
 	void reset()
 	{
@@ -70,6 +70,8 @@ struct jar
 	}
 
 	// Private Methods
+	void queue_entry(const char *fname, bool deflate, int modtime, bytes &head, bytes &tail);
+	void write_finished_entries(bool all);
 	void write_data(void *ptr, int len);
 	void write_data(bytes &b)
 	{
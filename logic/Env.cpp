@@ -1,11 +1,15 @@
 #include "Env.h"
 #include "net/HttpMetaCache.h"
+#include "net/NetScheduler.h"
 #include "icons/IconList.h"
+#include "minecraft/AssetPackStore.h"
 #include "BaseVersion.h"
 #include "BaseVersionList.h"
 #include <QDir>
 #include <QNetworkProxy>
 #include <QNetworkAccessManager>
+#include <QThreadPool>
+#include <QThread>
 #include <QDebug>
 #include "tasks/Task.h"
 #include <QDebug>
@@ -17,11 +21,20 @@
 Env::Env()
 {
 	m_qnam = std::make_shared<QNetworkAccessManager>();
+	m_netScheduler = std::make_shared<NetScheduler>();
+	m_workerPool = std::make_shared<QThreadPool>();
+	m_workerPool->setMaxThreadCount(QThread::idealThreadCount());
 }
 
 void Env::destroy()
 {
+	// let running jobs finish before anything they might touch goes away
+	if (m_workerPool)
+		m_workerPool->waitForDone();
+	m_workerPool.reset();
+	m_assetPacks.reset();
 	m_metacache.reset();
+	m_netScheduler.reset();
 	m_qnam.reset();
 	m_icons.reset();
 	m_versionLists.clear();
@@ -39,6 +52,42 @@ std::shared_ptr< HttpMetaCache > Env::metacache()
 	return m_metacache;
 }
 
+std::shared_ptr< NetScheduler > Env::netScheduler()
+{
+	Q_ASSERT(m_netScheduler != nullptr);
+	return m_netScheduler;
+}
+
+std::shared_ptr<QThreadPool> Env::workerPool()
+{
+	Q_ASSERT(m_workerPool != nullptr);
+	return m_workerPool;
+}
+
+std::shared_ptr<AssetPackStore> Env::assetPacks()
+{
+	return m_assetPacks;
+}
+
+void Env::setAssetPacks(std::shared_ptr<AssetPackStore> packs)
+{
+	m_assetPacks = packs;
+}
+
+std::shared_ptr<void> Env::holdAssets()
+{
+	m_assetHolds++;
+	return std::shared_ptr<void>(nullptr, [this](void *)
+	{
+		m_assetHolds--;
+	});
+}
+
+bool Env::assetsHeld() const
+{
+	return m_assetHolds > 0;
+}
+
 std::shared_ptr< QNetworkAccessManager > Env::qnam()
 {
 	return m_qnam;
@@ -49,6 +98,11 @@ std::shared_ptr<IconList> Env::icons()
 	Q_ASSERT(m_icons != nullptr);
 	return m_icons;
 }
+
+void Env::setIcons(std::shared_ptr<IconList> icons)
+{
+	m_icons = icons;
+}
 /*
 class NullVersion : public BaseVersion
 {
@@ -1,12 +1,16 @@
 #pragma once
 
 #include <memory>
+#include <atomic>
 #include <QString>
 #include <QMap>
 
 class IconList;
 class QNetworkAccessManager;
 class HttpMetaCache;
+class NetScheduler;
+class QThreadPool;
+class AssetPackStore;
 class BaseVersionList;
 class BaseVersion;
 
@@ -30,7 +34,23 @@ public:
 
 	std::shared_ptr<HttpMetaCache> metacache();
 
+	/// the process-wide scheduler all NetJobs submit their downloads to
+	std::shared_ptr<NetScheduler> netScheduler();
+
+	/// the process-wide pool for CPU heavy work (unpacking, hashing) that must not block the GUI
+	std::shared_ptr<QThreadPool> workerPool();
+
 	std::shared_ptr<IconList> icons();
+	void setIcons(std::shared_ptr<IconList> icons);
+
+	/// packed asset objects, or nullptr if they aren't used
+	std::shared_ptr<AssetPackStore> assetPacks();
+	void setAssetPacks(std::shared_ptr<AssetPackStore> packs);
+
+	/// say that asset objects are being downloaded or moved around, for as long as the returned
+	/// pointer lives. The cache GC leaves the asset objects alone in the meantime.
+	std::shared_ptr<void> holdAssets();
+	bool assetsHeld() const;
 
 	/// init the cache. FIXME: possible future hook point
 	void initHttpMetaCache(QString rootPath, QString staticDataPath);
@@ -48,6 +68,10 @@ public:
 protected:
 	std::shared_ptr<QNetworkAccessManager> m_qnam;
 	std::shared_ptr<HttpMetaCache> m_metacache;
+	std::shared_ptr<NetScheduler> m_netScheduler;
+	std::shared_ptr<QThreadPool> m_workerPool;
 	std::shared_ptr<IconList> m_icons;
+	std::shared_ptr<AssetPackStore> m_assetPacks;
+	std::atomic<int> m_assetHolds{0};
 	QMap<QString, std::shared_ptr<BaseVersionList>> m_versionLists;
 };
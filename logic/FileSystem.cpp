@@ -6,6 +6,22 @@
 #include <QSaveFile>
 #include <QFileInfo>
 
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+#if defined(Q_OS_LINUX)
+#include <sys/ioctl.h>
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif
+
 void ensureExists(const QDir &dir)
 {
 	if (!QDir().mkpath(dir.absolutePath()))
@@ -54,3 +70,111 @@ QByteArray FS::read(const QString &filename)
 	}
 	return data;
 }
+
+bool FS::cloneFile(const QString &source, const QString &target)
+{
+#if defined(Q_OS_LINUX)
+	QByteArray sourceName = QFile::encodeName(source);
+	QByteArray targetName = QFile::encodeName(target);
+	int in = ::open(sourceName.constData(), O_RDONLY);
+	if (in < 0)
+		return false;
+	int out = ::open(targetName.constData(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (out < 0)
+	{
+		::close(in);
+		return false;
+	}
+	bool cloned = ::ioctl(out, FICLONE, in) == 0;
+	::close(out);
+	::close(in);
+	if (!cloned)
+	{
+		::unlink(targetName.constData());
+	}
+	return cloned;
+#else
+	Q_UNUSED(source);
+	Q_UNUSED(target);
+	return false;
+#endif
+}
+
+bool FS::hardLink(const QString &source, const QString &target)
+{
+#if defined(Q_OS_WIN)
+	return CreateHardLinkW((LPCWSTR)QDir::toNativeSeparators(target).utf16(),
+						   (LPCWSTR)QDir::toNativeSeparators(source).utf16(), nullptr);
+#else
+	return ::link(QFile::encodeName(source).constData(), QFile::encodeName(target).constData()) == 0;
+#endif
+}
+
+bool FS::replaceFile(const QString &source, const QString &target)
+{
+#if defined(Q_OS_WIN)
+	return MoveFileExW((LPCWSTR)QDir::toNativeSeparators(source).utf16(),
+					   (LPCWSTR)QDir::toNativeSeparators(target).utf16(),
+					   MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+	QByteArray from = QFile::encodeName(source);
+	QByteArray to = QFile::encodeName(target);
+	return ::rename(from.constData(), to.constData()) == 0;
+#endif
+}
+
+bool FS::syncFile(QFile &file)
+{
+	if (!file.flush())
+		return false;
+#if defined(Q_OS_WIN)
+	return FlushFileBuffers((HANDLE)_get_osfhandle(file.handle()));
+#else
+	return ::fsync(file.handle()) == 0;
+#endif
+}
+
+#if defined(Q_OS_WIN)
+static bool fileInformation(const QString &path, BY_HANDLE_FILE_INFORMATION &info)
+{
+	HANDLE file = CreateFileW((LPCWSTR)QDir::toNativeSeparators(path).utf16(), 0,
+							  FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+							  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	bool ok = GetFileInformationByHandle(file, &info);
+	CloseHandle(file);
+	return ok;
+}
+#endif
+
+int FS::linkCount(const QString &path)
+{
+#if defined(Q_OS_WIN)
+	BY_HANDLE_FILE_INFORMATION info;
+	return fileInformation(path, info) ? int(info.nNumberOfLinks) : 0;
+#else
+	struct stat info;
+	if (::stat(QFile::encodeName(path).constData(), &info) != 0)
+		return 0;
+	return int(info.st_nlink);
+#endif
+}
+
+bool FS::sameFile(const QString &a, const QString &b)
+{
+#if defined(Q_OS_WIN)
+	BY_HANDLE_FILE_INFORMATION infoA, infoB;
+	if (!fileInformation(a, infoA) || !fileInformation(b, infoB))
+		return false;
+	return infoA.dwVolumeSerialNumber == infoB.dwVolumeSerialNumber &&
+		   infoA.nFileIndexHigh == infoB.nFileIndexHigh &&
+		   infoA.nFileIndexLow == infoB.nFileIndexLow;
+#else
+	struct stat infoA, infoB;
+	if (::stat(QFile::encodeName(a).constData(), &infoA) != 0 ||
+		::stat(QFile::encodeName(b).constData(), &infoB) != 0)
+		return false;
+	return infoA.st_dev == infoB.st_dev && infoA.st_ino == infoB.st_ino;
+#endif
+}
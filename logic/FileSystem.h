@@ -4,10 +4,25 @@
 
 #include "Exception.h"
 
+class QFile;
+
 namespace FS
 {
 DECLARE_EXCEPTION(FileSystem);
 
 void write(const QString &filename, const QByteArray &data);
 QByteArray read(const QString &filename);
+
+/// create 'target' as a copy-on-write clone of 'source'. Only some file systems can do this.
+bool cloneFile(const QString &source, const QString &target);
+/// create 'target' as a hard link to 'source'. Both have to be on the same file system.
+bool hardLink(const QString &source, const QString &target);
+/// move 'source' over 'target' in one step, so 'target' is always either the old or the new file
+bool replaceFile(const QString &source, const QString &target);
+/// make sure what was written to the open 'file' is on the disk, not just in the OS cache
+bool syncFile(QFile &file);
+/// number of hard links to the file at 'path', 0 if it can't be told
+int linkCount(const QString &path);
+/// 'a' and 'b' are the same file (the same device and inode), e.g. hard links to each other
+bool sameFile(const QString &a, const QString &b);
 }
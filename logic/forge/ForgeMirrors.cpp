@@ -15,6 +15,7 @@ ForgeMirrors::ForgeMirrors(QList<ForgeXzDownloadPtr> &libs, NetJobPtr parent_job
 
 void ForgeMirrors::start()
 {
+	m_status = Job_InProgress;
 	qDebug() << "Downloading " << m_url.toString();
 	QNetworkRequest request(m_url);
 	request.setHeader(QNetworkRequest::UserAgentHeader, "MultiMC/5.0 (Uncached)");
@@ -22,6 +23,7 @@ void ForgeMirrors::start()
 	QNetworkReply *rep = worker->get(request);
 
 	m_reply.reset(rep);
+	trackReply(rep);
 	connect(rep, SIGNAL(downloadProgress(qint64, qint64)),
 			SLOT(downloadProgress(qint64, qint64)));
 	connect(rep, SIGNAL(finished()), SLOT(downloadFinished()));
@@ -146,6 +146,9 @@ void ForgeListLoadTask::executeTask()
 
 bool ForgeListLoadTask::abort()
 {
+	if (!listJob || !isRunning())
+		return false;
+	emitAborted();
 	return listJob->abort();
 }
 
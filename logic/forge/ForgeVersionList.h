@@ -67,6 +67,10 @@ public:
 
 	virtual void executeTask();
 	virtual bool abort();
+	virtual bool canAbort() const
+	{
+		return true;
+	}
 
 protected
 slots:
@@ -15,6 +15,8 @@
 
 #include "Env.h"
 #include "ForgeXzDownload.h"
+#include "net/NetScheduler.h"
+#include "FileSystem.h"
 #include <pathutils.h>
 
 #include <QCryptographicHash>
@@ -22,12 +24,13 @@
 #include <QDateTime>
 #include <QDir>
 #include <QDebug>
+#include <QFutureWatcher>
+#include <QtConcurrentRun>
 
 ForgeXzDownload::ForgeXzDownload(QString relative_path, MetaEntryPtr entry) : NetAction()
 {
 	m_entry = entry;
 	m_target_path = entry->getFullPath();
-	m_pack200_xz_file.setFileTemplate("./dl_temp.XXXXXX");
 	m_status = Job_NotStarted;
 	m_url_path = relative_path;
 }
@@ -61,6 +64,13 @@ void ForgeXzDownload::start()
 		emit failed(m_index_within_job);
 		return;
 	}
+	// the xz stream is decoded as it arrives, only the finished jar touches the disk
+	m_pack200.clear();
+	m_decoder.reset(new XzDecoder([this](const char *data, size_t size)
+	{
+		m_pack200.append(data, size);
+		return true;
+	}));
 
 	qDebug() << "Downloading " << m_url.toString();
 	QNetworkRequest request(m_url);
@@ -71,6 +81,7 @@ void ForgeXzDownload::start()
 	QNetworkReply *rep = worker->get(request);
 
 	m_reply.reset(rep);
+	trackReply(rep);
 	connect(rep, SIGNAL(downloadProgress(qint64, qint64)),
 			SLOT(downloadProgress(qint64, qint64)));
 	connect(rep, SIGNAL(finished()), SLOT(downloadFinished()));
@@ -119,48 +130,35 @@ void ForgeXzDownload::updateUrl()
 
 void ForgeXzDownload::downloadFinished()
 {
-	//TEST: defer to other possible mirrors (autofail the first one)
-	/*
-	qDebug() <<"dl " << index_within_job << " mirror " << m_mirror_index;
-	if( m_mirror_index == 0)
-	{
-		qDebug() <<"dl " << index_within_job << " AUTOFAIL";
-		m_status = Job_Failed;
-		m_pack200_xz_file.close();
-		m_pack200_xz_file.remove();
-		m_reply.reset();
-		failAndTryNextMirror();
-		return;
-	}
-	*/
+	// whatever the bandwidth limit held back is still in the reply
+	if (m_reply->bytesAvailable())
+		downloadReadyRead();
 
 	// if the download succeeded
 	if (m_status != Job_Failed)
 	{
 		// nothing went wrong...
 		m_status = Job_Finished;
-		if (m_pack200_xz_file.isOpen())
+		if (m_decoder && m_decoder->isFinished())
 		{
-			// we actually downloaded something! process and isntall it
-			decompressAndInstall();
+			// we actually downloaded something! install it
+			startUnpacking();
 			return;
 		}
 		else
 		{
-			// something bad happened -- on the local machine!
-			m_status = Job_Failed;
-			m_pack200_xz_file.remove();
+			// the stream ended early or never started
+			qCritical() << "Incomplete xz stream from " << m_url.toString();
+			discardPack200();
 			m_reply.reset();
-			emit failed(m_index_within_job);
+			failAndTryNextMirror();
 			return;
 		}
 	}
 	// else the download failed
 	else
 	{
-		m_status = Job_Failed;
-		m_pack200_xz_file.close();
-		m_pack200_xz_file.remove();
+		discardPack200();
 		m_reply.reset();
 		failAndTryNextMirror();
 		return;
@@ -169,221 +167,129 @@ void ForgeXzDownload::downloadFinished()
 
 void ForgeXzDownload::downloadReadyRead()
 {
-
-	if (!m_pack200_xz_file.isOpen())
+	QByteArray ba = ENV.netScheduler()->read(this, m_reply.get());
+	if (m_status == Job_Failed || !m_decoder)
+		return;
+	if (!m_decoder->feed(ba))
 	{
-		if (!m_pack200_xz_file.open())
-		{
-			/*
-			* Can't open the file... the job failed
-			*/
-			m_reply->abort();
-			emit failed(m_index_within_job);
-			return;
-		}
+		qCritical() << "Error decoding " << m_url.toString() << " : " << m_decoder->errorString();
+		m_status = Job_Failed;
+		m_reply->abort();
 	}
-	m_pack200_xz_file.write(m_reply->readAll());
 }
 
-#include "xz.h"
+void ForgeXzDownload::discardPack200()
+{
+	m_decoder.reset();
+	m_pack200.clear();
+	m_pack200.squeeze();
+}
+
 #include "unpack200.h"
 #include <stdexcept>
 
-const size_t buffer_size = 8196;
-
-void ForgeXzDownload::decompressAndInstall()
+void ForgeXzDownload::startUnpacking()
 {
-	// rewind the downloaded temp file
-	m_pack200_xz_file.seek(0);
-	// de-xz'd file
-	QTemporaryFile pack200_file("./dl_temp.XXXXXX");
-	pack200_file.open();
+	// still busy, but the connection can go to the next download
+	m_status = Job_InProgress;
+	m_etag = m_reply->rawHeader("ETag");
+	m_reply.reset();
+	QByteArray pack200 = m_pack200;
+	discardPack200();
 
-	bool xz_success = false;
-	// first, de-xz
+	auto watcher = new QFutureWatcher<Unpacked>(this);
+	connect(watcher, &QFutureWatcher<Unpacked>::finished, this, [this, watcher]()
 	{
-		uint8_t in[buffer_size];
-		uint8_t out[buffer_size];
-		struct xz_buf b;
-		struct xz_dec *s;
-		enum xz_ret ret;
-		xz_crc32_init();
-		xz_crc64_init();
-		s = xz_dec_init(XZ_DYNALLOC, 1 << 26);
-		if (s == nullptr)
-		{
-			xz_dec_end(s);
-			failAndTryNextMirror();
-			return;
-		}
-		b.in = in;
-		b.in_pos = 0;
-		b.in_size = 0;
-		b.out = out;
-		b.out_pos = 0;
-		b.out_size = buffer_size;
-		while (!xz_success)
-		{
-			if (b.in_pos == b.in_size)
-			{
-				b.in_size = m_pack200_xz_file.read((char *)in, sizeof(in));
-				b.in_pos = 0;
-			}
-
-			ret = xz_dec_run(s, &b);
-
-			if (b.out_pos == sizeof(out))
-			{
-				if (pack200_file.write((char *)out, b.out_pos) != b.out_pos)
-				{
-					// msg = "Write error\n";
-					xz_dec_end(s);
-					failAndTryNextMirror();
-					return;
-				}
-
-				b.out_pos = 0;
-			}
-
-			if (ret == XZ_OK)
-				continue;
-
-			if (ret == XZ_UNSUPPORTED_CHECK)
-			{
-				// unsupported check. this is OK, but we should log this
-				continue;
-			}
-
-			if (pack200_file.write((char *)out, b.out_pos) != b.out_pos)
-			{
-				// write error
-				pack200_file.close();
-				xz_dec_end(s);
-				return;
-			}
-
-			switch (ret)
-			{
-			case XZ_STREAM_END:
-				xz_dec_end(s);
-				xz_success = true;
-				break;
-
-			case XZ_MEM_ERROR:
-				qCritical() << "Memory allocation failed\n";
-				xz_dec_end(s);
-				failAndTryNextMirror();
-				return;
-
-			case XZ_MEMLIMIT_ERROR:
-				qCritical() << "Memory usage limit reached\n";
-				xz_dec_end(s);
-				failAndTryNextMirror();
-				return;
-
-			case XZ_FORMAT_ERROR:
-				qCritical() << "Not a .xz file\n";
-				xz_dec_end(s);
-				failAndTryNextMirror();
-				return;
-
-			case XZ_OPTIONS_ERROR:
-				qCritical() << "Unsupported options in the .xz headers\n";
-				xz_dec_end(s);
-				failAndTryNextMirror();
-				return;
-
-			case XZ_DATA_ERROR:
-			case XZ_BUF_ERROR:
-				qCritical() << "File is corrupt\n";
-				xz_dec_end(s);
-				failAndTryNextMirror();
-				return;
-
-			default:
-				qCritical() << "Bug!\n";
-				xz_dec_end(s);
-				failAndTryNextMirror();
-				return;
-			}
-		}
-	}
-	m_pack200_xz_file.remove();
+		watcher->deleteLater();
+		unpackFinished(watcher->result());
+	});
+	watcher->setFuture(QtConcurrent::run(ENV.workerPool().get(), &ForgeXzDownload::unpack,
+										 pack200, m_target_path));
+	emit transferDone(m_index_within_job);
+}
 
-	// revert pack200
-	pack200_file.seek(0);
-	int handle_in = pack200_file.handle();
-	// FIXME: dispose of file handles, pointers and the like. Ideally wrap in objects.
-	if(handle_in == -1)
+ForgeXzDownload::Unpacked ForgeXzDownload::unpack(QByteArray pack200, QString target_path)
+{
+	Unpacked result;
+	// the old jar stays until the new one is complete. It is replaced, never written into, as
+	// it may share its data with other files.
+	QFile jar_file(target_path + ".part");
+	if (!jar_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
 	{
-		qCritical() << "Error reopening " << pack200_file.fileName();
-		failAndTryNextMirror();
-		return;
+		result.error = "Can't open " + jar_file.fileName();
+		return result;
 	}
-	FILE * file_in = fdopen(handle_in,"r");
-	if(!file_in)
+	// hash the jar on its way to the disk instead of reading it back
+	QCryptographicHash md5(QCryptographicHash::Md5);
+	try
 	{
-		qCritical() << "Error reopening " << pack200_file.fileName();
-		failAndTryNextMirror();
-		return;
+		unpack_200(pack200.constData(), pack200.size(), [&](const void *data, size_t size)
+		{
+			md5.addData((const char *)data, size);
+			return jar_file.write((const char *)data, size) == (qint64)size;
+		},
+		UNPACK_200_DEFLATE_PARALLEL);
 	}
-	QFile qfile_out(m_target_path);
-	if(!qfile_out.open(QIODevice::WriteOnly))
+	catch (std::runtime_error &err)
 	{
-		qCritical() << "Error opening " << qfile_out.fileName();
-		failAndTryNextMirror();
-		return;
+		result.error = err.what();
+		jar_file.remove();
+		return result;
 	}
-	int handle_out = qfile_out.handle();
-	if(handle_out == -1)
+	if (!jar_file.flush())
 	{
-		qCritical() << "Error opening " << qfile_out.fileName();
-		failAndTryNextMirror();
-		return;
+		result.error = "Can't write " + jar_file.fileName();
+		jar_file.remove();
+		return result;
 	}
-	FILE * file_out = fdopen(handle_out,"w");
-	if(!file_out)
+	jar_file.close();
+	result.md5sum = md5.result().toHex().constData();
+	return result;
+}
+
+void ForgeXzDownload::unpackFinished(const Unpacked &result)
+{
+	QString part_path = m_target_path + ".part";
+	// failed() went out when this was aborted, only clean up
+	if (m_aborted)
 	{
-		qCritical() << "Error opening " << qfile_out.fileName();
-		failAndTryNextMirror();
+		QFile::remove(part_path);
 		return;
 	}
-	try
-	{
-		unpack_200(file_in, file_out);
-	}
-	catch (std::runtime_error &err)
+	if (!result.error.isEmpty())
 	{
-		m_status = Job_Failed;
-		qCritical() << "Error unpacking " << pack200_file.fileName() << " : " << err.what();
-		QFile f(m_target_path);
-		if (f.exists())
-			f.remove();
+		qCritical() << "Error unpacking " << m_url.toString() << " : " << result.error;
 		failAndTryNextMirror();
 		return;
 	}
-	pack200_file.remove();
-
-	QFile jar_file(m_target_path);
-
-	if (!jar_file.open(QIODevice::ReadOnly))
+	if (!FS::replaceFile(part_path, m_target_path))
 	{
-		jar_file.remove();
+		qCritical() << "Could not move" << part_path << "to" << m_target_path;
+		QFile::remove(part_path);
 		failAndTryNextMirror();
 		return;
 	}
-	m_entry->md5sum = QCryptographicHash::hash(jar_file.readAll(), QCryptographicHash::Md5)
-						  .toHex()
-						  .constData();
-	jar_file.close();
 
+	m_status = Job_Finished;
+	m_entry->md5sum = result.md5sum;
 	QFileInfo output_file_info(m_target_path);
-	m_entry->etag = m_reply->rawHeader("ETag").constData();
+	m_entry->etag = m_etag.constData();
 	m_entry->local_changed_timestamp =
 		output_file_info.lastModified().toUTC().toMSecsSinceEpoch();
 	m_entry->stale = false;
 	ENV.metacache()->updateEntry(m_entry);
 
-	m_reply.reset();
 	emit succeeded(m_index_within_job);
 }
+
+QString ForgeXzDownload::coalescingKey() const
+{
+	return QFileInfo(m_target_path).absoluteFilePath();
+}
+
+void ForgeXzDownload::takeResultFrom(NetActionPtr other)
+{
+	// the other download put the file in place and updated the cache
+	ENV.metacache()->syncEntry(m_entry);
+	NetAction::takeResultFrom(other);
+}
@@ -18,8 +18,9 @@
 #include "net/NetAction.h"
 #include "net/HttpMetaCache.h"
 #include <QFile>
-#include <QTemporaryFile>
 #include "ForgeMirror.h"
+#include "XzDecoder.h"
+#include <memory>
 
 typedef std::shared_ptr<class ForgeXzDownload> ForgeXzDownloadPtr;
 
@@ -30,14 +31,18 @@ public:
 	MetaEntryPtr m_entry;
 	/// if saving to file, use the one specified in this string
 	QString m_target_path;
-	/// this is the output file, if any
-	QTemporaryFile m_pack200_xz_file;
+	/// the decompressed pack200 data of the current attempt, decoded while it arrives
+	QByteArray m_pack200;
+	/// decodes the .xz download on the fly
+	std::unique_ptr<XzDecoder> m_decoder;
 	/// mirror index (NOT OPTICS, I SWEAR)
 	int m_mirror_index = 0;
 	/// list of mirrors to use. Mirror has the url base
 	QList<ForgeMirror> m_mirrors;
 	/// path relative to the mirror base
 	QString m_url_path;
+	/// ETag of the finished transfer, kept for when the jar is in place
+	QByteArray m_etag;
 
 public:
 	explicit ForgeXzDownload(QString relative_path, MetaEntryPtr entry);
@@ -47,6 +52,8 @@ public:
 	}
 	virtual ~ForgeXzDownload(){};
 	void setMirrors(QList<ForgeMirror> & mirrors);
+	virtual QString coalescingKey() const;
+	virtual void takeResultFrom(NetActionPtr other);
 
 protected
 slots:
@@ -60,7 +67,17 @@ slots:
 	virtual void start();
 
 private:
-	void decompressAndInstall();
+	/// outcome of unpacking on a worker thread
+	struct Unpacked
+	{
+		QString error;
+		QString md5sum;
+	};
+	/// writes target_path.part, which unpackFinished moves over the jar
+	static Unpacked unpack(QByteArray pack200, QString target_path);
+	void startUnpacking();
+	void unpackFinished(const Unpacked &result);
+	void discardPack200();
 	void failAndTryNextMirror();
 	void updateUrl();
 };
@@ -0,0 +1,113 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "XzDecoder.h"
+#include "xz.h"
+
+namespace
+{
+const int outputSize = 64 * 1024;
+// the dictionary of anything forge ships is far below this
+const uint32_t memoryLimit = 1 << 26;
+
+bool initTables()
+{
+	xz_crc32_init();
+	xz_crc64_init();
+	return true;
+}
+}
+
+XzDecoder::XzDecoder(Sink sink) : m_sink(sink)
+{
+	// once per process, no matter how many threads decode at the same time
+	static bool tablesReady = initTables();
+	Q_UNUSED(tablesReady);
+	m_out.resize(outputSize);
+	m_dec = xz_dec_init(XZ_DYNALLOC, memoryLimit);
+	if (!m_dec)
+	{
+		m_error = "Could not allocate the xz decoder";
+	}
+}
+
+XzDecoder::~XzDecoder()
+{
+	if (m_dec)
+		xz_dec_end(m_dec);
+}
+
+bool XzDecoder::feed(const char *data, size_t size)
+{
+	if (!m_error.isEmpty())
+		return false;
+	// anything after the end of the stream is ignored
+	if (m_finished || !size)
+		return true;
+
+	struct xz_buf b;
+	b.in = (const uint8_t *)data;
+	b.in_pos = 0;
+	b.in_size = size;
+	b.out = (uint8_t *)m_out.data();
+	b.out_pos = 0;
+	b.out_size = m_out.size();
+	for (;;)
+	{
+		enum xz_ret ret = xz_dec_run(m_dec, &b);
+		bool outputFull = b.out_pos == b.out_size;
+		if (b.out_pos)
+		{
+			if (!m_sink(m_out.constData(), b.out_pos))
+			{
+				m_error = "Could not write the decompressed data";
+				return false;
+			}
+			m_bytes_out += b.out_pos;
+			b.out_pos = 0;
+		}
+		switch (ret)
+		{
+		case XZ_OK:
+		// the check type is unknown, the data is still fine
+		case XZ_UNSUPPORTED_CHECK:
+			if (b.in_pos == b.in_size && !outputFull)
+				return true;
+			continue;
+		case XZ_STREAM_END:
+			m_finished = true;
+			return true;
+		case XZ_MEM_ERROR:
+			m_error = "Memory allocation failed";
+			return false;
+		case XZ_MEMLIMIT_ERROR:
+			m_error = "Memory usage limit reached";
+			return false;
+		case XZ_FORMAT_ERROR:
+			m_error = "Not a .xz file";
+			return false;
+		case XZ_OPTIONS_ERROR:
+			m_error = "Unsupported options in the .xz headers";
+			return false;
+		case XZ_DATA_ERROR:
+		case XZ_BUF_ERROR:
+			m_error = "File is corrupt";
+			return false;
+		default:
+			m_error = "Unknown xz decoder error";
+			return false;
+		}
+	}
+}
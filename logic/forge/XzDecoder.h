@@ -0,0 +1,69 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <functional>
+
+struct xz_dec;
+
+/**
+ * Incremental .xz decoder.
+ *
+ * Compressed data is fed in as it arrives, in pieces of any size, and the decompressed data
+ * is handed to the sink as soon as it is available. Neither side is ever held in full.
+ */
+class XzDecoder
+{
+public:
+	/// receives decompressed data. Returning false stops the decoder with an error.
+	typedef std::function<bool(const char *data, size_t size)> Sink;
+
+	explicit XzDecoder(Sink sink);
+	~XzDecoder();
+
+	/// decode the next piece of the stream. Returns false if the stream or the sink failed.
+	bool feed(const char *data, size_t size);
+	bool feed(const QByteArray &data)
+	{
+		return feed(data.constData(), data.size());
+	}
+
+	/// true once the end of the stream was reached and everything before it checked out
+	bool isFinished() const
+	{
+		return m_finished;
+	}
+	/// empty unless something went wrong
+	QString errorString() const
+	{
+		return m_error;
+	}
+	/// number of bytes handed to the sink so far
+	qint64 bytesOut() const
+	{
+		return m_bytes_out;
+	}
+
+private:
+	Sink m_sink;
+	struct xz_dec *m_dec = nullptr;
+	QByteArray m_out;
+	qint64 m_bytes_out = 0;
+	bool m_finished = false;
+	QString m_error;
+};
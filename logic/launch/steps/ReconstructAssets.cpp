@@ -0,0 +1,63 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ReconstructAssets.h"
+#include <launch/LaunchTask.h>
+#include <minecraft/ReconstructAssetsTask.h>
+
+void ReconstructAssets::executeTask()
+{
+	m_task = std::make_shared<ReconstructAssetsTask>(m_assetsId);
+	connect(m_task.get(), SIGNAL(finished()), this, SLOT(reconstructFinished()));
+	connect(m_task.get(), &Task::progress, this, &Task::setProgress);
+	connect(m_task.get(), &Task::status, this, &Task::setStatus);
+	m_task->start();
+}
+
+bool ReconstructAssets::canAbort() const
+{
+	return m_task && m_task->canAbort();
+}
+
+bool ReconstructAssets::abort()
+{
+	if(!canAbort())
+	{
+		return false;
+	}
+	return m_task->abort();
+}
+
+void ReconstructAssets::reconstructFinished()
+{
+	if(m_task->wasAborted())
+	{
+		emitAborted();
+		return;
+	}
+	if(!m_task->successful())
+	{
+		// the game can still start, it just won't have all of its sounds
+		emit logLine(tr("Couldn't put the assets in place: %1\n\n").arg(m_task->failReason()),
+					 MessageLevel::Warning);
+	}
+	else if(m_task->incomplete())
+	{
+		emit logLine(tr("%1 assets are missing or couldn't be placed.\n\n")
+						 .arg(m_task->incomplete()),
+					 MessageLevel::Warning);
+	}
+	emitSucceeded();
+}
@@ -0,0 +1,41 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <launch/LaunchStep.h>
+#include <memory>
+
+class ReconstructAssetsTask;
+
+// Puts the virtual assets folder legacy versions use, or packed assets, in place on a worker thread.
+class ReconstructAssets: public LaunchStep
+{
+	Q_OBJECT
+public:
+	explicit ReconstructAssets(LaunchTask *parent, QString assetsId)
+		: LaunchStep(parent), m_assetsId(assetsId) {};
+	virtual ~ReconstructAssets() {};
+
+	virtual void executeTask();
+	virtual bool canAbort() const;
+	virtual bool abort();
+private slots:
+	void reconstructFinished();
+
+private:
+	QString m_assetsId;
+	std::shared_ptr<ReconstructAssetsTask> m_task;
+};
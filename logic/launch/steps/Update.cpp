@@ -35,9 +35,22 @@ void Update::proceed()
 	m_updateTask->start();
 }
 
+bool Update::abort()
+{
+	if(!canAbort())
+	{
+		return false;
+	}
+	return m_updateTask->abort();
+}
+
 void Update::updateFinished()
 {
-	if(m_updateTask->successful())
+	if(m_updateTask->wasAborted())
+	{
+		emitAborted();
+	}
+	else if(m_updateTask->successful())
 	{
 		emitSucceeded();
 	}
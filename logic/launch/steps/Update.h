@@ -30,8 +30,9 @@ public:
 	virtual void executeTask();
 	virtual bool canAbort() const
 	{
-		return false;
+		return m_updateTask && m_updateTask->canAbort();
 	}
+	virtual bool abort();
 	virtual void proceed();
 private slots:
 	void updateFinished();
@@ -0,0 +1,395 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "AssetDownloadTask.h"
+#include "Env.h"
+#include "FileSystem.h"
+#include "ReconstructAssetsTask.h"
+#include "net/NetScheduler.h"
+#include "net/URLConstants.h"
+#include <pathutils.h>
+
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QTimer>
+#include <QFile>
+#include <QSet>
+#include <QDebug>
+
+namespace
+{
+/// enough to keep the scheduler's host limit busy, it decides how many really run
+const int DEFAULT_CONCURRENCY = 8;
+}
+
+/// Downloads one object at a time, and then the next one. Reused for as long as the task runs.
+class AssetFetcher : public NetAction
+{
+	Q_OBJECT
+public:
+	AssetFetcher() : m_sha1(QCryptographicHash::Sha1)
+	{
+	}
+
+	/// get ready for another object. Only while the fetcher isn't in the scheduler.
+	void reset(const QUrl &url, const AssetObject &object, const QString &target)
+	{
+		m_url = url;
+		m_hash = object.hash.toLatin1().toLower();
+		m_size = object.size;
+		m_target = target;
+		m_size_hint = object.size;
+		m_progress = 0;
+		m_total_progress = object.size;
+		m_status = Job_NotStarted;
+		m_aborted = false;
+		m_replaced = false;
+		m_timing = NetActionTiming();
+	}
+
+	/// true if the last object took the place of one that was already there
+	bool replaced() const
+	{
+		return m_replaced;
+	}
+
+	QString coalescingKey() const override
+	{
+		return QFileInfo(m_target).absoluteFilePath();
+	}
+
+public
+slots:
+	void start() override
+	{
+		m_status = Job_InProgress;
+		m_sha1.reset();
+		m_received = 0;
+		m_response_checked = false;
+		m_write_body = false;
+		// the object only shows up under its name once it is known to be good
+		m_output.setFileName(m_target + ".part");
+		if (!ensureFilePathExists(m_target) ||
+			!m_output.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		{
+			qCritical() << "Could not open" << m_output.fileName() << ":" << m_output.errorString();
+			m_status = Job_Failed;
+			emit failed(m_index_within_job);
+			return;
+		}
+
+		QNetworkRequest request(m_url);
+		request.setHeader(QNetworkRequest::UserAgentHeader, "MultiMC/5.0 (Uncached)");
+		QNetworkReply *rep = ENV.qnam()->get(request);
+		m_reply.reset(rep);
+		trackReply(rep);
+		connect(rep, SIGNAL(downloadProgress(qint64, qint64)),
+				SLOT(downloadProgress(qint64, qint64)));
+		connect(rep, SIGNAL(finished()), SLOT(downloadFinished()));
+		connect(rep, SIGNAL(error(QNetworkReply::NetworkError)),
+				SLOT(downloadError(QNetworkReply::NetworkError)));
+		connect(rep, SIGNAL(readyRead()), SLOT(downloadReadyRead()));
+	}
+
+protected
+slots:
+	void downloadProgress(qint64 bytesReceived, qint64) override
+	{
+		m_progress = bytesReceived;
+		emit netActionProgress(m_index_within_job, bytesReceived, m_size);
+	}
+
+	void downloadError(QNetworkReply::NetworkError error) override
+	{
+		qCritical() << "Error" << error << ":" << m_reply->errorString() << "while downloading"
+					<< m_reply->url();
+		m_status = Job_Failed;
+	}
+
+	void downloadReadyRead() override
+	{
+		if (!m_response_checked)
+			checkResponse();
+		QByteArray data = ENV.netScheduler()->read(this, m_reply.get());
+		// error pages are not what we came for
+		if (!m_write_body || m_status == Job_Failed)
+			return;
+		m_received += data.size();
+		m_sha1.addData(data);
+		if (m_received > m_size || m_output.write(data) != data.size())
+		{
+			m_status = Job_Failed;
+			m_reply->abort();
+		}
+	}
+
+	void downloadFinished() override
+	{
+		if (!m_response_checked)
+			checkResponse();
+		// whatever the bandwidth limit held back is still in the reply
+		if (m_reply->bytesAvailable())
+			downloadReadyRead();
+		m_output.close();
+
+		bool ok = m_status != Job_Failed && m_write_body;
+		if (ok && (m_received != m_size || m_sha1.result().toHex() != m_hash))
+		{
+			qWarning() << "Got" << m_received << "bytes from" << m_url.toString()
+					   << "that don't match the asset object's hash";
+			ok = false;
+		}
+		if (ok)
+		{
+			// replaces a damaged copy that may be in the way
+			m_replaced = QFile::exists(m_target);
+			if (!FS::replaceFile(m_output.fileName(), m_target))
+			{
+				qCritical() << "Could not move" << m_output.fileName() << "to" << m_target;
+				ok = false;
+			}
+		}
+		if (!ok)
+			m_output.remove();
+
+		m_reply->disconnect(this);
+		m_reply.reset();
+		m_status = ok ? Job_Finished : Job_Failed;
+		if (ok)
+			emit succeeded(m_index_within_job);
+		else
+			emit failed(m_index_within_job);
+	}
+
+private:
+	void checkResponse()
+	{
+		m_response_checked = true;
+		int status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+		// no status at all means this isn't HTTP (local files and such)
+		m_write_body = (status == 0 || status == 200);
+	}
+
+private:
+	QByteArray m_hash;
+	qint64 m_size = 0;
+	QString m_target;
+	QFile m_output;
+	QCryptographicHash m_sha1;
+	qint64 m_received = 0;
+	bool m_response_checked = false;
+	bool m_write_body = false;
+	bool m_replaced = false;
+};
+
+AssetDownloadTask::AssetDownloadTask(QVector<AssetObject> objects, QString objectDir,
+									 QObject *parent)
+	: Task(parent), m_objects(objects), m_objectDir(objectDir),
+	  m_baseUrl("http://" + URLConstants::RESOURCE_BASE), m_concurrency(DEFAULT_CONCURRENCY)
+{
+}
+
+AssetDownloadTask::~AssetDownloadTask()
+{
+	// fetchers still in the scheduler would keep their slots, or go on downloading for nobody
+	for (auto &fetcher : m_fetchers)
+	{
+		fetcher->disconnect(this);
+	}
+	stopFetchers();
+}
+
+void AssetDownloadTask::executeTask()
+{
+	// several paths can share one object
+	{
+		QSet<QString> seen;
+		QVector<AssetObject> unique;
+		for (auto &object : m_objects)
+		{
+			if (seen.contains(object.hash))
+				continue;
+			seen.insert(object.hash);
+			unique.append(object);
+			m_totalBytes += object.size;
+		}
+		m_objects = unique;
+	}
+	if (m_objects.isEmpty())
+	{
+		emitSucceeded();
+		return;
+	}
+	m_failures.fill(0, m_objects.size());
+
+	setStatus(tr("Getting the assets files from Mojang..."));
+	int fetchers = qMin(m_concurrency, m_objects.size());
+	for (int i = 0; i < fetchers; i++)
+	{
+		auto fetcher = std::make_shared<AssetFetcher>();
+		fetcher->m_index_within_job = i;
+		connect(fetcher.get(), &NetAction::succeeded, this, &AssetDownloadTask::fetcherSucceeded);
+		connect(fetcher.get(), &NetAction::failed, this, &AssetDownloadTask::fetcherFailed);
+		connect(fetcher.get(), &NetAction::netActionProgress, this,
+				&AssetDownloadTask::fetcherProgress);
+		m_fetchers.push_back(fetcher);
+		m_fetcherObject.append(-1);
+	}
+	feedFetchers();
+}
+
+bool AssetDownloadTask::abort()
+{
+	if (!isRunning())
+		return false;
+	// stop first, so whatever the fetchers report while going down is ignored
+	emitAborted();
+	stopFetchers();
+	return true;
+}
+
+void AssetDownloadTask::stopFetchers()
+{
+	for (size_t i = 0; i < m_fetchers.size(); i++)
+	{
+		if (m_fetcherObject[i] < 0)
+			continue;
+		m_fetcherObject[i] = -1;
+		if (!ENV.netScheduler()->dequeue(m_fetchers[i]))
+			m_fetchers[i]->abort();
+	}
+}
+
+void AssetDownloadTask::scheduleFeed()
+{
+	// the scheduler is still busy with the fetcher that just finished
+	if (m_feedQueued)
+		return;
+	m_feedQueued = true;
+	QMetaObject::invokeMethod(this, "feedFetchers", Qt::QueuedConnection);
+}
+
+void AssetDownloadTask::feedFetchers()
+{
+	m_feedQueued = false;
+	if (!isRunning())
+		return;
+
+	bool busy = m_waiting > 0;
+	for (size_t i = 0; i < m_fetchers.size(); i++)
+	{
+		if (m_fetcherObject[i] < 0)
+		{
+			int object;
+			if (!m_retryQueue.isEmpty())
+				object = m_retryQueue.takeFirst();
+			else if (m_next < m_objects.size())
+				object = m_next++;
+			else
+				continue;
+			const AssetObject &asset = m_objects[object];
+			QString name = asset.hash.left(2) + "/" + asset.hash;
+			m_fetchers[i]->reset(QUrl(m_baseUrl + name), asset, PathCombine(m_objectDir, name));
+			m_fetcherObject[i] = object;
+			m_attempts++;
+			ENV.netScheduler()->enqueue(m_fetchers[i]);
+		}
+		busy = true;
+	}
+	if (busy)
+		return;
+
+	qDebug() << "Downloaded" << m_downloaded << "of" << m_objects.size() << "asset objects in"
+			 << m_attempts << "attempts," << m_fetchers.size() << "at a time";
+	if (!m_failed.isEmpty())
+	{
+		emitFailed(tr("%1 of %2 objects could not be downloaded:\n%3")
+					   .arg(m_failed.size())
+					   .arg(m_objects.size())
+					   .arg(m_failed.join("\n")));
+		return;
+	}
+	emitSucceeded();
+}
+
+void AssetDownloadTask::objectDone(int fetcher)
+{
+	m_fetcherObject[fetcher] = -1;
+	updateProgress();
+	scheduleFeed();
+}
+
+void AssetDownloadTask::fetcherSucceeded(int fetcher)
+{
+	if (!isRunning() || m_fetcherObject[fetcher] < 0)
+		return;
+	m_downloaded++;
+	m_doneBytes += m_objects[m_fetcherObject[fetcher]].size;
+	if (m_fetchers[fetcher]->replaced() && !m_replacedObjects)
+	{
+		// the old object may still be in a virtual folder
+		ReconstructAssetsTask::invalidate(PathCombine(m_objectDir, ".."));
+		m_replacedObjects = true;
+	}
+	objectDone(fetcher);
+}
+
+void AssetDownloadTask::fetcherFailed(int fetcher)
+{
+	if (!isRunning() || m_fetcherObject[fetcher] < 0)
+		return;
+	int object = m_fetcherObject[fetcher];
+	QString url = m_fetchers[fetcher]->m_url.toString();
+	if (m_failures[object] >= m_retryPolicy.maxRetries)
+	{
+		m_failed.append(url);
+		m_doneBytes += m_objects[object].size;
+		objectDone(fetcher);
+		return;
+	}
+	m_failures[object]++;
+	int delay = m_retryPolicy.delayFor(m_failures[object]);
+	qDebug() << "Retrying" << url << "in" << delay << "ms";
+	m_waiting++;
+	auto timer = new QTimer(this);
+	timer->setSingleShot(true);
+	connect(timer, &QTimer::timeout, this, [this, object, timer]()
+	{
+		timer->deleteLater();
+		m_waiting--;
+		m_retryQueue.append(object);
+		scheduleFeed();
+	});
+	timer->start(delay);
+	objectDone(fetcher);
+}
+
+void AssetDownloadTask::fetcherProgress(int, qint64, qint64)
+{
+	updateProgress();
+}
+
+void AssetDownloadTask::updateProgress()
+{
+	qint64 current = m_doneBytes;
+	for (size_t i = 0; i < m_fetchers.size(); i++)
+	{
+		if (m_fetcherObject[i] >= 0)
+			current += m_fetchers[i]->m_progress;
+	}
+	setProgress(current, m_totalBytes);
+}
+
+#include "AssetDownloadTask.moc"
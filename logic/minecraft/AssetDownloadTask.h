@@ -0,0 +1,125 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "tasks/Task.h"
+#include "net/NetJob.h"
+#include "AssetsUtils.h"
+
+#include <QStringList>
+#include <memory>
+#include <vector>
+
+class AssetFetcher;
+
+/**
+ * Downloads asset objects into 'assets/objects', however many there are.
+ *
+ * The objects stay in one flat list. A few fetchers go through it, each taking the next
+ * object when it is done with the last one, so what this costs grows with the number of
+ * connections and not with the number of objects. The fetchers go through the network
+ * scheduler like any other action, so the connection and bandwidth limits still apply.
+ *
+ * Every object is hashed while it comes in and only put in place if it matches its hash.
+ * Objects that fail are tried again later, as many times as the retry policy says.
+ */
+class AssetDownloadTask : public Task
+{
+	Q_OBJECT
+public:
+	explicit AssetDownloadTask(QVector<AssetObject> objects, QString objectDir = "assets/objects",
+							   QObject *parent = 0);
+	virtual ~AssetDownloadTask();
+
+	/// where the objects come from, 'http://resources.download.minecraft.net/' by default
+	void setBaseUrl(QString url)
+	{
+		m_baseUrl = url;
+	}
+	void setRetryPolicy(const RetryPolicy &policy)
+	{
+		m_retryPolicy = policy;
+	}
+	/// number of objects downloaded at the same time, at most
+	void setConcurrency(int fetchers)
+	{
+		m_concurrency = qMax(fetchers, 1);
+	}
+
+	/// objects that were downloaded and put in place
+	int downloaded() const
+	{
+		return m_downloaded;
+	}
+	/// downloads started, including the ones that were tried again
+	int attempts() const
+	{
+		return m_attempts;
+	}
+
+	virtual bool canAbort() const
+	{
+		return true;
+	}
+	virtual bool abort();
+
+protected:
+	virtual void executeTask();
+
+private
+slots:
+	void fetcherSucceeded(int fetcher);
+	void fetcherFailed(int fetcher);
+	void fetcherProgress(int fetcher, qint64 current, qint64 total);
+	/// hand the next objects to the idle fetchers, or finish
+	void feedFetchers();
+
+private:
+	void scheduleFeed();
+	void objectDone(int fetcher);
+	void updateProgress();
+	/// take the busy fetchers out of the scheduler
+	void stopFetchers();
+
+private:
+	QVector<AssetObject> m_objects;
+	QString m_objectDir;
+	QString m_baseUrl;
+	RetryPolicy m_retryPolicy;
+	int m_concurrency;
+
+	/// next object nobody has tried yet
+	int m_next = 0;
+	/// failed attempts of each object
+	QVector<quint8> m_failures;
+	/// objects that are due for another attempt
+	QList<int> m_retryQueue;
+	/// objects waiting for their retry delay
+	int m_waiting = 0;
+	QStringList m_failed;
+
+	std::vector<std::shared_ptr<AssetFetcher>> m_fetchers;
+	/// the object each fetcher is working on, -1 while it is idle
+	QVector<int> m_fetcherObject;
+	bool m_feedQueued = false;
+
+	qint64 m_totalBytes = 0;
+	qint64 m_doneBytes = 0;
+	int m_downloaded = 0;
+	int m_attempts = 0;
+	/// set once a damaged object was replaced and the reconstructed folders were invalidated
+	bool m_replacedObjects = false;
+};
@@ -0,0 +1,334 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "AssetPackStore.h"
+#include "FileSystem.h"
+#include <pathutils.h>
+
+#include <QCryptographicHash>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QtEndian>
+#include <QDir>
+#include <QDebug>
+
+namespace
+{
+/// a new pack is started when the current one would grow past this
+const qint64 maxPackSize = 64 * 1024 * 1024;
+/// sha1, pack, offset, size, checksum
+const int recordSize = 20 + 4 + 8 + 8 + 2;
+
+QByteArray rawHash(const QString &hash)
+{
+	if (hash.size() != 40)
+		return QByteArray();
+	QByteArray raw = QByteArray::fromHex(hash.toLatin1());
+	return raw.size() == 20 ? raw : QByteArray();
+}
+
+bool matches(const QByteArray &data, const QByteArray &raw)
+{
+	return QCryptographicHash::hash(data, QCryptographicHash::Sha1) == raw;
+}
+}
+
+AssetPackStore::AssetPackStore(QString root) : m_root(root)
+{
+	QMutexLocker locker(&m_mutex);
+	m_open = open();
+}
+
+AssetPackStore::~AssetPackStore()
+{
+	m_index.close();
+	m_packFile.close();
+}
+
+QString AssetPackStore::packPath(quint32 pack) const
+{
+	return PathCombine(m_root, QString("pack-%1").arg(pack));
+}
+
+bool AssetPackStore::open()
+{
+	if (!QDir().mkpath(m_root))
+	{
+		qWarning() << "Could not create" << m_root;
+		return false;
+	}
+	m_index.setFileName(PathCombine(m_root, "index"));
+	if (!m_index.open(QIODevice::ReadWrite))
+	{
+		qWarning() << "Could not open" << m_index.fileName() << ":" << m_index.errorString();
+		return false;
+	}
+	QByteArray data = m_index.readAll();
+	QHash<quint32, qint64> packSizes;
+	qint64 offset = 0;
+	for (; offset + recordSize <= data.size(); offset += recordSize)
+	{
+		const uchar *record = (const uchar *)data.constData() + offset;
+		if (qFromLittleEndian<quint16>(record + recordSize - 2) !=
+			qChecksum((const char *)record, recordSize - 2))
+			break;
+		QByteArray hash((const char *)record, 20);
+		Location location;
+		location.pack = qFromLittleEndian<quint32>(record + 20);
+		location.offset = qFromLittleEndian<qint64>(record + 24);
+		location.size = qFromLittleEndian<qint64>(record + 32);
+		if (location.size < 0)
+		{
+			m_objects.remove(hash);
+			continue;
+		}
+		if (!packSizes.contains(location.pack))
+			packSizes.insert(location.pack, QFileInfo(packPath(location.pack)).size());
+		// the data never made it to the disk
+		if (location.offset + location.size > packSizes[location.pack])
+			continue;
+		m_objects.insert(hash, location);
+		m_pack = qMax(m_pack, location.pack);
+	}
+	m_indexSize = offset;
+	if (m_indexSize != data.size())
+	{
+		qWarning() << "Dropping" << data.size() - m_indexSize << "bytes of damaged index from"
+				   << m_index.fileName();
+		m_index.resize(m_indexSize);
+	}
+	m_index.seek(m_indexSize);
+
+	// objects go to the end of the newest pack, after anything that is there already
+	m_packSize = QFileInfo(packPath(m_pack)).size();
+	return true;
+}
+
+bool AssetPackStore::appendRecord(const QByteArray &hash, const Location &location)
+{
+	QByteArray record(recordSize, '\0');
+	uchar *out = (uchar *)record.data();
+	memcpy(out, hash.constData(), 20);
+	qToLittleEndian<quint32>(location.pack, out + 20);
+	qToLittleEndian<qint64>(location.offset, out + 24);
+	qToLittleEndian<qint64>(location.size, out + 32);
+	qToLittleEndian<quint16>(qChecksum(record.constData(), recordSize - 2), out + recordSize - 2);
+	m_index.seek(m_indexSize);
+	if (m_index.write(record) != recordSize || !m_index.flush())
+	{
+		qWarning() << "Could not write to" << m_index.fileName() << ":" << m_index.errorString();
+		// don't leave half a record behind for the next one to follow
+		m_index.resize(m_indexSize);
+		return false;
+	}
+	m_indexSize += recordSize;
+	return true;
+}
+
+qint64 AssetPackStore::size(const QString &hash) const
+{
+	QByteArray raw = rawHash(hash);
+	QMutexLocker locker(&m_mutex);
+	auto iter = m_objects.constFind(raw);
+	return iter == m_objects.constEnd() ? -1 : iter->size;
+}
+
+int AssetPackStore::count() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_objects.size();
+}
+
+bool AssetPackStore::add(const QString &hash, const QByteArray &data)
+{
+	QByteArray raw = rawHash(hash);
+	if (raw.isEmpty() || !matches(data, raw))
+		return false;
+
+	QMutexLocker locker(&m_mutex);
+	if (!m_open)
+		return false;
+	if (m_objects.contains(raw))
+		return true;
+	if (m_packSize > 0 && m_packSize + data.size() > maxPackSize)
+	{
+		m_packFile.close();
+		m_pack++;
+		m_packSize = QFileInfo(packPath(m_pack)).size();
+	}
+	if (!m_packFile.isOpen())
+	{
+		m_packFile.setFileName(packPath(m_pack));
+		if (!m_packFile.open(QIODevice::ReadWrite))
+		{
+			qWarning() << "Could not open" << m_packFile.fileName() << ":"
+					   << m_packFile.errorString();
+			return false;
+		}
+	}
+	m_packFile.seek(m_packSize);
+	if (m_packFile.write(data) != data.size() || !m_packFile.flush())
+	{
+		qWarning() << "Could not write to" << m_packFile.fileName() << ":"
+				   << m_packFile.errorString();
+		m_packFile.resize(m_packSize);
+		return false;
+	}
+
+	Location location;
+	location.pack = m_pack;
+	location.offset = m_packSize;
+	location.size = data.size();
+	m_packSize += data.size();
+	// without its record, the data is just some bytes nobody refers to
+	if (!appendRecord(raw, location))
+		return false;
+	m_objects.insert(raw, location);
+	return true;
+}
+
+bool AssetPackStore::readLocked(const Location &location, QByteArray *data) const
+{
+	auto &reader = m_readers[location.pack];
+	if (!reader)
+	{
+		reader = std::make_shared<QFile>(packPath(location.pack));
+		// no buffering, the pack may have grown since the last read
+		if (!reader->open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+		{
+			qWarning() << "Could not open" << reader->fileName() << ":" << reader->errorString();
+			reader.reset();
+			return false;
+		}
+	}
+	if (!reader->seek(location.offset))
+		return false;
+	*data = reader->read(location.size);
+	return data->size() == location.size;
+}
+
+bool AssetPackStore::read(const QString &hash, QByteArray *data) const
+{
+	QByteArray raw = rawHash(hash);
+	QMutexLocker locker(&m_mutex);
+	auto iter = m_objects.constFind(raw);
+	if (iter == m_objects.constEnd())
+		return false;
+	return readLocked(*iter, data);
+}
+
+bool AssetPackStore::extract(const QString &hash, const QString &target) const
+{
+	QByteArray data;
+	if (!read(hash, &data))
+		return false;
+	if (!matches(data, rawHash(hash)))
+	{
+		qWarning() << "Packed asset object" << hash << "is damaged, not extracting it";
+		return false;
+	}
+	try
+	{
+		FS::write(target, data);
+	}
+	catch (FS::FileSystemException &)
+	{
+		return false;
+	}
+	return true;
+}
+
+bool AssetPackStore::forget(const QString &hash)
+{
+	QByteArray raw = rawHash(hash);
+	QMutexLocker locker(&m_mutex);
+	if (!m_objects.contains(raw))
+		return true;
+	Location tombstone;
+	if (!appendRecord(raw, tombstone))
+		return false;
+	m_objects.remove(raw);
+	return true;
+}
+
+bool AssetPackStore::verify(const QString &hash) const
+{
+	QByteArray data;
+	return read(hash, &data) && matches(data, rawHash(hash));
+}
+
+QStringList AssetPackStore::verifyAll(bool forgetBad)
+{
+	QList<QByteArray> hashes;
+	{
+		QMutexLocker locker(&m_mutex);
+		hashes = m_objects.keys();
+	}
+	QStringList bad;
+	for (auto &raw : hashes)
+	{
+		QString hash = raw.toHex();
+		if (!verify(hash))
+			bad.append(hash);
+	}
+	if (forgetBad)
+	{
+		for (auto &hash : bad)
+		{
+			forget(hash);
+		}
+	}
+	return bad;
+}
+
+AssetPackStore::Migration AssetPackStore::migrate(const QString &objectDir,
+												  const QSet<QString> &keepLoose,
+												  std::function<bool()> cancelled)
+{
+	Migration result;
+	QDirIterator objects(objectDir, QDir::Files, QDirIterator::Subdirectories);
+	while (objects.hasNext())
+	{
+		if (cancelled && cancelled())
+			break;
+		QFileInfo info(objects.next());
+		QString hash = info.fileName();
+		// only what looks like 'xx/<sha1 starting with xx>'
+		if (rawHash(hash).isEmpty() || info.dir().dirName() != hash.left(2))
+			continue;
+		if (size(hash) != info.size())
+		{
+			QFile file(info.filePath());
+			if (!file.open(QIODevice::ReadOnly))
+				continue;
+			QByteArray data = file.readAll();
+			file.close();
+			if (!matches(data, rawHash(hash)))
+			{
+				result.bad++;
+				continue;
+			}
+			// a packed object of the wrong size is broken, this one is better
+			if (!forget(hash) || !add(hash, data))
+				continue;
+			result.packed++;
+			result.bytes += data.size();
+		}
+		if (!keepLoose.contains(hash) && QFile::remove(info.filePath()))
+			result.removed++;
+	}
+	return result;
+}
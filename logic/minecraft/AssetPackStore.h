@@ -0,0 +1,113 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QFile>
+#include <QMutex>
+#include <functional>
+#include <memory>
+
+/**
+ * Asset objects packed into a few big files instead of one file each.
+ *
+ * '<root>/pack-<n>' files only ever grow: objects are appended to the newest one, until it is
+ * full. '<root>/index' says where each object is, by SHA-1. It is a journal of fixed size
+ * records, the last record for an object wins. A damaged end of the index is dropped on open.
+ *
+ * The loose objects in 'assets/objects' keep working next to this. Whatever reads objects
+ * looks there first and here second.
+ *
+ * All methods can be called from any thread.
+ */
+class AssetPackStore
+{
+public:
+	struct Migration
+	{
+		int packed = 0;
+		int removed = 0;
+		int bad = 0;
+		qint64 bytes = 0;
+	};
+
+	explicit AssetPackStore(QString root);
+	~AssetPackStore();
+
+	QString root() const
+	{
+		return m_root;
+	}
+
+	/// size of the packed object with the given hash, -1 if there is none
+	qint64 size(const QString &hash) const;
+	bool contains(const QString &hash) const
+	{
+		return size(hash) >= 0;
+	}
+	/// number of packed objects
+	int count() const;
+
+	/// append an object, unless it is packed already. The data has to match the hash.
+	bool add(const QString &hash, const QByteArray &data);
+	/// read a packed object, without checking it
+	bool read(const QString &hash, QByteArray *data) const;
+	/// write a packed object to 'target', if it still matches its hash
+	bool extract(const QString &hash, const QString &target) const;
+	/// stop using a packed object. It stays in its pack, but can be added again.
+	bool forget(const QString &hash);
+
+	/// true if the packed object matches its hash
+	bool verify(const QString &hash) const;
+	/// the hashes of all packed objects that don't match. They are forgotten if 'forgetBad' is set.
+	QStringList verifyAll(bool forgetBad = false);
+
+	/**
+	 * Pack the loose objects in 'objectDir' and remove them, except the ones in 'keepLoose'.
+	 * Objects that don't match their hash are left alone. Stops early if 'cancelled' says so.
+	 */
+	Migration migrate(const QString &objectDir, const QSet<QString> &keepLoose,
+					  std::function<bool()> cancelled = nullptr);
+
+private:
+	struct Location
+	{
+		quint32 pack = 0;
+		qint64 offset = 0;
+		qint64 size = -1;
+	};
+	bool open();
+	bool appendRecord(const QByteArray &hash, const Location &location);
+	bool readLocked(const Location &location, QByteArray *data) const;
+	QString packPath(quint32 pack) const;
+
+private:
+	QString m_root;
+	mutable QMutex m_mutex;
+	QHash<QByteArray, Location> m_objects;
+	QFile m_index;
+	qint64 m_indexSize = 0;
+	/// the pack objects are appended to
+	QFile m_packFile;
+	quint32 m_pack = 0;
+	qint64 m_packSize = 0;
+	/// open packs, for reading
+	mutable QHash<quint32, std::shared_ptr<QFile>> m_readers;
+	bool m_open = false;
+};
@@ -16,170 +16,495 @@
 #include <QDir>
 #include <QDirIterator>
 #include <QCryptographicHash>
-#include <QJsonParseError>
-#include <QJsonDocument>
-#include <QJsonObject>
-#include <QVariant>
+#include <QDataStream>
+#include <QDateTime>
+#include <QSaveFile>
 #include <QDebug>
 
 #include "AssetsUtils.h"
 #include <pathutils.h>
 
-namespace AssetsUtils
+namespace
 {
-
 /*
- * Returns true on success, with index populated
- * index is undefined otherwise
+ * Reads the asset index format straight into an AssetsIndex:
+ * {
+ *   "virtual": true,
+ *   "objects": {
+ *     "icons/icon_16x16.png": {
+ *       "hash": "bdf48ef6b5d0d23bbb02e17d04865216179f510a",
+ *       "size": 3665
+ *     },
+ *     ...
+ *   }
+ * }
+ * Anything else in the file is skipped, as long as it is valid JSON.
  */
-bool loadAssetsIndexJson(QString path, AssetsIndex *index)
+class IndexParser
 {
-	/*
-	{
-	  "objects": {
-		"icons/icon_16x16.png": {
-		  "hash": "bdf48ef6b5d0d23bbb02e17d04865216179f510a",
-		  "size": 3665
-		},
-		...
-		}
-	  }
+public:
+	IndexParser(const QByteArray &data)
+		: m_begin(data.constData()), m_pos(m_begin), m_end(m_begin + data.size())
+	{
 	}
-	*/
 
-	QFile file(path);
+	bool parse(AssetsIndex *index)
+	{
+		skipSpace();
+		if (!peek('{'))
+			return fail("Root should be an object");
+		bool ok = readObject([&](const QByteArray &key)
+		{
+			if (key == "objects")
+				return readObjects(index);
+			if (key == "virtual" && (peek('t') || peek('f')))
+				return readBool(&index->isVirtual);
+			return skipValue(0);
+		});
+		if (!ok)
+			return false;
+		skipSpace();
+		if (m_pos != m_end)
+			return fail("Garbage after the index");
+		return true;
+	}
 
-	// Try to open the file and fail if we can't.
-	// TODO: We should probably report this error to the user.
-	if (!file.open(QIODevice::ReadOnly))
+	QString error() const
 	{
-		qCritical() << "Failed to read assets index file" << path;
+		return m_error;
+	}
+
+private:
+	// deeper than this is not an asset index
+	static const int MAX_DEPTH = 64;
+
+	bool fail(const char *message)
+	{
+		if (m_error.isEmpty())
+			m_error = QString("%1 at offset %2").arg(message).arg(m_pos - m_begin);
 		return false;
 	}
 
-	// Read the file and close it.
-	QByteArray jsonData = file.readAll();
-	file.close();
+	void skipSpace()
+	{
+		while (m_pos < m_end && (*m_pos == ' ' || *m_pos == '\n' || *m_pos == '\r' || *m_pos == '\t'))
+			m_pos++;
+	}
 
-	QJsonParseError parseError;
-	QJsonDocument jsonDoc = QJsonDocument::fromJson(jsonData, &parseError);
+	static bool isDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
 
-	// Fail if the JSON is invalid.
-	if (parseError.error != QJsonParseError::NoError)
+	bool peek(char c) const
 	{
-		qCritical() << "Failed to parse assets index file:" << parseError.errorString()
-					 << "at offset " << QString::number(parseError.offset);
-		return false;
+		return m_pos < m_end && *m_pos == c;
 	}
 
-	// Make sure the root is an object.
-	if (!jsonDoc.isObject())
+	bool expect(char c)
 	{
-		qCritical() << "Invalid assets index JSON: Root should be an array.";
-		return false;
+		skipSpace();
+		if (!peek(c))
+			return fail("Unexpected character");
+		m_pos++;
+		return true;
 	}
 
-	QJsonObject root = jsonDoc.object();
+	bool readLiteral(const char *literal)
+	{
+		size_t len = strlen(literal);
+		if ((size_t)(m_end - m_pos) < len || memcmp(m_pos, literal, len) != 0)
+			return fail("Unexpected character");
+		m_pos += len;
+		return true;
+	}
 
-	QJsonValue isVirtual = root.value("virtual");
-	if (!isVirtual.isUndefined())
+	bool readBool(bool *out)
 	{
-		index->isVirtual = isVirtual.toBool(false);
+		*out = peek('t');
+		return readLiteral(*out ? "true" : "false");
 	}
 
-	QJsonValue objects = root.value("objects");
-	QVariantMap map = objects.toVariant().toMap();
+	/// calls member(key) with the position at the value of each member. key is UTF-8.
+	template <typename F> bool readObject(F member)
+	{
+		if (!expect('{'))
+			return false;
+		skipSpace();
+		if (peek('}'))
+		{
+			m_pos++;
+			return true;
+		}
+		for (;;)
+		{
+			QByteArray key;
+			skipSpace();
+			if (!readUtf8(&key) || !expect(':'))
+				return false;
+			skipSpace();
+			if (!member(key))
+				return false;
+			skipSpace();
+			if (peek(','))
+			{
+				m_pos++;
+				continue;
+			}
+			return expect('}');
+		}
+	}
 
-	for (QVariantMap::const_iterator iter = map.begin(); iter != map.end(); ++iter)
+	bool readObjects(AssetsIndex *index)
 	{
-		// qDebug() << iter.key();
+		if (!peek('{'))
+			return skipValue(0);
+		index->objects.clear();
+		return readObject([&](const QByteArray &path)
+		{
+			if (!peek('{'))
+				return skipValue(1);
+			AssetObject object;
+			object.path = QString::fromUtf8(path);
+			bool ok = readObject([&](const QByteArray &key)
+			{
+				if (key == "hash" && peek('"'))
+					return readString(&object.hash);
+				if (key == "size" && m_pos < m_end && (*m_pos == '-' || isDigit(*m_pos)))
+					return readNumber(&object.size);
+				return skipValue(2);
+			});
+			index->objects.append(object);
+			return ok;
+		});
+	}
 
-		QVariant variant = iter.value();
-		QVariantMap nested_objects = variant.toMap();
+	bool readString(QString *out)
+	{
+		QByteArray utf8;
+		if (!readUtf8(&utf8))
+			return false;
+		*out = QString::fromUtf8(utf8);
+		return true;
+	}
 
-		AssetObject object;
+	/// out may point into the parsed data
+	bool readUtf8(QByteArray *out)
+	{
+		if (!peek('"'))
+			return fail("Expected a string");
+		const char *start = ++m_pos;
+		// the common case - nothing escaped
+		while (m_pos < m_end && *m_pos != '"' && *m_pos != '\\')
+			m_pos++;
+		if (peek('"'))
+		{
+			*out = QByteArray::fromRawData(start, m_pos - start);
+			m_pos++;
+			return true;
+		}
+		QByteArray utf8(start, m_pos - start);
+		while (m_pos < m_end && *m_pos != '"')
+		{
+			if (*m_pos != '\\')
+			{
+				utf8.append(*m_pos++);
+				continue;
+			}
+			if (++m_pos == m_end)
+				break;
+			char c = *m_pos++;
+			switch (c)
+			{
+			case 'b':
+				utf8.append('\b');
+				break;
+			case 'f':
+				utf8.append('\f');
+				break;
+			case 'n':
+				utf8.append('\n');
+				break;
+			case 'r':
+				utf8.append('\r');
+				break;
+			case 't':
+				utf8.append('\t');
+				break;
+			case 'u':
+			{
+				uint code = 0;
+				if (!readHex4(&code))
+					return false;
+				// surrogate pairs come as two escapes
+				if (code >= 0xD800 && code < 0xDC00 && m_end - m_pos >= 6 && m_pos[0] == '\\' &&
+					m_pos[1] == 'u')
+				{
+					const char *low = m_pos;
+					m_pos += 2;
+					uint second = 0;
+					if (!readHex4(&second))
+						return false;
+					if (second >= 0xDC00 && second < 0xE000)
+						code = QChar::surrogateToUcs4(code, second);
+					else
+						m_pos = low;
+				}
+				utf8.append(QString::fromUcs4(&code, 1).toUtf8());
+				break;
+			}
+			default:
+				utf8.append(c);
+			}
+		}
+		if (!peek('"'))
+			return fail("Unterminated string");
+		m_pos++;
+		*out = utf8;
+		return true;
+	}
+
+	bool readHex4(uint *out)
+	{
+		if (m_end - m_pos < 4)
+			return fail("Bad unicode escape");
+		bool ok;
+		*out = QByteArray(m_pos, 4).toUInt(&ok, 16);
+		if (!ok)
+			return fail("Bad unicode escape");
+		m_pos += 4;
+		return true;
+	}
 
-		for (QVariantMap::const_iterator nested_iter = nested_objects.begin();
-			 nested_iter != nested_objects.end(); ++nested_iter)
+	bool readNumber(qint64 *out)
+	{
+		const char *start = m_pos;
+		bool negative = peek('-');
+		if (negative)
+			m_pos++;
+		qint64 value = 0;
+		const char *digits = m_pos;
+		while (m_pos < m_end && isDigit(*m_pos) && m_pos - digits < 18)
+			value = value * 10 + (*m_pos++ - '0');
+		if (m_pos == digits)
+			return fail("Bad number");
+		if (m_pos == m_end || !(isDigit(*m_pos) || *m_pos == '.' || *m_pos == 'e' || *m_pos == 'E'))
 		{
-			// qDebug() << nested_iter.key() << nested_iter.value().toString();
-			QString key = nested_iter.key();
-			QVariant value = nested_iter.value();
+			*out = negative ? -value : value;
+			return true;
+		}
+		// fractions, exponents and huge numbers are not sizes, but they are still JSON
+		while (m_pos < m_end && (isDigit(*m_pos) || (*m_pos && strchr(".eE+-", *m_pos))))
+			m_pos++;
+		bool ok;
+		double number = QByteArray(start, m_pos - start).toDouble(&ok);
+		if (!ok)
+			return fail("Bad number");
+		// keep the conversion defined
+		*out = qBound(-9e18, number, 9e18);
+		return true;
+	}
 
-			if (key == "hash")
+	bool skipValue(int depth)
+	{
+		if (depth > MAX_DEPTH)
+			return fail("Nested too deeply");
+		skipSpace();
+		if (m_pos == m_end)
+			return fail("Unexpected end of file");
+		switch (*m_pos)
+		{
+		case '{':
+			return readObject([&](const QByteArray &)
+			{
+				return skipValue(depth + 1);
+			});
+		case '[':
+			m_pos++;
+			skipSpace();
+			if (peek(']'))
 			{
-				object.hash = value.toString();
+				m_pos++;
+				return true;
 			}
-			else if (key == "size")
+			for (;;)
 			{
-				object.size = value.toDouble();
+				if (!skipValue(depth + 1))
+					return false;
+				skipSpace();
+				if (peek(','))
+				{
+					m_pos++;
+					continue;
+				}
+				return expect(']');
 			}
+		case '"':
+		{
+			QByteArray ignored;
+			return readUtf8(&ignored);
+		}
+		case 't':
+			return readLiteral("true");
+		case 'f':
+			return readLiteral("false");
+		case 'n':
+			return readLiteral("null");
+		default:
+			qint64 ignored;
+			return readNumber(&ignored);
 		}
+	}
+
+	const char *m_begin;
+	const char *m_pos;
+	const char *m_end;
+	QString m_error;
+};
+
+/*
+ * The sidecar holds the parsed index together with what the JSON looked like when it was
+ * written. It is current if the JSON has the same size and modification time, or failing
+ * that, the same MD5 - a re-downloaded index gets a new mtime, but usually not new contents.
+ */
+const quint32 sidecarMagic = 0x4d4d4149; // 'MMAI'
+const quint32 sidecarVersion = 1;
+
+struct SidecarKey
+{
+	qint64 size = -1;
+	qint64 mtime = -1;
+	QByteArray md5;
+};
 
-		index->objects.insert(iter.key(), object);
+QByteArray writeSidecar(const SidecarKey &key, const AssetsIndex &index)
+{
+	QByteArray data;
+	QDataStream out(&data, QIODevice::WriteOnly);
+	out.setVersion(QDataStream::Qt_5_0);
+	out << sidecarMagic << sidecarVersion << key.size << key.mtime << key.md5 << index.isVirtual
+		<< quint32(index.objects.size());
+	for (auto &object : index.objects)
+	{
+		out << object.path << object.hash << object.size;
 	}
+	return data;
+}
 
-	return true;
+bool readSidecarKey(QDataStream &in, SidecarKey *key)
+{
+	quint32 magic, version;
+	in >> magic >> version;
+	if (in.status() != QDataStream::Ok || magic != sidecarMagic || version != sidecarVersion)
+		return false;
+	in >> key->size >> key->mtime >> key->md5;
+	return in.status() == QDataStream::Ok;
 }
 
-QDir reconstructAssets(QString assetsId)
+bool readSidecarIndex(QDataStream &in, AssetsIndex *index)
 {
-	QDir assetsDir = QDir("assets/");
-	QDir indexDir = QDir(PathCombine(assetsDir.path(), "indexes"));
-	QDir objectDir = QDir(PathCombine(assetsDir.path(), "objects"));
-	QDir virtualDir = QDir(PathCombine(assetsDir.path(), "virtual"));
+	quint32 count;
+	in >> index->isVirtual >> count;
+	// don't trust the count with the allocation, a broken file would run out of data first
+	index->objects.clear();
+	for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++)
+	{
+		AssetObject object;
+		in >> object.path >> object.hash >> object.size;
+		index->objects.append(object);
+	}
+	return in.status() == QDataStream::Ok && in.atEnd();
+}
+}
 
-	QString indexPath = PathCombine(indexDir.path(), assetsId + ".json");
-	QFile indexFile(indexPath);
-	QDir virtualRoot(PathCombine(virtualDir.path(), assetsId));
+namespace AssetsUtils
+{
 
-	if (!indexFile.exists())
+bool parseAssetsIndex(const QByteArray &json, AssetsIndex *index, QString *error)
+{
+	*index = AssetsIndex();
+	IndexParser parser(json);
+	if (!parser.parse(index))
 	{
-		qCritical() << "No assets index file" << indexPath << "; can't reconstruct assets";
-		return virtualRoot;
+		if (error)
+			*error = parser.error();
+		return false;
 	}
+	return true;
+}
 
-	qDebug() << "reconstructAssets" << assetsDir.path() << indexDir.path()
-				 << objectDir.path() << virtualDir.path() << virtualRoot.path();
-
-	AssetsIndex index;
-	bool loadAssetsIndex = AssetsUtils::loadAssetsIndexJson(indexPath, &index);
+QString assetsIndexSidecar(QString file)
+{
+	return file + ".bin";
+}
 
-	if (loadAssetsIndex && index.isVirtual)
+/*
+ * Returns true on success, with index populated
+ * index is undefined otherwise
+ */
+bool loadAssetsIndexJson(QString path, AssetsIndex *index)
+{
+	QFileInfo info(path);
+	SidecarKey current;
+	current.size = info.size();
+	current.mtime = info.lastModified().toMSecsSinceEpoch();
+
+	QFile sidecarFile(assetsIndexSidecar(path));
+	QByteArray sidecar;
+	if (info.isFile() && sidecarFile.open(QIODevice::ReadOnly))
+	{
+		sidecar = sidecarFile.readAll();
+		sidecarFile.close();
+	}
+	QDataStream in(sidecar);
+	in.setVersion(QDataStream::Qt_5_0);
+	SidecarKey stored;
+	bool haveSidecar = readSidecarKey(in, &stored);
+	if (haveSidecar && stored.size == current.size && stored.mtime == current.mtime &&
+		readSidecarIndex(in, index))
 	{
-		qDebug() << "Reconstructing virtual assets folder at" << virtualRoot.path();
+		return true;
+	}
 
-		for (QString map : index.objects.keys())
-		{
-			AssetObject asset_object = index.objects.value(map);
-			QString target_path = PathCombine(virtualRoot.path(), map);
-			QFile target(target_path);
+	QFile file(path);
+
+	// Try to open the file and fail if we can't.
+	// TODO: We should probably report this error to the user.
+	if (!file.open(QIODevice::ReadOnly))
+	{
+		qCritical() << "Failed to read assets index file" << path;
+		return false;
+	}
 
-			QString tlk = asset_object.hash.left(2);
+	// Read the file and close it.
+	QByteArray jsonData = file.readAll();
+	file.close();
+	current.size = jsonData.size();
+	current.md5 = QCryptographicHash::hash(jsonData, QCryptographicHash::Md5);
 
-			QString original_path =
-				PathCombine(PathCombine(objectDir.path(), tlk), asset_object.hash);
-			QFile original(original_path);
-			if (!original.exists())
-				continue;
-			if (!target.exists())
-			{
-				QFileInfo info(target_path);
-				QDir target_dir = info.dir();
-				// qDebug() << target_dir;
-				if (!target_dir.exists())
-					QDir("").mkpath(target_dir.path());
-
-				bool couldCopy = original.copy(target_path);
-				qDebug() << " Copying" << original_path << "to" << target_path
-							 << QString::number(couldCopy); // << original.errorString();
-			}
+	bool parsed = false;
+	if (haveSidecar && stored.size == current.size && stored.md5 == current.md5)
+	{
+		// same contents, only touched. the sidecar still needs the new mtime.
+		parsed = readSidecarIndex(in, index);
+	}
+	if (!parsed)
+	{
+		QString error;
+		if (!parseAssetsIndex(jsonData, index, &error))
+		{
+			qCritical() << "Failed to parse assets index file" << path << ":" << error;
+			return false;
 		}
-
-		// TODO: Write last used time to virtualRoot/.lastused
 	}
 
-	return virtualRoot;
+	QSaveFile out(sidecarFile.fileName());
+	QByteArray data = writeSidecar(current, *index);
+	if (!out.open(QIODevice::WriteOnly) || out.write(data) != data.size() || !out.commit())
+	{
+		qWarning() << "Could not write" << out.fileName() << ":" << out.errorString();
+	}
+	return true;
 }
 
 }
@@ -16,23 +16,29 @@
 #pragma once
 
 #include <QString>
-#include <QMap>
+#include <QVector>
 
 struct AssetObject
 {
+	/// where the object goes in a virtual assets folder
+	QString path;
 	QString hash;
-	qint64 size;
+	qint64 size = 0;
 };
 
 struct AssetsIndex
 {
-	QMap<QString, AssetObject> objects;
+	/// in the order of the index file
+	QVector<AssetObject> objects;
 	bool isVirtual = false;
 };
 
 namespace AssetsUtils
 {
+/// Parse an asset index in a single pass. Returns false and sets error if it isn't one.
+bool parseAssetsIndex(const QByteArray &json, AssetsIndex *index, QString *error = nullptr);
+/// The binary copy of the index kept next to it, so later loads can skip the parsing
+QString assetsIndexSidecar(QString file);
+/// Load an asset index from its sidecar if that is still current, from the JSON otherwise
 bool loadAssetsIndexJson(QString file, AssetsIndex* index);
-/// Reconstruct a virtual assets folder for the given assets ID and return the folder
-QDir reconstructAssets(QString assetsId);
 }
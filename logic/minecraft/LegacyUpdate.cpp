@@ -40,6 +40,19 @@ void LegacyUpdate::executeTask()
 	fmllibsStart();
 }
 
+bool LegacyUpdate::abort()
+{
+	if (!isRunning())
+		return false;
+	// stop first, so whatever the downloads report while going down is ignored
+	emitAborted();
+	if (m_reply && m_reply->isRunning())
+		m_reply->abort();
+	if (legacyDownloadJob && legacyDownloadJob->isRunning())
+		legacyDownloadJob->abort();
+	return true;
+}
+
 void LegacyUpdate::fmllibsStart()
 {
 	// Get the mod list
@@ -143,7 +156,7 @@ void LegacyUpdate::fmllibsFinished()
 				emitFailed(tr("Failed creating FML library folder inside the instance."));
 				return;
 			}
-			if (!QFile::copy(entry->getFullPath(), PathCombine(inst->libDir(), lib.filename)))
+			if (!metacache->copyEntryFile(entry, path))
 			{
 				emitFailed(tr("Failed copying Forge/FML library: %1.").arg(lib.filename));
 				return;
@@ -208,7 +221,7 @@ void LegacyUpdate::lwjglStart()
 
 void LegacyUpdate::lwjglFinished(QNetworkReply *reply)
 {
-	if (m_reply.get() != reply)
+	if (m_reply.get() != reply || wasAborted())
 	{
 		return;
 	}
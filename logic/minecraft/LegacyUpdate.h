@@ -34,6 +34,13 @@ class LegacyUpdate : public Task
 public:
 	explicit LegacyUpdate(BaseInstance *inst, QObject *parent = 0);
 	virtual void executeTask();
+	virtual bool canAbort() const
+	{
+		return true;
+	}
+
+public slots:
+	virtual bool abort();
 
 private
 slots:
@@ -60,6 +60,14 @@ public:
 	explicit MCVListVersionUpdateTask(MinecraftVersionList *vlist, QString updatedVersion);
 	virtual ~MCVListVersionUpdateTask() override{};
 	virtual void executeTask() override;
+	virtual bool canAbort() const override
+	{
+		return true;
+	}
+
+public
+slots:
+	virtual bool abort() override;
 
 protected
 slots:
@@ -512,8 +520,24 @@ void MCVListVersionUpdateTask::executeTask()
 	specificVersionDownloadJob->start();
 }
 
+bool MCVListVersionUpdateTask::abort()
+{
+	if (!isRunning())
+		return false;
+	emitAborted();
+	if (specificVersionDownloadJob)
+	{
+		// its failed() goes straight out, so don't let it through on the way down
+		specificVersionDownloadJob->disconnect(this);
+		specificVersionDownloadJob->abort();
+	}
+	return true;
+}
+
 void MCVListVersionUpdateTask::json_downloaded()
 {
+	if (!isRunning())
+		return;
 	NetActionPtr DlJob = specificVersionDownloadJob->first();
 	auto data = std::dynamic_pointer_cast<ByteArrayDownload>(DlJob)->m_data;
 	specificVersionDownloadJob.reset();
@@ -30,10 +30,11 @@
 #include <launch/steps/TextPrint.h>
 #include <launch/steps/ModMinecraftJar.h>
 #include <launch/steps/CheckJava.h>
+#include <launch/steps/ReconstructAssets.h>
 #include "minecraft/OneSixProfileStrategy.h"
 #include "MMCZip.h"
 
-#include "minecraft/AssetsUtils.h"
+#include "minecraft/ReconstructAssetsTask.h"
 #include "icons/IconList.h"
 
 OneSixInstance::OneSixInstance(SettingsObjectPtr globalSettings, SettingsObjectPtr settings, const QString &rootDir)
@@ -114,7 +115,9 @@ QStringList OneSixInstance::processMinecraftArgs(AuthSessionPtr session)
 	QString absRootDir = QDir(minecraftRoot()).absolutePath();
 	token_mapping["game_directory"] = absRootDir;
 	QString absAssetsDir = QDir("assets/").absolutePath();
-	token_mapping["game_assets"] = AssetsUtils::reconstructAssets(m_version->assets).absolutePath();
+	// the ReconstructAssets step fills it before the game starts
+	token_mapping["game_assets"] =
+		QDir(ReconstructAssetsTask::virtualRoot(m_version->assets)).absolutePath();
 
 	token_mapping["user_properties"] = session->serializeUserProperties();
 	token_mapping["user_type"] = session->user_type;
@@ -260,6 +263,11 @@ std::shared_ptr<LaunchTask> OneSixInstance::createLaunchTask(AuthSessionPtr sess
 	{
 		process->appendStep(std::make_shared<Update>(pptr));
 	}
+	// only versions that use the virtual assets folder need it, or packed assets
+	if(m_version->minecraftArguments.contains("${game_assets}") || ENV.assetPacks())
+	{
+		process->appendStep(std::make_shared<ReconstructAssets>(pptr, m_version->assets));
+	}
 	// if there are any jar mods
 	if(getJarMods().size())
 	{
@@ -466,6 +474,23 @@ std::shared_ptr<MinecraftProfile> OneSixInstance::getMinecraftProfile() const
 	return m_version;
 }
 
+std::shared_ptr<MinecraftProfile> OneSixInstance::getLoadedProfile()
+{
+	// instances are loaded without their version files. They are read when first needed.
+	if (!m_version->rowCount())
+	{
+		try
+		{
+			reloadProfile();
+		}
+		catch (Exception &error)
+		{
+			qWarning() << "Couldn't load the version of" << name() << ":" << error.cause();
+		}
+	}
+	return m_version;
+}
+
 QString OneSixInstance::getStatusbarDescription()
 {
 	QStringList traits;
@@ -75,6 +75,10 @@ public:
 	/// get the current full version info
 	std::shared_ptr<MinecraftProfile> getMinecraftProfile() const;
 
+	/// same, but loaded from the version files first if nothing did that yet. The profile stays
+	/// empty if they can't be loaded.
+	std::shared_ptr<MinecraftProfile> getLoadedProfile();
+
 	virtual QString getStatusbarDescription() override;
 
 	virtual QDir jarmodsPath() const;
@@ -22,6 +22,7 @@
 #include <QFileInfo>
 #include <QTextStream>
 #include <QDataStream>
+#include <QPointer>
 #include <pathutils.h>
 #include <JlCompress.h>
 
@@ -32,16 +33,34 @@
 #include "minecraft/OneSixInstance.h"
 #include "forge/ForgeMirrors.h"
 #include "net/URLConstants.h"
+#include "net/SegmentedDownload.h"
 #include "minecraft/AssetsUtils.h"
+#include "minecraft/VerifyAssetsTask.h"
+#include "minecraft/AssetDownloadTask.h"
+#include "minecraft/AssetPackStore.h"
 #include "Exception.h"
 #include "MMCZip.h"
 
+bool OneSixUpdate::s_verifyAssets = false;
+
+void OneSixUpdate::setVerifyAssets(bool verify)
+{
+	s_verifyAssets = verify;
+}
+
 OneSixUpdate::OneSixUpdate(OneSixInstance *inst, QObject *parent) : Task(parent), m_inst(inst)
 {
+	connect(this, &Task::finished, this, [this]()
+	{
+		m_assetsHold.reset();
+	});
 }
 
 void OneSixUpdate::executeTask()
 {
+	// the index and the objects this gets must not be taken for garbage
+	m_assetsHold = ENV.holdAssets();
+
 	// Make directories
 	QDir mcDir(m_inst->minecraftRoot());
 	if (!mcDir.exists() && !mcDir.mkpath("."))
@@ -80,6 +99,25 @@ void OneSixUpdate::executeTask()
 	versionUpdateTask->start();
 }
 
+bool OneSixUpdate::abort()
+{
+	if (!isRunning())
+		return false;
+	// stop first, so whatever the jobs report while going down is ignored
+	emitAborted();
+	if (versionUpdateTask && versionUpdateTask->isRunning())
+		versionUpdateTask->abort();
+	if (jarlibDownloadJob && jarlibDownloadJob->isRunning())
+		jarlibDownloadJob->abort();
+	if (legacyDownloadJob && legacyDownloadJob->isRunning())
+		legacyDownloadJob->abort();
+	if (verifyAssetsTask && verifyAssetsTask->isRunning())
+		verifyAssetsTask->abort();
+	if (assetsDownloadTask && assetsDownloadTask->isRunning())
+		assetsDownloadTask->abort();
+	return true;
+}
+
 void OneSixUpdate::versionUpdateFailed(QString reason)
 {
 	emitFailed(reason);
@@ -87,6 +125,9 @@ void OneSixUpdate::versionUpdateFailed(QString reason)
 
 void OneSixUpdate::assetIndexStart()
 {
+	// the step before finished just as the update was aborted
+	if (wasAborted())
+		return;
 	setStatus(tr("Updating assets index..."));
 	OneSixInstance *inst = (OneSixInstance *)m_inst;
 	std::shared_ptr<MinecraftProfile> version = inst->getMinecraftProfile();
@@ -125,34 +166,43 @@ void OneSixUpdate::assetIndexFinished()
 		auto entry = metacache->resolveEntry("asset_indexes", assetName + ".json");
 		metacache->evictEntry(entry);
 		emitFailed(tr("Failed to read the assets index!"));
+		return;
+	}
+
+	// hashing everything also finds the objects that only have the right size
+	if (s_verifyAssets)
+	{
+		setStatus(tr("Verifying the assets files..."));
+		verifyAssetsTask = std::make_shared<VerifyAssetsTask>(index.objects, true);
+		connect(verifyAssetsTask.get(), &Task::succeeded, this, &OneSixUpdate::assetsFinished);
+		connect(verifyAssetsTask.get(), &Task::failed, this, &OneSixUpdate::emitFailed);
+		connect(verifyAssetsTask.get(), &Task::progress, this, &Task::progress);
+		connect(verifyAssetsTask.get(), &Task::status, this, &Task::setStatus);
+		verifyAssetsTask->start();
+		return;
 	}
 
-	QList<Md5EtagDownloadPtr> dls;
-	for (auto object : index.objects.values())
+	auto packs = ENV.assetPacks();
+	QVector<AssetObject> missing;
+	for (auto &object : index.objects)
 	{
-		QString objectName = object.hash.left(2) + "/" + object.hash;
-		QFileInfo objectFile("assets/objects/" + objectName);
+		// packed objects don't need a stat, and they get extracted before the launch
+		if (packs && packs->size(object.hash) == object.size)
+			continue;
+		QFileInfo objectFile("assets/objects/" + object.hash.left(2) + "/" + object.hash);
 		if ((!objectFile.isFile()) || (objectFile.size() != object.size))
 		{
-			auto objectDL = MD5EtagDownload::make(
-				QUrl("http://" + URLConstants::RESOURCE_BASE + objectName),
-				objectFile.filePath());
-			objectDL->m_total_progress = object.size;
-			dls.append(objectDL);
+			missing.append(object);
 		}
 	}
-	if (dls.size())
+	if (missing.size())
 	{
-		setStatus(tr("Getting the assets files from Mojang..."));
-		auto job = new NetJob(tr("Assets for %1").arg(inst->name()));
-		for (auto dl : dls)
-			job->addNetAction(dl);
-		jarlibDownloadJob.reset(job);
-		connect(jarlibDownloadJob.get(), SIGNAL(succeeded()), SLOT(assetsFinished()));
-		connect(jarlibDownloadJob.get(), &NetJob::failed, this, &OneSixUpdate::assetsFailed);
-		connect(jarlibDownloadJob.get(), SIGNAL(progress(qint64, qint64)),
-				SIGNAL(progress(qint64, qint64)));
-		jarlibDownloadJob->start();
+		assetsDownloadTask = std::make_shared<AssetDownloadTask>(missing);
+		connect(assetsDownloadTask.get(), &Task::succeeded, this, &OneSixUpdate::assetsFinished);
+		connect(assetsDownloadTask.get(), &Task::failed, this, &OneSixUpdate::assetsFailed);
+		connect(assetsDownloadTask.get(), &Task::progress, this, &Task::progress);
+		connect(assetsDownloadTask.get(), &Task::status, this, &Task::setStatus);
+		assetsDownloadTask->start();
 		return;
 	}
 	assetsFinished();
@@ -176,6 +226,9 @@ void OneSixUpdate::assetsFailed(QString reason)
 
 void OneSixUpdate::jarlibStart()
 {
+	// the step before finished just as the update was aborted
+	if (wasAborted())
+		return;
 	setStatus(tr("Getting the library files from Mojang..."));
 	qDebug() << m_inst->name() << ": downloading libraries";
 	OneSixInstance *inst = (OneSixInstance *)m_inst;
@@ -196,28 +249,11 @@ void OneSixUpdate::jarlibStart()
 
 	// Build a list of URLs that will need to be downloaded.
 	std::shared_ptr<MinecraftProfile> version = inst->getMinecraftProfile();
-	// minecraft.jar for this version
-	{
-		QString version_id = version->id;
-		QString localPath = version_id + "/" + version_id + ".jar";
-		QString urlstr = "http://" + URLConstants::AWS_DOWNLOAD_VERSIONS + localPath;
-
-		auto job = new NetJob(tr("Libraries for instance %1").arg(inst->name()));
-
-		auto metacache = ENV.metacache();
-		auto entry = metacache->resolveEntry("versions", localPath);
-		job->addNetAction(CacheDownload::make(QUrl(urlstr), entry));
-		jarHashOnEntry = entry->md5sum;
-
-		jarlibDownloadJob.reset(job);
-	}
-
 	auto libs = version->getActiveNativeLibs();
 	libs.append(version->getActiveNormalLibs());
 
-	auto metacache = ENV.metacache();
-	QList<ForgeXzDownloadPtr> ForgeLibs;
 	QList<std::shared_ptr<OneSixLibrary>> brokenLocalLibs;
+	libraryDownloads.clear();
 
 	for (auto lib : libs)
 	{
@@ -233,18 +269,20 @@ void OneSixUpdate::jarlibStart()
 
 		auto f = [&](QString storage, QString dl)
 		{
-			auto entry = metacache->resolveEntry("libraries", storage);
-			if (entry->stale)
+			LibraryDownload download;
+			download.storage = storage;
+			download.url = dl;
+			if (lib->hint() == "forge-pack-xz")
+			{
+				download.kind = LibraryDownload::ForgeXz;
+			}
+			// the forge universal jar is big enough to be worth splitting up
+			else if (lib->artifactPrefix() == "net.minecraftforge:forge" ||
+					 lib->artifactPrefix() == "net.minecraftforge:minecraftforge")
 			{
-				if (lib->hint() == "forge-pack-xz")
-				{
-					ForgeLibs.append(ForgeXzDownload::make(storage, entry));
-				}
-				else
-				{
-					jarlibDownloadJob->addNetAction(CacheDownload::make(dl, entry));
-				}
+				download.kind = LibraryDownload::Segmented;
 			}
+			libraryDownloads.append(download);
 		};
 		if (raw_storage.contains("${arch}"))
 		{
@@ -262,7 +300,6 @@ void OneSixUpdate::jarlibStart()
 	}
 	if (!brokenLocalLibs.empty())
 	{
-		jarlibDownloadJob.reset();
 		QStringList failed;
 		for (auto brokenLib : brokenLocalLibs)
 		{
@@ -275,12 +312,83 @@ void OneSixUpdate::jarlibStart()
 					  "outside of MultiMC.").arg(failed_all));
 		return;
 	}
+
+	// files that changed on disk get hashed on worker threads, not here
+	QString version_id = version->id;
+	QString localPath = version_id + "/" + version_id + ".jar";
+	QStringList storages;
+	for (auto &download : libraryDownloads)
+	{
+		storages.append(download.storage);
+	}
+	auto metacache = ENV.metacache();
+	QPointer<OneSixUpdate> self(this);
+	metacache->resolveEntryAsync("versions", localPath, [=](MetaEntryPtr jarEntry)
+	{
+		if (!self)
+			return;
+		metacache->resolveEntriesAsync("libraries", storages,
+									   [=](QList<MetaEntryPtr> libEntries)
+		{
+			if (self)
+				self->jarlibResolved(version_id, jarEntry, libEntries);
+		});
+	});
+}
+
+void OneSixUpdate::jarlibResolved(QString version_id, MetaEntryPtr jarEntry,
+								  QList<MetaEntryPtr> libEntries)
+{
+	// aborted while the files were being hashed
+	if (wasAborted())
+		return;
+	// minecraft.jar for this version
+	{
+		QString localPath = version_id + "/" + version_id + ".jar";
+		QString urlstr = "http://" + URLConstants::AWS_DOWNLOAD_VERSIONS + localPath;
+
+		auto job = new NetJob(tr("Libraries for instance %1").arg(m_inst->name()));
+		auto jarDownload = SegmentedDownload::make(QUrl(urlstr), jarEntry);
+		// the biggest download by far, everything else fits around it
+		jarDownload->m_priority = NetAction::CriticalPriority;
+		job->addNetAction(jarDownload);
+		jarHashOnEntry = jarEntry->md5sum;
+
+		jarlibDownloadJob.reset(job);
+	}
+
+	QList<ForgeXzDownloadPtr> ForgeLibs;
+	for (int i = 0; i < libraryDownloads.size(); i++)
+	{
+		auto &download = libraryDownloads[i];
+		auto entry = libEntries[i];
+		if (!entry->stale)
+			continue;
+		switch (download.kind)
+		{
+		case LibraryDownload::ForgeXz:
+			ForgeLibs.append(ForgeXzDownload::make(download.storage, entry));
+			break;
+		case LibraryDownload::Segmented:
+		{
+			auto libDownload = SegmentedDownload::make(download.url, entry);
+			libDownload->m_priority = NetAction::CriticalPriority;
+			jarlibDownloadJob->addNetAction(libDownload);
+			break;
+		}
+		case LibraryDownload::Plain:
+			jarlibDownloadJob->addNetAction(CacheDownload::make(download.url, entry));
+			break;
+		}
+	}
 	// TODO: think about how to propagate this from the original json file... or IF AT ALL
 	QString forgeMirrorList = "http://files.minecraftforge.net/mirror-brand.list";
 	if (!ForgeLibs.empty())
 	{
-		jarlibDownloadJob->addNetAction(
-			ForgeMirrors::make(ForgeLibs, jarlibDownloadJob, forgeMirrorList));
+		// the forge libraries can't start before the mirror list is there
+		auto mirrors = ForgeMirrors::make(ForgeLibs, jarlibDownloadJob, forgeMirrorList);
+		mirrors->m_priority = NetAction::CriticalPriority;
+		jarlibDownloadJob->addNetAction(mirrors);
 	}
 
 	connect(jarlibDownloadJob.get(), SIGNAL(succeeded()), SLOT(jarlibFinished()));
@@ -395,7 +503,7 @@ void OneSixUpdate::fmllibsFinished()
 				emitFailed(tr("Failed creating FML library folder inside the instance."));
 				return;
 			}
-			if (!QFile::copy(entry->getFullPath(), PathCombine(inst->libDir(), lib.filename)))
+			if (!metacache->copyEntryFile(entry, path))
 			{
 				emitFailed(tr("Failed copying Forge/FML library: %1.").arg(lib.filename));
 				return;
@@ -20,6 +20,7 @@
 #include <QUrl>
 
 #include "net/NetJob.h"
+#include "net/HttpMetaCache.h"
 #include "tasks/Task.h"
 #include "minecraft/VersionFilterData.h"
 #include <quazip.h>
@@ -32,7 +33,16 @@ class OneSixUpdate : public Task
 	Q_OBJECT
 public:
 	explicit OneSixUpdate(OneSixInstance *inst, QObject *parent = 0);
+	/// check every asset object against its hash instead of just its size
+	static void setVerifyAssets(bool verify);
 	virtual void executeTask();
+	virtual bool canAbort() const
+	{
+		return true;
+	}
+
+public slots:
+	virtual bool abort();
 
 private
 slots:
@@ -54,6 +64,22 @@ slots:
 	void assetsFailed(QString reason);
 
 private:
+	void jarlibResolved(QString version_id, MetaEntryPtr jarEntry, QList<MetaEntryPtr> libEntries);
+
+private:
+	struct LibraryDownload
+	{
+		enum Kind
+		{
+			Plain,
+			Segmented,
+			ForgeXz
+		};
+		QString storage;
+		QString url;
+		Kind kind = Plain;
+	};
+	QList<LibraryDownload> libraryDownloads;
 	NetJobPtr jarlibDownloadJob;
 	NetJobPtr legacyDownloadJob;
 
@@ -61,8 +87,16 @@ private:
 	std::shared_ptr<MinecraftVersion> targetVersion;
 	/// the task that is spawned for version updates
 	std::shared_ptr<Task> versionUpdateTask;
+	/// hashes and repairs the asset objects, if that is turned on
+	std::shared_ptr<Task> verifyAssetsTask;
+	/// gets the asset objects that are missing
+	std::shared_ptr<Task> assetsDownloadTask;
+	/// keeps the cache GC away from the asset objects while this runs
+	std::shared_ptr<void> m_assetsHold;
 
 	OneSixInstance *m_inst = nullptr;
 	QString jarHashOnEntry;
 	QList<FMLlib> fmlLibsToProcess;
+
+	static bool s_verifyAssets;
 };
@@ -0,0 +1,147 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PackAssetsTask.h"
+#include "AssetsUtils.h"
+#include "Env.h"
+#include "InstanceList.h"
+#include "minecraft/OneSixInstance.h"
+#include "minecraft/MinecraftProfile.h"
+#include <pathutils.h>
+
+#include <QtConcurrentRun>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QFile>
+#include <QSet>
+#include <QDebug>
+
+PackAssetsTask::PackAssetsTask(std::shared_ptr<AssetPackStore> packs,
+							   std::shared_ptr<InstanceList> instances, bool verify,
+							   QString assetsDir, QObject *parent)
+	: Task(parent), m_packs(packs), m_instances(instances), m_verify(verify),
+	  m_assetsDir(assetsDir)
+{
+	connect(&m_watcher, SIGNAL(finished()), SLOT(packFinished()));
+}
+
+PackAssetsTask::~PackAssetsTask()
+{
+	// the worker reports to this task, it has to be done before the task goes away
+	if (m_cancel)
+		*m_cancel = true;
+	m_watcher.waitForFinished();
+}
+
+void PackAssetsTask::executeTask()
+{
+	setStatus(tr("Packing the assets files..."));
+	QStringList keepIndexes;
+	if (m_instances)
+	{
+		for (int i = 0; i < m_instances->count(); i++)
+		{
+			auto onesix = std::dynamic_pointer_cast<OneSixInstance>(m_instances->at(i));
+			if (!onesix)
+				continue;
+			auto profile = onesix->getLoadedProfile();
+			if (profile && !profile->assets.isEmpty() && !keepIndexes.contains(profile->assets))
+				keepIndexes.append(profile->assets);
+		}
+	}
+
+	m_assetsHold = ENV.holdAssets();
+	m_cancel = std::make_shared<std::atomic<bool>>(false);
+	auto cancel = m_cancel;
+	auto packs = m_packs;
+	QString assetsDir = m_assetsDir;
+	bool verify = m_verify;
+	m_watcher.setFuture(QtConcurrent::run(ENV.workerPool().get(), [=]()
+	{
+		return pack(packs, keepIndexes, assetsDir, verify, cancel);
+	}));
+}
+
+bool PackAssetsTask::abort()
+{
+	if (!isRunning())
+		return false;
+	// the worker stops between two objects
+	*m_cancel = true;
+	return true;
+}
+
+PackAssetsTask::Report PackAssetsTask::pack(std::shared_ptr<AssetPackStore> packs,
+											QStringList keepIndexes, QString assetsDir,
+											bool verify,
+											std::shared_ptr<std::atomic<bool>> cancel)
+{
+	Report report;
+	QString objectDir = PathCombine(assetsDir, "objects");
+
+	// if an index that is in use can't be read, nothing can be removed safely
+	QSet<QString> keepLoose;
+	for (auto &assetsId : keepIndexes)
+	{
+		QString indexPath = PathCombine(assetsDir, "indexes", assetsId + ".json");
+		if (!QFile::exists(indexPath))
+			continue;
+		AssetsIndex index;
+		if (!AssetsUtils::loadAssetsIndexJson(indexPath, &index))
+		{
+			qWarning() << "Could not read asset index" << indexPath << ", not packing assets";
+			return report;
+		}
+		for (auto &object : index.objects)
+		{
+			keepLoose.insert(object.hash);
+		}
+	}
+
+	report.migration = packs->migrate(objectDir, keepLoose, [cancel]()
+	{
+		return bool(*cancel);
+	});
+
+	// the other indexes may be missing loose objects now
+	QDirIterator stamps(objectDir, QStringList() << ".complete-*", QDir::Files | QDir::Hidden);
+	while (stamps.hasNext())
+	{
+		QString stamp = stamps.next();
+		QString assetsId = QFileInfo(stamp).fileName().mid(QString(".complete-").size());
+		if (!keepIndexes.contains(assetsId))
+			QFile::remove(stamp);
+	}
+
+	if (verify && !*cancel)
+		report.badPacked = packs->verifyAll(true);
+	return report;
+}
+
+void PackAssetsTask::packFinished()
+{
+	m_assetsHold.reset();
+	m_report = m_watcher.result();
+	if (*m_cancel)
+	{
+		emitAborted();
+		return;
+	}
+	auto &migration = m_report.migration;
+	qDebug() << "Packed" << migration.packed << "asset objects (" << migration.bytes
+			 << "bytes), removed" << migration.removed << "loose ones," << migration.bad
+			 << "didn't match their hash," << m_report.badPacked.size() << "packed ones were broken";
+	emitSucceeded();
+}
@@ -0,0 +1,83 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "tasks/Task.h"
+#include "AssetPackStore.h"
+
+#include <QFutureWatcher>
+#include <QStringList>
+#include <atomic>
+#include <memory>
+
+class InstanceList;
+
+/**
+ * Moves the loose asset objects into the asset packs.
+ *
+ * The objects of the asset indexes the instances use stay loose as well, the game reads them
+ * from there. Everything else only stays in the packs, and is extracted again when an
+ * instance needs it. With 'verify', the packed objects are checked too, and the broken ones
+ * are forgotten, so the next update downloads them again.
+ */
+class PackAssetsTask : public Task
+{
+	Q_OBJECT
+public:
+	struct Report
+	{
+		AssetPackStore::Migration migration;
+		QStringList badPacked;
+	};
+
+	explicit PackAssetsTask(std::shared_ptr<AssetPackStore> packs,
+							std::shared_ptr<InstanceList> instances, bool verify = false,
+							QString assetsDir = "assets/", QObject *parent = 0);
+	virtual ~PackAssetsTask();
+
+	const Report &report() const
+	{
+		return m_report;
+	}
+
+	virtual bool canAbort() const
+	{
+		return true;
+	}
+	virtual bool abort();
+
+protected:
+	virtual void executeTask();
+
+private
+slots:
+	void packFinished();
+
+private:
+	static Report pack(std::shared_ptr<AssetPackStore> packs, QStringList keepIndexes,
+					   QString assetsDir, bool verify, std::shared_ptr<std::atomic<bool>> cancel);
+
+private:
+	std::shared_ptr<AssetPackStore> m_packs;
+	std::shared_ptr<InstanceList> m_instances;
+	bool m_verify = false;
+	QString m_assetsDir;
+	std::shared_ptr<std::atomic<bool>> m_cancel;
+	QFutureWatcher<Report> m_watcher;
+	/// keeps the cache GC away from the asset objects while this runs
+	std::shared_ptr<void> m_assetsHold;
+	Report m_report;
+};
@@ -0,0 +1,294 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ReconstructAssetsTask.h"
+#include "AssetsUtils.h"
+#include "AssetPackStore.h"
+#include "Env.h"
+#include "FileSystem.h"
+#include <pathutils.h>
+
+#include <QtConcurrentRun>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QDirIterator>
+#include <QSet>
+#include <QDebug>
+
+namespace
+{
+/// name of the stamp inside the virtual folder
+const char *COMPLETE_STAMP = ".complete";
+/// progress goes out once for this many objects
+const int PROGRESS_STEP = 64;
+
+QString indexPath(const QString &assetsId, const QString &assetsDir)
+{
+	return PathCombine(assetsDir, "indexes", assetsId + ".json");
+}
+
+/// the stamp of an index that isn't virtual. It goes with the loose objects.
+QString objectsStamp(const QString &assetsId, const QString &assetsDir)
+{
+	return PathCombine(assetsDir, "objects", COMPLETE_STAMP + QString("-") + assetsId);
+}
+
+/// what the stamp says when the virtual folder matches the index file
+QByteArray stampFor(const QFileInfo &index)
+{
+	return QByteArray::number(index.size()) + " " +
+		   QByteArray::number(index.lastModified().toMSecsSinceEpoch()) + "\n";
+}
+
+bool stampMatches(const QString &stampPath, const QFileInfo &index)
+{
+	QFile stamp(stampPath);
+	if (!stamp.open(QIODevice::ReadOnly))
+		return false;
+	return stamp.read(64) == stampFor(index);
+}
+}
+
+ReconstructAssetsTask::ReconstructAssetsTask(QString assetsId, QString assetsDir, QObject *parent)
+	: Task(parent), m_assetsId(assetsId), m_assetsDir(assetsDir)
+{
+	connect(&m_watcher, SIGNAL(finished()), SLOT(reconstructFinished()));
+}
+
+ReconstructAssetsTask::~ReconstructAssetsTask()
+{
+	// the worker reports to this task, it has to be done before the task goes away
+	if (m_cancel)
+		*m_cancel = true;
+	m_watcher.waitForFinished();
+}
+
+QString ReconstructAssetsTask::virtualRoot(QString assetsId, QString assetsDir)
+{
+	return PathCombine(assetsDir, "virtual", assetsId);
+}
+
+void ReconstructAssetsTask::invalidate(QString assetsDir)
+{
+	QDirIterator virtualDirs(PathCombine(assetsDir, "virtual"), QDir::Dirs | QDir::NoDotAndDotDot);
+	while (virtualDirs.hasNext())
+	{
+		QFile::remove(PathCombine(virtualDirs.next(), COMPLETE_STAMP));
+	}
+	QDirIterator stamps(PathCombine(assetsDir, "objects"),
+						QStringList() << COMPLETE_STAMP + QString("-*"),
+						QDir::Files | QDir::Hidden);
+	while (stamps.hasNext())
+	{
+		QFile::remove(stamps.next());
+	}
+}
+
+void ReconstructAssetsTask::executeTask()
+{
+	m_result = Result();
+	QFileInfo index(indexPath(m_assetsId, m_assetsDir));
+	if (index.exists() &&
+		(stampMatches(PathCombine(virtualRoot(m_assetsId, m_assetsDir), COMPLETE_STAMP), index) ||
+		 (ENV.assetPacks() && stampMatches(objectsStamp(m_assetsId, m_assetsDir), index))))
+	{
+		emitSucceeded();
+		return;
+	}
+
+	setStatus(tr("Putting the assets in place..."));
+	m_cancel = std::make_shared<std::atomic<bool>>(false);
+	auto cancel = m_cancel;
+	QString assetsId = m_assetsId;
+	QString assetsDir = m_assetsDir;
+	m_watcher.setFuture(QtConcurrent::run(ENV.workerPool().get(), [=]()
+	{
+		return reconstruct(assetsId, assetsDir, cancel, this);
+	}));
+}
+
+bool ReconstructAssetsTask::abort()
+{
+	if (!isRunning())
+		return false;
+	// the worker notices between two objects
+	if (m_cancel)
+		*m_cancel = true;
+	return true;
+}
+
+ReconstructAssetsTask::Result ReconstructAssetsTask::reconstruct(
+	QString assetsId, QString assetsDir, std::shared_ptr<std::atomic<bool>> cancel,
+	ReconstructAssetsTask *task)
+{
+	Result result;
+	QString indexFile = indexPath(assetsId, assetsDir);
+	QFileInfo indexInfo(indexFile);
+	if (!indexInfo.exists())
+	{
+		result.error = tr("No assets index file %1").arg(indexFile);
+		return result;
+	}
+	AssetsIndex index;
+	if (!AssetsUtils::loadAssetsIndexJson(indexFile, &index))
+	{
+		result.error = tr("Couldn't read the assets index file %1").arg(indexFile);
+		return result;
+	}
+	// without packs, the loose objects are all there is
+	auto packs = ENV.assetPacks();
+	if (!index.isVirtual && !packs)
+		return result;
+
+	QString objectDir = PathCombine(assetsDir, "objects");
+	QString root = index.isVirtual ? virtualRoot(assetsId, assetsDir) : objectDir;
+	QString stampPath;
+	if (index.isVirtual)
+	{
+		qDebug() << "Reconstructing virtual assets folder at" << root;
+		stampPath = PathCombine(root, COMPLETE_STAMP);
+	}
+	else
+	{
+		qDebug() << "Extracting packed assets of" << assetsId << "to" << root;
+		stampPath = objectsStamp(assetsId, assetsDir);
+	}
+
+	// whatever happens from here on, the old stamp is no good anymore
+	QFile::remove(stampPath);
+
+	// each way of placing a file is given up on the first time it fails
+	bool tryClone = true;
+	bool tryLink = true;
+	QSet<QString> knownDirs;
+	const int total = index.objects.size();
+	for (int i = 0; i < total; i++)
+	{
+		if (*cancel)
+		{
+			result.cancelled = true;
+			return result;
+		}
+		if (i % PROGRESS_STEP == 0)
+		{
+			QMetaObject::invokeMethod(task, "setProgress", Qt::QueuedConnection,
+									  Q_ARG(qint64, i), Q_ARG(qint64, total));
+		}
+
+		const AssetObject &object = index.objects[i];
+		QString original = PathCombine(objectDir, object.hash.left(2), object.hash);
+		QString target = index.isVirtual ? PathCombine(root, object.path) : original;
+
+		QFileInfo targetInfo(target);
+		QFileInfo originalInfo(original);
+		if (targetInfo.exists())
+		{
+			// a clone or copy is never older than its object, and a hard link is the object.
+			// An older one was placed before the object got replaced, by a repair.
+			if (targetInfo.size() == object.size &&
+				(!index.isVirtual || !originalInfo.exists() ||
+				 targetInfo.lastModified() >= originalInfo.lastModified()))
+			{
+				result.placed++;
+				continue;
+			}
+			// from an older version of the index, or of the object
+			QFile::remove(target);
+		}
+		if (!originalInfo.exists())
+		{
+			if (packs && packs->size(object.hash) == object.size &&
+				packs->extract(object.hash, target))
+			{
+				result.placed++;
+			}
+			else
+			{
+				result.missing++;
+			}
+			continue;
+		}
+
+		QString targetDir = targetInfo.absolutePath();
+		if (!knownDirs.contains(targetDir))
+		{
+			QDir().mkpath(targetDir);
+			knownDirs.insert(targetDir);
+		}
+
+		bool done = false;
+		if (tryClone)
+		{
+			done = FS::cloneFile(original, target);
+			tryClone = done;
+		}
+		if (!done && tryLink)
+		{
+			done = FS::hardLink(original, target);
+			tryLink = done;
+		}
+		if (!done)
+		{
+			done = QFile::copy(original, target);
+		}
+		if (done)
+		{
+			result.placed++;
+		}
+		else
+		{
+			qWarning() << "Couldn't place" << original << "at" << target;
+			result.failed++;
+		}
+	}
+	QMetaObject::invokeMethod(task, "setProgress", Qt::QueuedConnection, Q_ARG(qint64, total),
+							  Q_ARG(qint64, total));
+
+	// only a complete folder gets skipped next time. Missing objects may still show up.
+	if (result.missing == 0 && result.failed == 0)
+	{
+		try
+		{
+			FS::write(stampPath, stampFor(indexInfo));
+		}
+		catch (FS::FileSystemException &)
+		{
+			// it will be checked again next time, that's all
+		}
+	}
+	return result;
+}
+
+void ReconstructAssetsTask::reconstructFinished()
+{
+	m_result = m_watcher.result();
+	if (m_result.cancelled)
+	{
+		emitAborted();
+		return;
+	}
+	if (!m_result.error.isEmpty())
+	{
+		emitFailed(m_result.error);
+		return;
+	}
+	if (m_result.missing || m_result.failed)
+	{
+		qWarning() << "Virtual assets for" << m_assetsId << "are incomplete:" << m_result.missing
+				   << "objects missing," << m_result.failed << "couldn't be placed";
+	}
+	emitSucceeded();
+}
@@ -0,0 +1,91 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "tasks/Task.h"
+
+#include <QFutureWatcher>
+#include <atomic>
+#include <memory>
+
+/**
+ * Fills the virtual assets folder of a legacy ("virtual": true) asset index from the objects.
+ *
+ * Objects are cloned where the file system can do that, hard linked where it can't, and copied
+ * when neither works. When everything is in place, a stamp with the size and modification time
+ * of the index goes into the folder. As long as it matches, later runs are done right away.
+ * Whatever replaces objects has to call invalidate(), the folders may still hold the old ones.
+ *
+ * Objects that are only in the asset packs are extracted instead. With packs, the objects of
+ * other indexes are extracted into the loose objects folder the same way, with their stamp
+ * next to them.
+ */
+class ReconstructAssetsTask : public Task
+{
+	Q_OBJECT
+public:
+	explicit ReconstructAssetsTask(QString assetsId, QString assetsDir = "assets/",
+								   QObject *parent = 0);
+	virtual ~ReconstructAssetsTask();
+
+	/// the folder this fills, whether it exists yet or not
+	static QString virtualRoot(QString assetsId, QString assetsDir = "assets/");
+
+	/// forget that any folder is complete, so the next run checks every object again
+	static void invalidate(QString assetsDir = "assets/");
+
+	virtual bool canAbort() const
+	{
+		return true;
+	}
+	virtual bool abort();
+
+	/// objects that were placed by the last run, and the ones that couldn't be
+	int placed() const
+	{
+		return m_result.placed;
+	}
+	int incomplete() const
+	{
+		return m_result.missing + m_result.failed;
+	}
+
+protected:
+	virtual void executeTask();
+
+private
+slots:
+	void reconstructFinished();
+
+private:
+	struct Result
+	{
+		QString error;
+		bool cancelled = false;
+		int placed = 0;
+		int missing = 0;
+		int failed = 0;
+	};
+	static Result reconstruct(QString assetsId, QString assetsDir,
+							  std::shared_ptr<std::atomic<bool>> cancel, ReconstructAssetsTask *task);
+
+private:
+	QString m_assetsId;
+	QString m_assetsDir;
+	std::shared_ptr<std::atomic<bool>> m_cancel;
+	QFutureWatcher<Result> m_watcher;
+	Result m_result;
+};
@@ -0,0 +1,260 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "VerifyAssetsTask.h"
+#include "Env.h"
+#include "AssetPackStore.h"
+#include "ReconstructAssetsTask.h"
+#include <pathutils.h>
+
+#include <QtConcurrentRun>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QFileInfo>
+#include <QFile>
+#include <QSet>
+#include <QDebug>
+#include <vector>
+
+namespace
+{
+/// how much of an object is read at a time
+const qint64 READ_CHUNK = 256 * 1024;
+/// progress goes out once for this many objects
+const int PROGRESS_STEP = 64;
+}
+
+VerifyAssetsTask::VerifyAssetsTask(QString assetsId, bool repair, QString assetsDir,
+								   QObject *parent)
+	: Task(parent), m_assetsId(assetsId), m_repair(repair), m_assetsDir(assetsDir)
+{
+	connect(&m_watcher, SIGNAL(finished()), SLOT(verifyFinished()));
+}
+
+VerifyAssetsTask::VerifyAssetsTask(QVector<AssetObject> objects, bool repair, QString assetsDir,
+								   QObject *parent)
+	: Task(parent), m_objects(objects), m_repair(repair), m_assetsDir(assetsDir)
+{
+	connect(&m_watcher, SIGNAL(finished()), SLOT(verifyFinished()));
+}
+
+VerifyAssetsTask::~VerifyAssetsTask()
+{
+	// the worker reports to this task, it has to be done before the task goes away
+	if (m_cancel)
+		*m_cancel = true;
+	m_watcher.waitForFinished();
+}
+
+bool VerifyAssetsTask::verifyObject(const QString &path, const AssetObject &object,
+									qint64 *bytesRead)
+{
+	QFile file(path);
+	if (file.size() != object.size || !file.open(QIODevice::ReadOnly))
+		return false;
+	QCryptographicHash sha1(QCryptographicHash::Sha1);
+	QByteArray buffer(int(qMin(READ_CHUNK, qMax(object.size, qint64(1)))), Qt::Uninitialized);
+	qint64 total = 0;
+	for (;;)
+	{
+		qint64 read = file.read(buffer.data(), buffer.size());
+		if (read < 0)
+			return false;
+		if (read == 0)
+			break;
+		sha1.addData(buffer.constData(), int(read));
+		total += read;
+	}
+	if (bytesRead)
+		*bytesRead += total;
+	return total == object.size &&
+		   sha1.result().toHex() == object.hash.toLatin1().toLower();
+}
+
+void VerifyAssetsTask::executeTask()
+{
+	if (!m_assetsId.isEmpty())
+	{
+		QString indexPath = PathCombine(m_assetsDir, "indexes", m_assetsId + ".json");
+		AssetsIndex index;
+		if (!AssetsUtils::loadAssetsIndexJson(indexPath, &index))
+		{
+			emitFailed(tr("Failed to read the assets index %1").arg(indexPath));
+			return;
+		}
+		m_objects = index.objects;
+	}
+
+	setStatus(tr("Verifying the assets files..."));
+	m_cancel = std::make_shared<std::atomic<bool>>(false);
+	auto cancel = m_cancel;
+	auto objects = m_objects;
+	QString objectDir = PathCombine(m_assetsDir, "objects");
+	m_watcher.setFuture(QtConcurrent::run(ENV.workerPool().get(), [=]()
+	{
+		return verify(objects, objectDir, cancel, this);
+	}));
+}
+
+bool VerifyAssetsTask::abort()
+{
+	if (!isRunning())
+		return false;
+	if (m_repairTask && m_repairTask->isRunning())
+	{
+		m_repairTask->abort();
+		emitAborted();
+		return true;
+	}
+	// the worker notices between two objects, aborted() goes out when it is done
+	if (m_cancel)
+		*m_cancel = true;
+	return true;
+}
+
+VerifyAssetsTask::Result VerifyAssetsTask::verify(QVector<AssetObject> objects,
+												  QString objectDir,
+												  std::shared_ptr<std::atomic<bool>> cancel,
+												  VerifyAssetsTask *task)
+{
+	Result result;
+	QElapsedTimer timer;
+	timer.start();
+
+	// several paths can share one object
+	QVector<AssetObject> unique;
+	{
+		QSet<QString> seen;
+		for (auto &object : objects)
+		{
+			if (seen.contains(object.hash))
+				continue;
+			seen.insert(object.hash);
+			unique.append(object);
+		}
+	}
+
+	// every thread takes the next object until there are none left
+	auto packs = ENV.assetPacks();
+	const int total = unique.size();
+	std::vector<char> bad(total, 0);
+	std::atomic<int> next(0);
+	std::atomic<int> done(0);
+	std::atomic<qint64> bytes(0);
+	auto work = [&]()
+	{
+		qint64 read = 0;
+		for (int i = next++; i < total && !*cancel; i = next++)
+		{
+			const AssetObject &object = unique[i];
+			QString path = PathCombine(objectDir, object.hash.left(2), object.hash);
+			// loose objects come first, like everywhere else
+			if (packs && packs->size(object.hash) == object.size && !QFile::exists(path))
+			{
+				bad[i] = !packs->verify(object.hash);
+				read += object.size;
+			}
+			else
+			{
+				bad[i] = !verifyObject(path, object, &read);
+			}
+			int finished = ++done;
+			if (finished % PROGRESS_STEP == 0)
+			{
+				QMetaObject::invokeMethod(task, "setProgress", Qt::QueuedConnection,
+										  Q_ARG(qint64, finished), Q_ARG(qint64, total));
+			}
+		}
+		bytes += read;
+	};
+
+	// this thread helps, so it waits for no one but the helpers
+	QList<QFuture<void>> helpers;
+	auto pool = ENV.workerPool();
+	int threads = qMin(pool->maxThreadCount(), total);
+	for (int i = 1; i < threads; i++)
+	{
+		helpers.append(QtConcurrent::run(pool.get(), work));
+	}
+	work();
+	for (auto &helper : helpers)
+	{
+		helper.waitForFinished();
+	}
+
+	if (*cancel)
+	{
+		result.cancelled = true;
+		return result;
+	}
+	for (int i = 0; i < total; i++)
+	{
+		if (bad[i])
+			result.bad.append(unique[i]);
+	}
+	result.report.checked = total;
+	result.report.bad = result.bad.size();
+	result.report.bytes = bytes;
+	result.report.msecs = timer.elapsed();
+	return result;
+}
+
+void VerifyAssetsTask::verifyFinished()
+{
+	Result result = m_watcher.result();
+	if (result.cancelled || *m_cancel)
+	{
+		emitAborted();
+		return;
+	}
+	m_report = result.report;
+	m_bad = result.bad;
+	qDebug() << "Verified" << m_report.checked << "asset objects," << m_report.bytes << "bytes in"
+			 << m_report.msecs << "ms (" << m_report.throughput() << "MiB/s )," << m_report.bad
+			 << "bad";
+	setProgress(m_report.checked, m_report.checked);
+
+	if (!m_repair || m_bad.isEmpty())
+	{
+		emitSucceeded();
+		return;
+	}
+
+	// the bad objects may have been placed in the virtual folders already
+	ReconstructAssetsTask::invalidate(m_assetsDir);
+	QString objectDir = PathCombine(m_assetsDir, "objects");
+	auto packs = ENV.assetPacks();
+	for (auto &object : m_bad)
+	{
+		// if the download fails, a bad file of the right size would pass for a good one later
+		QString path = PathCombine(objectDir, object.hash.left(2), object.hash);
+		if (QFile::exists(path) && !QFile::remove(path))
+			qWarning() << "Couldn't remove bad asset object" << path;
+		if (packs && packs->contains(object.hash) && !packs->verify(object.hash))
+			packs->forget(object.hash);
+	}
+	m_repairTask = std::make_shared<AssetDownloadTask>(m_bad, objectDir);
+	connect(m_repairTask.get(), &Task::succeeded, this, &VerifyAssetsTask::emitSucceeded);
+	connect(m_repairTask.get(), &Task::failed, this, &VerifyAssetsTask::repairFailed);
+	connect(m_repairTask.get(), &Task::progress, this, &Task::progress);
+	connect(m_repairTask.get(), &Task::status, this, &Task::setStatus);
+	m_repairTask->start();
+}
+
+void VerifyAssetsTask::repairFailed(QString reason)
+{
+	emitFailed(tr("Failed to download assets:\n%1").arg(reason));
+}
@@ -0,0 +1,107 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "tasks/Task.h"
+#include "AssetDownloadTask.h"
+
+#include <QFutureWatcher>
+#include <atomic>
+#include <memory>
+
+/**
+ * Checks asset objects against the SHA-1 they are named after.
+ *
+ * The objects are read in chunks and hashed on all threads of the worker pool. Missing objects
+ * and objects of the wrong size are bad without being read. Objects that are only in the asset
+ * packs are checked there. In repair mode, the bad objects are removed (or forgotten by the
+ * packs) and downloaded again, and nothing else is.
+ */
+class VerifyAssetsTask : public Task
+{
+	Q_OBJECT
+public:
+	struct Report
+	{
+		int checked = 0;
+		int bad = 0;
+		/// read and hashed
+		qint64 bytes = 0;
+		qint64 msecs = 0;
+
+		/// MiB/s of hashing, for the log
+		double throughput() const
+		{
+			return msecs ? bytes / (1024.0 * 1024.0) / (msecs / 1000.0) : 0;
+		}
+	};
+
+	/// all objects of the index for the given assets ID
+	explicit VerifyAssetsTask(QString assetsId, bool repair, QString assetsDir = "assets/",
+							  QObject *parent = 0);
+	/// just the given objects
+	explicit VerifyAssetsTask(QVector<AssetObject> objects, bool repair,
+							  QString assetsDir = "assets/", QObject *parent = 0);
+	virtual ~VerifyAssetsTask();
+
+	/// true if the object at path is there and has the contents its hash says
+	static bool verifyObject(const QString &path, const AssetObject &object, qint64 *bytesRead);
+
+	const Report &report() const
+	{
+		return m_report;
+	}
+	/// what was found to be bad, in repair mode also what was downloaded again
+	const QVector<AssetObject> &badObjects() const
+	{
+		return m_bad;
+	}
+
+	virtual bool canAbort() const
+	{
+		return true;
+	}
+	virtual bool abort();
+
+protected:
+	virtual void executeTask();
+
+private
+slots:
+	void verifyFinished();
+	void repairFailed(QString reason);
+
+private:
+	struct Result
+	{
+		QVector<AssetObject> bad;
+		Report report;
+		bool cancelled = false;
+	};
+	static Result verify(QVector<AssetObject> objects, QString objectDir,
+						 std::shared_ptr<std::atomic<bool>> cancel, VerifyAssetsTask *task);
+
+private:
+	QString m_assetsId;
+	QVector<AssetObject> m_objects;
+	bool m_repair = false;
+	QString m_assetsDir;
+	std::shared_ptr<std::atomic<bool>> m_cancel;
+	QFutureWatcher<Result> m_watcher;
+	std::shared_ptr<AssetDownloadTask> m_repairTask;
+	Report m_report;
+	QVector<AssetObject> m_bad;
+};
@@ -0,0 +1,120 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BlobStore.h"
+#include "FileSystem.h"
+#include <pathutils.h>
+
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QDebug>
+
+BlobStore::BlobStore(QString root) : m_root(root)
+{
+}
+
+QString BlobStore::blobPath(const QString &md5sum) const
+{
+	return PathCombine(m_root, md5sum.left(2), md5sum);
+}
+
+bool BlobStore::adopt(const QString &path, const QString &md5sum)
+{
+	if (md5sum.size() != 32)
+		return false;
+	QString blob = blobPath(md5sum);
+	if (!QFileInfo(blob).isFile())
+	{
+		// first file with this content. it becomes the blob.
+		if (!ensureFilePathExists(blob))
+			return false;
+		return FS::hardLink(path, blob);
+	}
+
+	// a link to the blob already
+	if (FS::sameFile(path, blob))
+		return true;
+	// don't take the md5sum's word for it
+	if (QFileInfo(blob).size() != QFileInfo(path).size() || !sameContents(path, blob))
+	{
+		qWarning() << "Blob" << blob << "does not match" << path << ", not sharing it";
+		return false;
+	}
+	// a hard link, so the link count of the blob says whether it is still used
+	QString temp = path + ".blob";
+	QFile::remove(temp);
+	if (!FS::hardLink(blob, temp))
+		return false;
+	if (!FS::replaceFile(temp, path))
+	{
+		qWarning() << "Could not replace" << path << "with a link to" << blob;
+		QFile::remove(temp);
+		return false;
+	}
+	return true;
+}
+
+bool BlobStore::canAdoptQuickly(const QString &path, const QString &md5sum) const
+{
+	if (md5sum.size() != 32)
+		return true;
+	QString blob = blobPath(md5sum);
+	return !QFileInfo(blob).isFile() || FS::sameFile(path, blob);
+}
+
+BlobStore::Collection BlobStore::collect(bool dryRun) const
+{
+	Collection result;
+	QDirIterator blobs(m_root, QDir::Files, QDirIterator::Subdirectories);
+	while (blobs.hasNext())
+	{
+		QFileInfo blob(blobs.next());
+		// 0 means the count is unknown, that doesn't make it unused
+		if (FS::linkCount(blob.filePath()) != 1)
+			continue;
+		qint64 size = blob.size();
+		if (!dryRun && !QFile::remove(blob.filePath()))
+		{
+			qWarning() << "Could not remove unused blob" << blob.filePath();
+			continue;
+		}
+		result.blobs++;
+		result.bytes += size;
+	}
+	return result;
+}
+
+bool BlobStore::cloneOrCopy(const QString &source, const QString &target)
+{
+	if (FS::cloneFile(source, target))
+		return true;
+	return QFile::copy(source, target);
+}
+
+bool BlobStore::sameContents(const QString &a, const QString &b)
+{
+	QFile fileA(a);
+	QFile fileB(b);
+	if (!fileA.open(QIODevice::ReadOnly) || !fileB.open(QIODevice::ReadOnly))
+		return false;
+	const qint64 chunkSize = 64 * 1024;
+	while (!fileA.atEnd())
+	{
+		if (fileA.read(chunkSize) != fileB.read(chunkSize))
+			return false;
+	}
+	return fileB.atEnd();
+}
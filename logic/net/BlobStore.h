@@ -0,0 +1,68 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <QString>
+
+/**
+ * Content-addressed storage for the files of the HTTP meta cache.
+ *
+ * Every distinct file is kept once, as '<root>/<first two digits of the md5>/<md5>'.
+ * The files in the cache bases are hard links to those blobs, so identical data fetched
+ * through different URLs takes up space once. A blob that has no other links left is not used
+ * by anything and can be collected.
+ *
+ * Files sharing data with the store must only ever be replaced, never written in place. That
+ * is why nothing outside the cache gets a link: instances get clones or copies.
+ */
+class BlobStore
+{
+public:
+	struct Collection
+	{
+		int blobs = 0;
+		qint64 bytes = 0;
+	};
+
+	explicit BlobStore(QString root);
+
+	QString root() const
+	{
+		return m_root;
+	}
+	QString blobPath(const QString &md5sum) const;
+
+	/// make the file at 'path' share its data with the blob for 'md5sum'.
+	/// The file becomes the blob if there is none yet. Thread safe.
+	bool adopt(const QString &path, const QString &md5sum);
+
+	/// adopt() wouldn't have to read any file: there is no blob yet, or 'path' is linked to it
+	/// already. Otherwise both files are compared, which is better done on a worker thread.
+	bool canAdoptQuickly(const QString &path, const QString &md5sum) const;
+
+	/// remove the blobs nothing links to any more. With 'dryRun', only count them.
+	Collection collect(bool dryRun = false) const;
+
+	/// create 'target' with the data of 'source': a copy-on-write clone if the file system
+	/// can do it, a plain copy otherwise. Changing one never changes the other.
+	static bool cloneOrCopy(const QString &source, const QString &target);
+
+private:
+	static bool sameContents(const QString &a, const QString &b);
+
+private:
+	QString m_root;
+};
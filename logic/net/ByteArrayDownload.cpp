@@ -25,6 +25,7 @@ ByteArrayDownload::ByteArrayDownload(QUrl url) : NetAction()
 
 void ByteArrayDownload::start()
 {
+	m_status = Job_InProgress;
 	qDebug() << "Downloading " << m_url.toString();
 	QNetworkRequest request(m_url);
 	request.setHeader(QNetworkRequest::UserAgentHeader, "MultiMC/5.0 (Uncached)");
@@ -32,6 +33,7 @@ void ByteArrayDownload::start()
 	QNetworkReply *rep = worker->get(request);
 
 	m_reply.reset(rep);
+	trackReply(rep);
 	connect(rep, SIGNAL(downloadProgress(qint64, qint64)),
 			SLOT(downloadProgress(qint64, qint64)));
 	connect(rep, SIGNAL(finished()), SLOT(downloadFinished()));
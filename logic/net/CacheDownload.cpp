@@ -21,6 +21,8 @@
 #include <QDateTime>
 #include <QDebug>
 #include "Env.h"
+#include "NetScheduler.h"
+#include "FileSystem.h"
 
 CacheDownload::CacheDownload(QUrl url, MetaEntryPtr entry)
 	: NetAction(), md5sum(QCryptographicHash::Md5)
@@ -28,7 +30,12 @@ CacheDownload::CacheDownload(QUrl url, MetaEntryPtr entry)
 	m_url = url;
 	m_entry = entry;
 	m_target_path = entry->getFullPath();
+	m_partial_path = m_target_path + ".part";
 	m_status = Job_NotStarted;
+	// the new version is most likely about as big as the old one
+	QFileInfo current(m_target_path);
+	if (current.isFile())
+		m_size_hint = current.size();
 }
 
 void CacheDownload::start()
@@ -40,10 +47,10 @@ void CacheDownload::start()
 		emit succeeded(m_index_within_job);
 		return;
 	}
-	// create a new save file
-	m_output_file.reset(new QSaveFile(m_target_path));
+	wroteAnyData = false;
+	m_response_checked = false;
+	m_write_body = false;
 
-	// if there already is a file and md5 checking is in effect and it can be opened
 	if (!ensureFilePathExists(m_target_path))
 	{
 		qCritical() << "Could not create folder for " + m_target_path;
@@ -51,25 +58,41 @@ void CacheDownload::start()
 		emit failed(m_index_within_job);
 		return;
 	}
-	if (!m_output_file->open(QIODevice::WriteOnly))
+
+	// continue a previous attempt if we can
+	if (!m_resume.begin(m_partial_path))
+		md5sum.reset();
+
+	m_output_file.setFileName(m_partial_path);
+	auto mode = m_resume.offset ? (QIODevice::WriteOnly | QIODevice::Append)
+								: (QIODevice::WriteOnly | QIODevice::Truncate);
+	if (!m_output_file.open(mode))
 	{
-		qCritical() << "Could not open " + m_target_path + " for writing";
+		qCritical() << "Could not open " + m_partial_path + " for writing";
 		m_status = Job_Failed;
 		emit failed(m_index_within_job);
 		return;
 	}
-	qDebug() << "Downloading " << m_url.toString();
 	QNetworkRequest request(m_url);
 
-	// check file consistency first.
-	QFile current(m_target_path);
-	if(current.exists() && current.size() != 0)
+	if (m_resume.offset)
 	{
-		if (m_entry->remote_changed_timestamp.size())
-			request.setRawHeader(QString("If-Modified-Since").toLatin1(),
-								m_entry->remote_changed_timestamp.toLatin1());
-		if (m_entry->etag.size())
-			request.setRawHeader(QString("If-None-Match").toLatin1(), m_entry->etag.toLatin1());
+		qDebug() << "Resuming " << m_url.toString() << " at byte " << m_resume.offset;
+		m_resume.prepare(request);
+	}
+	else
+	{
+		qDebug() << "Downloading " << m_url.toString();
+		// check file consistency first.
+		QFile current(m_target_path);
+		if(current.exists() && current.size() != 0)
+		{
+			if (m_entry->remote_changed_timestamp.size())
+				request.setRawHeader(QString("If-Modified-Since").toLatin1(),
+									m_entry->remote_changed_timestamp.toLatin1());
+			if (m_entry->etag.size())
+				request.setRawHeader(QString("If-None-Match").toLatin1(), m_entry->etag.toLatin1());
+		}
 	}
 
 	request.setHeader(QNetworkRequest::UserAgentHeader, "MultiMC/5.0 (Cached)");
@@ -78,6 +101,7 @@ void CacheDownload::start()
 	QNetworkReply *rep = worker->get(request);
 
 	m_reply.reset(rep);
+	trackReply(rep);
 	connect(rep, SIGNAL(downloadProgress(qint64, qint64)),
 			SLOT(downloadProgress(qint64, qint64)));
 	connect(rep, SIGNAL(finished()), SLOT(downloadFinished()));
@@ -86,8 +110,34 @@ void CacheDownload::start()
 	connect(rep, SIGNAL(readyRead()), SLOT(downloadReadyRead()));
 }
 
+bool CacheDownload::checkResponse()
+{
+	m_response_checked = true;
+	auto response = m_resume.check(m_reply.get());
+	m_write_body = response == DownloadResume::Continue || response == DownloadResume::Restart;
+	if (response == DownloadResume::Restart)
+	{
+		m_output_file.resize(0);
+		m_output_file.seek(0);
+		md5sum.reset();
+	}
+	return response != DownloadResume::BadRange;
+}
+
+void CacheDownload::discardPartial()
+{
+	m_output_file.close();
+	m_output_file.remove();
+	m_resume.reset();
+	md5sum.reset();
+}
+
 void CacheDownload::downloadProgress(qint64 bytesReceived, qint64 bytesTotal)
 {
+	// a resumed download only reports the remaining part
+	if (bytesTotal >= 0)
+		bytesTotal += m_resume.offset;
+	bytesReceived += m_resume.offset;
 	m_total_progress = bytesTotal;
 	m_progress = bytesReceived;
 	emit netActionProgress(m_index_within_job, bytesReceived, bytesTotal);
@@ -101,6 +151,9 @@ void CacheDownload::downloadError(QNetworkReply::NetworkError error)
 }
 void CacheDownload::downloadFinished()
 {
+	// whatever the bandwidth limit held back is still in the reply
+	if (m_reply->bytesAvailable())
+		downloadReadyRead();
 	QVariant redirect = m_reply->header(QNetworkRequest::LocationHeader);
 	QString redirectURL;
 	if(redirect.isValid())
@@ -118,6 +171,7 @@ void CacheDownload::downloadFinished()
 	{
 		m_url = QUrl(redirect.toString());
 		qDebug() << "Following redirect to " << m_url.toString();
+		m_output_file.close();
 		start();
 		return;
 	}
@@ -125,25 +179,35 @@ void CacheDownload::downloadFinished()
 	// if the download succeeded
 	if (m_status == Job_Failed)
 	{
-		m_output_file->cancelWriting();
+		int status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+		// keep the partial file for the next attempt, unless it can't be continued
+		if (m_aborted || !m_resume.canContinue(status))
+		{
+			discardPartial();
+		}
+		else
+		{
+			qDebug() << "Keeping " << m_resume.size << " bytes of " << m_url.toString();
+			m_output_file.close();
+		}
 		m_reply.reset();
 		emit failed(m_index_within_job);
 		return;
 	}
 
-	// if we wrote any data to the save file, we try to commit the data to the real file.
+	m_output_file.close();
+	// if we wrote any data to the partial file, it replaces the real file.
 	if (wroteAnyData)
 	{
-		// nothing went wrong...
-		if (m_output_file->commit())
+		if (FS::replaceFile(m_partial_path, m_target_path))
 		{
 			m_status = Job_Finished;
 			m_entry->md5sum = md5sum.result().toHex().constData();
 		}
 		else
 		{
-			qCritical() << "Failed to commit changes to " << m_target_path;
-			m_output_file->cancelWriting();
+			qCritical() << "Failed to move downloaded data to " << m_target_path;
+			discardPartial();
 			m_reply.reset();
 			m_status = Job_Failed;
 			emit failed(m_index_within_job);
@@ -152,11 +216,13 @@ void CacheDownload::downloadFinished()
 	}
 	else
 	{
+		m_output_file.remove();
 		m_status = Job_Finished;
 	}
 
-	// then get rid of the save file
-	m_output_file.reset();
+	// the partial data now lives in the real file (or wasn't needed)
+	m_resume.reset();
+	md5sum.reset();
 
 	QFileInfo output_file_info(m_target_path);
 
@@ -177,14 +243,38 @@ void CacheDownload::downloadFinished()
 
 void CacheDownload::downloadReadyRead()
 {
-	QByteArray ba = m_reply->readAll();
-	md5sum.addData(ba);
-	if (m_output_file->write(ba) != ba.size())
+	if (!m_response_checked && !checkResponse())
 	{
-		qCritical() << "Failed writing into " + m_target_path;
 		m_status = Job_Failed;
+		discardPartial();
 		m_reply->abort();
-		emit failed(m_index_within_job);
+		return;
+	}
+	QByteArray ba = ENV.netScheduler()->read(this, m_reply.get());
+	// error pages and redirects are not what we came for
+	if (!m_write_body || m_status == Job_Failed)
+		return;
+	if (m_output_file.write(ba) != ba.size())
+	{
+		qCritical() << "Failed writing into " + m_partial_path;
+		m_status = Job_Failed;
+		discardPartial();
+		m_reply->abort();
+		return;
 	}
+	md5sum.addData(ba);
+	m_resume.size += ba.size();
 	wroteAnyData = true;
 }
+
+QString CacheDownload::coalescingKey() const
+{
+	return QFileInfo(m_target_path).absoluteFilePath();
+}
+
+void CacheDownload::takeResultFrom(NetActionPtr other)
+{
+	// the other download put the file in place and updated the cache
+	ENV.metacache()->syncEntry(m_entry);
+	NetAction::takeResultFrom(other);
+}
@@ -17,8 +17,9 @@
 
 #include "NetAction.h"
 #include "HttpMetaCache.h"
+#include "DownloadResume.h"
 #include <QCryptographicHash>
-#include <QSaveFile>
+#include <QFile>
 
 class INetworkValidator
 {
@@ -51,15 +52,24 @@ private:
 	MetaEntryPtr m_entry;
 	/// if saving to file, use the one specified in this string
 	QString m_target_path;
+	/// data is downloaded into this file and moved over the target when complete
+	QString m_partial_path;
 	/// this is the output file, if any
-	std::shared_ptr<QSaveFile> m_output_file;
-	/// the hash-as-you-download
+	QFile m_output_file;
+	/// the hash-as-you-download. It covers everything in the partial file, across retries.
 	QCryptographicHash md5sum;
 
 	INetworkValidator *m_validator = nullptr;
 
 	bool wroteAnyData = false;
 
+	/// the partial file, all of it hashed by md5sum
+	DownloadResume m_resume;
+	/// the reply has been checked for status and ranges
+	bool m_response_checked = false;
+	/// the body of the reply is the file we want (not an error page or a redirect)
+	bool m_write_body = false;
+
 public:
 	explicit CacheDownload(QUrl url, MetaEntryPtr entry);
 	static CacheDownloadPtr make(QUrl url, MetaEntryPtr entry)
@@ -75,6 +85,8 @@ public:
 	{
 		m_validator = validator;
 	}
+	virtual QString coalescingKey() const;
+	virtual void takeResultFrom(NetActionPtr other);
 protected
 slots:
 	virtual void downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
@@ -85,4 +97,8 @@ slots:
 public
 slots:
 	virtual void start();
+
+private:
+	bool checkResponse();
+	void discardPartial();
 };
@@ -0,0 +1,310 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CacheGCTask.h"
+#include "Env.h"
+#include "HttpMetaCache.h"
+#include "BlobStore.h"
+#include "FileSystem.h"
+#include "InstanceList.h"
+#include "minecraft/OneSixInstance.h"
+#include "minecraft/MinecraftProfile.h"
+#include "minecraft/OneSixLibrary.h"
+#include "minecraft/AssetsUtils.h"
+#include <pathutils.h>
+
+#include <QtConcurrentRun>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QFile>
+#include <QDebug>
+#include <algorithm>
+
+CacheGCTask::CacheGCTask(std::shared_ptr<InstanceList> instances, bool dryRun, QObject *parent)
+	: Task(parent), m_instances(instances), m_dryRun(dryRun)
+{
+	connect(&m_watcher, SIGNAL(finished()), SLOT(collectFinished()));
+}
+
+CacheGCTask::~CacheGCTask()
+{
+	// the worker reports to this task, it has to be done before the task goes away
+	m_watcher.waitForFinished();
+}
+
+void CacheGCTask::pinInstances()
+{
+	m_pinned.clear();
+	m_pinnedFolders.clear();
+	if (!m_instances)
+		return;
+	for (int i = 0; i < m_instances->count(); i++)
+	{
+		auto instance = m_instances->at(i);
+		m_pinnedFolders.insert("versions/" + instance->intendedVersionId() + "/");
+
+		auto onesix = std::dynamic_pointer_cast<OneSixInstance>(instance);
+		if (!onesix)
+			continue;
+		auto profile = onesix->getLoadedProfile();
+		if (!profile || !profile->rowCount())
+			continue;
+		auto libs = profile->getActiveNativeLibs();
+		libs.append(profile->getActiveNormalLibs());
+		for (auto lib : libs)
+		{
+			QString storage = lib->storageSuffix();
+			if (storage.contains("${arch}"))
+			{
+				QString cooked = storage;
+				m_pinned.insert("libraries/" + cooked.replace("${arch}", "32"));
+				cooked = storage;
+				m_pinned.insert("libraries/" + cooked.replace("${arch}", "64"));
+			}
+			else
+			{
+				m_pinned.insert("libraries/" + storage);
+			}
+		}
+		if (!profile->assets.isEmpty())
+			m_pinned.insert("asset_indexes/" + profile->assets + ".json");
+	}
+}
+
+void CacheGCTask::executeTask()
+{
+	setStatus(tr("Looking for old files in the cache..."));
+	pinInstances();
+	m_pinned += m_kept;
+
+	auto metacache = ENV.metacache();
+	QList<Base> bases;
+	for (auto name : metacache->bases())
+	{
+		Base base;
+		base.name = name;
+		base.quota = metacache->baseQuota(name);
+		if (base.quota <= 0)
+			continue;
+		for (auto entry : metacache->getEntries(name))
+		{
+			Item item;
+			item.base = name;
+			item.path = entry->path;
+			item.fullPath = PathCombine(metacache->getBasePath(name), entry->path);
+			// entries from before access tracking count as accessed when they changed last
+			item.lastAccess = qMax(entry->last_access_timestamp, entry->local_changed_timestamp);
+			QString key = name + "/" + entry->path;
+			item.pinned = m_pinned.contains(key);
+			for (auto &folder : m_pinnedFolders)
+			{
+				if (key.startsWith(folder))
+				{
+					item.pinned = true;
+					break;
+				}
+			}
+			base.items.append(item);
+		}
+		bases.append(base);
+	}
+
+	Assets assets;
+	assets.indexes = metacache->getBasePath("asset_indexes");
+	assets.objects = metacache->getBasePath("asset_objects");
+	assets.quota = metacache->baseQuota("asset_objects");
+	assets.startTime = QDateTime::currentMSecsSinceEpoch();
+	auto blobs = metacache->blobStore();
+	bool dryRun = m_dryRun;
+	m_watcher.setFuture(QtConcurrent::run([=]()
+	{
+		return collect(bases, assets, blobs, dryRun, this);
+	}));
+}
+
+CacheGCTask::Result CacheGCTask::collect(QList<Base> bases, Assets assets,
+										 std::shared_ptr<BlobStore> blobs, bool dryRun,
+										 CacheGCTask *task)
+{
+	Result result;
+	qint64 total = 0;
+	for (auto &base : bases)
+	{
+		total += base.items.size();
+	}
+	qint64 done = 0;
+	QSet<QString> removedIndexes;
+
+	for (auto &base : bases)
+	{
+		qint64 used = 0;
+		for (auto &item : base.items)
+		{
+			item.size = QFileInfo(item.fullPath).size();
+			item.links = FS::linkCount(item.fullPath);
+			used += item.size;
+			QMetaObject::invokeMethod(task, "setProgress", Qt::QueuedConnection,
+									  Q_ARG(qint64, ++done), Q_ARG(qint64, total));
+		}
+		if (used <= base.quota)
+			continue;
+		std::sort(base.items.begin(), base.items.end(), [](const Item &a, const Item &b)
+		{
+			return a.lastAccess < b.lastAccess;
+		});
+		for (auto &item : base.items)
+		{
+			if (used <= base.quota)
+				break;
+			if (item.pinned)
+				continue;
+			if (!dryRun && QFile::exists(item.fullPath) && !QFile::remove(item.fullPath))
+			{
+				qWarning() << "Could not remove" << item.fullPath << "from the cache";
+				continue;
+			}
+			used -= item.size;
+			result.evicted.append(item);
+			result.report.files.append(item.fullPath);
+			if (item.links <= 1)
+				result.report.bytes += item.size;
+			if (base.name == "asset_indexes")
+			{
+				removedIndexes.insert(QFileInfo(item.fullPath).absoluteFilePath());
+				if (!dryRun)
+					QFile::remove(AssetsUtils::assetsIndexSidecar(item.fullPath));
+			}
+		}
+	}
+
+	sweepAssetObjects(assets, removedIndexes, dryRun, result.report);
+
+	// whatever the evictions left without links. A dry run can't see those, only older ones.
+	if (blobs)
+	{
+		auto collection = blobs->collect(dryRun);
+		result.report.blobs = collection.blobs;
+		result.report.blobBytes = collection.bytes;
+	}
+	return result;
+}
+
+void CacheGCTask::sweepAssetObjects(const Assets &assets, const QSet<QString> &removedIndexes,
+									bool dryRun, Report &report)
+{
+	if (assets.quota <= 0)
+		return;
+	// an update may be getting a new index and its objects right now
+	if (ENV.assetsHeld())
+	{
+		qDebug() << "Asset objects are in use, not collecting them";
+		return;
+	}
+
+	// objects are only known through the indexes. if any index can't be read, keep everything.
+	QSet<QString> referenced;
+	bool indexesRead = false;
+	QDirIterator indexes(assets.indexes, QStringList() << "*.json", QDir::Files);
+	while (indexes.hasNext())
+	{
+		QString indexPath = QFileInfo(indexes.next()).absoluteFilePath();
+		if (removedIndexes.contains(indexPath))
+			continue;
+		AssetsIndex index;
+		if (!AssetsUtils::loadAssetsIndexJson(indexPath, &index))
+		{
+			qWarning() << "Could not read asset index" << indexPath << ", keeping all asset objects";
+			return;
+		}
+		for (auto &object : index.objects)
+		{
+			referenced.insert(object.hash);
+		}
+		indexesRead = true;
+	}
+	if (!indexesRead)
+		return;
+
+	struct Candidate
+	{
+		QString path;
+		qint64 size;
+		qint64 modified;
+	};
+	QList<Candidate> candidates;
+	qint64 used = 0;
+	QDirIterator objects(assets.objects, QDir::Files, QDirIterator::Subdirectories);
+	while (objects.hasNext())
+	{
+		QFileInfo object(objects.next());
+		used += object.size();
+		QString hash = object.fileName();
+		// only what looks like 'xx/<sha1 starting with xx>', not stamps or partial downloads
+		if (hash.size() != 40 || object.dir().dirName() != hash.left(2))
+			continue;
+		if (referenced.contains(hash))
+			continue;
+		qint64 modified = object.lastModified().toMSecsSinceEpoch();
+		if (modified >= assets.startTime)
+			continue;
+		candidates.append({object.absoluteFilePath(), object.size(), modified});
+	}
+	if (used <= assets.quota)
+		return;
+
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b)
+	{
+		return a.modified < b.modified;
+	});
+	for (auto &candidate : candidates)
+	{
+		if (used <= assets.quota)
+			break;
+		if (ENV.assetsHeld())
+		{
+			qDebug() << "Asset objects are in use now, not removing any more";
+			break;
+		}
+		if (!dryRun && !QFile::remove(candidate.path))
+			continue;
+		used -= candidate.size;
+		report.assetObjects++;
+		report.assetBytes += candidate.size;
+	}
+}
+
+void CacheGCTask::collectFinished()
+{
+	auto result = m_watcher.result();
+	m_report = result.report;
+	if (!m_dryRun)
+	{
+		auto metacache = ENV.metacache();
+		for (auto &item : result.evicted)
+		{
+			auto entry = metacache->getEntry(item.base, item.path);
+			if (entry)
+			{
+				metacache->evictEntry(entry);
+			}
+		}
+	}
+	qDebug() << (m_dryRun ? "Cache GC would remove" : "Cache GC removed") << m_report.files.size()
+			 << "files," << m_report.bytes << "bytes and" << m_report.assetObjects
+			 << "asset objects," << m_report.assetBytes << "bytes and" << m_report.blobs
+			 << "blobs," << m_report.blobBytes << "bytes";
+	emitSucceeded();
+}
@@ -0,0 +1,126 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "tasks/Task.h"
+
+#include <QFutureWatcher>
+#include <QStringList>
+#include <QSet>
+#include <memory>
+
+class InstanceList;
+class BlobStore;
+
+/**
+ * Keeps the bases of the HTTP meta cache within their quotas.
+ *
+ * Least recently used entries go first. Files that an instance in the list needs are never
+ * removed. If the asset objects are over their quota too, the ones no remaining asset index
+ * refers to are removed, oldest first. Objects newer than the task and objects that are held
+ * by an update (see Env::holdAssets) are left alone. Blobs of the blob store that nothing links
+ * to any more are removed last.
+ * In dry run mode, nothing is touched and the report says what would have been removed.
+ */
+class CacheGCTask : public Task
+{
+	Q_OBJECT
+public:
+	struct Report
+	{
+		QStringList files;
+		/// freed by removing the files. Files that share their data with a blob free nothing
+		/// until the blob goes too.
+		qint64 bytes = 0;
+		int assetObjects = 0;
+		qint64 assetBytes = 0;
+		int blobs = 0;
+		qint64 blobBytes = 0;
+	};
+
+	explicit CacheGCTask(std::shared_ptr<InstanceList> instances, bool dryRun = false,
+						 QObject *parent = 0);
+	virtual ~CacheGCTask();
+
+	/// keep a file of the cache, besides the ones the instances need
+	void keep(QString base, QString path)
+	{
+		m_kept.insert(base + "/" + path);
+	}
+
+	const Report &report() const
+	{
+		return m_report;
+	}
+
+protected:
+	virtual void executeTask();
+
+private
+slots:
+	void collectFinished();
+
+private:
+	// everything the worker thread gets to see. Copies, nothing shared with the cache.
+	struct Item
+	{
+		QString base;
+		QString path;
+		QString fullPath;
+		qint64 lastAccess = 0;
+		bool pinned = false;
+		qint64 size = 0;
+		int links = 1;
+	};
+	struct Base
+	{
+		QString name;
+		qint64 quota = 0;
+		QList<Item> items;
+	};
+	struct Result
+	{
+		QList<Item> evicted;
+		Report report;
+	};
+
+private:
+	void pinInstances();
+	struct Assets
+	{
+		QString indexes;
+		QString objects;
+		qint64 quota = 0;
+		/// objects changed after this (ms since the epoch) may belong to a running update
+		qint64 startTime = 0;
+	};
+	static Result collect(QList<Base> bases, Assets assets, std::shared_ptr<BlobStore> blobs,
+						  bool dryRun, CacheGCTask *task);
+	static void sweepAssetObjects(const Assets &assets, const QSet<QString> &removedIndexes,
+								  bool dryRun, Report &report);
+
+private:
+	std::shared_ptr<InstanceList> m_instances;
+	bool m_dryRun = false;
+	// "<base>/<path>" of the files instances need
+	QSet<QString> m_pinned;
+	// same, but from keep()
+	QSet<QString> m_kept;
+	// same, but whole folders
+	QSet<QString> m_pinnedFolders;
+	QFutureWatcher<Result> m_watcher;
+	Report m_report;
+};
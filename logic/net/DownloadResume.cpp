@@ -0,0 +1,92 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DownloadResume.h"
+
+#include <QFileInfo>
+#include <QDebug>
+
+bool DownloadResume::begin(const QString &path)
+{
+	// only if we still have all of the data and a way to tell whether the file changed
+	QFileInfo partial_info(path);
+	if (size > 0 && !validator.isEmpty() && partial_info.isFile() && partial_info.size() == size)
+	{
+		offset = size;
+		return true;
+	}
+	reset();
+	return false;
+}
+
+void DownloadResume::prepare(QNetworkRequest &request) const
+{
+	if (!offset)
+		return;
+	request.setRawHeader("Range", QString("bytes=%1-").arg(offset).toLatin1());
+	request.setRawHeader("If-Range", validator);
+}
+
+DownloadResume::Response DownloadResume::check(QNetworkReply *reply)
+{
+	int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+	// no status at all means this isn't HTTP (local files and such)
+	if (status != 0 && status != 200 && status != 206)
+		return NotTheFile;
+
+	Response response = Continue;
+	if (status == 206)
+	{
+		// make sure we got the part we asked for - 'bytes <first>-<last>/<length>'
+		QByteArray range = reply->rawHeader("Content-Range");
+		int dash = range.indexOf('-');
+		bool ok = range.startsWith("bytes ") && dash > 6;
+		qint64 first = ok ? range.mid(6, dash - 6).trimmed().toLongLong(&ok) : -1;
+		if (!ok || first != offset)
+		{
+			qCritical() << "Unexpected range" << range << "while resuming" << reply->url();
+			return BadRange;
+		}
+	}
+	else if (offset)
+	{
+		// the server ignored the range or the file changed - start over
+		qDebug() << "Server sent the whole file, restarting" << reply->url();
+		offset = 0;
+		size = 0;
+		response = Restart;
+	}
+
+	// remember what we need to continue this file later. Weak ETags can't be used for ranges.
+	QByteArray etag = reply->rawHeader("ETag");
+	if (!etag.isEmpty() && !etag.startsWith("W/"))
+		validator = etag;
+	else
+		validator = reply->rawHeader("Last-Modified");
+	return response;
+}
+
+bool DownloadResume::canContinue(int status) const
+{
+	// 416 means the partial file doesn't fit what the server has
+	return size > 0 && !validator.isEmpty() && status != 416;
+}
+
+void DownloadResume::reset()
+{
+	size = 0;
+	offset = 0;
+	validator.clear();
+}
@@ -0,0 +1,64 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QString>
+
+/**
+ * What a download needs to continue its partial file where a failed attempt stopped,
+ * instead of starting over. Shared by the downloads that keep their partial file around.
+ *
+ * The rest of the file is asked for with a Range request, guarded by If-Range, so a file
+ * that changed on the server in the meantime comes back whole.
+ */
+class DownloadResume
+{
+public:
+	/// what the body of a reply means for the partial file
+	enum Response
+	{
+		/// not the file at all (an error page, a redirect, ...)
+		NotTheFile,
+		/// the body continues the partial file, or starts a fresh one
+		Continue,
+		/// the server sent the whole file, the partial file has to be emptied first
+		Restart,
+		/// a range that doesn't fit the partial file
+		BadRange
+	};
+
+	/// decide whether the next request continues the partial file at 'path'. True if it does.
+	bool begin(const QString &path);
+	/// ask for the rest of the file only, if the request continues the partial file
+	void prepare(QNetworkRequest &request) const;
+	/// look at the status and range of the reply. Remembers what is needed to continue later.
+	Response check(QNetworkReply *reply);
+	/// the data in the partial file can be used by another attempt
+	bool canContinue(int status) const;
+	/// forget about the partial file
+	void reset();
+
+public:
+	/// bytes in the partial file
+	qint64 size = 0;
+	/// ETag or Last-Modified of the response that produced the partial file, used for If-Range
+	QByteArray validator;
+	/// where the current request continues the partial file, 0 for a fresh download
+	qint64 offset = 0;
+};
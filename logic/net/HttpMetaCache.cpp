@@ -20,9 +20,12 @@
 
 #include <QFileInfo>
 #include <QFile>
+#include <QSet>
 #include <QTemporaryFile>
 #include <QDateTime>
 #include <QCryptographicHash>
+#include <QtConcurrentRun>
+#include <QThread>
 
 #include <QDebug>
 
@@ -30,6 +33,34 @@
 #include <QJsonArray>
 #include <QJsonObject>
 
+namespace
+{
+// past this many changes, the journal is compacted without waiting for things to quiet down
+const int journalCompactionThreshold = 2000;
+// changes are synced to the disk in batches, at most once per this many ms
+const int journalSyncInterval = 1000;
+// the last access time is only written down when it moved by this much. Keeps reads cheap.
+const qint64 accessGranularity = 24 * 60 * 60 * 1000;
+
+MetaCacheIndex::Record toRecord(MetaEntryPtr entry)
+{
+	MetaCacheIndex::Record record;
+	record.base = entry->base;
+	record.path = entry->path;
+	record.md5sum = entry->md5sum;
+	record.etag = entry->etag;
+	record.local_changed_timestamp = entry->local_changed_timestamp;
+	record.last_access_timestamp = entry->last_access_timestamp;
+	record.remote_changed_timestamp = entry->remote_changed_timestamp;
+	return record;
+}
+
+QString makeKey(const QString &base, const QString &path)
+{
+	return base + QChar('\0') + path;
+}
+}
+
 QString MetaEntry::getFullPath()
 {
 	// FIXME: make local?
@@ -39,15 +70,26 @@ QString MetaEntry::getFullPath()
 HttpMetaCache::HttpMetaCache(QString path) : QObject()
 {
 	m_index_file = path;
+	m_binary_index_file = path + ".idx";
+	m_journal_file = path + ".journal";
 	saveBatchingTimer.setSingleShot(true);
 	saveBatchingTimer.setTimerType(Qt::VeryCoarseTimer);
-	connect(&saveBatchingTimer, SIGNAL(timeout()), SLOT(SaveNow()));
+	connect(&saveBatchingTimer, SIGNAL(timeout()), SLOT(compactInBackground()));
+	syncBatchingTimer.setSingleShot(true);
+	syncBatchingTimer.setInterval(journalSyncInterval);
+	connect(&syncBatchingTimer, SIGNAL(timeout()), SLOT(syncJournal()));
+	connect(&m_compaction, SIGNAL(finished()), SLOT(compactionFinished()));
+	m_hash_pool.setMaxThreadCount(QThread::idealThreadCount());
 }
 
 HttpMetaCache::~HttpMetaCache()
 {
 	saveBatchingTimer.stop();
-	SaveNow();
+	syncBatchingTimer.stop();
+	// pending results are dropped along with their watchers
+	m_hash_pool.waitForDone();
+	// the journal already has everything. only finish what was started.
+	finishCompactions();
 }
 
 MetaEntryPtr HttpMetaCache::getEntry(QString base, QString resource_path)
@@ -63,15 +105,34 @@ MetaEntryPtr HttpMetaCache::getEntry(QString base, QString resource_path)
 	{
 		return map.entry_list[resource_path];
 	}
+	// not used yet in this session. look it up in the index file.
+	MetaCacheIndex::Record record;
+	if (m_index.find(base, resource_path, record))
+	{
+		auto foo = new MetaEntry;
+		foo->base = base;
+		foo->path = resource_path;
+		foo->md5sum = record.md5sum;
+		foo->etag = record.etag;
+		foo->local_changed_timestamp = record.local_changed_timestamp;
+		foo->last_access_timestamp = record.last_access_timestamp;
+		foo->remote_changed_timestamp = record.remote_changed_timestamp;
+		// presumed innocent until closer examination
+		foo->stale = false;
+		MetaEntryPtr entry(foo);
+		map.entry_list[resource_path] = entry;
+		return entry;
+	}
 	return MetaEntryPtr();
 }
 
-MetaEntryPtr HttpMetaCache::resolveEntry(QString base, QString resource_path,
-										 QString expected_etag)
+MetaEntryPtr HttpMetaCache::checkEntry(QString base, QString resource_path,
+									   QString expected_etag, QString &hash_path,
+									   qint64 &file_last_changed)
 {
 	auto entry = getEntry(base, resource_path);
-	// it's not present? generate a default stale entry
-	if (!entry)
+	// it's not present (or was thrown out)? generate a default stale entry
+	if (!entry || entry->stale)
 	{
 		return staleEntry(base, resource_path);
 	}
@@ -84,40 +145,136 @@ MetaEntryPtr HttpMetaCache::resolveEntry(QString base, QString resource_path,
 	if (!finfo.isFile() || !finfo.isReadable())
 	{
 		// if the file doesn't exist, we disown the entry
-		selected_base.entry_list.remove(resource_path);
-		return staleEntry(base, resource_path);
+		return disownEntry(base, resource_path);
 	}
 
 	if (!expected_etag.isEmpty() && expected_etag != entry->etag)
 	{
 		// if the etag doesn't match expected, we disown the entry
-		selected_base.entry_list.remove(resource_path);
-		return staleEntry(base, resource_path);
+		return disownEntry(base, resource_path);
 	}
 
-	// if the file changed, check md5sum
-	qint64 file_last_changed = finfo.lastModified().toUTC().toMSecsSinceEpoch();
+	// if the file changed, the md5sum has to be checked
+	file_last_changed = finfo.lastModified().toUTC().toMSecsSinceEpoch();
 	if (file_last_changed != entry->local_changed_timestamp)
 	{
-		QFile input(real_path);
-		input.open(QIODevice::ReadOnly);
-		QString md5sum = QCryptographicHash::hash(input.readAll(), QCryptographicHash::Md5)
-							 .toHex()
-							 .constData();
-		if (entry->md5sum != md5sum)
-		{
-			selected_base.entry_list.remove(resource_path);
-			return staleEntry(base, resource_path);
-		}
-		// md5sums matched... keep entry and save the new state to file
-		entry->local_changed_timestamp = file_last_changed;
-		SaveEventually();
+		hash_path = real_path;
+		return entry;
 	}
+	markAccessed(entry);
+	return entry;
+}
 
-	// entry passed all the checks we cared about.
+void HttpMetaCache::markAccessed(MetaEntryPtr entry)
+{
+	qint64 now = QDateTime::currentMSecsSinceEpoch();
+	if (now - entry->last_access_timestamp < accessGranularity)
+		return;
+	entry->last_access_timestamp = now;
+	// losing this to a crash costs nothing but a slightly worse guess for the cache GC
+	journal(MetaCacheJournal::Put, entry, false);
+}
+
+MetaEntryPtr HttpMetaCache::finishEntry(MetaEntryPtr entry, QString md5sum,
+										qint64 file_last_changed)
+{
+	if (entry->md5sum != md5sum)
+	{
+		return disownEntry(entry->base, entry->path);
+	}
+	// md5sums matched... keep entry and save the new state to file
+	entry->local_changed_timestamp = file_last_changed;
+	entry->last_access_timestamp = QDateTime::currentMSecsSinceEpoch();
+	journal(MetaCacheJournal::Put, entry);
 	return entry;
 }
 
+QString HttpMetaCache::hashFile(QString path)
+{
+	QFile input(path);
+	if (!input.open(QIODevice::ReadOnly))
+		return QString();
+	// reads the file a chunk at a time, big jars don't end up in memory whole
+	QCryptographicHash md5(QCryptographicHash::Md5);
+	if (!md5.addData(&input))
+		return QString();
+	return md5.result().toHex().constData();
+}
+
+MetaEntryPtr HttpMetaCache::resolveEntry(QString base, QString resource_path,
+										 QString expected_etag)
+{
+	QString hash_path;
+	qint64 file_last_changed = 0;
+	auto entry = checkEntry(base, resource_path, expected_etag, hash_path, file_last_changed);
+	if (hash_path.isEmpty())
+	{
+		// entry passed all the checks we cared about (or is stale).
+		return entry;
+	}
+	return finishEntry(entry, hashFile(hash_path), file_last_changed);
+}
+
+void HttpMetaCache::resolveEntryAsync(QString base, QString resource_path,
+									  ResolveCallback callback, QString expected_etag)
+{
+	QString hash_path;
+	qint64 file_last_changed = 0;
+	auto entry = checkEntry(base, resource_path, expected_etag, hash_path, file_last_changed);
+	if (hash_path.isEmpty())
+	{
+		callback(entry);
+		return;
+	}
+	auto watcher = new QFutureWatcher<QString>(this);
+	connect(watcher, &QFutureWatcher<QString>::finished, this, [=]()
+	{
+		watcher->deleteLater();
+		// something else replaced or threw out the entry while we were hashing. start over.
+		if (getEntry(base, resource_path) != entry || entry->stale)
+		{
+			resolveEntryAsync(base, resource_path, callback, expected_etag);
+			return;
+		}
+		callback(finishEntry(entry, watcher->result(), file_last_changed));
+	});
+	watcher->setFuture(QtConcurrent::run(&m_hash_pool, &HttpMetaCache::hashFile, hash_path));
+}
+
+void HttpMetaCache::resolveEntriesAsync(QString base, QStringList resource_paths,
+										BatchResolveCallback callback)
+{
+	struct Batch
+	{
+		QList<MetaEntryPtr> entries;
+		int remaining;
+		BatchResolveCallback callback;
+	};
+	auto batch = std::make_shared<Batch>();
+	batch->remaining = resource_paths.size();
+	batch->callback = callback;
+	if (resource_paths.isEmpty())
+	{
+		callback(batch->entries);
+		return;
+	}
+	for (int i = 0; i < resource_paths.size(); i++)
+	{
+		batch->entries.append(MetaEntryPtr());
+	}
+	for (int i = 0; i < resource_paths.size(); i++)
+	{
+		resolveEntryAsync(base, resource_paths[i], [batch, i](MetaEntryPtr entry)
+		{
+			batch->entries[i] = entry;
+			if (--batch->remaining == 0)
+			{
+				batch->callback(batch->entries);
+			}
+		});
+	}
+}
+
 bool HttpMetaCache::updateEntry(MetaEntryPtr stale_entry)
 {
 	if (!m_entries.contains(stale_entry->base))
@@ -131,8 +288,68 @@ bool HttpMetaCache::updateEntry(MetaEntryPtr stale_entry)
 		qCritical() << "Cannot add stale entry: " << stale_entry->getFullPath().toLocal8Bit();
 		return false;
 	}
-	m_entries[stale_entry->base].entry_list[stale_entry->path] = stale_entry;
-	SaveEventually();
+	auto &selected_base = m_entries[stale_entry->base];
+	// removing a file that shares its data frees nothing, that would make quotas meaningless
+	bool share = m_blob_store && selected_base.quota <= 0;
+	QString real_path = PathCombine(selected_base.base_path, stale_entry->path);
+	if (share && m_blob_store->canAdoptQuickly(real_path, stale_entry->md5sum))
+	{
+		share = false;
+		if (m_blob_store->adopt(real_path, stale_entry->md5sum))
+		{
+			stale_entry->local_changed_timestamp =
+				QFileInfo(real_path).lastModified().toUTC().toMSecsSinceEpoch();
+		}
+	}
+	stale_entry->last_access_timestamp = QDateTime::currentMSecsSinceEpoch();
+	selected_base.entry_list[stale_entry->path] = stale_entry;
+	journal(MetaCacheJournal::Put, stale_entry);
+	if (share)
+	{
+		adoptInBackground(stale_entry, real_path);
+	}
+	return true;
+}
+
+void HttpMetaCache::adoptInBackground(MetaEntryPtr entry, QString real_path)
+{
+	auto store = m_blob_store;
+	QString md5sum = entry->md5sum;
+	auto watcher = new QFutureWatcher<bool>(this);
+	connect(watcher, &QFutureWatcher<bool>::finished, this, [=]()
+	{
+		watcher->deleteLater();
+		if (!watcher->result())
+			return;
+		// something else replaced or threw out the entry in the meantime
+		if (getEntry(entry->base, entry->path) != entry || entry->stale ||
+			entry->md5sum != md5sum)
+			return;
+		// it is a link to an older file now
+		entry->local_changed_timestamp =
+			QFileInfo(real_path).lastModified().toUTC().toMSecsSinceEpoch();
+		journal(MetaCacheJournal::Put, entry);
+	});
+	// both files are read to compare them, that is not for the GUI thread
+	watcher->setFuture(QtConcurrent::run(&m_hash_pool, [store, real_path, md5sum]()
+	{
+		return store->adopt(real_path, md5sum);
+	}));
+}
+
+bool HttpMetaCache::syncEntry(MetaEntryPtr entry)
+{
+	auto current = getEntry(entry->base, entry->path);
+	if (!current || current->stale)
+		return false;
+	if (current == entry)
+		return true;
+	entry->md5sum = current->md5sum;
+	entry->etag = current->etag;
+	entry->local_changed_timestamp = current->local_changed_timestamp;
+	entry->last_access_timestamp = current->last_access_timestamp;
+	entry->remote_changed_timestamp = current->remote_changed_timestamp;
+	entry->stale = false;
 	return true;
 }
 
@@ -141,7 +358,12 @@ bool HttpMetaCache::evictEntry(MetaEntryPtr entry)
 	if(entry)
 	{
 		entry->stale = true;
-		SaveEventually();
+		if (m_entries.contains(entry->base))
+		{
+			// keep it around so it hides the record in the index
+			m_entries[entry->base].entry_list[entry->path] = entry;
+		}
+		journal(MetaCacheJournal::Remove, entry);
 		return true;
 	}
 	return false;
@@ -156,6 +378,14 @@ MetaEntryPtr HttpMetaCache::staleEntry(QString base, QString resource_path)
 	return MetaEntryPtr(foo);
 }
 
+MetaEntryPtr HttpMetaCache::disownEntry(QString base, QString resource_path)
+{
+	auto entry = staleEntry(base, resource_path);
+	m_entries[base].entry_list[resource_path] = entry;
+	journal(MetaCacheJournal::Remove, entry);
+	return entry;
+}
+
 void HttpMetaCache::addBase(QString base, QString base_root)
 {
 	// TODO: report error
@@ -167,6 +397,75 @@ void HttpMetaCache::addBase(QString base, QString base_root)
 	m_entries[base] = foo;
 }
 
+void HttpMetaCache::setBlobStore(std::shared_ptr<BlobStore> store)
+{
+	m_blob_store = store;
+}
+
+std::shared_ptr<BlobStore> HttpMetaCache::blobStore()
+{
+	return m_blob_store;
+}
+
+bool HttpMetaCache::copyEntryFile(MetaEntryPtr entry, QString target)
+{
+	// never a link: whatever is done to the copy must not reach the cache
+	return BlobStore::cloneOrCopy(entry->getFullPath(), target);
+}
+
+void HttpMetaCache::setBaseQuota(QString base, qint64 bytes)
+{
+	if (m_entries.contains(base))
+	{
+		m_entries[base].quota = bytes;
+	}
+}
+
+qint64 HttpMetaCache::baseQuota(QString base)
+{
+	if (m_entries.contains(base))
+	{
+		return m_entries[base].quota;
+	}
+	return 0;
+}
+
+QStringList HttpMetaCache::bases()
+{
+	return m_entries.keys();
+}
+
+QList<MetaEntryPtr> HttpMetaCache::getEntries(QString base)
+{
+	QList<MetaEntryPtr> entries;
+	if (!m_entries.contains(base))
+		return entries;
+	auto &map = m_entries[base];
+	for (auto entry : map.entry_list)
+	{
+		if (!entry->stale)
+			entries.append(entry);
+	}
+	// the rest isn't materialized, these are detached copies of the index records
+	for (int i = 0; i < m_index.count(); i++)
+	{
+		auto record = m_index.at(i);
+		if (record.base != base || map.entry_list.contains(record.path))
+			continue;
+		auto foo = new MetaEntry;
+		foo->base = base;
+		foo->path = record.path;
+		foo->md5sum = record.md5sum;
+		foo->etag = record.etag;
+		foo->local_changed_timestamp = record.local_changed_timestamp;
+		foo->last_access_timestamp = record.last_access_timestamp;
+		foo->remote_changed_timestamp = record.remote_changed_timestamp;
+		foo->stale = false;
+		entries.append(MetaEntryPtr(foo));
+	}
+	return entries;
+}
+
 QString HttpMetaCache::getBasePath(QString base)
 {
 	if (m_entries.contains(base))
@@ -177,31 +476,85 @@ QString HttpMetaCache::getBasePath(QString base)
 }
 
 void HttpMetaCache::Load()
+{
+	// a compaction was interrupted right between removing the old index and renaming the new one
+	QString new_index = m_binary_index_file + ".new";
+	if (!QFile::exists(m_binary_index_file) && QFile::exists(new_index))
+	{
+		QFile::rename(new_index, m_binary_index_file);
+	}
+
+	// no binary index yet? migrate the old JSON one, if there is any.
+	bool migrate = !m_index.open(m_binary_index_file) && loadJson();
+
+	// replay whatever happened after the index was last written. Before migrating, because
+	// writing the index drops the part of the journal it covers.
+	QList<MetaCacheJournal::Change> changes;
+	m_journal.open(m_journal_file, changes);
+	for (auto &change : changes)
+	{
+		auto &record = change.record;
+		if (!m_entries.contains(record.base))
+			continue;
+		auto entry = staleEntry(record.base, record.path);
+		if (change.operation == MetaCacheJournal::Put)
+		{
+			entry->md5sum = record.md5sum;
+			entry->etag = record.etag;
+			entry->local_changed_timestamp = record.local_changed_timestamp;
+			entry->last_access_timestamp = record.last_access_timestamp;
+			entry->remote_changed_timestamp = record.remote_changed_timestamp;
+			entry->stale = false;
+		}
+		m_entries[record.base].entry_list[record.path] = entry;
+	}
+
+	if (migrate)
+	{
+		qDebug() << "Migrating" << m_index_file << "to" << m_binary_index_file;
+		SaveNow();
+		if (m_index.isOpen())
+		{
+			// everything is in the index now, no need to keep it all in memory
+			for (auto &group : m_entries)
+			{
+				group.entry_list.clear();
+			}
+			QFile::remove(m_index_file);
+		}
+	}
+	else if (m_journal.count())
+	{
+		SaveEventually();
+	}
+}
+
+bool HttpMetaCache::loadJson()
 {
 	QFile index(m_index_file);
 	if (!index.open(QIODevice::ReadOnly))
-		return;
+		return false;
 
 	QJsonDocument json = QJsonDocument::fromJson(index.readAll());
 	if (!json.isObject())
-		return;
+		return false;
 	auto root = json.object();
 	// check file version first
 	auto version_val = root.value("version");
 	if (!version_val.isString())
-		return;
+		return false;
 	if (version_val.toString() != "1")
-		return;
+		return false;
 
 	// read the entry array
 	auto entries_val = root.value("entries");
 	if (!entries_val.isArray())
-		return;
+		return false;
 	QJsonArray array = entries_val.toArray();
 	for (auto element : array)
 	{
 		if (!element.isObject())
-			return;
+			return true;
 		auto element_obj = element.toObject();
 		QString base = element_obj.value("base").toString();
 		if (!m_entries.contains(base))
@@ -219,6 +572,31 @@ void HttpMetaCache::Load()
 		foo->stale = false;
 		entrymap.entry_list[path] = MetaEntryPtr(foo);
 	}
+	return true;
+}
+
+void HttpMetaCache::journal(MetaCacheJournal::Operation operation, MetaEntryPtr entry,
+						   bool durable)
+{
+	m_journal.append(operation, toRecord(entry));
+	// one sync for all the changes a job makes, not one for each of them
+	if (durable && !syncBatchingTimer.isActive())
+	{
+		syncBatchingTimer.start();
+	}
+	if (m_journal.count() >= journalCompactionThreshold)
+	{
+		compactInBackground();
+	}
+	else
+	{
+		SaveEventually();
+	}
+}
+
+void HttpMetaCache::syncJournal()
+{
+	m_journal.sync();
 }
 
 void HttpMetaCache::SaveEventually()
@@ -228,42 +606,139 @@ void HttpMetaCache::SaveEventually()
 	saveBatchingTimer.start(30000);
 }
 
-void HttpMetaCache::SaveNow()
+// what the compaction needs to know about the in-memory state, copied so it can run elsewhere
+struct HttpMetaCache::Snapshot
+{
+	QSet<QString> bases;
+	// everything in memory, live or not. these hide the records in the old index.
+	QSet<QString> touched;
+	QList<MetaCacheIndex::Record> live;
+};
+
+bool HttpMetaCache::writeIndex(const QString &index_path, const Snapshot &snapshot)
 {
-	QJsonObject toplevel;
-	toplevel.insert("version", QJsonValue(QString("1")));
-	QJsonArray entriesArr;
-	for (auto group : m_entries)
+	QList<MetaCacheIndex::Record> records;
+	MetaCacheIndex old_index;
+	if (old_index.open(index_path))
 	{
-		for (auto entry : group.entry_list)
+		for (int i = 0; i < old_index.count(); i++)
 		{
+			auto record = old_index.at(i);
+			if (!snapshot.bases.contains(record.base))
+				continue;
+			if (snapshot.touched.contains(makeKey(record.base, record.path)))
+				continue;
+			records.append(record);
+		}
+		old_index.close();
+	}
+	records.append(snapshot.live);
+	try
+	{
+		FS::write(index_path + ".new", MetaCacheIndex::serialize(records));
+	}
+	catch (Exception &e)
+	{
+		qWarning() << e.what();
+		return false;
+	}
+	return true;
+}
+
+HttpMetaCache::Snapshot HttpMetaCache::takeSnapshot() const
+{
+	Snapshot snapshot;
+	for (auto &group : m_entries)
+	{
+		for (auto &entry : group.entry_list)
+		{
+			snapshot.touched.insert(makeKey(entry->base, entry->path));
 			// do not save stale entries. they are dead.
-			if(entry->stale)
+			if (!entry->stale)
 			{
-				continue;
+				snapshot.live.append(toRecord(entry));
 			}
-			QJsonObject entryObj;
-			entryObj.insert("base", QJsonValue(entry->base));
-			entryObj.insert("path", QJsonValue(entry->path));
-			entryObj.insert("md5sum", QJsonValue(entry->md5sum));
-			entryObj.insert("etag", QJsonValue(entry->etag));
-			entryObj.insert("last_changed_timestamp",
-							QJsonValue(double(entry->local_changed_timestamp)));
-			if (!entry->remote_changed_timestamp.isEmpty())
-				entryObj.insert("remote_changed_timestamp",
-								QJsonValue(entry->remote_changed_timestamp));
-			entriesArr.append(entryObj);
 		}
 	}
-	toplevel.insert("entries", entriesArr);
+	for (auto iter = m_entries.begin(); iter != m_entries.end(); iter++)
+	{
+		snapshot.bases.insert(iter.key());
+	}
+	return snapshot;
+}
 
-	QJsonDocument doc(toplevel);
-	try
+void HttpMetaCache::compactInBackground()
+{
+	// one at a time. whatever comes in meanwhile is picked up by the next one.
+	if (m_compaction_pending)
+		return;
+	saveBatchingTimer.stop();
+	m_compaction_pending = true;
+	m_compaction_covers = m_journal.size();
+	auto snapshot = takeSnapshot();
+	auto index_path = m_binary_index_file;
+	m_compaction.setFuture(QtConcurrent::run([index_path, snapshot]()
+	{
+		return writeIndex(index_path, snapshot);
+	}));
+}
+
+void HttpMetaCache::compactionFinished()
+{
+	if (!m_compaction_pending)
+		return;
+	m_compaction_pending = false;
+	if (!m_compaction.result() || !installIndex(m_compaction_covers))
+	{
+		// try again later
+		if (m_journal.count())
+			SaveEventually();
+		return;
+	}
+	// more piled up while it was running, don't let the journal grow any further
+	if (m_journal.count() >= journalCompactionThreshold)
 	{
-		FS::write(m_index_file, doc.toJson());
+		compactInBackground();
 	}
-	catch (Exception & e)
+}
+
+void HttpMetaCache::finishCompactions()
+{
+	// one that finishes may start the next one for what piled up meanwhile
+	while (m_compaction_pending)
 	{
-		qWarning() << e.what();
+		m_compaction.waitForFinished();
+		compactionFinished();
+	}
+}
+
+bool HttpMetaCache::installIndex(qint64 journal_covered)
+{
+	// the file can't be replaced while it is mapped (on some platforms)
+	m_index.close();
+	bool replaced = FS::replaceFile(m_binary_index_file + ".new", m_binary_index_file);
+	m_index.open(m_binary_index_file);
+	if (!replaced)
+	{
+		// keep the journal, it is all we have now
+		qWarning() << "Could not replace" << m_binary_index_file;
+		return false;
+	}
+	// a crash before this point only means replaying changes that are already in the index
+	m_journal.dropFront(journal_covered);
+	return true;
+}
+
+void HttpMetaCache::SaveNow()
+{
+	saveBatchingTimer.stop();
+	// the next compaction builds on the result of the running one
+	finishCompactions();
+	if (m_index.isOpen() && !m_journal.count())
+		return;
+	qint64 covered = m_journal.size();
+	if (writeIndex(m_binary_index_file, takeSnapshot()))
+	{
+		installIndex(covered);
 	}
 }
@@ -17,7 +17,14 @@
 #include <QString>
 #include <QMap>
 #include <qtimer.h>
+#include <QFutureWatcher>
+#include <QThreadPool>
+#include <QStringList>
 #include <memory>
+#include <functional>
+#include "MetaCacheIndex.h"
+#include "MetaCacheJournal.h"
+#include "BlobStore.h"
 
 class HttpMetaCache;
 
@@ -28,6 +35,8 @@ struct MetaEntry
 	QString md5sum;
 	QString etag;
 	qint64 local_changed_timestamp = 0;
+	// when the entry was last resolved or updated. Only precise to a day.
+	qint64 last_access_timestamp = 0;
 	QString remote_changed_timestamp; // QString for now, RFC 2822 encoded time
 	bool stale = true;
 	QString getFullPath();
@@ -39,6 +48,9 @@ class HttpMetaCache : public QObject
 {
 	Q_OBJECT
 public:
+	typedef std::function<void(MetaEntryPtr)> ResolveCallback;
+	typedef std::function<void(QList<MetaEntryPtr>)> BatchResolveCallback;
+
 	// supply path to the cache index file
 	HttpMetaCache(QString path);
 	~HttpMetaCache();
@@ -51,31 +63,107 @@ public:
 	MetaEntryPtr resolveEntry(QString base, QString resource_path,
 							  QString expected_etag = QString());
 
+	// same as resolveEntry, but changed files are hashed on a worker thread.
+	// the callback runs on the thread of the cache, possibly before this returns.
+	void resolveEntryAsync(QString base, QString resource_path, ResolveCallback callback,
+						   QString expected_etag = QString());
+
+	// resolve a whole set of entries in parallel. The callback gets them in the same order.
+	void resolveEntriesAsync(QString base, QStringList resource_paths,
+							 BatchResolveCallback callback);
+
 	// add a previously resolved stale entry
 	bool updateEntry(MetaEntryPtr stale_entry);
 
+	// copy what the cache knows about the file into an entry object from elsewhere.
+	// returns false if the cache has nothing live for it.
+	bool syncEntry(MetaEntryPtr entry);
+
 	// evict selected entry from cache
 	bool evictEntry(MetaEntryPtr entry);
 
 	void addBase(QString base, QString base_root);
 
-	// (re)start a timer that calls SaveNow later.
+	// share the data of identical files between all the bases. Off unless a store is set.
+	// Bases with a quota don't take part.
+	void setBlobStore(std::shared_ptr<BlobStore> store);
+	std::shared_ptr<BlobStore> blobStore();
+
+	// size limit for the files of a base in bytes, used by the cache GC. 0 means no limit.
+	void setBaseQuota(QString base, qint64 bytes);
+	qint64 baseQuota(QString base);
+	QStringList bases();
+
+	// all the live entries of a base. Meant for maintenance, this goes through the whole index.
+	QList<MetaEntryPtr> getEntries(QString base);
+
+	// put a copy of the entry's file at target. A clone where the file system can do it.
+	bool copyEntryFile(MetaEntryPtr entry, QString target);
+
+	// (re)start a timer that compacts the journal into the index later.
 	void SaveEventually();
 	void Load();
 	QString getBasePath(QString base);
 public
 slots:
+	// compact the journal into the index right away
 	void SaveNow();
 
+private
+slots:
+	void compactInBackground();
+	void compactionFinished();
+	void syncJournal();
+
 private:
+	// the cheap part of resolving: sets hash_path if the file has to be hashed to decide
+	MetaEntryPtr checkEntry(QString base, QString resource_path, QString expected_etag,
+							QString &hash_path, qint64 &file_last_changed);
+	// the file was hashed, keep or disown the entry
+	MetaEntryPtr finishEntry(MetaEntryPtr entry, QString md5sum, qint64 file_last_changed);
+	void markAccessed(MetaEntryPtr entry);
+	// share the entry's file with an existing blob once a worker thread compared them
+	void adoptInBackground(MetaEntryPtr entry, QString real_path);
+	static QString hashFile(QString path);
+	// write a change to the journal. Unless it only matters a little (access times), it goes
+	// to the disk with the next batch.
+	void journal(MetaCacheJournal::Operation operation, MetaEntryPtr entry,
+				 bool durable = true);
+	// wait for the running compaction, and the ones it starts, and install their results
+	void finishCompactions();
+	// put the freshly written index in place and drop the part of the journal it covers
+	bool installIndex(qint64 journal_covered);
+	struct Snapshot;
+	Snapshot takeSnapshot() const;
+	// merge the old index and the snapshot into a new index file next to the old one
+	static bool writeIndex(const QString &index_path, const Snapshot &snapshot);
 	// create a new stale entry, given the parameters
 	MetaEntryPtr staleEntry(QString base, QString resource_path);
+	// stale entry that stays in the entry list, hiding the one in the index file
+	MetaEntryPtr disownEntry(QString base, QString resource_path);
+	// read the old JSON index into memory. returns true if there was one.
+	bool loadJson();
 	struct EntryMap
 	{
 		QString base_path;
+		qint64 quota = 0;
+		// entries read from the index or changed since it was written
 		QMap<QString, MetaEntryPtr> entry_list;
 	};
 	QMap<QString, EntryMap> m_entries;
+	// the old JSON index. Only read to migrate it.
 	QString m_index_file;
+	// the binary index, mapped into memory
+	QString m_binary_index_file;
+	MetaCacheIndex m_index;
+	// changes since the index was written, appended as they happen
+	QString m_journal_file;
+	MetaCacheJournal m_journal;
+	QFutureWatcher<bool> m_compaction;
+	bool m_compaction_pending = false;
+	qint64 m_compaction_covers = 0;
 	QTimer saveBatchingTimer;
+	QTimer syncBatchingTimer;
+	QThreadPool m_hash_pool;
+	std::shared_ptr<BlobStore> m_blob_store;
 };
\ No newline at end of file
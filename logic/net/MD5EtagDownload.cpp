@@ -15,8 +15,10 @@
 
 #include "Env.h"
 #include "MD5EtagDownload.h"
+#include "NetScheduler.h"
 #include <pathutils.h>
 #include <QCryptographicHash>
+#include <QFileInfo>
 #include <QDebug>
 
 MD5EtagDownload::MD5EtagDownload(QUrl url, QString target_path) : NetAction()
@@ -28,10 +30,17 @@ MD5EtagDownload::MD5EtagDownload(QUrl url, QString target_path) : NetAction()
 
 void MD5EtagDownload::start()
 {
+	m_status = Job_InProgress;
 	QString filename = m_target_path;
 	m_output_file.setFileName(filename);
+	m_response_checked = false;
+	m_write_body = false;
+
+	// continue a previous attempt if we still have all of its data
+	m_resume.begin(filename);
+
 	// if there already is a file and md5 checking is in effect and it can be opened
-	if (m_output_file.exists() && m_output_file.open(QIODevice::ReadOnly))
+	if (!m_resume.offset && m_output_file.exists() && m_output_file.open(QIODevice::ReadOnly))
 	{
 		// get the md5 of the local file.
 		m_local_md5 =
@@ -63,11 +72,19 @@ void MD5EtagDownload::start()
 
 	QNetworkRequest request(m_url);
 
-	qDebug() << "Downloading " << m_url.toString() << " local MD5: " << m_local_md5;
-
-	if(!m_local_md5.isEmpty())
+	if (m_resume.offset)
 	{
-		request.setRawHeader(QString("If-None-Match").toLatin1(), m_local_md5.toLatin1());
+		qDebug() << "Resuming " << m_url.toString() << " at byte " << m_resume.offset;
+		m_resume.prepare(request);
+	}
+	else
+	{
+		qDebug() << "Downloading " << m_url.toString() << " local MD5: " << m_local_md5;
+
+		if(!m_local_md5.isEmpty())
+		{
+			request.setRawHeader(QString("If-None-Match").toLatin1(), m_local_md5.toLatin1());
+		}
 	}
 	if(!m_expected_md5.isEmpty())
 		qDebug() << "Expecting " << m_expected_md5;
@@ -77,7 +94,9 @@ void MD5EtagDownload::start()
 	// Go ahead and try to open the file.
 	// If we don't do this, empty files won't be created, which breaks the updater.
 	// Plus, this way, we don't end up starting a download for a file we can't open.
-	if (!m_output_file.open(QIODevice::WriteOnly))
+	auto mode = m_resume.offset ? (QIODevice::WriteOnly | QIODevice::Append)
+								: (QIODevice::WriteOnly | QIODevice::Truncate);
+	if (!m_output_file.open(mode))
 	{
 		emit failed(m_index_within_job);
 		return;
@@ -87,6 +106,7 @@ void MD5EtagDownload::start()
 	QNetworkReply *rep = worker->get(request);
 
 	m_reply.reset(rep);
+	trackReply(rep);
 	connect(rep, SIGNAL(downloadProgress(qint64, qint64)),
 			SLOT(downloadProgress(qint64, qint64)));
 	connect(rep, SIGNAL(finished()), SLOT(downloadFinished()));
@@ -95,8 +115,32 @@ void MD5EtagDownload::start()
 	connect(rep, SIGNAL(readyRead()), SLOT(downloadReadyRead()));
 }
 
+bool MD5EtagDownload::checkResponse()
+{
+	m_response_checked = true;
+	auto response = m_resume.check(m_reply.get());
+	m_write_body = response == DownloadResume::Continue || response == DownloadResume::Restart;
+	if (response == DownloadResume::Restart)
+	{
+		m_output_file.resize(0);
+		m_output_file.seek(0);
+	}
+	return response != DownloadResume::BadRange;
+}
+
+void MD5EtagDownload::discardPartial()
+{
+	m_output_file.close();
+	m_output_file.remove();
+	m_resume.reset();
+}
+
 void MD5EtagDownload::downloadProgress(qint64 bytesReceived, qint64 bytesTotal)
 {
+	// a resumed download only reports the remaining part
+	if (bytesTotal >= 0)
+		bytesTotal += m_resume.offset;
+	bytesReceived += m_resume.offset;
 	m_total_progress = bytesTotal;
 	m_progress = bytesReceived;
 	emit netActionProgress(m_index_within_job, bytesReceived, bytesTotal);
@@ -111,12 +155,16 @@ void MD5EtagDownload::downloadError(QNetworkReply::NetworkError error)
 
 void MD5EtagDownload::downloadFinished()
 {
+	// whatever the bandwidth limit held back is still in the reply
+	if (m_reply->bytesAvailable())
+		downloadReadyRead();
 	// if the download succeeded
 	if (m_status != Job_Failed)
 	{
 		// nothing went wrong...
 		m_status = Job_Finished;
 		m_output_file.close();
+		m_resume.reset();
 
 		// FIXME: compare with the real written data md5sum
 		// this is just an ETag
@@ -129,8 +177,17 @@ void MD5EtagDownload::downloadFinished()
 	// else the download failed
 	else
 	{
-		m_output_file.close();
-		m_output_file.remove();
+		int status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+		// keep the partial file for the next attempt, unless it can't be continued
+		if (m_aborted || !m_resume.canContinue(status))
+		{
+			discardPartial();
+		}
+		else
+		{
+			qDebug() << "Keeping " << m_resume.size << " bytes of " << m_url.toString();
+			m_output_file.close();
+		}
 		m_reply.reset();
 		emit failed(m_index_within_job);
 		return;
@@ -146,10 +203,33 @@ void MD5EtagDownload::downloadReadyRead()
 			/*
 			* Can't open the file... the job failed
 			*/
+			m_status = Job_Failed;
 			m_reply->abort();
-			emit failed(m_index_within_job);
 			return;
 		}
 	}
-	m_output_file.write(m_reply->readAll());
+	if (!m_response_checked && !checkResponse())
+	{
+		m_status = Job_Failed;
+		discardPartial();
+		m_reply->abort();
+		return;
+	}
+	QByteArray ba = ENV.netScheduler()->read(this, m_reply.get());
+	// error pages are not what we came for
+	if (!m_write_body || m_status == Job_Failed)
+		return;
+	if (m_output_file.write(ba) != ba.size())
+	{
+		m_status = Job_Failed;
+		discardPartial();
+		m_reply->abort();
+		return;
+	}
+	m_resume.size += ba.size();
+}
+
+QString MD5EtagDownload::coalescingKey() const
+{
+	return QFileInfo(m_target_path).absoluteFilePath();
 }
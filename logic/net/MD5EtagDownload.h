@@ -16,6 +16,7 @@
 #pragma once
 
 #include "NetAction.h"
+#include "DownloadResume.h"
 #include <QFile>
 
 typedef std::shared_ptr<class MD5EtagDownload> Md5EtagDownloadPtr;
@@ -31,6 +32,12 @@ public:
 	QString m_target_path;
 	/// this is the output file, if any
 	QFile m_output_file;
+	/// what a failed attempt left in the output file, kept for resuming
+	DownloadResume m_resume;
+	/// the reply has been checked for status and ranges
+	bool m_response_checked = false;
+	/// the body of the reply is the file we want (not an error page)
+	bool m_write_body = false;
 
 public:
 	explicit MD5EtagDownload(QUrl url, QString target_path);
@@ -39,6 +46,7 @@ public:
 		return Md5EtagDownloadPtr(new MD5EtagDownload(url, target_path));
 	}
 	virtual ~MD5EtagDownload(){};
+	virtual QString coalescingKey() const;
 protected
 slots:
 	virtual void downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
@@ -49,4 +57,8 @@ slots:
 public
 slots:
 	virtual void start();
+
+private:
+	bool checkResponse();
+	void discardPartial();
 };
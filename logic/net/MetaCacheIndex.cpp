@@ -0,0 +1,215 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MetaCacheIndex.h"
+
+#include <QtEndian>
+#include <QDebug>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+const char magic[4] = {'M', 'M', 'C', 'I'};
+const int headerSize = 16;
+// four (offset, size) pairs and the local and last access timestamps
+const int recordSize = 4 * 8 + 8 + 8;
+// version 2 didn't have the last access timestamp
+const int recordSizeV2 = 4 * 8 + 8;
+
+int compareKeys(const char *a, int a_size, const char *b, int b_size)
+{
+	int result = memcmp(a, b, qMin(a_size, b_size));
+	if (result != 0)
+		return result;
+	return a_size - b_size;
+}
+
+QByteArray makeKey(const QString &base, const QString &path)
+{
+	QByteArray key = base.toUtf8();
+	key.append('\0');
+	key.append(path.toUtf8());
+	return key;
+}
+}
+
+bool MetaCacheIndex::open(const QString &path)
+{
+	close();
+	m_file.setFileName(path);
+	if (!m_file.open(QIODevice::ReadOnly))
+		return false;
+	m_size = m_file.size();
+	if (m_size < headerSize)
+	{
+		close();
+		return false;
+	}
+	m_data = m_file.map(0, m_size);
+	if (!m_data)
+	{
+		qWarning() << "Could not map" << path << ":" << m_file.errorString();
+		close();
+		return false;
+	}
+	quint32 file_version = qFromLittleEndian<quint32>(m_data + 4);
+	if (memcmp(m_data, magic, sizeof(magic)) != 0 || (file_version != version && file_version != 2))
+	{
+		close();
+		return false;
+	}
+	m_record_size = file_version == 2 ? recordSizeV2 : recordSize;
+	quint32 count = qFromLittleEndian<quint32>(m_data + 8);
+	if (qint64(count) * m_record_size + headerSize > m_size)
+	{
+		qWarning() << "Truncated meta cache index" << path;
+		close();
+		return false;
+	}
+	m_count = count;
+	return true;
+}
+
+void MetaCacheIndex::close()
+{
+	if (m_data)
+	{
+		m_file.unmap(const_cast<uchar *>(m_data));
+		m_data = nullptr;
+	}
+	m_file.close();
+	m_size = 0;
+	m_count = 0;
+}
+
+const uchar *MetaCacheIndex::record(int index) const
+{
+	return m_data + headerSize + qint64(index) * m_record_size;
+}
+
+QByteArray MetaCacheIndex::string(const uchar *field) const
+{
+	quint32 offset = qFromLittleEndian<quint32>(field);
+	quint32 size = qFromLittleEndian<quint32>(field + 4);
+	// never trust the file to stay inside itself
+	if (qint64(offset) + size > m_size)
+		return QByteArray();
+	return QByteArray::fromRawData((const char *)m_data + offset, size);
+}
+
+MetaCacheIndex::Record MetaCacheIndex::at(int index) const
+{
+	Record out;
+	if (index < 0 || index >= m_count)
+		return out;
+	const uchar *rec = record(index);
+	QByteArray key = string(rec);
+	int separator = key.indexOf('\0');
+	out.base = QString::fromUtf8(key.left(separator));
+	out.path = QString::fromUtf8(key.mid(separator + 1));
+	out.md5sum = QString::fromUtf8(string(rec + 8));
+	out.etag = QString::fromUtf8(string(rec + 16));
+	out.remote_changed_timestamp = QString::fromUtf8(string(rec + 24));
+	out.local_changed_timestamp = qFromLittleEndian<qint64>(rec + 32);
+	if (m_record_size == recordSize)
+	{
+		out.last_access_timestamp = qFromLittleEndian<qint64>(rec + 40);
+	}
+	return out;
+}
+
+bool MetaCacheIndex::find(const QString &base, const QString &path, Record &out) const
+{
+	if (!m_data)
+		return false;
+	QByteArray key = makeKey(base, path);
+	int low = 0;
+	int high = m_count - 1;
+	while (low <= high)
+	{
+		int middle = low + (high - low) / 2;
+		QByteArray candidate = string(record(middle));
+		int result = compareKeys(candidate.constData(), candidate.size(), key.constData(), key.size());
+		if (result == 0)
+		{
+			out = at(middle);
+			return true;
+		}
+		if (result < 0)
+			low = middle + 1;
+		else
+			high = middle - 1;
+	}
+	return false;
+}
+
+QByteArray MetaCacheIndex::serialize(const QList<Record> &records)
+{
+	struct Prepared
+	{
+		QByteArray strings[4];
+		qint64 local_changed_timestamp;
+		qint64 last_access_timestamp;
+	};
+	QList<Prepared> prepared;
+	prepared.reserve(records.size());
+	for (auto &record : records)
+	{
+		Prepared p;
+		p.strings[0] = makeKey(record.base, record.path);
+		p.strings[1] = record.md5sum.toUtf8();
+		p.strings[2] = record.etag.toUtf8();
+		p.strings[3] = record.remote_changed_timestamp.toUtf8();
+		p.local_changed_timestamp = record.local_changed_timestamp;
+		p.last_access_timestamp = record.last_access_timestamp;
+		prepared.append(p);
+	}
+	std::sort(prepared.begin(), prepared.end(), [](const Prepared &a, const Prepared &b)
+	{
+		return compareKeys(a.strings[0].constData(), a.strings[0].size(),
+						   b.strings[0].constData(), b.strings[0].size()) < 0;
+	});
+
+	qint64 stringsSize = 0;
+	for (auto &p : prepared)
+	{
+		for (auto &s : p.strings)
+			stringsSize += s.size();
+	}
+	QByteArray out(headerSize + prepared.size() * recordSize + stringsSize, '\0');
+	uchar *data = (uchar *)out.data();
+	memcpy(data, magic, sizeof(magic));
+	qToLittleEndian<quint32>(version, data + 4);
+	qToLittleEndian<quint32>(prepared.size(), data + 8);
+
+	uchar *rec = data + headerSize;
+	quint32 offset = headerSize + prepared.size() * recordSize;
+	for (auto &p : prepared)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			const QByteArray &s = p.strings[i];
+			qToLittleEndian<quint32>(offset, rec + i * 8);
+			qToLittleEndian<quint32>(s.size(), rec + i * 8 + 4);
+			memcpy(data + offset, s.constData(), s.size());
+			offset += s.size();
+		}
+		qToLittleEndian<qint64>(p.local_changed_timestamp, rec + 32);
+		qToLittleEndian<qint64>(p.last_access_timestamp, rec + 40);
+		rec += recordSize;
+	}
+	return out;
+}
@@ -0,0 +1,84 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <QString>
+#include <QFile>
+#include <QList>
+
+/**
+ * Read-only, memory-mapped binary index of the HTTP meta cache.
+ *
+ * Layout (all integers little endian):
+ *   header:  "MMCI", version (u32), record count (u32), reserved (u32)
+ *   records: count * { key, md5sum, etag, remote timestamp: (offset u32, size u32) each,
+ *                      local timestamp (i64), last access timestamp (i64) }, sorted by key bytes
+ *   strings: UTF-8 data the records point to. The key is "<base>\0<path>".
+ *
+ * Lookups are a binary search over the mapped records and only the found record is decoded.
+ * Version 2 files (without the last access timestamp) can still be read.
+ */
+class MetaCacheIndex
+{
+public:
+	static const quint32 version = 3;
+
+	struct Record
+	{
+		QString base;
+		QString path;
+		QString md5sum;
+		QString etag;
+		QString remote_changed_timestamp;
+		qint64 local_changed_timestamp = 0;
+		qint64 last_access_timestamp = 0;
+	};
+
+public:
+	~MetaCacheIndex()
+	{
+		close();
+	}
+
+	/// map the index file. Returns false if it doesn't exist or isn't a valid index.
+	bool open(const QString &path);
+	void close();
+	bool isOpen() const
+	{
+		return m_data != nullptr;
+	}
+
+	int count() const
+	{
+		return m_count;
+	}
+	Record at(int index) const;
+	bool find(const QString &base, const QString &path, Record &out) const;
+
+	/// produce the contents of an index file holding the records
+	static QByteArray serialize(const QList<Record> &records);
+
+private:
+	const uchar *record(int index) const;
+	QByteArray string(const uchar *field) const;
+
+private:
+	QFile m_file;
+	const uchar *m_data = nullptr;
+	qint64 m_size = 0;
+	int m_count = 0;
+	int m_record_size = 0;
+};
@@ -0,0 +1,161 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MetaCacheJournal.h"
+#include "FileSystem.h"
+
+#include <QDataStream>
+#include <QtEndian>
+#include <QDebug>
+
+namespace
+{
+const int frameHeaderSize = 6;
+// changes are tiny. anything bigger than this is garbage.
+const quint32 maxPayloadSize = 1024 * 1024;
+
+QByteArray encode(MetaCacheJournal::Operation operation, const MetaCacheIndex::Record &record)
+{
+	QByteArray payload;
+	QDataStream out(&payload, QIODevice::WriteOnly);
+	out.setVersion(QDataStream::Qt_5_0);
+	out << quint8(operation) << record.base << record.path << record.md5sum << record.etag
+		<< record.remote_changed_timestamp << record.local_changed_timestamp
+		<< record.last_access_timestamp;
+
+	QByteArray frame(frameHeaderSize, '\0');
+	qToLittleEndian<quint32>(payload.size(), (uchar *)frame.data());
+	qToLittleEndian<quint16>(qChecksum(payload.constData(), payload.size()),
+							 (uchar *)frame.data() + 4);
+	frame.append(payload);
+	return frame;
+}
+
+/// decode all complete frames, returns the number of bytes they take up
+qint64 decode(const QByteArray &data, QList<MetaCacheJournal::Change> &changes)
+{
+	qint64 offset = 0;
+	while (offset + frameHeaderSize <= data.size())
+	{
+		const uchar *header = (const uchar *)data.constData() + offset;
+		quint32 size = qFromLittleEndian<quint32>(header);
+		quint16 checksum = qFromLittleEndian<quint16>(header + 4);
+		if (size > maxPayloadSize || offset + frameHeaderSize + size > data.size())
+			break;
+		const char *payload = data.constData() + offset + frameHeaderSize;
+		if (qChecksum(payload, size) != checksum)
+			break;
+
+		QDataStream in(QByteArray::fromRawData(payload, size));
+		in.setVersion(QDataStream::Qt_5_0);
+		quint8 operation;
+		MetaCacheJournal::Change change;
+		in >> operation >> change.record.base >> change.record.path >> change.record.md5sum >>
+			change.record.etag >> change.record.remote_changed_timestamp >>
+			change.record.local_changed_timestamp >> change.record.last_access_timestamp;
+		if (in.status() != QDataStream::Ok ||
+			(operation != MetaCacheJournal::Put && operation != MetaCacheJournal::Remove))
+			break;
+		change.operation = MetaCacheJournal::Operation(operation);
+		changes.append(change);
+		offset += frameHeaderSize + size;
+	}
+	return offset;
+}
+}
+
+bool MetaCacheJournal::open(const QString &path, QList<Change> &changes)
+{
+	close();
+	m_path = path;
+	m_file.setFileName(path);
+	if (!m_file.open(QIODevice::ReadWrite))
+	{
+		qWarning() << "Could not open" << path << ":" << m_file.errorString();
+		return false;
+	}
+	QByteArray data = m_file.readAll();
+	int before = changes.size();
+	m_size = decode(data, changes);
+	m_count = changes.size() - before;
+	if (m_size != data.size())
+	{
+		qWarning() << "Dropping" << data.size() - m_size << "bytes of damaged journal from" << path;
+		m_file.resize(m_size);
+	}
+	m_file.seek(m_size);
+	return true;
+}
+
+void MetaCacheJournal::close()
+{
+	sync();
+	m_file.close();
+	m_unsynced = false;
+	m_size = 0;
+	m_count = 0;
+}
+
+bool MetaCacheJournal::append(Operation operation, const MetaCacheIndex::Record &record)
+{
+	if (!m_file.isOpen())
+		return false;
+	QByteArray frame = encode(operation, record);
+	m_file.seek(m_size);
+	// out of our buffers, so it survives the process. sync() takes care of the rest.
+	if (m_file.write(frame) != frame.size() || !m_file.flush())
+	{
+		qWarning() << "Could not write to" << m_path << ":" << m_file.errorString();
+		// don't leave half a frame behind for the next append to follow
+		m_file.resize(m_size);
+		return false;
+	}
+	m_size += frame.size();
+	m_count++;
+	m_unsynced = true;
+	return true;
+}
+
+bool MetaCacheJournal::sync()
+{
+	if (!m_unsynced || !m_file.isOpen())
+		return true;
+	if (!FS::syncFile(m_file))
+	{
+		qWarning() << "Could not sync" << m_path << ":" << m_file.errorString();
+		return false;
+	}
+	m_unsynced = false;
+	return true;
+}
+
+bool MetaCacheJournal::dropFront(qint64 bytes)
+{
+	if (!m_file.isOpen())
+		return false;
+	m_file.seek(bytes);
+	QByteArray rest = m_file.readAll();
+	m_file.close();
+	try
+	{
+		FS::write(m_path, rest);
+	}
+	catch (Exception &e)
+	{
+		qWarning() << e.what();
+	}
+	QList<Change> remaining;
+	return open(m_path, remaining);
+}
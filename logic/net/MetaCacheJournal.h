@@ -0,0 +1,80 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <QString>
+#include <QFile>
+#include <QList>
+#include "MetaCacheIndex.h"
+
+/**
+ * Append-only log of changes made to the HTTP meta cache since its index was last written.
+ *
+ * Every change is a separate frame: payload size (u32), checksum of the payload (u16), payload.
+ * A frame that was only partially written when the process died fails the size or checksum
+ * check and is cut off, along with everything after it, when the journal is opened again.
+ */
+class MetaCacheJournal
+{
+public:
+	enum Operation
+	{
+		Put = 1,
+		Remove = 2
+	};
+	struct Change
+	{
+		Operation operation;
+		MetaCacheIndex::Record record;
+	};
+
+public:
+	~MetaCacheJournal()
+	{
+		close();
+	}
+
+	/// open or create the journal and read all the complete changes in it
+	bool open(const QString &path, QList<Change> &changes);
+	void close();
+
+	/// write a change to the end of the journal right away. It is only sure to be on the disk
+	/// after the next sync().
+	bool append(Operation operation, const MetaCacheIndex::Record &record);
+
+	/// wait for everything appended so far to be on the disk
+	bool sync();
+
+	/// remove the first 'bytes' bytes of the journal, they are in the index now
+	bool dropFront(qint64 bytes);
+
+	qint64 size() const
+	{
+		return m_size;
+	}
+	int count() const
+	{
+		return m_count;
+	}
+
+private:
+	QString m_path;
+	QFile m_file;
+	qint64 m_size = 0;
+	int m_count = 0;
+	/// appended since the last sync
+	bool m_unsynced = false;
+};
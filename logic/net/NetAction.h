@@ -19,6 +19,7 @@
 #include <QUrl>
 #include <memory>
 #include <QNetworkReply>
+#include <QElapsedTimer>
 #include <QObjectPtr.h>
 
 enum JobStatus
@@ -29,6 +30,59 @@ enum JobStatus
 	Job_Failed
 };
 
+/// Where the time of one attempt at a NetAction went. Times are in microseconds on
+/// a monotonic clock shared by all actions, -1 when the point was never reached.
+struct NetActionTiming
+{
+	enum Result
+	{
+		Pending,
+		/// the body was transferred
+		Downloaded,
+		/// the server said the cached file is still good (304)
+		NotModified,
+		/// the cached file was used without asking the server
+		CacheHit,
+		/// another action with the same target did the transfer
+		Coalesced,
+		Failed
+	};
+
+	/// the current time on the clock used for all the timestamps
+	static qint64 now()
+	{
+		static QElapsedTimer clock;
+		if (!clock.isValid())
+			clock.start();
+		return clock.nsecsElapsed() / 1000;
+	}
+
+	/// final URL, after redirects
+	QString url;
+	/// index of the action within its job
+	int index = 0;
+	/// number of failed attempts before this one
+	int retries = 0;
+	/// handed over to the scheduler
+	qint64 queued = -1;
+	/// started by the scheduler
+	qint64 started = -1;
+	/// TLS handshake done. Only known for new HTTPS connections.
+	qint64 connected = -1;
+	/// response headers received
+	qint64 responded = -1;
+	/// first bytes of the body received
+	qint64 first_byte = -1;
+	qint64 finished = -1;
+	/// bytes received during this attempt
+	qint64 bytes = 0;
+	/// HTTP status of the last response, 0 if there was none
+	int http_status = 0;
+	/// error the last reply ended with
+	QNetworkReply::NetworkError error = QNetworkReply::NoError;
+	Result result = Pending;
+};
+
 typedef std::shared_ptr<class NetAction> NetActionPtr;
 class NetAction : public QObject, public std::enable_shared_from_this<NetAction>
 {
@@ -57,6 +111,21 @@ public:
 		return shared_from_this();
 	}
 
+	/// actions that produce the same file share a key. Only one of them runs at a time,
+	/// the rest take over its result. Empty means the action never shares.
+	virtual QString coalescingKey() const
+	{
+		return QString();
+	}
+	/// another action with the same key succeeded. Finish this one with its result.
+	virtual void takeResultFrom(NetActionPtr other)
+	{
+		m_total_progress = other->m_total_progress;
+		m_progress = m_total_progress;
+		m_status = Job_Finished;
+		emit succeeded(m_index_within_job);
+	}
+
 public:
 	/// the network reply
 	QObjectPtr<QNetworkReply> m_reply;
@@ -73,17 +142,87 @@ public:
 	/// index within the parent job
 	int m_index_within_job = 0;
 
+	enum Priority
+	{
+		LowPriority = -1,
+		NormalPriority = 0,
+		/// other work waits for this one, start it as soon as possible
+		CriticalPriority = 1
+	};
+	/// actions with a higher priority are started first
+	int m_priority = NormalPriority;
+	/// expected size in bytes, -1 if unknown. Among equal priorities, bigger ones start first.
+	qint64 m_size_hint = -1;
+
 	qint64 m_progress = 0;
 	qint64 m_total_progress = 1;
 
 	/// number of failures up to this point
 	int m_failures = 0;
 
+	/// abort() was called. There is no point in keeping anything for another attempt.
+	bool m_aborted = false;
+
+	/// share of the bandwidth limit relative to other actions. Set by the job.
+	double m_bandwidth_weight = 1.0;
+
+	/// timing of the current (or last) attempt. Mostly filled in by the scheduler.
+	NetActionTiming m_timing;
+
+	/// close the timing of the current attempt. Only the first call after a start counts.
+	void finishTiming(bool success)
+	{
+		auto &timing = m_timing;
+		if (timing.finished >= 0)
+			return;
+		timing.finished = NetActionTiming::now();
+		timing.url = m_url.toString();
+		timing.index = m_index_within_job;
+		if (!success)
+			timing.result = NetActionTiming::Failed;
+		else if (timing.result != NetActionTiming::Pending)
+			return;
+		else if (timing.http_status == 304)
+			timing.result = NetActionTiming::NotModified;
+		else if (timing.responded < 0 && !timing.bytes)
+			timing.result = NetActionTiming::CacheHit;
+		else
+			timing.result = NetActionTiming::Downloaded;
+	}
+
+protected:
+	/// record when the reply connects and responds. Call for every request sent.
+	void trackReply(QNetworkReply *reply)
+	{
+#ifndef QT_NO_SSL
+		connect(reply, &QNetworkReply::encrypted, this, [this]()
+		{
+			if (m_timing.connected < 0)
+				m_timing.connected = NetActionTiming::now();
+		});
+#endif
+		connect(reply, &QNetworkReply::metaDataChanged, this, [this, reply]()
+		{
+			if (m_timing.responded < 0)
+				m_timing.responded = NetActionTiming::now();
+			m_timing.http_status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+		});
+		connect(reply, static_cast<void (QNetworkReply::*)(QNetworkReply::NetworkError)>(
+						   &QNetworkReply::error),
+				this, [this](QNetworkReply::NetworkError error)
+		{
+			m_timing.error = error;
+		});
+	}
+
 signals:
 	void started(int index);
 	void netActionProgress(int index, qint64 current, qint64 total);
 	void succeeded(int index);
 	void failed(int index);
+	/// the network part is over and the action only has local work left (unpacking, ...).
+	/// Its connection slot goes to the next action. succeeded() or failed() still follow.
+	void transferDone(int index);
 
 protected
 slots:
@@ -95,4 +234,28 @@ slots:
 public
 slots:
 	virtual void start() = 0;
+	/// stop the action. It fails as soon as possible and doesn't leave partial files behind.
+	virtual bool abort()
+	{
+		m_aborted = true;
+		if (m_status != Job_InProgress)
+			return true;
+		m_status = Job_Failed;
+		if (m_reply)
+		{
+			// the reply finishes right away and the action fails the usual way
+			m_reply->abort();
+		}
+		else
+		{
+			emit failed(m_index_within_job);
+		}
+		return true;
+	}
+	/// the bandwidth limit allows reading again
+	virtual void resumeReading()
+	{
+		if (m_reply)
+			downloadReadyRead();
+	}
 };
@@ -14,40 +14,103 @@
  */
 
 #include "NetJob.h"
+#include "NetScheduler.h"
+#include "Env.h"
 #include "pathutils.h"
 #include "MD5EtagDownload.h"
 #include "ByteArrayDownload.h"
 #include "CacheDownload.h"
 
 #include <QDebug>
+#include <QTimer>
+#include <QDir>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <random>
+#include <algorithm>
+
+QString NetJob::s_traceDirectory;
+
+namespace
+{
+// parts report progress for every chunk they receive. Nobody needs to see it that often.
+const int progressInterval = 100;
+}
+
+NetJob::NetJob(QString job_name) : Task(), m_job_name(job_name)
+{
+	m_progressTimer.setInterval(progressInterval);
+	m_progressTimer.setTimerType(Qt::CoarseTimer);
+	connect(&m_progressTimer, SIGNAL(timeout()), SLOT(publishProgress()));
+}
+
+NetJob::~NetJob()
+{
+	// parts still sitting in the scheduler would keep their slots, or start with nobody listening
+	stopParts();
+}
 
 void NetJob::partSucceeded(int index)
 {
 	// do progress. all slots are 1 in size at least
 	auto &slot = parts_progress[index];
 	partProgress(index, slot.total_progress, slot.total_progress);
+	recordTiming(index, true);
 
 	m_doing.remove(index);
 	m_done.insert(index);
 	downloads[index].get()->disconnect(this);
+	progressChanged();
 	startMoreParts();
 }
 
+int RetryPolicy::delayFor(int retry) const
+{
+	static std::mt19937 rng(std::random_device{}());
+	qint64 delay = initialDelay;
+	for (int i = 1; i < retry && delay < maxDelay; i++)
+	{
+		delay *= 2;
+	}
+	delay = qMin<qint64>(delay, maxDelay);
+	// keep the fixed part, randomize the rest
+	qint64 randomized = delay * jitter;
+	std::uniform_int_distribution<qint64> dist(0, qMax<qint64>(randomized, 0));
+	return delay - randomized + dist(rng);
+}
+
 void NetJob::partFailed(int index)
 {
 	m_doing.remove(index);
 	auto &slot = parts_progress[index];
-	if (slot.failures == 3)
+	recordTiming(index, false);
+	downloads[index].get()->disconnect(this);
+	if (slot.failures >= m_retryPolicy.maxRetries)
 	{
 		m_failed.insert(index);
+		progressChanged();
+		startMoreParts();
+		return;
 	}
-	else
+	slot.failures++;
+	int delay = m_retryPolicy.delayFor(slot.failures);
+	qDebug() << m_job_name << "retrying" << downloads[index]->m_url.toString() << "in" << delay
+			 << "ms";
+	m_retrying.insert(index);
+	auto timer = new QTimer(this);
+	timer->setSingleShot(true);
+	connect(timer, &QTimer::timeout, this, [this, index, timer]()
 	{
-		slot.failures++;
+		timer->deleteLater();
+		if (!m_running)
+			return;
+		m_retrying.remove(index);
 		m_todo.enqueue(index);
-	}
-	downloads[index].get()->disconnect(this);
-	startMoreParts();
+		startMoreParts();
+	});
+	timer->start(delay);
 }
 
 void NetJob::partProgress(int index, qint64 bytesReceived, qint64 bytesTotal)
@@ -61,7 +124,29 @@ void NetJob::partProgress(int index, qint64 bytesReceived, qint64 bytesTotal)
 	total_progress -= slot.total_progress;
 	slot.total_progress = bytesTotal;
 	total_progress += slot.total_progress;
+	progressChanged();
+}
+
+void NetJob::progressChanged()
+{
+	m_progressDirty = true;
+	if (!m_progressTimer.isActive())
+	{
+		m_progressTimer.start();
+	}
+}
+
+void NetJob::publishProgress()
+{
+	if (!m_progressDirty)
+	{
+		// nothing happened for a whole interval
+		m_progressTimer.stop();
+		return;
+	}
+	m_progressDirty = false;
 	setProgress(current_progress, total_progress);
+	emit filesProgress(m_done.size(), m_failed.size(), downloads.size());
 }
 
 void NetJob::executeTask()
@@ -76,13 +161,50 @@ void NetJob::executeTask()
 	QMetaObject::invokeMethod(this, "startMoreParts", Qt::QueuedConnection);
 }
 
+bool NetJob::abort()
+{
+	if (!m_running)
+		return false;
+	qDebug() << m_job_name << "aborted.";
+	m_running = false;
+	m_progressTimer.stop();
+	m_todo.clear();
+	m_retrying.clear();
+	stopParts();
+	emitAborted();
+	return true;
+}
+
+void NetJob::stopParts()
+{
+	if (m_doing.isEmpty())
+		return;
+	auto scheduler = ENV.netScheduler();
+	for (auto index : m_doing)
+	{
+		auto part = downloads[index];
+		// the failure that follows is ours, don't retry it
+		part->disconnect(this);
+		if (!scheduler->dequeue(part))
+		{
+			part->abort();
+		}
+	}
+	m_doing.clear();
+}
+
 void NetJob::startMoreParts()
 {
 	// check for final conditions if there's nothing in the queue
 	if(!m_todo.size())
 	{
-		if(!m_doing.size())
+		if(!m_doing.size() && !m_retrying.size())
 		{
+			m_running = false;
+			// whoever watches gets the final numbers before the result
+			publishProgress();
+			m_progressTimer.stop();
+			writeTraceIfWanted();
 			if(!m_failed.size())
 			{
 				qDebug() << m_job_name << "succeeded.";
@@ -96,20 +218,22 @@ void NetJob::startMoreParts()
 		}
 		return;
 	}
-	// otherwise try to start more parts
-	while (m_doing.size() < 6)
+	// otherwise hand the parts over to the scheduler. It decides when they actually start.
+	auto scheduler = ENV.netScheduler();
+	while (m_todo.size())
 	{
-		if(!m_todo.size())
-			return;
 		int doThis = m_todo.dequeue();
 		m_doing.insert(doThis);
 		auto part = downloads[doThis];
+		part->m_bandwidth_weight = m_bandwidth_weight;
+		part->m_timing = NetActionTiming();
+		part->m_timing.retries = parts_progress[doThis].failures;
 		// connect signals :D
 		connect(part.get(), SIGNAL(succeeded(int)), SLOT(partSucceeded(int)));
 		connect(part.get(), SIGNAL(failed(int)), SLOT(partFailed(int)));
 		connect(part.get(), SIGNAL(netActionProgress(int, qint64, qint64)),
 				SLOT(partProgress(int, qint64, qint64)));
-		part->start();
+		scheduler->enqueue(part);
 	}
 }
 
@@ -124,3 +248,277 @@ QStringList NetJob::getFailedFiles()
 	failed.sort();
 	return failed;
 }
+
+void NetJob::recordTiming(int index, bool success)
+{
+	auto part = downloads[index];
+	part->finishTiming(success);
+	m_timings.append(part->m_timing);
+}
+
+namespace
+{
+qint64 percentile(QList<qint64> values, double fraction)
+{
+	if (values.isEmpty())
+		return 0;
+	std::sort(values.begin(), values.end());
+	return values[qMin<int>(values.size() - 1, values.size() * fraction)];
+}
+
+QString resultName(NetActionTiming::Result result)
+{
+	switch (result)
+	{
+	case NetActionTiming::Downloaded:
+		return "downloaded";
+	case NetActionTiming::NotModified:
+		return "not modified";
+	case NetActionTiming::CacheHit:
+		return "cache hit";
+	case NetActionTiming::Coalesced:
+		return "coalesced";
+	case NetActionTiming::Failed:
+		return "failed";
+	case NetActionTiming::Pending:
+	default:
+		return "pending";
+	}
+}
+
+QJsonObject traceEvent(const QString &name, qint64 begin, qint64 end, int lane)
+{
+	QJsonObject event;
+	event.insert("name", name);
+	event.insert("cat", QString("net"));
+	event.insert("ph", QString("X"));
+	event.insert("ts", double(begin));
+	event.insert("dur", double(qMax<qint64>(end - begin, 0)));
+	event.insert("pid", 1);
+	event.insert("tid", lane);
+	return event;
+}
+
+QString formatBytes(double bytes)
+{
+	if (bytes < 1024)
+		return QString("%1 B").arg(qint64(bytes));
+	if (bytes < 1024 * 1024)
+		return QString("%1 KiB").arg(bytes / 1024.0, 0, 'f', 1);
+	return QString("%1 MiB").arg(bytes / (1024.0 * 1024.0), 0, 'f', 1);
+}
+}
+
+QByteArray NetJob::traceJson() const
+{
+	// attempts that overlap can't share a row in the viewer. Every one gets the first free row.
+	QList<NetActionTiming> timings = m_timings;
+	std::sort(timings.begin(), timings.end(), [](const NetActionTiming &a, const NetActionTiming &b)
+	{
+		return a.queued < b.queued;
+	});
+	QList<qint64> laneEnds;
+	QJsonArray events;
+
+	QJsonObject processName;
+	processName.insert("name", QString("process_name"));
+	processName.insert("ph", QString("M"));
+	processName.insert("pid", 1);
+	QJsonObject processArgs;
+	processArgs.insert("name", m_job_name);
+	processName.insert("args", processArgs);
+	events.append(processName);
+
+	for (auto &timing : timings)
+	{
+		if (timing.queued < 0 || timing.finished < 0)
+			continue;
+		int lane = 0;
+		while (lane < laneEnds.size() && laneEnds[lane] > timing.queued)
+			lane++;
+		if (lane == laneEnds.size())
+			laneEnds.append(timing.finished);
+		else
+			laneEnds[lane] = timing.finished;
+
+		QString name = QUrl(timing.url).fileName();
+		auto attempt = traceEvent(name.isEmpty() ? timing.url : name, timing.queued,
+								  timing.finished, lane);
+		QJsonObject args;
+		args.insert("url", timing.url);
+		args.insert("result", resultName(timing.result));
+		args.insert("bytes", double(timing.bytes));
+		args.insert("retries", timing.retries);
+		args.insert("http_status", timing.http_status);
+		attempt.insert("args", args);
+		events.append(attempt);
+
+		// the phases of the attempt, nested inside it
+		qint64 started = timing.started >= 0 ? timing.started : timing.finished;
+		events.append(traceEvent("queued", timing.queued, started, lane));
+		if (timing.connected >= 0)
+		{
+			events.append(traceEvent("connect", started, timing.connected, lane));
+		}
+		qint64 responded = timing.responded >= 0 ? timing.responded : timing.first_byte;
+		if (responded >= 0)
+		{
+			qint64 waitFrom = timing.connected >= 0 ? timing.connected : started;
+			events.append(traceEvent("waiting for response", waitFrom, responded, lane));
+			events.append(traceEvent("transfer", responded, timing.finished, lane));
+		}
+	}
+	QJsonObject root;
+	root.insert("traceEvents", events);
+	root.insert("displayTimeUnit", QString("ms"));
+	return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
+
+QString NetJob::timingSummary(int slowest) const
+{
+	int downloaded = 0, notModified = 0, cacheHits = 0, coalesced = 0, failed = 0;
+	int retries = 0;
+	qint64 bytes = 0, transferTime = 0;
+	qint64 begin = -1, end = -1;
+	QList<qint64> waits, responses;
+	QSet<int> files;
+	for (auto &timing : m_timings)
+	{
+		if (timing.finished < 0)
+			continue;
+		files.insert(timing.index);
+		if (timing.retries)
+			retries++;
+		switch (timing.result)
+		{
+		case NetActionTiming::Downloaded:
+			downloaded++;
+			break;
+		case NetActionTiming::NotModified:
+			notModified++;
+			break;
+		case NetActionTiming::CacheHit:
+			cacheHits++;
+			break;
+		case NetActionTiming::Coalesced:
+			coalesced++;
+			break;
+		default:
+			failed++;
+		}
+		bytes += timing.bytes;
+		if (timing.queued >= 0)
+		{
+			begin = (begin < 0) ? timing.queued : qMin(begin, timing.queued);
+			if (timing.started >= 0)
+				waits.append(timing.started - timing.queued);
+		}
+		end = qMax(end, timing.finished);
+		if (timing.started >= 0 && timing.responded >= 0)
+		{
+			responses.append(timing.responded - timing.started);
+			transferTime += timing.finished - timing.responded;
+		}
+	}
+	double seconds = (begin >= 0 && end > begin) ? (end - begin) / 1e6 : 0;
+
+	QString out;
+	out += QString("Job '%1': %2 files in %3 s, %4 attempts, %5 retries\n")
+			   .arg(m_job_name)
+			   .arg(files.size())
+			   .arg(seconds, 0, 'f', 2)
+			   .arg(m_timings.size())
+			   .arg(retries);
+	out += QString("  %1 downloaded (%2, %3/s), %4 not modified, %5 cache hits, "
+				   "%6 coalesced, %7 failed\n")
+			   .arg(downloaded)
+			   .arg(formatBytes(bytes))
+			   .arg(formatBytes(seconds > 0 ? bytes / seconds : 0))
+			   .arg(notModified)
+			   .arg(cacheHits)
+			   .arg(coalesced)
+			   .arg(failed);
+	auto line = [](const QString &what, const QList<qint64> &values)
+	{
+		qint64 sum = 0;
+		for (auto value : values)
+			sum += value;
+		qint64 average = values.isEmpty() ? 0 : sum / values.size();
+		return QString("  %1 avg %2 ms, p50 %3 ms, p95 %4 ms\n")
+			.arg(what, -9)
+			.arg(average / 1000)
+			.arg(percentile(values, 0.5) / 1000)
+			.arg(percentile(values, 0.95) / 1000);
+	};
+	out += line("queued", waits);
+	out += line("response", responses);
+	out += QString("  %1 %2 ms, summed over all parts\n").arg("transfer", -9).arg(transferTime / 1000);
+
+	if (slowest <= 0)
+		return out;
+	QList<NetActionTiming> timings = m_timings;
+	std::sort(timings.begin(), timings.end(), [](const NetActionTiming &a, const NetActionTiming &b)
+	{
+		return (a.finished - a.queued) > (b.finished - b.queued);
+	});
+	out += QString("  %1 %2 %3 %4 %5 %6\n")
+			   .arg("total ms", 9)
+			   .arg("queued", 8)
+			   .arg("response", 9)
+			   .arg("bytes", 10)
+			   .arg("result", -12)
+			   .arg("url");
+	for (int i = 0; i < timings.size() && i < slowest; i++)
+	{
+		auto &timing = timings[i];
+		if (timing.queued < 0 || timing.finished < 0)
+			continue;
+		qint64 started = timing.started >= 0 ? timing.started : timing.finished;
+		qint64 response = timing.responded >= 0 ? timing.responded - started : 0;
+		out += QString("  %1 %2 %3 %4 %5 %6\n")
+				   .arg((timing.finished - timing.queued) / 1000, 9)
+				   .arg((started - timing.queued) / 1000, 8)
+				   .arg(response / 1000, 9)
+				   .arg(timing.bytes, 10)
+				   .arg(resultName(timing.result), -12)
+				   .arg(timing.url);
+	}
+	return out;
+}
+
+bool NetJob::writeTrace(const QString &path) const
+{
+	QFile file(path);
+	if (!ensureFilePathExists(path) || !file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+	{
+		qWarning() << "Could not write network trace to" << path;
+		return false;
+	}
+	file.write(traceJson());
+	return true;
+}
+
+void NetJob::setTraceDirectory(const QString &directory)
+{
+	s_traceDirectory = directory;
+}
+
+void NetJob::writeTraceIfWanted()
+{
+	if (s_traceDirectory.isEmpty() || m_timings.isEmpty())
+		return;
+	QString name = m_job_name;
+	name.replace(QRegExp("[^a-zA-Z0-9_.-]"), "_");
+	QString fileName = QString("%1-%2.json")
+						   .arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss-zzz"))
+						   .arg(name);
+	QString path = QDir(s_traceDirectory).absoluteFilePath(fileName);
+	if (writeTrace(path))
+	{
+		qDebug() << "Network trace written to" << path;
+	}
+	for (auto line : timingSummary().split('\n', QString::SkipEmptyParts))
+	{
+		qDebug("%s", qPrintable(line));
+	}
+}
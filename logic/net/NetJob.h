@@ -27,12 +27,28 @@
 class NetJob;
 typedef QObjectPtr<NetJob> NetJobPtr;
 
+/// How a NetJob retries its failed parts
+struct RetryPolicy
+{
+	/// how many times a part is retried before the job gives up on it
+	int maxRetries = 3;
+	/// delay before the first retry, in milliseconds. It doubles with every retry.
+	int initialDelay = 500;
+	/// upper bound for the delay, in milliseconds
+	int maxDelay = 30000;
+	/// fraction of the delay that is randomized, so parts failing together don't retry together
+	double jitter = 0.5;
+
+	/// delay before the given retry (starting with 1), in milliseconds
+	int delayFor(int retry) const;
+};
+
 class NetJob : public Task
 {
 	Q_OBJECT
 public:
-	explicit NetJob(QString job_name) : Task(), m_job_name(job_name) {}
-	virtual ~NetJob() {}
+	explicit NetJob(QString job_name);
+	virtual ~NetJob();
 	template <typename T> bool addNetAction(T action)
 	{
 		NetActionPtr base = std::static_pointer_cast<NetAction>(action);
@@ -46,15 +62,12 @@ public:
 		}
 		parts_progress.append(pi);
 		total_progress += pi.total_progress;
-		// if this is already running, the action needs to be started right away!
+		// if this is already running, the action needs to be submitted right away!
 		if (isRunning())
 		{
-			setProgress(current_progress, total_progress);
-			connect(base.get(), SIGNAL(succeeded(int)), SLOT(partSucceeded(int)));
-			connect(base.get(), SIGNAL(failed(int)), SLOT(partFailed(int)));
-			connect(base.get(), SIGNAL(netActionProgress(int, qint64, qint64)),
-					SLOT(partProgress(int, qint64, qint64)));
-			base->start();
+			progressChanged();
+			m_todo.enqueue(base->m_index_within_job);
+			startMoreParts();
 		}
 		return true;
 	}
@@ -83,19 +96,89 @@ public:
 	}
 	QStringList getFailedFiles();
 
+	/// number of parts that are done, failed for good, and all of them
+	int filesDone() const
+	{
+		return m_done.size();
+	}
+	int filesFailed() const
+	{
+		return m_failed.size();
+	}
+	int filesTotal() const
+	{
+		return downloads.size();
+	}
+
+	void setRetryPolicy(const RetryPolicy &policy)
+	{
+		m_retryPolicy = policy;
+	}
+	RetryPolicy retryPolicy() const
+	{
+		return m_retryPolicy;
+	}
+
+	/// share of the global bandwidth limit the parts of this job get, relative to other jobs
+	void setBandwidthWeight(double weight)
+	{
+		m_bandwidth_weight = qMax(weight, 0.01);
+		for (auto part : downloads)
+		{
+			part->m_bandwidth_weight = m_bandwidth_weight;
+		}
+	}
+	double bandwidthWeight() const
+	{
+		return m_bandwidth_weight;
+	}
+
+	/// timing of every finished attempt of every part, in the order they finished
+	QList<NetActionTiming> timings() const
+	{
+		return m_timings;
+	}
+	/// the timings as Chrome trace events (chrome://tracing, Perfetto)
+	QByteArray traceJson() const;
+	bool writeTrace(const QString &path) const;
+	/// human readable totals, followed by the given number of slowest attempts
+	QString timingSummary(int slowest = 10) const;
+
+	/// when set, every job writes its trace there and logs its summary when it ends
+	static void setTraceDirectory(const QString &directory);
+
+signals:
+	/// published together with progress(), at most once per progress interval
+	void filesProgress(int done, int failed, int total);
+
 private slots:
 	void startMoreParts();
+	void publishProgress();
 
 public slots:
 	virtual void executeTask();
-	// FIXME: implement
-	virtual bool abort() {return false;};
+	/// stop everything that is queued or running. The job emits aborted() right away.
+	virtual bool abort();
+
+public:
+	virtual bool canAbort() const
+	{
+		return true;
+	}
 
 private slots:
 	void partProgress(int index, qint64 bytesReceived, qint64 bytesTotal);
 	void partSucceeded(int index);
 	void partFailed(int index);
 
+private:
+	void recordTiming(int index, bool success);
+	/// totals changed. They are published by the progress timer, not right away.
+	void progressChanged();
+	void writeTraceIfWanted();
+	/// take the running and queued parts out of the scheduler
+	void stopParts();
+
 private:
 	struct part_info
 	{
@@ -111,7 +194,15 @@ private:
 	QSet<int> m_doing;
 	QSet<int> m_done;
 	QSet<int> m_failed;
+	/// parts waiting for their retry delay to pass
+	QSet<int> m_retrying;
+	RetryPolicy m_retryPolicy;
+	double m_bandwidth_weight = 1.0;
+	QList<NetActionTiming> m_timings;
+	static QString s_traceDirectory;
 	qint64 current_progress = 0;
 	qint64 total_progress = 0;
+	QTimer m_progressTimer;
+	bool m_progressDirty = false;
 	bool m_running = false;
 };
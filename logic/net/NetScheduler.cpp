@@ -0,0 +1,566 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NetScheduler.h"
+
+#include <QDebug>
+#include <algorithm>
+
+namespace
+{
+// how often the limits are re-evaluated
+const int sampleInterval = 1000;
+// what every host starts with - the same number of connections a NetJob used to open
+const int initialHostLimit = 6;
+const int initialGlobalLimit = 16;
+// weight of the newest sample in the smoothed values
+const double smoothing = 0.3;
+// how often tokens are handed out while the rate limit is on
+const int refillInterval = 50;
+// read buffer of replies while the rate limit is on. Qt stops reading the socket when it is full.
+const qint64 throttledBufferSize = 64 * 1024;
+
+// the host or the way to it is in trouble, not just this one request (404, bad hash, full disk)
+bool hostInTrouble(const NetActionTiming &timing)
+{
+	if (timing.http_status >= 500)
+		return true;
+	switch (timing.error)
+	{
+	case QNetworkReply::ConnectionRefusedError:
+	case QNetworkReply::RemoteHostClosedError:
+	case QNetworkReply::HostNotFoundError:
+	case QNetworkReply::TimeoutError:
+	case QNetworkReply::TemporaryNetworkFailureError:
+	case QNetworkReply::NetworkSessionFailedError:
+	case QNetworkReply::UnknownNetworkError:
+	case QNetworkReply::ProxyConnectionRefusedError:
+	case QNetworkReply::ProxyConnectionClosedError:
+	case QNetworkReply::ProxyNotFoundError:
+	case QNetworkReply::ProxyTimeoutError:
+		return true;
+	default:
+		return false;
+	}
+}
+}
+
+void NetScheduler::Limiter::setBounds(int newMinimum, int newMaximum)
+{
+	minimum = qMax(1, newMinimum);
+	maximum = qMax(minimum, newMaximum);
+	limit = qBound(minimum, limit, maximum);
+}
+
+void NetScheduler::Limiter::sampleLatency(double ms)
+{
+	latency = (latency == 0) ? ms : latency * (1.0 - smoothing) + ms * smoothing;
+	if (min_latency == 0 || ms < min_latency)
+	{
+		min_latency = ms;
+	}
+}
+
+bool NetScheduler::Limiter::adapt(double seconds)
+{
+	double rate = window_bytes / seconds;
+	window_bytes = 0;
+	throughput = (throughput == 0) ? rate : throughput * (1.0 - smoothing) + rate * smoothing;
+
+	int old_limit = limit;
+	// only probe while the limit is actually what holds things back
+	if (saturated)
+	{
+		if (min_latency > 0 && latency > min_latency * 4)
+		{
+			// the other side is getting slower to respond. back off.
+			limit = qMax(minimum, limit - qMax(1, limit / 4));
+		}
+		else if (rate > last_rate * 1.1)
+		{
+			// the last change helped, try one more connection
+			limit = qMin(maximum, limit + 1);
+		}
+		else if (rate < last_rate * 0.75)
+		{
+			limit = qMax(minimum, limit - 1);
+		}
+	}
+	saturated = false;
+	last_rate = rate;
+	return limit != old_limit;
+}
+
+NetScheduler::NetScheduler(QObject *parent) : QObject(parent)
+{
+	m_global.setBounds(4, 32);
+	m_global.limit = initialGlobalLimit;
+	m_adaptTimer.setInterval(sampleInterval);
+	connect(&m_adaptTimer, SIGNAL(timeout()), SLOT(adaptLimits()));
+	m_rateTimer.setInterval(refillInterval);
+	m_rateTimer.setTimerType(Qt::PreciseTimer);
+	connect(&m_rateTimer, SIGNAL(timeout()), SLOT(refillTokens()));
+}
+
+QString NetScheduler::hostKey(NetActionPtr action)
+{
+	return action->m_url.host().toLower();
+}
+
+bool NetScheduler::startsBefore(const NetActionPtr &a, const NetActionPtr &b)
+{
+	if (a->m_priority != b->m_priority)
+		return a->m_priority > b->m_priority;
+	return a->m_size_hint > b->m_size_hint;
+}
+
+void NetScheduler::enqueue(NetActionPtr action)
+{
+	action->m_timing.queued = NetActionTiming::now();
+	QString coalescingKey = action->coalescingKey();
+	if (!coalescingKey.isEmpty())
+	{
+		auto leader = m_leaders.value(coalescingKey);
+		if (leader && leader != action)
+		{
+			m_followers[leader.get()].append(action);
+			return;
+		}
+		m_leaders.insert(coalescingKey, action);
+	}
+	queueAction(action);
+}
+
+void NetScheduler::queueAction(NetActionPtr action)
+{
+	QString key = hostKey(action);
+	if (!m_hosts.contains(key))
+	{
+		Host host;
+		host.limiter.limit = initialHostLimit;
+		host.limiter.setBounds(m_hostMinimum, m_hostMaximum);
+		m_hosts.insert(key, host);
+	}
+	// behind everything that goes first or ties with it, so equal actions stay in order
+	auto &queue = m_hosts[key].queue;
+	auto position = std::upper_bound(queue.begin(), queue.end(), action, startsBefore);
+	queue.insert(position, action);
+	schedulePump();
+}
+
+bool NetScheduler::dequeue(NetActionPtr action)
+{
+	for (auto &followers : m_followers)
+	{
+		if (followers.removeOne(action))
+		{
+			return true;
+		}
+	}
+	for (auto &host : m_hosts)
+	{
+		if (host.queue.removeOne(action))
+		{
+			releaseFollowers(action.get(), false);
+			return true;
+		}
+	}
+	return false;
+}
+
+int NetScheduler::coalescedCount() const
+{
+	int count = 0;
+	for (auto &followers : m_followers)
+	{
+		count += followers.size();
+	}
+	return count;
+}
+
+void NetScheduler::releaseFollowers(NetAction *leader, bool success)
+{
+	QString key = leader->coalescingKey();
+	if (key.isEmpty() || m_leaders.value(key).get() != leader)
+		return;
+	auto leaderPtr = m_leaders.take(key);
+	auto followers = m_followers.take(leader);
+	if (followers.isEmpty())
+		return;
+	if (success)
+	{
+		for (auto follower : followers)
+		{
+			follower->m_timing.started = NetActionTiming::now();
+			follower->m_timing.result = NetActionTiming::Coalesced;
+			follower->finishTiming(true);
+			follower->takeResultFrom(leaderPtr);
+		}
+		return;
+	}
+	// the next one in line tries for itself
+	auto next = followers.takeFirst();
+	m_leaders.insert(key, next);
+	if (!followers.isEmpty())
+	{
+		m_followers.insert(next.get(), followers);
+	}
+	queueAction(next);
+}
+
+void NetScheduler::schedulePump()
+{
+	// actions are never started from inside the call that submitted them or from inside
+	// another action's signal handlers. This keeps the bookkeeping simple.
+	if (m_pumpQueued)
+		return;
+	m_pumpQueued = true;
+	QMetaObject::invokeMethod(this, "pump", Qt::QueuedConnection);
+}
+
+void NetScheduler::pump()
+{
+	m_pumpQueued = false;
+	// round-robin over the hosts, one action per host and pass. Hosts with more important
+	// work waiting go first, in case the global limit runs out during the pass.
+	bool startedAny = true;
+	while (startedAny)
+	{
+		startedAny = false;
+		QStringList keys;
+		for (auto iter = m_hosts.begin(); iter != m_hosts.end(); iter++)
+		{
+			if (!iter->queue.isEmpty())
+				keys.append(iter.key());
+		}
+		std::stable_sort(keys.begin(), keys.end(), [this](const QString &a, const QString &b)
+		{
+			return startsBefore(m_hosts[a].queue.head(), m_hosts[b].queue.head());
+		});
+		for (auto key : keys)
+		{
+			Host &host = m_hosts[key];
+			if (host.queue.isEmpty())
+				continue;
+			if (m_active.size() - m_released >= m_global.limit)
+			{
+				m_global.saturated = true;
+				return;
+			}
+			if (host.active >= host.limiter.limit)
+			{
+				host.limiter.saturated = true;
+				continue;
+			}
+			startAction(key, host.queue.dequeue());
+			startedAny = true;
+		}
+	}
+}
+
+void NetScheduler::startAction(const QString &host, NetActionPtr action)
+{
+	NetAction *raw = action.get();
+	Transfer transfer;
+	transfer.action = action;
+	transfer.host = host;
+	transfer.timer.start();
+	raw->m_timing.started = NetActionTiming::now();
+	m_active.insert(raw, transfer);
+	m_hosts[host].active++;
+
+	if (!m_adaptTimer.isActive())
+	{
+		m_window.start();
+		m_adaptTimer.start();
+	}
+
+	connect(raw, &NetAction::netActionProgress, this, [this, raw](int, qint64 current, qint64)
+	{
+		actionProgress(raw, current);
+	});
+	connect(raw, &NetAction::succeeded, this, [this, raw](int)
+	{
+		actionFinished(raw, true);
+	});
+	connect(raw, &NetAction::failed, this, [this, raw](int)
+	{
+		actionFinished(raw, false);
+	});
+	connect(raw, &NetAction::transferDone, this, [this, raw](int)
+	{
+		actionTransferDone(raw);
+	});
+	action->start();
+}
+
+void NetScheduler::actionProgress(NetAction *action, qint64 current)
+{
+	auto iter = m_active.find(action);
+	if (iter == m_active.end())
+		return;
+	Transfer &transfer = *iter;
+	// redirects restart the transfer from zero
+	if (current < transfer.last_progress)
+	{
+		transfer.last_progress = 0;
+	}
+	qint64 delta = current - transfer.last_progress;
+	transfer.last_progress = current;
+	if (delta <= 0)
+		return;
+	action->m_timing.bytes += delta;
+
+	Limiter &limiter = m_hosts[transfer.host].limiter;
+	if (!transfer.got_first_byte)
+	{
+		transfer.got_first_byte = true;
+		action->m_timing.first_byte = NetActionTiming::now();
+		double ms = transfer.timer.elapsed();
+		limiter.sampleLatency(ms);
+		m_global.sampleLatency(ms);
+	}
+	limiter.window_bytes += delta;
+	limiter.total_bytes += delta;
+	m_global.window_bytes += delta;
+	m_global.total_bytes += delta;
+}
+
+void NetScheduler::actionTransferDone(NetAction *action)
+{
+	auto iter = m_active.find(action);
+	if (iter == m_active.end() || iter->released)
+		return;
+	iter->released = true;
+	m_released++;
+	m_hosts[iter->host].active--;
+	// the action keeps its place in m_active, followers still wait for its result
+	schedulePump();
+}
+
+void NetScheduler::actionFinished(NetAction *action, bool success)
+{
+	auto iter = m_active.find(action);
+	if (iter == m_active.end())
+		return;
+	Transfer transfer = *iter;
+	m_active.erase(iter);
+	action->disconnect(this);
+
+	action->finishTiming(success);
+
+	Host &host = m_hosts[transfer.host];
+	if (transfer.released)
+		m_released--;
+	else
+		host.active--;
+	if (!transfer.got_first_byte)
+	{
+		// nothing was transferred (cache hit, 304, ...), use the whole round trip
+		double ms = transfer.timer.elapsed();
+		host.limiter.sampleLatency(ms);
+		m_global.sampleLatency(ms);
+	}
+	if (success)
+	{
+		host.limiter.completed++;
+		m_global.completed++;
+	}
+	else if (!action->m_aborted)
+	{
+		host.limiter.failed++;
+		m_global.failed++;
+		// be nice to hosts that are having trouble
+		if (hostInTrouble(action->m_timing))
+			host.limiter.limit = qMax(host.limiter.minimum, host.limiter.limit - 1);
+	}
+	releaseFollowers(action, success);
+	schedulePump();
+}
+
+void NetScheduler::setRateLimit(qint64 bytesPerSecond)
+{
+	m_rateLimit = qMax<qint64>(bytesPerSecond, 0);
+	if (m_rateLimit)
+		return;
+	// let everyone who was held back read what they have
+	m_rateTimer.stop();
+	auto throttled = m_throttles.keys();
+	m_throttles.clear();
+	for (auto action : throttled)
+	{
+		action->resumeReading();
+	}
+}
+
+QByteArray NetScheduler::read(NetAction *action, QNetworkReply *reply)
+{
+	if (!m_rateLimit)
+	{
+		reply->setReadBufferSize(0);
+		return reply->readAll();
+	}
+	reply->setReadBufferSize(throttledBufferSize);
+	if (!m_throttles.contains(action))
+	{
+		m_throttles.insert(action, Throttle());
+		connect(action, &QObject::destroyed, this, [this, action]()
+		{
+			m_throttles.remove(action);
+		});
+	}
+	Throttle &throttle = m_throttles[action];
+	if (reply->isFinished())
+	{
+		// nothing more comes from the network. take it all and pay for it later.
+		QByteArray data = reply->readAll();
+		throttle.credit -= data.size();
+		return data;
+	}
+	qint64 wanted = reply->bytesAvailable();
+	qint64 allowed = qBound<qint64>(0, throttle.credit, wanted);
+	throttle.credit -= allowed;
+	if (allowed < wanted)
+	{
+		throttle.hungry = true;
+		if (!m_rateTimer.isActive())
+		{
+			m_rateClock.start();
+			m_rateTimer.start();
+		}
+	}
+	return reply->read(allowed);
+}
+
+void NetScheduler::refillTokens()
+{
+	double seconds = qMax<qint64>(m_rateClock.restart(), 1) / 1000.0;
+	QList<NetAction *> hungry;
+	double totalWeight = 0;
+	for (auto iter = m_throttles.begin(); iter != m_throttles.end(); iter++)
+	{
+		if (!iter->hungry)
+			continue;
+		hungry.append(iter.key());
+		totalWeight += iter.key()->m_bandwidth_weight;
+	}
+	if (hungry.isEmpty())
+	{
+		m_rateTimer.stop();
+		return;
+	}
+	double budget = m_rateLimit * seconds;
+	for (auto action : hungry)
+	{
+		Throttle &throttle = m_throttles[action];
+		double share = action->m_bandwidth_weight / totalWeight;
+		// don't let anyone save up for a big burst
+		qint64 cap = qMax<qint64>(m_rateLimit * share / 4, 4096);
+		throttle.credit = qMin<qint64>(throttle.credit + qint64(budget * share), cap);
+		throttle.hungry = false;
+	}
+	for (auto action : hungry)
+	{
+		// reading can finish actions, which can get them deleted
+		if (m_throttles.contains(action))
+		{
+			action->resumeReading();
+		}
+	}
+}
+
+void NetScheduler::adaptLimits()
+{
+	double seconds = qMax<qint64>(m_window.restart(), 1) / 1000.0;
+	for (auto iter = m_hosts.begin(); iter != m_hosts.end(); iter++)
+	{
+		int old_limit = iter->limiter.limit;
+		if (iter->limiter.adapt(seconds))
+		{
+			qDebug() << "Connection limit for" << iter.key() << "changed from" << old_limit
+					 << "to" << iter->limiter.limit << "at"
+					 << qRound64(iter->limiter.throughput) << "B/s";
+		}
+	}
+	m_global.adapt(seconds);
+
+	// go idle when there is nothing left to do
+	bool idle = m_active.isEmpty();
+	for (auto &host : m_hosts)
+	{
+		if (!host.queue.isEmpty())
+			idle = false;
+	}
+	if (idle)
+	{
+		m_adaptTimer.stop();
+	}
+	emit statsUpdated();
+	schedulePump();
+}
+
+NetScheduler::Stats NetScheduler::makeStats(const QString &host, const Limiter &limiter) const
+{
+	Stats stats;
+	stats.host = host;
+	stats.limit = limiter.limit;
+	stats.bytes = limiter.total_bytes;
+	stats.throughput = limiter.throughput;
+	stats.latency = limiter.latency;
+	stats.completed = limiter.completed;
+	stats.failed = limiter.failed;
+	return stats;
+}
+
+NetScheduler::Stats NetScheduler::globalStats() const
+{
+	Stats stats = makeStats(QString(), m_global);
+	stats.active = m_active.size() - m_released;
+	for (auto &host : m_hosts)
+	{
+		stats.queued += host.queue.size();
+	}
+	return stats;
+}
+
+QList<NetScheduler::Stats> NetScheduler::hostStats() const
+{
+	QList<Stats> list;
+	for (auto iter = m_hosts.begin(); iter != m_hosts.end(); iter++)
+	{
+		Stats stats = makeStats(iter.key(), iter->limiter);
+		stats.active = iter->active;
+		stats.queued = iter->queue.size();
+		list.append(stats);
+	}
+	return list;
+}
+
+void NetScheduler::setGlobalLimits(int minimum, int maximum)
+{
+	m_global.setBounds(minimum, maximum);
+	schedulePump();
+}
+
+void NetScheduler::setHostLimits(int minimum, int maximum)
+{
+	m_hostMinimum = minimum;
+	m_hostMaximum = maximum;
+	for (auto &host : m_hosts)
+	{
+		host.limiter.setBounds(minimum, maximum);
+	}
+	schedulePump();
+}
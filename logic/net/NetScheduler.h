@@ -0,0 +1,192 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QMap>
+#include <QHash>
+#include <QQueue>
+#include <QTimer>
+#include <QElapsedTimer>
+#include "NetAction.h"
+
+/**
+ * Process-wide scheduler for network actions.
+ *
+ * NetJobs hand their actions over to the scheduler instead of starting them directly.
+ * Actions are queued per host and started only when both the host and the global
+ * connection limits allow it. The queues are ordered by priority and then by size, largest
+ * first, so the long transfers don't end up being the last ones to start. Every sampling
+ * interval, the limits are adjusted based on the throughput and latency observed in the
+ * previous interval.
+ *
+ * Actions with the same coalescing key (the same target file) are never run side by side.
+ * The first one does the transfer, the others wait for it and take over its result.
+ * If it fails, the next one in line gets its turn.
+ *
+ * All actions read their replies through the scheduler, which can hold them to a global
+ * bandwidth limit. Tokens are handed out to the actions waiting for them in proportion to
+ * their weight. An action without tokens leaves the data in its reply, which has a small
+ * read buffer while the limit is on. Once that is full, no more is read from the network.
+ */
+class NetScheduler : public QObject
+{
+	Q_OBJECT
+public:
+	struct Stats
+	{
+		/// host name, empty for the global stats
+		QString host;
+		/// current connection limit
+		int limit = 0;
+		/// number of running actions
+		int active = 0;
+		/// number of actions waiting for a free slot
+		int queued = 0;
+		/// bytes received since the scheduler was created
+		qint64 bytes = 0;
+		/// smoothed throughput in bytes per second
+		double throughput = 0;
+		/// smoothed time to first byte in milliseconds
+		double latency = 0;
+		int completed = 0;
+		int failed = 0;
+	};
+
+	/// One connection limit (global or per host) and what it adapts to
+	struct Limiter
+	{
+		int limit = 1;
+		int minimum = 1;
+		int maximum = 1;
+		/// bytes received during the current sampling interval
+		qint64 window_bytes = 0;
+		/// rate measured during the previous sampling interval
+		double last_rate = 0;
+		double throughput = 0;
+		double latency = 0;
+		double min_latency = 0;
+		/// set when an action had to wait because of this limiter
+		bool saturated = false;
+		qint64 total_bytes = 0;
+		int completed = 0;
+		int failed = 0;
+
+		void setBounds(int newMinimum, int newMaximum);
+		void sampleLatency(double ms);
+		/// adjust the limit. returns true if it changed
+		bool adapt(double seconds);
+	};
+
+public:
+	explicit NetScheduler(QObject *parent = 0);
+	virtual ~NetScheduler() {};
+
+	/// queue an action. It will be started as soon as the limits allow it.
+	void enqueue(NetActionPtr action);
+
+	/// remove an action that hasn't been started yet. Returns true if it was removed.
+	bool dequeue(NetActionPtr action);
+
+	/// number of actions waiting for another action with the same key
+	int coalescedCount() const;
+
+	/// limit for all actions together, in bytes per second. 0 means no limit.
+	void setRateLimit(qint64 bytesPerSecond);
+	qint64 rateLimit() const
+	{
+		return m_rateLimit;
+	}
+
+	/// read as much from the reply of the action as the rate limit allows right now.
+	/// If that's not everything, the action gets resumeReading() called later.
+	/// A finished reply is always read completely.
+	QByteArray read(NetAction *action, QNetworkReply *reply);
+
+	Stats globalStats() const;
+	QList<Stats> hostStats() const;
+
+	void setGlobalLimits(int minimum, int maximum);
+	void setHostLimits(int minimum, int maximum);
+
+signals:
+	/// emitted after each sampling interval, when the limits may have changed
+	void statsUpdated();
+
+private slots:
+	void pump();
+	void adaptLimits();
+	void refillTokens();
+
+private:
+	struct Host
+	{
+		Limiter limiter;
+		QQueue<NetActionPtr> queue;
+		int active = 0;
+	};
+	struct Throttle
+	{
+		/// bytes the action may read. Negative when it owes some.
+		qint64 credit = 0;
+		/// the action has data waiting that it wasn't allowed to read
+		bool hungry = false;
+	};
+	struct Transfer
+	{
+		NetActionPtr action;
+		QString host;
+		qint64 last_progress = 0;
+		bool got_first_byte = false;
+		/// the action gave its connection slot back before finishing
+		bool released = false;
+		QElapsedTimer timer;
+	};
+
+	static QString hostKey(NetActionPtr action);
+	/// true if 'a' should be started before 'b'
+	static bool startsBefore(const NetActionPtr &a, const NetActionPtr &b);
+	Stats makeStats(const QString &host, const Limiter &limiter) const;
+	void schedulePump();
+	void startAction(const QString &host, NetActionPtr action);
+	void actionProgress(NetAction *action, qint64 current);
+	void actionTransferDone(NetAction *action);
+	void actionFinished(NetAction *action, bool success);
+	void queueAction(NetActionPtr action);
+	/// the action that was running for a key is done (or gone), deal with the ones waiting for it
+	void releaseFollowers(NetAction *leader, bool success);
+
+private:
+	QMap<QString, Host> m_hosts;
+	QHash<NetAction *, Transfer> m_active;
+	/// actions in m_active that already gave their connection back
+	int m_released = 0;
+	/// coalescing key -> the action doing the transfer for it (queued or running)
+	QHash<QString, NetActionPtr> m_leaders;
+	/// actions waiting for the transfer of a leader
+	QHash<NetAction *, QList<NetActionPtr>> m_followers;
+	Limiter m_global;
+	int m_hostMinimum = 1;
+	int m_hostMaximum = 16;
+	bool m_pumpQueued = false;
+	QTimer m_adaptTimer;
+	QElapsedTimer m_window;
+
+	qint64 m_rateLimit = 0;
+	QHash<NetAction *, Throttle> m_throttles;
+	QTimer m_rateTimer;
+	QElapsedTimer m_rateClock;
+};
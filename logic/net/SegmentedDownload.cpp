@@ -0,0 +1,581 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SegmentedDownload.h"
+#include <pathutils.h>
+
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QRegExp>
+#include <QPointer>
+#include <QtConcurrentRun>
+#include <QDebug>
+#include "Env.h"
+#include "NetScheduler.h"
+#include "FileSystem.h"
+
+namespace
+{
+QString hashFile(const QString &path)
+{
+	QFile file(path);
+	if (!file.open(QIODevice::ReadOnly))
+		return QString();
+	QCryptographicHash md5(QCryptographicHash::Md5);
+	while (!file.atEnd())
+	{
+		md5.addData(file.read(1024 * 1024));
+	}
+	return md5.result().toHex().constData();
+}
+}
+
+/// Holds the place of one segment in the scheduler. The transfer itself is done by the
+/// SegmentedDownload, as soon as the scheduler starts this.
+class SegmentSlot : public NetAction
+{
+	Q_OBJECT
+public:
+	SegmentSlot(SegmentedDownload *owner, int segment) : m_owner(owner), m_segment(segment)
+	{
+		m_url = owner->m_url;
+		m_index_within_job = owner->m_index_within_job;
+		m_priority = owner->m_priority;
+		m_bandwidth_weight = owner->m_bandwidth_weight;
+	}
+
+	/// the segment is done, the slot goes to the next action
+	void finish(bool success)
+	{
+		if (m_status != Job_InProgress)
+			return;
+		m_status = success ? Job_Finished : Job_Failed;
+		if (success)
+			emit succeeded(m_index_within_job);
+		else
+			emit failed(m_index_within_job);
+	}
+
+public
+slots:
+	void start() override
+	{
+		m_status = Job_InProgress;
+		if (m_owner && m_owner->startSegment(m_segment))
+			return;
+		// the download is gone or moved on, nothing to do with the slot
+		m_aborted = true;
+		finish(false);
+	}
+	bool abort() override
+	{
+		m_aborted = true;
+		finish(false);
+		return true;
+	}
+
+protected
+slots:
+	void downloadProgress(qint64, qint64) override {}
+	void downloadError(QNetworkReply::NetworkError) override {}
+	void downloadFinished() override {}
+	void downloadReadyRead() override {}
+
+private:
+	QPointer<SegmentedDownload> m_owner;
+	int m_segment;
+};
+
+SegmentedDownload::SegmentedDownload(QUrl url, MetaEntryPtr entry, qint64 threshold,
+									 int segments)
+	: NetAction()
+{
+	m_url = url;
+	m_entry = entry;
+	m_target_path = entry->getFullPath();
+	m_partial_path = m_target_path + ".part";
+	m_threshold = threshold;
+	m_segment_count = qMax(1, segments);
+	m_status = Job_NotStarted;
+	QFileInfo current(m_target_path);
+	if (current.isFile())
+		m_size_hint = current.size();
+	connect(&m_hashing, SIGNAL(finished()), SLOT(hashFinished()));
+}
+
+SegmentedDownload::~SegmentedDownload()
+{
+	// segments still waiting in the scheduler find this gone and give their slot back
+	m_hashing.waitForFinished();
+}
+
+void SegmentedDownload::start()
+{
+	m_status = Job_InProgress;
+	if (!m_entry->stale)
+	{
+		m_status = Job_Finished;
+		emit succeeded(m_index_within_job);
+		return;
+	}
+	if (!ensureFilePathExists(m_target_path))
+	{
+		qCritical() << "Could not create folder for " + m_target_path;
+		m_status = Job_Failed;
+		emit failed(m_index_within_job);
+		return;
+	}
+
+	// ask for the size and range support first
+	QNetworkRequest request(m_url);
+	QFile current(m_target_path);
+	if (current.exists() && current.size() != 0)
+	{
+		if (m_entry->remote_changed_timestamp.size())
+			request.setRawHeader("If-Modified-Since", m_entry->remote_changed_timestamp.toLatin1());
+		if (m_entry->etag.size())
+			request.setRawHeader("If-None-Match", m_entry->etag.toLatin1());
+	}
+	request.setHeader(QNetworkRequest::UserAgentHeader, "MultiMC/5.0 (Cached)");
+
+	QNetworkReply *rep = ENV.qnam()->head(request);
+	m_reply.reset(rep);
+	trackReply(rep);
+	connect(rep, SIGNAL(finished()), SLOT(probeFinished()));
+}
+
+void SegmentedDownload::probeFinished()
+{
+	if (m_aborted)
+	{
+		m_reply.reset();
+		m_status = Job_Failed;
+		emit failed(m_index_within_job);
+		return;
+	}
+	QVariant redirect = m_reply->header(QNetworkRequest::LocationHeader);
+	if (redirect.isValid())
+	{
+		m_url = QUrl(redirect.toString());
+		qDebug() << "Following redirect to " << m_url.toString();
+		start();
+		return;
+	}
+
+	int status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+	if (status == 304)
+	{
+		// what we have is still good
+		QFileInfo output_file_info(m_target_path);
+		m_entry->local_changed_timestamp =
+			output_file_info.lastModified().toUTC().toMSecsSinceEpoch();
+		m_entry->stale = false;
+		ENV.metacache()->updateEntry(m_entry);
+		m_reply.reset();
+		m_status = Job_Finished;
+		emit succeeded(m_index_within_job);
+		return;
+	}
+
+	bool ranges = m_reply->rawHeader("Accept-Ranges").trimmed() == "bytes";
+	m_length = m_reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+	m_etag = m_reply->rawHeader("ETag");
+	m_last_modified = m_reply->rawHeader("Last-Modified");
+	bool strong_validator =
+		(!m_etag.isEmpty() && !m_etag.startsWith("W/")) || !m_last_modified.isEmpty();
+	bool usable = m_reply->error() == QNetworkReply::NoError && status == 200;
+	m_reply.reset();
+
+	// anything unusual goes through the plain old single connection path
+	if (!usable || !ranges || !strong_validator || m_length < m_threshold ||
+		m_segment_count < 2)
+	{
+		startFallback();
+		return;
+	}
+	startSegments();
+}
+
+void SegmentedDownload::startFallback()
+{
+	// keep the same one across retries, so it can resume what it already has
+	if (!m_fallback)
+	{
+		m_fallback = CacheDownload::make(m_url, m_entry);
+	}
+	m_fallback->m_url = m_url;
+	m_fallback->m_index_within_job = m_index_within_job;
+	connect(m_fallback.get(), SIGNAL(succeeded(int)), SLOT(fallbackSucceeded(int)));
+	connect(m_fallback.get(), SIGNAL(failed(int)), SLOT(fallbackFailed(int)));
+	connect(m_fallback.get(), SIGNAL(netActionProgress(int, qint64, qint64)),
+			SLOT(fallbackProgress(int, qint64, qint64)));
+	m_fallback->start();
+}
+
+void SegmentedDownload::fallbackSucceeded(int)
+{
+	m_fallback->disconnect(this);
+	m_status = Job_Finished;
+	emit succeeded(m_index_within_job);
+}
+
+void SegmentedDownload::fallbackFailed(int)
+{
+	m_fallback->disconnect(this);
+	m_status = Job_Failed;
+	emit failed(m_index_within_job);
+}
+
+void SegmentedDownload::fallbackProgress(int, qint64 current, qint64 total)
+{
+	downloadProgress(current, total);
+}
+
+void SegmentedDownload::startSegments()
+{
+	m_output_file.setFileName(m_partial_path);
+	if (!m_output_file.open(QIODevice::ReadWrite | QIODevice::Truncate) ||
+		!m_output_file.resize(m_length))
+	{
+		qCritical() << "Could not preallocate " << m_partial_path;
+		m_output_file.close();
+		m_status = Job_Failed;
+		emit failed(m_index_within_job);
+		return;
+	}
+
+	qDebug() << "Downloading " << m_url.toString() << " in " << m_segment_count << " segments";
+	m_validator = m_etag.isEmpty() || m_etag.startsWith("W/") ? m_last_modified : m_etag;
+	qint64 segment_size = (m_length + m_segment_count - 1) / m_segment_count;
+	m_segments.clear();
+	for (qint64 first = 0; first < m_length; first += segment_size)
+	{
+		Segment segment;
+		segment.position = first;
+		segment.end = qMin(first + segment_size, m_length) - 1;
+		m_segments.append(segment);
+	}
+	// the other segments wait for connection slots of their own
+	for (int i = 1; i < m_segments.size(); i++)
+	{
+		auto slot = std::make_shared<SegmentSlot>(this, i);
+		slot->m_size_hint = m_segments[i].end + 1 - m_segments[i].position;
+		m_segments[i].slot = slot;
+		ENV.netScheduler()->enqueue(slot);
+	}
+	startSegment(0);
+	downloadProgress(0, m_length);
+}
+
+bool SegmentedDownload::startSegment(int index)
+{
+	if (index < 0 || index >= m_segments.size() || m_segments[index].reply)
+		return false;
+	Segment &segment = m_segments[index];
+	QNetworkRequest request(m_url);
+	request.setRawHeader("Range",
+						 QString("bytes=%1-%2").arg(segment.position).arg(segment.end).toLatin1());
+	// if the file changes under our hands, we get a 200 and bail out
+	request.setRawHeader("If-Range", m_validator);
+	request.setHeader(QNetworkRequest::UserAgentHeader, "MultiMC/5.0 (Cached)");
+	QNetworkReply *rep = ENV.qnam()->get(request);
+	segment.reply.reset(rep);
+	trackReply(rep);
+	connect(rep, SIGNAL(finished()), SLOT(downloadFinished()));
+	connect(rep, SIGNAL(error(QNetworkReply::NetworkError)),
+			SLOT(downloadError(QNetworkReply::NetworkError)));
+	connect(rep, SIGNAL(readyRead()), SLOT(downloadReadyRead()));
+	return true;
+}
+
+bool SegmentedDownload::takeOverSegment()
+{
+	for (int i = 0; i < m_segments.size(); i++)
+	{
+		auto &segment = m_segments[i];
+		if (segment.slot && !segment.reply && ENV.netScheduler()->dequeue(segment.slot))
+		{
+			segment.slot.reset();
+			startSegment(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+int SegmentedDownload::segmentOf(QObject *reply)
+{
+	for (int i = 0; i < m_segments.size(); i++)
+	{
+		if (m_segments[i].reply.get() == reply)
+			return i;
+	}
+	return -1;
+}
+
+bool SegmentedDownload::checkSegment(Segment &segment)
+{
+	segment.checked = true;
+	int status = segment.reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+	if (status != 206)
+	{
+		qCritical() << "Expected a partial response for " << m_url.toString() << ", got "
+					<< status;
+		return false;
+	}
+	// 'bytes <first>-<last>/<length>'
+	QRegExp range("bytes (\\d+)-(\\d+)/(\\d+|\\*)");
+	if (!range.exactMatch(QString::fromLatin1(segment.reply->rawHeader("Content-Range"))) ||
+		range.cap(1).toLongLong() != segment.position || range.cap(2).toLongLong() != segment.end)
+	{
+		qCritical() << "Unexpected range" << segment.reply->rawHeader("Content-Range")
+					<< "for" << m_url.toString();
+		return false;
+	}
+	return true;
+}
+
+void SegmentedDownload::downloadProgress(qint64 bytesReceived, qint64 bytesTotal)
+{
+	m_total_progress = bytesTotal;
+	m_progress = bytesReceived;
+	emit netActionProgress(m_index_within_job, bytesReceived, bytesTotal);
+}
+
+void SegmentedDownload::downloadError(QNetworkReply::NetworkError error)
+{
+	qCritical() << "Failed " << m_url.toString() << " with reason " << error;
+	m_status = Job_Failed;
+}
+
+void SegmentedDownload::downloadReadyRead()
+{
+	readSegment(segmentOf(sender()));
+}
+
+void SegmentedDownload::resumeReading()
+{
+	for (int i = 0; i < m_segments.size(); i++)
+	{
+		if (m_segments[i].reply && !m_segments[i].finished)
+			readSegment(i);
+	}
+}
+
+void SegmentedDownload::readSegment(int index)
+{
+	if (index < 0 || index >= m_segments.size() || m_status == Job_Failed)
+		return;
+	Segment &segment = m_segments[index];
+	if (!segment.checked && !checkSegment(segment))
+	{
+		m_status = Job_Failed;
+		segment.reply->abort();
+		return;
+	}
+	QByteArray data = ENV.netScheduler()->read(this, segment.reply.get());
+	if (segment.position + data.size() > segment.end + 1)
+	{
+		qCritical() << "Server sent more than requested for " << m_url.toString();
+		m_status = Job_Failed;
+		segment.reply->abort();
+		return;
+	}
+	if (!m_output_file.seek(segment.position) || m_output_file.write(data) != data.size())
+	{
+		qCritical() << "Failed writing into " + m_partial_path;
+		m_status = Job_Failed;
+		segment.reply->abort();
+		return;
+	}
+	segment.position += data.size();
+
+	// everything that isn't still missing has been received
+	qint64 missing = 0;
+	for (auto &other : m_segments)
+	{
+		missing += other.end + 1 - other.position;
+	}
+	downloadProgress(m_length - missing, m_length);
+}
+
+void SegmentedDownload::downloadFinished()
+{
+	int index = segmentOf(sender());
+	if (index < 0)
+		return;
+	// whatever the bandwidth limit held back is still in the reply
+	readSegment(index);
+	if (index >= m_segments.size())
+		return;
+	Segment &segment = m_segments[index];
+	segment.finished = true;
+	if (segment.position != segment.end + 1)
+	{
+		m_status = Job_Failed;
+	}
+	if (m_status == Job_Failed)
+	{
+		fail();
+		return;
+	}
+	if (segment.slot)
+	{
+		segment.slot->finish(true);
+	}
+	else if (!takeOverSegment())
+	{
+		// nothing left for our own slot, the next action can have it
+		emit transferDone(m_index_within_job);
+	}
+	for (auto &other : m_segments)
+	{
+		if (!other.finished)
+			return;
+	}
+	finishSegments();
+}
+
+bool SegmentedDownload::abort()
+{
+	if (m_status != Job_InProgress)
+		return NetAction::abort();
+	m_aborted = true;
+	if (m_hashing_pending)
+	{
+		// fails through hashFinished
+		return true;
+	}
+	if (m_fallback && m_fallback->m_status == Job_InProgress)
+	{
+		// fails through fallbackFailed
+		return m_fallback->abort();
+	}
+	if (!m_segments.isEmpty())
+	{
+		fail();
+		return true;
+	}
+	return NetAction::abort();
+}
+
+void SegmentedDownload::fail()
+{
+	// stop everything else that is still going. Their finished() calls end up here and
+	// don't find their segment anymore.
+	auto segments = m_segments;
+	m_segments.clear();
+	for (auto &segment : segments)
+	{
+		if (segment.reply && !segment.finished)
+			segment.reply->abort();
+		if (!segment.slot || ENV.netScheduler()->dequeue(segment.slot))
+			continue;
+		// only the segment that went wrong counts as a failure of the host
+		if (segment.finished)
+			segment.slot->finish(false);
+		else
+			segment.slot->abort();
+	}
+	m_output_file.close();
+	m_output_file.remove();
+	m_status = Job_Failed;
+	emit failed(m_index_within_job);
+}
+
+void SegmentedDownload::finishSegments()
+{
+	m_segments.clear();
+	m_output_file.close();
+
+	// verify the stitched together file. Big files take a while, so not on this thread.
+	m_hashing_pending = true;
+	QString path = m_partial_path;
+	m_hashing.setFuture(QtConcurrent::run([path]() { return hashFile(path); }));
+}
+
+void SegmentedDownload::hashFinished()
+{
+	if (!m_hashing_pending)
+		return;
+	m_hashing_pending = false;
+	QString md5sum = m_hashing.result();
+	if (m_aborted || md5sum.isEmpty())
+	{
+		if (!m_aborted)
+			qCritical() << "Could not read back " << m_partial_path;
+		m_output_file.remove();
+		m_status = Job_Failed;
+		emit failed(m_index_within_job);
+		return;
+	}
+
+	QString expected = m_expected_md5;
+	if (expected.isEmpty())
+	{
+		// S3 and many other servers use the md5 of the file as the ETag
+		QString etag = QString::fromLatin1(m_etag).remove('"');
+		if (QRegExp("[0-9a-fA-F]{32}").exactMatch(etag))
+			expected = etag.toLower();
+	}
+	if (!expected.isEmpty() && expected != md5sum)
+	{
+		qCritical() << "Checksum mismatch for " << m_url.toString() << ": expected " << expected
+					<< " got " << md5sum;
+		m_output_file.remove();
+		m_status = Job_Failed;
+		emit failed(m_index_within_job);
+		return;
+	}
+
+	if (!FS::replaceFile(m_partial_path, m_target_path))
+	{
+		qCritical() << "Failed to move downloaded data to " << m_target_path;
+		m_output_file.remove();
+		m_status = Job_Failed;
+		emit failed(m_index_within_job);
+		return;
+	}
+
+	QFileInfo output_file_info(m_target_path);
+	m_entry->md5sum = md5sum;
+	m_entry->etag = m_etag.constData();
+	if (!m_last_modified.isEmpty())
+	{
+		m_entry->remote_changed_timestamp = m_last_modified.constData();
+	}
+	m_entry->local_changed_timestamp =
+		output_file_info.lastModified().toUTC().toMSecsSinceEpoch();
+	m_entry->stale = false;
+	ENV.metacache()->updateEntry(m_entry);
+
+	m_status = Job_Finished;
+	emit succeeded(m_index_within_job);
+}
+
+QString SegmentedDownload::coalescingKey() const
+{
+	return QFileInfo(m_target_path).absoluteFilePath();
+}
+
+void SegmentedDownload::takeResultFrom(NetActionPtr other)
+{
+	// the other download put the file in place and updated the cache
+	ENV.metacache()->syncEntry(m_entry);
+	NetAction::takeResultFrom(other);
+}
+
+#include "SegmentedDownload.moc"
@@ -0,0 +1,136 @@
+/* Copyright 2013-2015 MultiMC Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "NetAction.h"
+#include "HttpMetaCache.h"
+#include "CacheDownload.h"
+#include <QFile>
+#include <QFutureWatcher>
+
+typedef std::shared_ptr<class SegmentedDownload> SegmentedDownloadPtr;
+class SegmentSlot;
+
+/**
+ * Cached download of a single large file over several connections.
+ *
+ * A HEAD request tells us the size of the file and whether the server accepts byte ranges.
+ * If it does and the file is at least as big as the threshold, the file is preallocated and
+ * fetched as a number of concurrent range requests. Otherwise this behaves exactly like a
+ * CacheDownload.
+ *
+ * The first segment uses the connection slot the scheduler gave this action. Every other
+ * segment waits in the scheduler for a slot of its own, so the host and global limits still
+ * hold. Segments that are still waiting when this action is done with its own get taken over.
+ */
+class SegmentedDownload : public NetAction
+{
+	Q_OBJECT
+public:
+	/// files smaller than this are downloaded over a single connection
+	static const qint64 defaultThreshold = 4 * 1024 * 1024;
+	static const int defaultSegments = 4;
+
+public:
+	explicit SegmentedDownload(QUrl url, MetaEntryPtr entry, qint64 threshold, int segments);
+	static SegmentedDownloadPtr make(QUrl url, MetaEntryPtr entry,
+									 qint64 threshold = defaultThreshold,
+									 int segments = defaultSegments)
+	{
+		return SegmentedDownloadPtr(new SegmentedDownload(url, entry, threshold, segments));
+	}
+	virtual ~SegmentedDownload();
+	QString getTargetFilepath()
+	{
+		return m_target_path;
+	}
+	/// md5 the finished file has to match. If not set, a md5-like ETag is used instead.
+	void setExpectedMd5(const QString &md5)
+	{
+		m_expected_md5 = md5;
+	}
+	virtual QString coalescingKey() const;
+	virtual void takeResultFrom(NetActionPtr other);
+
+protected
+slots:
+	virtual void downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+	virtual void downloadError(QNetworkReply::NetworkError error);
+	virtual void downloadFinished();
+	virtual void downloadReadyRead();
+
+private
+slots:
+	void probeFinished();
+	void fallbackSucceeded(int);
+	void fallbackFailed(int);
+	void fallbackProgress(int, qint64 current, qint64 total);
+	void hashFinished();
+
+public
+slots:
+	virtual void start();
+	virtual void resumeReading();
+	virtual bool abort();
+
+private:
+	struct Segment
+	{
+		QObjectPtr<QNetworkReply> reply;
+		/// holds the place of the segment in the scheduler, null for the ones done in our slot
+		std::shared_ptr<SegmentSlot> slot;
+		/// next byte to write
+		qint64 position = 0;
+		/// last byte of the segment
+		qint64 end = 0;
+		bool checked = false;
+		bool finished = false;
+	};
+	friend class SegmentSlot;
+	void startFallback();
+	void startSegments();
+	/// send the request for a segment. False if it is gone or already started.
+	bool startSegment(int index);
+	/// start a segment that is still waiting for a slot in ours. False if there is none.
+	bool takeOverSegment();
+	int segmentOf(QObject *reply);
+	void readSegment(int index);
+	bool checkSegment(Segment &segment);
+	void fail();
+	void finishSegments();
+
+private:
+	MetaEntryPtr m_entry;
+	QString m_target_path;
+	QString m_partial_path;
+	QString m_expected_md5;
+	qint64 m_threshold;
+	int m_segment_count;
+
+	/// what the HEAD request told us
+	qint64 m_length = -1;
+	QByteArray m_etag;
+	QByteArray m_last_modified;
+	/// what the segment requests use for If-Range
+	QByteArray m_validator;
+
+	QFile m_output_file;
+	QList<Segment> m_segments;
+	CacheDownloadPtr m_fallback;
+	/// the finished file is checked on the worker pool
+	QFutureWatcher<QString> m_hashing;
+	bool m_hashing_pending = false;
+};
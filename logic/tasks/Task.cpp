@@ -39,13 +39,20 @@ void Task::setProgress(qint64 current, qint64 total)
 
 void Task::start()
 {
+	// a task can be started again, whatever it did last time is forgotten
 	m_running = true;
+	m_finished = false;
+	m_succeeded = false;
+	m_aborted = false;
+	m_failReason.clear();
 	emit started();
 	executeTask();
 }
 
 void Task::emitFailed(QString reason)
 {
+	// whatever goes wrong while stopping doesn't matter anymore
+	if (m_aborted) { return; }
 	m_running = false;
 	m_finished = true;
 	m_succeeded = false;
@@ -55,6 +62,19 @@ void Task::emitFailed(QString reason)
 	emit finished();
 }
 
+void Task::emitAborted()
+{
+	if (m_finished) { return; }
+	m_running = false;
+	m_finished = true;
+	m_succeeded = false;
+	m_aborted = true;
+	m_failReason = tr("Aborted");
+	qDebug() << "Task aborted";
+	emit aborted();
+	emit finished();
+}
+
 void Task::emitSucceeded()
 {
 	if (!m_running) { return; } // Don't succeed twice.
@@ -86,3 +106,8 @@ QString Task::failReason() const
 	return m_failReason;
 }
 
+bool Task::wasAborted() const
+{
+	return m_aborted;
+}
+
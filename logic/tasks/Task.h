@@ -41,6 +41,12 @@ public:
 	 */
 	virtual QString failReason() const;
 
+	/*!
+	 * True if this task was stopped by abort() before it could finish.
+	 * Such a task emits aborted() instead of failed().
+	 */
+	virtual bool wasAborted() const;
+
 	virtual bool canAbort() const { return false; }
 
 	QString getStatus()
@@ -64,6 +70,7 @@ signals:
 	void finished();
 	void succeeded();
 	void failed(QString reason);
+	void aborted();
 	void status(QString status);
 
 public
@@ -77,6 +84,7 @@ protected:
 protected slots:
 	virtual void emitSucceeded();
 	virtual void emitFailed(QString reason);
+	virtual void emitAborted();
 
 public slots:
 	void setStatus(const QString &status);
@@ -86,6 +94,7 @@ protected:
 	bool m_running = false;
 	bool m_finished = false;
 	bool m_succeeded = false;
+	bool m_aborted = false;
 	QString m_failReason = "";
 	QString m_status;
 	int m_progress = 0;
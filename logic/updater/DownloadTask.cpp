@@ -35,6 +35,19 @@ DownloadTask::DownloadTask(Status status, QString target, QObject *parent)
 	m_updateFilesDir.setAutoRemove(false);
 }
 
+bool DownloadTask::abort()
+{
+	if (!isRunning())
+		return false;
+	emitAborted();
+	if (m_vinfoNetJob && m_vinfoNetJob->isRunning())
+		m_vinfoNetJob->abort();
+	if (m_filesNetJob && m_filesNetJob->isRunning())
+		m_filesNetJob->abort();
+	m_updateFilesDir.remove();
+	return true;
+}
+
 void DownloadTask::executeTask()
 {
 	loadVersionInfo();
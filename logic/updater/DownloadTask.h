@@ -46,6 +46,15 @@ public:
 	/// set updater download behavior
 	void setUseLocalUpdater(bool useLocal);
 
+	virtual bool canAbort() const override
+	{
+		return true;
+	}
+
+public slots:
+	/// stop downloading and throw away the files downloaded so far
+	virtual bool abort() override;
+
 protected:
 	//! Entry point for tasks.
 	virtual void executeTask() override;
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QUrl>
+#include <QMap>
+#include <QCryptographicHash>
+#include <memory>
+
+/**
+ * Minimal HTTP/1.1 server for exercising the network code without leaving the machine.
+ *
+ * Serves in-memory files with GET and HEAD, supports single byte ranges and ETags and can
+ * throttle each connection to simulate a server with per-connection bandwidth limits.
+ */
+class LocalHttpServer : public QTcpServer
+{
+public:
+	/// bytesPerSecond limits every connection separately, 0 means unlimited
+	explicit LocalHttpServer(qint64 bytesPerSecond = 0) : m_rate(bytesPerSecond)
+	{
+		connect(this, &QTcpServer::newConnection, this, [this]()
+		{
+			while (hasPendingConnections())
+				serve(nextPendingConnection());
+		});
+		listen(QHostAddress::LocalHost);
+	}
+
+	void addFile(const QString &path, const QByteArray &data)
+	{
+		m_files[path] = data;
+	}
+
+	/// the next full GET of 'path' breaks off after 'bytes' bytes of the body
+	void breakAfter(const QString &path, qint64 bytes)
+	{
+		m_breakAfter[path] = bytes;
+	}
+
+	QUrl url(const QString &path) const
+	{
+		return QUrl(QString("http://127.0.0.1:%1/%2").arg(serverPort()).arg(path));
+	}
+
+	static QByteArray etagOf(const QByteArray &data)
+	{
+		return "\"" + QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex() + "\"";
+	}
+
+	/// number of requests received so far, by method
+	QMap<QByteArray, int> requests;
+	/// the order in which paths were requested with GET
+	QStringList getOrder;
+	/// Range header of every GET, empty for requests without one
+	QList<QByteArray> ranges;
+	/// connections open right now, and the most there ever were at the same time
+	int connections = 0;
+	int peakConnections = 0;
+
+private:
+	void serve(QTcpSocket *socket)
+	{
+		connections++;
+		peakConnections = qMax(peakConnections, connections);
+		connect(socket, &QTcpSocket::disconnected, this, [this]() { connections--; });
+		auto buffer = std::make_shared<QByteArray>();
+		connect(socket, &QTcpSocket::readyRead, socket, [this, socket, buffer]()
+		{
+			buffer->append(socket->readAll());
+			int end = buffer->indexOf("\r\n\r\n");
+			if (end < 0)
+				return;
+			QByteArray head = buffer->left(end);
+			buffer->remove(0, end + 4);
+			respond(socket, head);
+		});
+		connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+	}
+
+	void respond(QTcpSocket *socket, const QByteArray &head)
+	{
+		auto lines = head.split('\n');
+		auto request = lines.takeFirst().trimmed().split(' ');
+		QByteArray method = request.value(0);
+		QString path = QString::fromUtf8(request.value(1)).mid(1);
+		QMap<QByteArray, QByteArray> headers;
+		for (auto line : lines)
+		{
+			int colon = line.indexOf(':');
+			if (colon > 0)
+				headers[line.left(colon).trimmed().toLower()] = line.mid(colon + 1).trimmed();
+		}
+		requests[method]++;
+		if (method == "GET")
+		{
+			getOrder.append(path);
+			ranges.append(headers.value("range"));
+		}
+
+		if (!m_files.contains(path))
+		{
+			socket->write("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+			return;
+		}
+		QByteArray data = m_files[path];
+		QByteArray etag = etagOf(data);
+		if (headers.value("if-none-match") == etag)
+		{
+			socket->write("HTTP/1.1 304 Not Modified\r\nETag: " + etag + "\r\n\r\n");
+			return;
+		}
+
+		QByteArray status = "200 OK";
+		QByteArray extra;
+		qint64 first = 0;
+		qint64 last = data.size() - 1;
+		QByteArray range = headers.value("range");
+		bool rangeValid = !headers.contains("if-range") || headers.value("if-range") == etag;
+		if (range.startsWith("bytes=") && rangeValid)
+		{
+			auto bounds = range.mid(6).split('-');
+			first = bounds.value(0).toLongLong();
+			if (!bounds.value(1).isEmpty())
+				last = qMin<qint64>(bounds.value(1).toLongLong(), data.size() - 1);
+			status = "206 Partial Content";
+			extra = "Content-Range: bytes " + QByteArray::number(first) + "-" +
+					QByteArray::number(last) + "/" + QByteArray::number(data.size()) + "\r\n";
+		}
+		QByteArray body = data.mid(first, last - first + 1);
+		socket->write("HTTP/1.1 " + status + "\r\nContent-Length: " +
+					  QByteArray::number(body.size()) + "\r\nAccept-Ranges: bytes\r\nETag: " +
+					  etag + "\r\n" + extra + "\r\n");
+		if (method == "HEAD")
+			return;
+		if (status.startsWith("200") && m_breakAfter.contains(path))
+		{
+			// the headers promised more than this
+			socket->write(body.left(m_breakAfter.take(path)));
+			socket->disconnectFromHost();
+			return;
+		}
+		if (!m_rate)
+		{
+			socket->write(body);
+			return;
+		}
+		// send a slice every 20ms to stay at the configured rate
+		auto remaining = std::make_shared<QByteArray>(body);
+		auto timer = new QTimer(socket);
+		qint64 slice = qMax<qint64>(m_rate / 50, 1);
+		connect(timer, &QTimer::timeout, socket, [socket, remaining, timer, slice]()
+		{
+			socket->write(remaining->left(slice));
+			remaining->remove(0, slice);
+			if (remaining->isEmpty())
+				timer->deleteLater();
+		});
+		timer->start(20);
+	}
+
+private:
+	QMap<QString, QByteArray> m_files;
+	QMap<QString, qint64> m_breakAfter;
+	qint64 m_rate;
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <memory>
+
+#include "Env.h"
+#include "InstanceList.h"
+#include "icons/IconList.h"
+#include "settings/INISettingsObject.h"
+#include <pathutils.h>
+
+/// Instances in a folder, loaded by a real InstanceList the way MultiMC does it on startup
+class TestInstances
+{
+public:
+	explicit TestInstances(const QString &root) : m_root(root)
+	{
+	}
+
+	/// a OneSix instance. Its Minecraft patch uses the asset index and the libraries.
+	void addOneSix(const QString &name, const QString &assets, const QStringList &libraries)
+	{
+		QString dir = PathCombine(m_root, "instances", name);
+		write(PathCombine(dir, "instance.cfg"),
+			  "InstanceType=OneSix\nIntendedVersion=1.7.10\nname=" + name.toUtf8() + "\n");
+
+		QJsonArray libs;
+		for (auto &library : libraries)
+		{
+			QJsonObject lib;
+			lib.insert("name", library);
+			libs.append(lib);
+		}
+		QJsonObject minecraft;
+		minecraft.insert("fileId", QString("net.minecraft"));
+		minecraft.insert("name", QString("Minecraft"));
+		minecraft.insert("version", QString("1.7.10"));
+		minecraft.insert("id", QString("1.7.10"));
+		minecraft.insert("mainClass", QString("net.minecraft.client.main.Main"));
+		minecraft.insert("assets", assets);
+		minecraft.insert("libraries", libs);
+		write(PathCombine(dir, "patches", "net.minecraft.json"), QJsonDocument(minecraft).toJson());
+
+		// the built in one is a resource of the application
+		QJsonObject lwjgl;
+		lwjgl.insert("fileId", QString("org.lwjgl"));
+		lwjgl.insert("name", QString("LWJGL"));
+		lwjgl.insert("version", QString("2.9.1"));
+		write(PathCombine(dir, "patches", "org.lwjgl.json"), QJsonDocument(lwjgl).toJson());
+	}
+
+	std::shared_ptr<InstanceList> load()
+	{
+		// the settings instances override or pass through
+		auto settings = std::make_shared<INISettingsObject>(PathCombine(m_root, "multimc.cfg"));
+		for (auto id : {"PreLaunchCommand", "WrapperCommand", "PostExitCommand", "JavaPath",
+						"JvmArgs", "JavaTimestamp", "JavaVersion"})
+		{
+			settings->registerSetting(id, "");
+		}
+		for (auto id : {"ShowConsole", "AutoCloseConsole", "LogPrePostOutput", "LaunchMaximized",
+						"TrackFTBInstances"})
+		{
+			settings->registerSetting(id, false);
+		}
+		for (auto id : {"MinecraftWinWidth", "MinecraftWinHeight", "MinMemAlloc", "MaxMemAlloc",
+						"PermGen"})
+		{
+			settings->registerSetting(id, 0);
+		}
+		ENV.setIcons(std::make_shared<IconList>(PathCombine(m_root, "builtin-icons"),
+												PathCombine(m_root, "icons")));
+
+		auto instances = std::make_shared<InstanceList>(settings, PathCombine(m_root, "instances"));
+		instances->loadList();
+		return instances;
+	}
+
+private:
+	void write(const QString &path, const QByteArray &data)
+	{
+		QDir().mkpath(QFileInfo(path).absolutePath());
+		QFile file(path);
+		file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+		file.write(data);
+	}
+
+	QString m_root;
+};
@@ -0,0 +1,310 @@
+#!/usr/bin/env python3
+"""
+Writes the pack200 fixtures used by tst_Pack200Benchmark.
+
+There is no pack200 packer outside of old JDKs, so this builds small archives directly:
+resource files and simple classes with fields and straight-line methods. Everything is
+written with the default band codings, so the archives exercise the cp, class, code,
+bytecode and file bands of the unpacker, but not band headers or attribute layouts.
+
+Usage: make_fixtures.py <anti200>
+
+For every fixture this writes <name>.pack.xz and the golden <name>.jar.xz, which is what
+`anti200 --store` made of it. The golden jars are checked against the generator's own idea
+of their contents before they are written.
+"""
+
+import io
+import lzma
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import zipfile
+
+# archive options
+AO_HAVE_FILE_HEADERS = 1 << 4
+AO_DEFLATE_HINT = 1 << 5
+AO_HAVE_FILE_OPTIONS = 1 << 7
+
+FO_DEFLATE_HINT = 1
+ACC_CODE = 1 << 17  # METHOD_ATTR_Code
+
+# (B, H, S, D) codings from coding.h
+BYTE1 = None
+CHAR3 = (3, 128, 0, 0)
+UNSIGNED5 = (5, 64, 0, 0)
+DELTA5 = (5, 64, 1, 1)
+UDELTA5 = (5, 64, 0, 1)
+MDELTA5 = (5, 64, 2, 1)
+
+
+def encode(values, spec, band=True):
+    """Encode values with a band's default coding, which has no escape in the header."""
+    if spec is BYTE1:
+        return bytes(values)
+    B, H, S, D = spec
+    L = 256 - H
+    out = bytearray()
+    prev = 0
+    for i, v in enumerate(values):
+        if D:
+            v, prev = (v - prev) & 0xffffffff, v
+            if S:
+                v = v - (1 << 32) if v & 0x80000000 else v
+        if i == 0 and band:
+            # the first value of a band must not look like a coding escape
+            if S:
+                assert not -256 <= v <= -1, values[:4]
+            else:
+                assert not L <= v < L + 256, values[:4]
+        if S:
+            u = v + v // ((1 << S) - 1) if v >= 0 else (~v << S) | ((1 << S) - 1)
+        else:
+            u = v
+        for k in range(B):
+            if u < L or k == B - 1:
+                assert u < 256
+                out.append(u)
+                break
+            u -= L
+            out.append(L + u % H)
+            u //= H
+    return bytes(out)
+
+
+class Archive:
+    def __init__(self, options):
+        self.options = options
+        self.utf8 = set()
+        self.files = []  # (name, data, options)
+        self.classes = []  # dicts, see add_class
+
+    def add_file(self, name, data, options=0):
+        self.utf8.add(name)
+        self.files.append((name, data, options))
+
+    def add_class(self, name, super_name, fields, methods):
+        """
+        fields: [(flags, name, type)]
+        methods: [(flags, name, type, max_stack, code)], where code is a list of opcodes and
+        (kind, opcode, operand...) tuples - ('byte', op, value), ('short', op, value) or
+        ('field', op, name, type) for a field of this class.
+        """
+        self.classes.append(dict(name=name, super=super_name, fields=fields, methods=methods))
+
+    def pack(self):
+        # constant pool, each kind sorted so that Utf8 prefixes are shared
+        classes = set()
+        signatures = set()
+        descrs = set()
+        fieldrefs = set()
+        for c in self.classes:
+            classes.update((c['name'], c['super']))
+            for _, name, type in c['fields']:
+                descrs.add((name, type))
+                fieldrefs.add((c['name'], name, type))
+            for _, name, type, _, code in c['methods']:
+                descrs.add((name, type))
+                for op in code:
+                    if isinstance(op, tuple) and op[0] == 'field':
+                        fieldrefs.add((c['name'],) + op[2:])
+        for name, type in descrs:
+            signatures.add(type)
+        forms = {}
+        for sig in signatures:
+            form, refs, i = '', [], 0
+            while i < len(sig):
+                form += sig[i]
+                if sig[i] == 'L':
+                    end = sig.index(';', i)
+                    refs.append(sig[i + 1:end])
+                    i = end
+                    form += ';'
+                i += 1
+            forms[sig] = (form, refs)
+            classes.update(refs)
+            self.utf8.add(form)
+        self.utf8.update(classes)
+        self.utf8.update(name for name, _ in descrs)
+
+        utf8 = [''] + sorted(self.utf8)
+        classes = sorted(classes)
+        signatures = sorted(signatures)
+        descrs = sorted(descrs)
+        fieldrefs = sorted(fieldrefs)
+        u_idx = {s: i for i, s in enumerate(utf8)}
+        c_idx = {s: i for i, s in enumerate(classes)}
+        s_idx = {s: i for i, s in enumerate(signatures)}
+        d_idx = {s: i for i, s in enumerate(descrs)}
+        f_idx = {s: i for i, s in enumerate(fieldrefs)}
+
+        bands = bytearray()
+        # cp_Utf8
+        prefix, suffix, chars = [], [], []
+        for i in range(1, len(utf8)):
+            a, b = utf8[i - 1], utf8[i]
+            p = 0
+            while p < min(len(a), len(b)) and a[p] == b[p]:
+                p += 1
+            if i >= 2:
+                prefix.append(p)
+            suffix.append(len(b) - p)
+            chars.extend(ord(ch) for ch in b[p:])
+        bands += encode(prefix, DELTA5) + encode(suffix, UNSIGNED5) + encode(chars, CHAR3)
+        # cp_Class, cp_Signature, cp_Descr, cp_Field
+        bands += encode([u_idx[c] for c in classes], UDELTA5)
+        bands += encode([u_idx[forms[s][0]] for s in signatures], DELTA5)
+        bands += encode([c_idx[r] for s in signatures for r in forms[s][1]], UDELTA5)
+        bands += encode([u_idx[n] for n, _ in descrs], DELTA5)
+        bands += encode([s_idx[t] for _, t in descrs], UDELTA5)
+        bands += encode([c_idx[c] for c, _, _ in fieldrefs], DELTA5)
+        bands += encode([d_idx[(n, t)] for _, n, t in fieldrefs], UDELTA5)
+
+        # classes
+        cs = self.classes
+        fields = [f for c in cs for f in c['fields']]
+        methods = [m for c in cs for m in c['methods']]
+        bands += encode([c_idx[c['name']] for c in cs], DELTA5)
+        bands += encode([c_idx[c['super']] for c in cs], DELTA5)
+        bands += encode([0] * len(cs), DELTA5)  # class_interface_count
+        bands += encode([len(c['fields']) for c in cs], DELTA5)
+        bands += encode([len(c['methods']) for c in cs], DELTA5)
+        bands += encode([d_idx[(n, t)] for _, n, t in fields], DELTA5)
+        bands += encode([f for f, _, _ in fields], UNSIGNED5)
+        bands += encode([d_idx[(n, t)] for _, n, t, _, _ in methods], MDELTA5)
+        bands += encode([f | ACC_CODE for f, _, _, _, _ in methods], UNSIGNED5)
+        bands += encode([0x21] * len(cs), UNSIGNED5)  # ACC_PUBLIC | ACC_SUPER
+
+        # code headers: max_stack and no extra locals, no handlers
+        bands += encode([1 + stack for _, _, _, stack, _ in methods], BYTE1)
+
+        # bytecodes and their operand bands
+        codes, operands = bytearray(), {'byte': [], 'short': [], 'field': []}
+        for c in cs:
+            for _, _, _, _, code in c['methods']:
+                for op in code:
+                    if isinstance(op, tuple):
+                        codes.append(op[1])
+                        if op[0] == 'field':
+                            operands['field'].append(f_idx[(c['name'],) + op[2:]])
+                        else:
+                            operands[op[0]].append(op[2])
+                    else:
+                        codes.append(op)
+                codes.append(255)  # end marker
+        bands += codes
+        bands += encode(operands['byte'], BYTE1)
+        bands += encode(operands['short'], DELTA5)
+        bands += encode(operands['field'], DELTA5)
+
+        # files
+        fs = self.files
+        bands += encode([u_idx[n] for n, _, _ in fs], UNSIGNED5)
+        bands += encode([len(d) for _, d, _ in fs], UNSIGNED5)
+        if self.options & AO_HAVE_FILE_OPTIONS:
+            bands += encode([o for _, _, o in fs], UNSIGNED5)
+        bands += b''.join(d for _, d, _ in fs)
+
+        header = encode([7, 150, self.options, 0, 0], UNSIGNED5, False)  # minver, majver, size
+        header += encode([0, 0, len(fs)], UNSIGNED5, False)  # next count, modtime, file count
+        counts = [len(utf8), 0, len(classes), len(signatures), len(descrs), len(fieldrefs), 0, 0]
+        header += encode(counts + [0, 0, 50, len(cs)], UNSIGNED5, False)  # ics, class version
+        return b'\xca\xfe\xd0\x0d' + header + bytes(bands)
+
+    def contents(self):
+        """Names and data of the resource files, in jar order"""
+        return [(n, d) for n, d, _ in self.files]
+
+
+def text(rnd, words, lines, width):
+    out = []
+    for _ in range(lines):
+        out.append(' '.join(rnd.choice(words) for _ in range(rnd.randint(1, width))))
+    return ('\n'.join(out) + '\n').encode()
+
+
+WORDS = ('block item tile entity render model texture sound forge mod config '
+         'registry event handler world chunk player inventory recipe ore dimension').split()
+
+
+def resources():
+    rnd = random.Random(200)
+    a = Archive(AO_HAVE_FILE_HEADERS | AO_HAVE_FILE_OPTIONS)
+    a.add_file('META-INF/MANIFEST.MF', b'Manifest-Version: 1.0\r\nCreated-By: fixture\r\n\r\n')
+    a.add_file('LICENSE.txt', text(rnd, WORDS, 300, 14), FO_DEFLATE_HINT)
+    for lang in ('de_DE', 'en_US', 'es_ES', 'fr_FR', 'it_IT', 'ja_JP', 'pl_PL', 'ru_RU'):
+        lines = ['item.fixture.thing%d.name=%s %d' % (i, rnd.choice(WORDS).title(), i)
+                 for i in range(400)]
+        a.add_file('assets/fixture/lang/%s.lang' % lang, ('\n'.join(lines) + '\n').encode(),
+                   FO_DEFLATE_HINT)
+    for i in range(300):
+        model = '{\n  "parent": "item/generated",\n  "textures": { "layer0": "fixture:items/%s_%d" }\n}\n'
+        a.add_file('assets/fixture/models/item/thing_%d.json' % i,
+                   (model % (rnd.choice(WORDS), i)).encode(), FO_DEFLATE_HINT)
+    for i in range(20):
+        # stand-ins for textures, which do not shrink much and are stored
+        data = bytes(rnd.getrandbits(8) for _ in range(rnd.randint(200, 1500)))
+        a.add_file('assets/fixture/textures/items/thing_%d.png' % i, data)
+    a.add_file('mcmod.info', b'[{"modid": "fixture", "name": "Fixture", "version": "1.0"}]\n',
+               FO_DEFLATE_HINT)
+    return a
+
+
+def classes():
+    rnd = random.Random(201)
+    a = Archive(AO_HAVE_FILE_HEADERS | AO_DEFLATE_HINT)
+    a.add_file('META-INF/MANIFEST.MF', b'Manifest-Version: 1.0\r\nCreated-By: fixture\r\n\r\n')
+    for i in range(2000):
+        name = 'net/minecraftforge/fixture/%s/Thing%d' % (WORDS[i % len(WORDS)], i)
+        fields = [(0x2, 'count', 'I'), (0x2, 'total', 'J'), (0x11, 'name', 'Ljava/lang/String;')]
+        if i % 4 == 0:
+            fields.append((0x1, 'parent', 'L%s;' % name))
+        methods = [(0x1, 'size', '()I', 2, [
+            0x2a, ('field', 0xb4, 'count', 'I'), 0x05, 0x68, 0xac])]  # this.count * 2
+        if i % 2 == 0:
+            methods.append((0x1, 'sum', '(II)I', 2, [
+                0x1b, 0x1c, 0x60, ('byte', 0x10, rnd.randint(0, 127)), 0x60, 0xac]))
+        if i % 3 == 0:
+            methods.append((0x1, 'bump', '()V', 3, [
+                0x2a, 0x59, ('field', 0xb4, 'count', 'I'), ('short', 0x11, rnd.randint(0, 30000)),
+                0x60, ('field', 0xb5, 'count', 'I'), 0xb1]))
+        a.add_class(name, 'java/lang/Object', fields, methods)
+    return a
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    anti200 = sys.argv[1]
+    here = os.path.dirname(os.path.abspath(__file__))
+    for name, archive in (('resources', resources()), ('classes', classes())):
+        pack = archive.pack()
+        with tempfile.TemporaryDirectory() as tmp:
+            pack_path = os.path.join(tmp, name + '.pack')
+            jar_path = os.path.join(tmp, name + '.jar')
+            with open(pack_path, 'wb') as f:
+                f.write(pack)
+            subprocess.check_call([anti200, '--store', pack_path, jar_path])
+            with open(jar_path, 'rb') as f:
+                jar = f.read()
+        z = zipfile.ZipFile(io.BytesIO(jar))
+        assert z.testzip() is None
+        entries = z.namelist()
+        expected = archive.contents()
+        assert entries[:len(expected)] == [n for n, _ in expected], name
+        for n, d in expected:
+            assert z.read(n) == d, n
+        assert len(entries) == len(expected) + len(archive.classes), name
+        for c, entry in zip(archive.classes, entries[len(expected):]):
+            assert entry == c['name'] + '.class', entry
+            assert z.read(entry)[:4] == b'\xca\xfe\xba\xbe', entry
+        for suffix, data in (('.pack.xz', pack), ('.jar.xz', jar)):
+            with open(os.path.join(here, name + suffix), 'wb') as f:
+                f.write(lzma.compress(data, check=lzma.CHECK_CRC64, preset=9))
+        print('%s: %d bytes of pack200, %d byte jar' % (name, len(pack), len(jar)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,268 @@
+#include <QTest>
+#include <QTemporaryDir>
+#include <QCryptographicHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSignalSpy>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include "TestUtil.h"
+#include "TestInstances.h"
+
+#include "Env.h"
+#include "minecraft/AssetPackStore.h"
+#include "minecraft/PackAssetsTask.h"
+#include "minecraft/ReconstructAssetsTask.h"
+
+class AssetPackStoreTest : public QObject
+{
+	Q_OBJECT
+private:
+	QString sha1(const QByteArray &data)
+	{
+		return QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex();
+	}
+
+	void write(const QString &path, const QByteArray &data)
+	{
+		QDir().mkpath(QFileInfo(path).absolutePath());
+		QFile file(path);
+		QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+		QCOMPARE(file.write(data), qint64(data.size()));
+	}
+
+	QString loosePath(const QString &objects, const QByteArray &data)
+	{
+		QString hash = sha1(data);
+		return objects + "/" + hash.left(2) + "/" + hash;
+	}
+
+private
+slots:
+	void test_addRead()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QByteArray first("some sound");
+		QByteArray second("some texture, a bit longer");
+		{
+			AssetPackStore store(dir.path());
+			QCOMPARE(store.count(), 0);
+			QVERIFY(store.add(sha1(first), first));
+			QVERIFY(store.add(sha1(second), second));
+			// the same one twice is fine, it's there already
+			QVERIFY(store.add(sha1(first), first));
+			// data that doesn't match its hash is not
+			QVERIFY(!store.add(sha1(first), second));
+			QVERIFY(!store.add("not a hash", first));
+			QCOMPARE(store.count(), 2);
+			QCOMPARE(store.size(sha1(second)), qint64(second.size()));
+			QCOMPARE(store.size(sha1("nothing")), qint64(-1));
+		}
+
+		// everything is still there after opening it again
+		AssetPackStore store(dir.path());
+		QCOMPARE(store.count(), 2);
+		QByteArray data;
+		QVERIFY(store.read(sha1(first), &data));
+		QCOMPARE(data, first);
+		QVERIFY(store.read(sha1(second), &data));
+		QCOMPARE(data, second);
+		QVERIFY(!store.read(sha1("nothing"), &data));
+
+		QString target = dir.path() + "/out/a/b";
+		QVERIFY(store.extract(sha1(second), target));
+		QCOMPARE(TestsInternal::readFile(target), second);
+	}
+
+	void test_damagedIndex()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QByteArray first("first");
+		{
+			AssetPackStore store(dir.path());
+			QVERIFY(store.add(sha1(first), first));
+		}
+		QByteArray index = TestsInternal::readFile(dir.path() + "/index");
+		// half of a record, as if writing it was cut short
+		write(dir.path() + "/index", index + index.left(index.size() / 2));
+
+		QByteArray second("second");
+		{
+			AssetPackStore store(dir.path());
+			QCOMPARE(store.count(), 1);
+			QVERIFY(store.add(sha1(second), second));
+		}
+		AssetPackStore store(dir.path());
+		QCOMPARE(store.count(), 2);
+		QVERIFY(store.verify(sha1(first)));
+		QVERIFY(store.verify(sha1(second)));
+	}
+
+	void test_forget()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QByteArray data("forget me");
+		{
+			AssetPackStore store(dir.path());
+			QVERIFY(store.add(sha1(data), data));
+			QVERIFY(store.forget(sha1(data)));
+			QVERIFY(!store.contains(sha1(data)));
+		}
+		AssetPackStore store(dir.path());
+		QVERIFY(!store.contains(sha1(data)));
+		// and it can come back
+		QVERIFY(store.add(sha1(data), data));
+		QVERIFY(store.contains(sha1(data)));
+	}
+
+	void test_verifyAll()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QByteArray good("good object");
+		QByteArray bad("bad object");
+		AssetPackStore store(dir.path());
+		QVERIFY(store.add(sha1(good), good));
+		QVERIFY(store.add(sha1(bad), bad));
+
+		// flip a byte of the second object in the pack
+		QFile pack(dir.path() + "/pack-0");
+		QVERIFY(pack.open(QIODevice::ReadWrite));
+		QVERIFY(pack.seek(good.size()));
+		QVERIFY(pack.write("B", 1) == 1);
+		pack.close();
+
+		QCOMPARE(store.verifyAll(), QStringList() << sha1(bad));
+		QVERIFY(!store.extract(sha1(bad), dir.path() + "/out"));
+		QVERIFY(!QFile::exists(dir.path() + "/out"));
+		QCOMPARE(store.verifyAll(true), QStringList() << sha1(bad));
+		QVERIFY(!store.contains(sha1(bad)));
+		QVERIFY(store.contains(sha1(good)));
+	}
+
+	void test_migrate()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QString objects = dir.path() + "/objects";
+		QByteArray used("used by an instance");
+		QByteArray unused("not used by anything");
+		QByteArray broken("broken");
+		write(loosePath(objects, used), used);
+		write(loosePath(objects, unused), unused);
+		write(loosePath(objects, broken), "BROKEN");
+		write(objects + "/not/an/object", "something else");
+
+		AssetPackStore store(dir.path() + "/packs");
+		QSet<QString> keep;
+		keep.insert(sha1(used));
+		auto migration = store.migrate(objects, keep);
+		QCOMPARE(migration.packed, 2);
+		QCOMPARE(migration.removed, 1);
+		QCOMPARE(migration.bad, 1);
+		QCOMPARE(migration.bytes, qint64(used.size() + unused.size()));
+
+		QVERIFY(QFile::exists(loosePath(objects, used)));
+		QVERIFY(!QFile::exists(loosePath(objects, unused)));
+		QVERIFY(QFile::exists(loosePath(objects, broken)));
+		QVERIFY(QFile::exists(objects + "/not/an/object"));
+		QVERIFY(store.verify(sha1(used)));
+		QVERIFY(store.verify(sha1(unused)));
+		QVERIFY(!store.contains(sha1(broken)));
+
+		// nothing new the second time
+		migration = store.migrate(objects, keep);
+		QCOMPARE(migration.packed, 0);
+		QCOMPARE(migration.removed, 0);
+	}
+
+	void test_packKeepsObjectsInUse()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QString assets = dir.path() + "/assets";
+		QString objects = assets + "/objects";
+		QByteArray used("used by an instance");
+		QByteArray unused("not used by anything");
+		for (auto data : {used, unused})
+		{
+			write(loosePath(objects, data), data);
+			QJsonObject object;
+			object.insert("hash", sha1(data));
+			object.insert("size", data.size());
+			QJsonObject index;
+			index.insert(data == used ? "used/thing" : "unused/thing", object);
+			QJsonObject root;
+			root.insert("objects", index);
+			write(assets + "/indexes/" + (data == used ? "used" : "unused") + ".json",
+				  QJsonDocument(root).toJson());
+		}
+		write(objects + "/.complete-used", "stamp");
+		write(objects + "/.complete-unused", "stamp");
+
+		// like on startup: nothing has looked at the instances' versions yet
+		TestInstances setup(dir.path());
+		setup.addOneSix("instance", "used", QStringList());
+		auto instances = setup.load();
+		QCOMPARE(instances->count(), 1);
+
+		auto packs = std::make_shared<AssetPackStore>(assets + "/packs");
+		PackAssetsTask task(packs, instances, false, assets);
+		QSignalSpy finished(&task, SIGNAL(finished()));
+		task.start();
+		QVERIFY(finished.count() || finished.wait());
+		QVERIFY(task.successful());
+
+		QCOMPARE(task.report().migration.packed, 2);
+		QCOMPARE(task.report().migration.removed, 1);
+		QVERIFY(QFile::exists(loosePath(objects, used)));
+		QVERIFY(!QFile::exists(loosePath(objects, unused)));
+		QVERIFY(QFile::exists(objects + "/.complete-used"));
+		QVERIFY(!QFile::exists(objects + "/.complete-unused"));
+	}
+
+	void test_extractForLaunch()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QString assets = dir.path();
+		QByteArray packed("only in the packs");
+		QByteArray loose("loose");
+
+		auto packs = std::make_shared<AssetPackStore>(assets + "/packs");
+		QVERIFY(packs->add(sha1(packed), packed));
+		write(loosePath(assets + "/objects", loose), loose);
+
+		QJsonObject objects;
+		for (auto data : {packed, loose})
+		{
+			QJsonObject object;
+			object.insert("hash", sha1(data));
+			object.insert("size", data.size());
+			objects.insert("thing/" + sha1(data), object);
+		}
+		QJsonObject root;
+		root.insert("objects", objects);
+		write(assets + "/indexes/modern.json", QJsonDocument(root).toJson());
+
+		ENV.setAssetPacks(packs);
+		ReconstructAssetsTask task("modern", assets);
+		QSignalSpy finished(&task, SIGNAL(finished()));
+		task.start();
+		QVERIFY(finished.count() || finished.wait());
+		ENV.setAssetPacks(nullptr);
+
+		QVERIFY(task.successful());
+		QCOMPARE(task.placed(), 2);
+		QCOMPARE(TestsInternal::readFile(loosePath(assets + "/objects", packed)), packed);
+		QVERIFY(QFile::exists(assets + "/objects/.complete-modern"));
+	}
+};
+
+QTEST_GUILESS_MAIN(AssetPackStoreTest)
+
+#include "tst_AssetPackStore.moc"
@@ -0,0 +1,534 @@
+#include <QTest>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QCryptographicHash>
+#include <QVariant>
+#include <QFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QSet>
+#include <QDirIterator>
+#include <QSignalSpy>
+#include "TestUtil.h"
+#include "LocalHttpServer.h"
+
+#include "Env.h"
+#include "minecraft/AssetsUtils.h"
+#include "minecraft/AssetDownloadTask.h"
+#include "minecraft/ReconstructAssetsTask.h"
+#include "minecraft/VerifyAssetsTask.h"
+#include "net/NetScheduler.h"
+
+class AssetsUtilsTest : public QObject
+{
+	Q_OBJECT
+private:
+	/// an index that looks like the real ones, with count objects
+	QByteArray makeIndex(int count)
+	{
+		QJsonObject objects;
+		for (int i = 0; i < count; i++)
+		{
+			QString path = QString("minecraft/sounds/thing%1/sound%2.ogg").arg(i % 40).arg(i);
+			QJsonObject object;
+			object.insert("hash", QString(QCryptographicHash::hash(path.toUtf8(),
+																   QCryptographicHash::Sha1)
+											  .toHex()));
+			object.insert("size", 1000 + i * 37);
+			objects.insert(path, object);
+		}
+		QJsonObject root;
+		root.insert("objects", objects);
+		root.insert("virtual", true);
+		return QJsonDocument(root).toJson();
+	}
+
+	/// how the index used to be read
+	QMap<QString, AssetObject> parseWithQJsonDocument(const QByteArray &json)
+	{
+		QMap<QString, AssetObject> result;
+		QJsonObject root = QJsonDocument::fromJson(json).object();
+		QVariantMap map = root.value("objects").toVariant().toMap();
+		for (auto iter = map.begin(); iter != map.end(); ++iter)
+		{
+			QVariantMap nested = iter.value().toMap();
+			AssetObject object;
+			object.path = iter.key();
+			object.hash = nested.value("hash").toString();
+			object.size = nested.value("size").toDouble();
+			result.insert(iter.key(), object);
+		}
+		return result;
+	}
+
+	void write(const QString &path, const QByteArray &data)
+	{
+		QFile file(path);
+		QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+		QCOMPARE(file.write(data), qint64(data.size()));
+	}
+
+	/// put the objects into assets/objects and return a virtual index listing them at 'path'
+	QByteArray addObjects(const QString &assets, const QMap<QString, QByteArray> &files)
+	{
+		QJsonObject objects;
+		for (auto iter = files.begin(); iter != files.end(); ++iter)
+		{
+			QString hash = QCryptographicHash::hash(iter.value(), QCryptographicHash::Sha1).toHex();
+			QDir().mkpath(assets + "/objects/" + hash.left(2));
+			write(assets + "/objects/" + hash.left(2) + "/" + hash, iter.value());
+			QJsonObject object;
+			object.insert("hash", hash);
+			object.insert("size", iter.value().size());
+			objects.insert(iter.key(), object);
+		}
+		QJsonObject root;
+		root.insert("objects", objects);
+		root.insert("virtual", true);
+		return QJsonDocument(root).toJson();
+	}
+
+	/// true if the task finished, right away or a bit later
+	bool run(Task &task)
+	{
+		QSignalSpy finished(&task, SIGNAL(finished()));
+		task.start();
+		return finished.count() || finished.wait();
+	}
+
+private
+slots:
+	void cleanupTestCase()
+	{
+		ENV.destroy();
+	}
+
+	void test_parse()
+	{
+		QByteArray json = "{\n"
+						  "  \"virtual\": true,\n"
+						  "  \"objects\": {\n"
+						  "    \"icons/icon_16x16.png\": {\n"
+						  "      \"hash\": \"bdf48ef6b5d0d23bbb02e17d04865216179f510a\",\n"
+						  "      \"size\": 3665\n"
+						  "    },\n"
+						  "    \"lang/\\u00e9t\\u00e9 \\\"\\ud83d\\ude00\\\".lang\": {\n"
+						  "      \"size\": 12, \"extra\": [1, 2.5e3, {\"a\": null}], \"hash\": \"ab\"\n"
+						  "    }\n"
+						  "  },\n"
+						  "  \"map_to_resources\": false\n"
+						  "}\n";
+		AssetsIndex index;
+		QString error;
+		QVERIFY2(AssetsUtils::parseAssetsIndex(json, &index, &error), qPrintable(error));
+		QVERIFY(index.isVirtual);
+		QCOMPARE(index.objects.size(), 2);
+		QCOMPARE(index.objects[0].path, QString("icons/icon_16x16.png"));
+		QCOMPARE(index.objects[0].hash, QString("bdf48ef6b5d0d23bbb02e17d04865216179f510a"));
+		QCOMPARE(index.objects[0].size, qint64(3665));
+		QCOMPARE(index.objects[1].path,
+				 QString::fromUtf8("lang/\xc3\xa9t\xc3\xa9 \"\xf0\x9f\x98\x80\".lang"));
+		QCOMPARE(index.objects[1].hash, QString("ab"));
+		QCOMPARE(index.objects[1].size, qint64(12));
+	}
+
+	void test_parseErrors_data()
+	{
+		QTest::addColumn<QByteArray>("json");
+		QTest::newRow("empty") << QByteArray();
+		QTest::newRow("array") << QByteArray("[]");
+		QTest::newRow("truncated") << QByteArray("{\"objects\": {\"a\": {\"hash\": \"x\"");
+		QTest::newRow("missing comma") << QByteArray("{\"objects\": {} \"virtual\": true}");
+		QTest::newRow("bad number") << QByteArray("{\"objects\": {\"a\": {\"size\": -}}}");
+		QTest::newRow("garbage after") << QByteArray("{\"objects\": {}} x");
+		QTest::newRow("unterminated") << QByteArray("{\"objects");
+	}
+	void test_parseErrors()
+	{
+		QFETCH(QByteArray, json);
+		AssetsIndex index;
+		QString error;
+		QVERIFY(!AssetsUtils::parseAssetsIndex(json, &index, &error));
+		QVERIFY(!error.isEmpty());
+	}
+
+	void test_sameAsQJsonDocument()
+	{
+		QByteArray json = makeIndex(4000);
+		QElapsedTimer timer;
+
+		timer.start();
+		auto expected = parseWithQJsonDocument(json);
+		qint64 oldTime = timer.nsecsElapsed();
+
+		timer.start();
+		AssetsIndex index;
+		QVERIFY(AssetsUtils::parseAssetsIndex(json, &index));
+		qint64 newTime = timer.nsecsElapsed();
+
+		qDebug("QJsonDocument and QVariantMap: %.2f ms, single pass: %.2f ms", oldTime / 1e6,
+			   newTime / 1e6);
+		QVERIFY(index.isVirtual);
+		QCOMPARE(index.objects.size(), expected.size());
+		for (auto &object : index.objects)
+		{
+			QVERIFY(expected.contains(object.path));
+			QCOMPARE(object.hash, expected[object.path].hash);
+			QCOMPARE(object.size, expected[object.path].size);
+		}
+	}
+
+	void test_sidecar()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QString path = dir.path() + "/1.8.json";
+		QString sidecar = AssetsUtils::assetsIndexSidecar(path);
+		QByteArray json = makeIndex(100);
+		write(path, json);
+
+		AssetsIndex parsed;
+		QVERIFY(AssetsUtils::parseAssetsIndex(json, &parsed));
+
+		// the first load writes the sidecar, the second one reads it
+		for (int i = 0; i < 2; i++)
+		{
+			AssetsIndex index;
+			QVERIFY(AssetsUtils::loadAssetsIndexJson(path, &index));
+			QVERIFY(QFile::exists(sidecar));
+			QCOMPARE(index.objects.size(), parsed.objects.size());
+			QCOMPARE(index.objects.last().path, parsed.objects.last().path);
+			QCOMPARE(index.objects.last().hash, parsed.objects.last().hash);
+			QCOMPARE(index.objects.last().size, parsed.objects.last().size);
+			QCOMPARE(index.isVirtual, parsed.isVirtual);
+		}
+
+		// rewritten with the same contents
+		write(path, json);
+		AssetsIndex same;
+		QVERIFY(AssetsUtils::loadAssetsIndexJson(path, &same));
+		QCOMPARE(same.objects.size(), 100);
+
+		// changed contents win over the sidecar
+		write(path, makeIndex(10));
+		AssetsIndex changed;
+		QVERIFY(AssetsUtils::loadAssetsIndexJson(path, &changed));
+		QCOMPARE(changed.objects.size(), 10);
+
+		// a broken sidecar is ignored and replaced
+		QByteArray good = TestsInternal::readFile(sidecar);
+		write(sidecar, good.left(good.size() / 2));
+		AssetsIndex repaired;
+		QVERIFY(AssetsUtils::loadAssetsIndexJson(path, &repaired));
+		QCOMPARE(repaired.objects.size(), 10);
+		QCOMPARE(TestsInternal::readFile(sidecar), good);
+
+		// and a broken index fails, whatever the sidecar says
+		write(path, "{");
+		AssetsIndex broken;
+		QVERIFY(!AssetsUtils::loadAssetsIndexJson(path, &broken));
+	}
+
+	void test_reconstruct()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QString assets = dir.path();
+		QString root = ReconstructAssetsTask::virtualRoot("legacy", assets);
+		QMap<QString, QByteArray> files;
+		files.insert("sound/a.ogg", "first");
+		files.insert("sound/deeper/b.ogg", "second one");
+		files.insert("lang/en_US.lang", "third");
+		QDir().mkpath(assets + "/indexes");
+		write(assets + "/indexes/legacy.json", addObjects(assets, files));
+
+		ReconstructAssetsTask task("legacy", assets);
+		QVERIFY(run(task));
+		QVERIFY(task.successful());
+		QCOMPARE(task.placed(), 3);
+		QCOMPARE(task.incomplete(), 0);
+		for (auto iter = files.begin(); iter != files.end(); ++iter)
+		{
+			QCOMPARE(TestsInternal::readFile(root + "/" + iter.key()), iter.value());
+		}
+
+		// complete, so nothing is looked at again
+		QFile::remove(root + "/sound/a.ogg");
+		ReconstructAssetsTask again("legacy", assets);
+		QVERIFY(run(again));
+		QVERIFY(again.successful());
+		QVERIFY(!QFile::exists(root + "/sound/a.ogg"));
+
+		// until the index changes
+		files.insert("sound/a.ogg", "first, but longer");
+		files.insert("missing.ogg", "gone");
+		QByteArray index = addObjects(assets, files);
+		QString missing = QCryptographicHash::hash("gone", QCryptographicHash::Sha1).toHex();
+		QVERIFY(QFile::remove(assets + "/objects/" + missing.left(2) + "/" + missing));
+		write(assets + "/indexes/legacy.json", index);
+		ReconstructAssetsTask changed("legacy", assets);
+		QVERIFY(run(changed));
+		QVERIFY(changed.successful());
+		QCOMPARE(changed.placed(), 3);
+		QCOMPARE(changed.incomplete(), 1);
+		QCOMPARE(TestsInternal::readFile(root + "/sound/a.ogg"), QByteArray("first, but longer"));
+
+		// incomplete folders are tried again
+		QFile::remove(root + "/lang/en_US.lang");
+		ReconstructAssetsTask retry("legacy", assets);
+		QVERIFY(run(retry));
+		QVERIFY(QFile::exists(root + "/lang/en_US.lang"));
+
+		// stopping halfway never leaves a folder that looks complete
+		files.remove("missing.ogg");
+		write(assets + "/indexes/legacy.json", addObjects(assets, files));
+		ReconstructAssetsTask stopped("legacy", assets);
+		QSignalSpy finished(&stopped, SIGNAL(finished()));
+		stopped.start();
+		stopped.abort();
+		QVERIFY(finished.count() || finished.wait());
+		QCOMPARE(QFile::exists(root + "/.complete"), !stopped.wasAborted());
+
+		// and a missing index fails
+		ReconstructAssetsTask noIndex("nothing", assets);
+		QVERIFY(run(noIndex));
+		QVERIFY(!noIndex.successful());
+	}
+
+	void test_reconstructAfterRepair()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QString assets = dir.path();
+		QString root = ReconstructAssetsTask::virtualRoot("legacy", assets);
+		QMap<QString, QByteArray> files;
+		files.insert("sound/good.ogg", "fine all along");
+		files.insert("sound/bad.ogg", "flipped");
+		QDir().mkpath(assets + "/indexes");
+		write(assets + "/indexes/legacy.json", addObjects(assets, files));
+
+		// same size, different contents. It ends up in the virtual folder like that.
+		QString hash = QCryptographicHash::hash("flipped", QCryptographicHash::Sha1).toHex();
+		QString object = assets + "/objects/" + hash.left(2) + "/" + hash;
+		write(object, "flopped");
+		ReconstructAssetsTask task("legacy", assets);
+		QVERIFY(run(task));
+		QVERIFY(task.successful());
+		QVERIFY(QFile::exists(root + "/.complete"));
+		QCOMPARE(TestsInternal::readFile(root + "/sound/bad.ogg"), QByteArray("flopped"));
+
+		// the download puts a new file in its place, the clone or link still has the old one
+		QTest::qWait(20);
+		LocalHttpServer server;
+		server.addFile(hash.left(2) + "/" + hash, "flipped");
+		AssetObject asset;
+		asset.path = "sound/bad.ogg";
+		asset.hash = hash;
+		asset.size = 7;
+		AssetDownloadTask repair(QVector<AssetObject>() << asset, assets + "/objects");
+		repair.setBaseUrl(server.url("").toString());
+		QVERIFY(run(repair));
+		QVERIFY(repair.successful());
+		QVERIFY(!QFile::exists(root + "/.complete"));
+
+		ReconstructAssetsTask again("legacy", assets);
+		QVERIFY(run(again));
+		QVERIFY(again.successful());
+		QCOMPARE(TestsInternal::readFile(root + "/sound/bad.ogg"), QByteArray("flipped"));
+		QCOMPARE(TestsInternal::readFile(root + "/sound/good.ogg"), QByteArray("fine all along"));
+		QVERIFY(QFile::exists(root + "/.complete"));
+	}
+
+	void test_verify()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QString assets = dir.path();
+		QMap<QString, QByteArray> files;
+		for (int i = 0; i < 300; i++)
+		{
+			files.insert(QString("sound/%1.ogg").arg(i), QByteArray(i * 100, char('a' + i % 26)));
+		}
+		files.insert("lang/en_US.lang", "good");
+		files.insert("lang/en_GB.lang", "good");
+		files.insert("lang/de_DE.lang", "flipped");
+		files.insert("lang/fr_FR.lang", "missing");
+		QDir().mkpath(assets + "/indexes");
+		write(assets + "/indexes/legacy.json", addObjects(assets, files));
+
+		auto objectPath = [&](const QByteArray &contents)
+		{
+			QString hash = QCryptographicHash::hash(contents, QCryptographicHash::Sha1).toHex();
+			return assets + "/objects/" + hash.left(2) + "/" + hash;
+		};
+		// same size, different contents. The size check alone can't see this one.
+		write(objectPath("flipped"), "flopped");
+		QVERIFY(QFile::remove(objectPath("missing")));
+
+		VerifyAssetsTask task("legacy", false, assets);
+		QVERIFY(run(task));
+		QVERIFY(task.successful());
+		// the two "good" ones are the same object
+		QCOMPARE(task.report().checked, 303);
+		QCOMPARE(task.report().bad, 2);
+		QCOMPARE(task.badObjects().size(), 2);
+		QSet<QString> bad;
+		for (auto &object : task.badObjects())
+		{
+			bad.insert(object.hash);
+		}
+		QVERIFY(bad.contains(QFileInfo(objectPath("flipped")).fileName()));
+		QVERIFY(bad.contains(QFileInfo(objectPath("missing")).fileName()));
+		qDebug("verified %lld bytes at %.1f MiB/s", task.report().bytes,
+			   task.report().throughput());
+
+		// without repair, nothing is touched
+		QCOMPARE(TestsInternal::readFile(objectPath("flipped")), QByteArray("flopped"));
+	}
+
+	void test_verifyAbort()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QString assets = dir.path();
+		QMap<QString, QByteArray> files;
+		for (int i = 0; i < 2000; i++)
+		{
+			files.insert(QString("sound/%1.ogg").arg(i), QByteArray(4096, char(i % 256)) +
+															 QByteArray::number(i));
+		}
+		QDir().mkpath(assets + "/indexes");
+		write(assets + "/indexes/many.json", addObjects(assets, files));
+
+		// aborted() only goes out once the worker is done with the task
+		VerifyAssetsTask task("many", false, assets);
+		QSignalSpy aborted(&task, SIGNAL(aborted()));
+		task.start();
+		QVERIFY(task.abort());
+		QVERIFY(aborted.count() || aborted.wait());
+		QVERIFY(task.wasAborted());
+		QVERIFY(!task.successful());
+
+		// going away right after the abort is fine too
+		auto gone = new VerifyAssetsTask("many", false, assets);
+		gone->start();
+		gone->abort();
+		delete gone;
+	}
+
+	void test_download()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QString objects = dir.path() + "/objects";
+		LocalHttpServer server;
+		auto object = [](const QString &path, const QByteArray &contents)
+		{
+			AssetObject result;
+			result.path = path;
+			result.hash = QCryptographicHash::hash(contents, QCryptographicHash::Sha1).toHex();
+			result.size = contents.size();
+			return result;
+		};
+		auto objectPath = [&](const AssetObject &asset)
+		{
+			return objects + "/" + asset.hash.left(2) + "/" + asset.hash;
+		};
+
+		QVector<AssetObject> good;
+		for (int i = 0; i < 40; i++)
+		{
+			QByteArray contents(i * 100, char('a' + i % 26));
+			contents += QByteArray::number(i);
+			good.append(object(QString("sound/%1.ogg").arg(i), contents));
+			server.addFile(good.last().hash.left(2) + "/" + good.last().hash, contents);
+		}
+		// a damaged copy that is in the way
+		QDir().mkpath(QFileInfo(objectPath(good[3])).absolutePath());
+		write(objectPath(good[3]), "damaged");
+
+		QVector<AssetObject> all = good;
+		// the same object under another name is only downloaded once
+		all.append(good[0]);
+		all.last().path = "sound/again.ogg";
+		// the server sends something else for this one
+		auto lying = object("lang/lying.lang", "the truth");
+		server.addFile(lying.hash.left(2) + "/" + lying.hash, "the lies");
+		all.append(lying);
+		// and doesn't have this one at all
+		all.append(object("lang/missing.lang", "missing"));
+
+		RetryPolicy retries;
+		retries.maxRetries = 1;
+		retries.initialDelay = 10;
+		retries.jitter = 0;
+		AssetDownloadTask task(all, objects);
+		task.setBaseUrl(server.url("").toString());
+		task.setRetryPolicy(retries);
+		task.setConcurrency(3);
+		QVERIFY(run(task));
+		QVERIFY(!task.successful());
+		QVERIFY(task.failReason().startsWith("2 of 42"));
+		QCOMPARE(task.downloaded(), 40);
+		// the two bad ones were tried twice
+		QCOMPARE(task.attempts(), 44);
+		QCOMPARE(server.requests["GET"], 44);
+
+		for (auto &asset : good)
+		{
+			QVERIFY(VerifyAssetsTask::verifyObject(objectPath(asset), asset, nullptr));
+		}
+		QVERIFY(!QFile::exists(objectPath(lying)));
+		// nothing half done is left behind
+		QStringList parts;
+		QDirIterator files(objects, QStringList() << "*.part", QDir::Files,
+						   QDirIterator::Subdirectories);
+		while (files.hasNext())
+		{
+			parts.append(files.next());
+		}
+		QCOMPARE(parts, QStringList());
+
+		AssetDownloadTask again(good, objects);
+		again.setBaseUrl(server.url("").toString());
+		QVERIFY(run(again));
+		QVERIFY(again.successful());
+	}
+
+	void test_downloadDestroyed()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QString objects = dir.path() + "/objects";
+		// slow enough to still be busy when the task goes away
+		LocalHttpServer server(50 * 1024);
+		QVector<AssetObject> assets;
+		for (int i = 0; i < 20; i++)
+		{
+			QByteArray contents(200 * 1024, char('a' + i));
+			AssetObject asset;
+			asset.path = QString("sound/%1.ogg").arg(i);
+			asset.hash = QCryptographicHash::hash(contents, QCryptographicHash::Sha1).toHex();
+			asset.size = contents.size();
+			assets.append(asset);
+			server.addFile(asset.hash.left(2) + "/" + asset.hash, contents);
+		}
+		auto task = new AssetDownloadTask(assets, objects);
+		task->setBaseUrl(server.url("").toString());
+		task->start();
+		QTRY_VERIFY(server.requests["GET"] > 0);
+
+		delete task;
+		QCOMPARE(ENV.netScheduler()->globalStats().queued, 0);
+		QTRY_COMPARE(ENV.netScheduler()->globalStats().active, 0);
+		int requests = server.requests["GET"];
+		QTest::qWait(200);
+		QCOMPARE(server.requests["GET"], requests);
+	}
+};
+
+QTEST_GUILESS_MAIN(AssetsUtilsTest)
+
+#include "tst_AssetsUtils.moc"
@@ -0,0 +1,133 @@
+#include <QTest>
+#include <QTemporaryDir>
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include "TestUtil.h"
+
+#include "FileSystem.h"
+#include "net/BlobStore.h"
+
+class BlobStoreTest : public QObject
+{
+	Q_OBJECT
+private:
+	QString md5(const QByteArray &data)
+	{
+		return QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex();
+	}
+
+	void write(const QString &path, const QByteArray &data)
+	{
+		QDir().mkpath(QFileInfo(path).absolutePath());
+		QFile file(path);
+		QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+		QCOMPARE(file.write(data), qint64(data.size()));
+	}
+
+private
+slots:
+	void test_adopt()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		BlobStore store(dir.path() + "/blobs");
+		QByteArray data("the same library, from two places");
+		QString first = dir.path() + "/libraries/a.jar";
+		QString second = dir.path() + "/versions/b.jar";
+		write(first, data);
+		write(second, data);
+
+		QVERIFY(store.adopt(first, md5(data)));
+		QVERIFY(store.adopt(second, md5(data)));
+		// again is fine
+		QVERIFY(store.adopt(second, md5(data)));
+		QCOMPARE(FS::linkCount(store.blobPath(md5(data))), 3);
+		QCOMPARE(TestsInternal::readFile(second), data);
+
+		// a file that doesn't match its md5 is left alone
+		QString liar = dir.path() + "/libraries/c.jar";
+		write(liar, "something else entirely, really");
+		QVERIFY(!store.adopt(liar, md5(data)));
+		QCOMPARE(FS::linkCount(liar), 1);
+	}
+
+	void test_adoptQuickly()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		BlobStore store(dir.path() + "/blobs");
+		QByteArray data("twenty bytes of data");
+		QString first = dir.path() + "/libraries/a.jar";
+		QString second = dir.path() + "/libraries/b.jar";
+		write(first, data);
+		// as big and as old as the blob will be, but not a link to it
+		write(second, QByteArray("twenty other bytes..").left(data.size()));
+
+		// nothing to compare with yet
+		QVERIFY(store.canAdoptQuickly(first, md5(data)));
+		QVERIFY(store.adopt(first, md5(data)));
+		QVERIFY(store.canAdoptQuickly(first, md5(data)));
+		QVERIFY(FS::sameFile(first, store.blobPath(md5(data))));
+
+		// the same size and time tell nothing, the contents have to be compared
+		QVERIFY(!store.canAdoptQuickly(second, md5(data)));
+		QVERIFY(!store.adopt(second, md5(data)));
+		QVERIFY(!FS::sameFile(second, store.blobPath(md5(data))));
+	}
+
+	void test_cloneOrCopy()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QString source = dir.path() + "/cache.jar";
+		QString target = dir.path() + "/instance.jar";
+		write(source, "from the cache");
+		QVERIFY(BlobStore::cloneOrCopy(source, target));
+		QCOMPARE(FS::linkCount(source), 1);
+
+		// changing the copy in place doesn't reach the cache
+		QFile file(target);
+		QVERIFY(file.open(QIODevice::ReadWrite));
+		QVERIFY(file.write("CHANGED") == 7);
+		file.close();
+		QCOMPARE(TestsInternal::readFile(source), QByteArray("from the cache"));
+	}
+
+	void test_collect()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		BlobStore store(dir.path() + "/blobs");
+		QByteArray kept("still used");
+		QByteArray orphaned("nobody wants me");
+		QString keptFile = dir.path() + "/libraries/kept.jar";
+		QString orphanedFile = dir.path() + "/libraries/orphaned.jar";
+		write(keptFile, kept);
+		write(orphanedFile, orphaned);
+		QVERIFY(store.adopt(keptFile, md5(kept)));
+		QVERIFY(store.adopt(orphanedFile, md5(orphaned)));
+
+		// as if the cache GC removed it
+		QVERIFY(QFile::remove(orphanedFile));
+
+		auto dryRun = store.collect(true);
+		QCOMPARE(dryRun.blobs, 1);
+		QCOMPARE(dryRun.bytes, qint64(orphaned.size()));
+		QVERIFY(QFile::exists(store.blobPath(md5(orphaned))));
+
+		auto collected = store.collect();
+		QCOMPARE(collected.blobs, 1);
+		QCOMPARE(collected.bytes, qint64(orphaned.size()));
+		QVERIFY(!QFile::exists(store.blobPath(md5(orphaned))));
+		QVERIFY(QFile::exists(store.blobPath(md5(kept))));
+		QCOMPARE(TestsInternal::readFile(keptFile), kept);
+
+		QCOMPARE(store.collect().blobs, 0);
+	}
+};
+
+QTEST_GUILESS_MAIN(BlobStoreTest)
+
+#include "tst_BlobStore.moc"
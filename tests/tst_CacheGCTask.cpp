@@ -0,0 +1,233 @@
+#include <QTest>
+#include <QTemporaryDir>
+#include <QCryptographicHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSignalSpy>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <utime.h>
+#include <ctime>
+#include "TestUtil.h"
+#include "TestInstances.h"
+
+#include "Env.h"
+#include "FileSystem.h"
+#include "net/HttpMetaCache.h"
+#include "net/CacheGCTask.h"
+#include <pathutils.h>
+
+class CacheGCTaskTest : public QObject
+{
+	Q_OBJECT
+private:
+	void write(const QString &path, const QByteArray &data)
+	{
+		QDir().mkpath(QFileInfo(path).absolutePath());
+		QFile file(path);
+		QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+		QCOMPARE(file.write(data), qint64(data.size()));
+	}
+
+	/// a file in the cache, last used at 'lastAccess'. Returns its full path.
+	QString addEntry(const QString &base, const QString &path, const QByteArray &data,
+					 qint64 lastAccess)
+	{
+		auto metacache = ENV.metacache();
+		QString fullPath = PathCombine(metacache->getBasePath(base), path);
+		write(fullPath, data);
+		auto entry = metacache->resolveEntry(base, path);
+		entry->md5sum = QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex();
+		entry->stale = false;
+		metacache->updateEntry(entry);
+		entry->last_access_timestamp = lastAccess;
+		return fullPath;
+	}
+
+	QString objectPath(const QByteArray &data)
+	{
+		QString hash = QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex();
+		return PathCombine(ENV.metacache()->getBasePath("asset_objects"), hash.left(2), hash);
+	}
+
+	bool run(Task &task)
+	{
+		QSignalSpy finished(&task, SIGNAL(finished()));
+		task.start();
+		return finished.count() || finished.wait();
+	}
+
+	QTemporaryDir m_dir;
+
+private
+slots:
+	void initTestCase()
+	{
+		QVERIFY(m_dir.isValid());
+		QDir::setCurrent(m_dir.path());
+		ENV.initHttpMetaCache(m_dir.path(), m_dir.path());
+	}
+
+	void cleanupTestCase()
+	{
+		ENV.destroy();
+	}
+
+	void test_leastRecentlyUsedFirst()
+	{
+		auto metacache = ENV.metacache();
+		QByteArray data(100, 'x');
+		QString second = addEntry("libraries", "b.jar", data, 2000);
+		QString third = addEntry("libraries", "c.jar", data, 3000);
+		QString first = addEntry("libraries", "a.jar", data, 1000);
+		QString pinned = addEntry("libraries", "pinned.jar", data, 500);
+		metacache->setBaseQuota("libraries", 250);
+
+		// nothing happens in a dry run, but the report is the same
+		CacheGCTask dryRun(nullptr, true);
+		dryRun.keep("libraries", "pinned.jar");
+		QVERIFY(run(dryRun));
+		QVERIFY(dryRun.successful());
+		QCOMPARE(dryRun.report().files, QStringList() << first << second);
+		QCOMPARE(dryRun.report().bytes, qint64(200));
+		QVERIFY(QFile::exists(first));
+		QVERIFY(QFile::exists(second));
+		QVERIFY(!metacache->getEntry("libraries", "a.jar")->stale);
+
+		CacheGCTask task(nullptr);
+		task.keep("libraries", "pinned.jar");
+		QVERIFY(run(task));
+		QVERIFY(task.successful());
+		QCOMPARE(task.report().files, QStringList() << first << second);
+		QCOMPARE(task.report().bytes, qint64(200));
+		QVERIFY(!QFile::exists(first));
+		QVERIFY(!QFile::exists(second));
+		QVERIFY(QFile::exists(third));
+		QVERIFY(QFile::exists(pinned));
+		QVERIFY(metacache->getEntry("libraries", "a.jar")->stale);
+		QVERIFY(!metacache->getEntry("libraries", "c.jar")->stale);
+
+		// under the quota now
+		CacheGCTask again(nullptr);
+		QVERIFY(run(again));
+		QVERIFY(again.report().files.isEmpty());
+		metacache->setBaseQuota("libraries", 0);
+	}
+
+	void test_instancePins()
+	{
+		auto metacache = ENV.metacache();
+		QByteArray data(100, 'x');
+		QString used = addEntry("libraries", "org/example/used/1.0/used-1.0.jar", data, 100);
+		QString old = addEntry("libraries", "old.jar", data, 200);
+		QString newer = addEntry("libraries", "newer.jar", data, 300);
+		QString index = addEntry("asset_indexes", "inuse.json", data, 100);
+		QString otherIndex = addEntry("asset_indexes", "other.json", data, 200);
+		metacache->setBaseQuota("libraries", 150);
+		metacache->setBaseQuota("asset_indexes", 150);
+
+		// like on startup: nothing has looked at the instance's version yet
+		TestInstances setup(PathCombine(m_dir.path(), "setup"));
+		setup.addOneSix("instance", "inuse", QStringList() << "org.example:used:1.0");
+		auto instances = setup.load();
+		QCOMPARE(instances->count(), 1);
+
+		CacheGCTask task(instances);
+		QVERIFY(run(task));
+		QVERIFY(task.successful());
+		QVERIFY(QFile::exists(used));
+		QVERIFY(QFile::exists(index));
+		QVERIFY(!QFile::exists(old));
+		QVERIFY(!QFile::exists(newer));
+		QVERIFY(!QFile::exists(otherIndex));
+		metacache->setBaseQuota("libraries", 0);
+		metacache->setBaseQuota("asset_indexes", 0);
+	}
+
+	void test_assetObjects()
+	{
+		auto metacache = ENV.metacache();
+		QByteArray used(100, 'u');
+		QByteArray unused(100, 'o');
+		QByteArray fresh(100, 'n');
+		for (auto data : {used, unused, fresh})
+		{
+			write(objectPath(data), data);
+		}
+		// as if an update got it while the GC was running
+		struct utimbuf times;
+		times.actime = times.modtime = std::time(nullptr) + 3600;
+		QCOMPARE(utime(QFile::encodeName(objectPath(fresh)).constData(), &times), 0);
+
+		QJsonObject object;
+		object.insert("hash", QFileInfo(objectPath(used)).fileName());
+		object.insert("size", used.size());
+		QJsonObject objects;
+		objects.insert("used.ogg", object);
+		QJsonObject root;
+		root.insert("objects", objects);
+		write(PathCombine(metacache->getBasePath("asset_indexes"), "used.json"),
+			  QJsonDocument(root).toJson());
+
+		// under the quota, nothing goes
+		metacache->setBaseQuota("asset_objects", 1000);
+		CacheGCTask underQuota(nullptr);
+		QVERIFY(run(underQuota));
+		QCOMPARE(underQuota.report().assetObjects, 0);
+		QVERIFY(QFile::exists(objectPath(unused)));
+
+		// an update is running, nothing goes
+		metacache->setBaseQuota("asset_objects", 150);
+		{
+			auto hold = ENV.holdAssets();
+			CacheGCTask held(nullptr);
+			QVERIFY(run(held));
+			QCOMPARE(held.report().assetObjects, 0);
+			QVERIFY(QFile::exists(objectPath(unused)));
+		}
+
+		CacheGCTask task(nullptr);
+		QVERIFY(run(task));
+		QCOMPARE(task.report().assetObjects, 1);
+		QCOMPARE(task.report().assetBytes, qint64(unused.size()));
+		QVERIFY(QFile::exists(objectPath(used)));
+		QVERIFY(!QFile::exists(objectPath(unused)));
+		QVERIFY(QFile::exists(objectPath(fresh)));
+		metacache->setBaseQuota("asset_objects", 0);
+	}
+
+	void test_blobs()
+	{
+		auto metacache = ENV.metacache();
+		metacache->setBlobStore(std::make_shared<BlobStore>(m_dir.path() + "/cache/blobs"));
+		QByteArray data("a version jar that is shared");
+		QString shared = addEntry("versions", "1.0/1.0.jar", data, 1000);
+		QCOMPARE(FS::linkCount(shared), 2);
+		// the copy is compared with the blob on a worker thread before it is linked
+		QString copy = addEntry("general", "1.0.jar", data, 1000);
+		QTRY_COMPARE(FS::linkCount(shared), 3);
+		QVERIFY(FS::sameFile(copy, shared));
+		metacache->evictEntry(metacache->getEntry("general", "1.0.jar"));
+		QVERIFY(QFile::remove(copy));
+
+		// removing the file itself frees nothing, the blob goes after it
+		metacache->setBaseQuota("versions", 1);
+		CacheGCTask task(nullptr);
+		QVERIFY(run(task));
+		QCOMPARE(task.report().files, QStringList() << shared);
+		QCOMPARE(task.report().bytes, qint64(0));
+		QCOMPARE(task.report().blobs, 1);
+		QCOMPARE(task.report().blobBytes, qint64(data.size()));
+
+		// bases with a quota don't share their files
+		QString alone = addEntry("versions", "1.1/1.1.jar", data, 2000);
+		QCOMPARE(FS::linkCount(alone), 1);
+		metacache->setBaseQuota("versions", 0);
+		metacache->setBlobStore(nullptr);
+	}
+};
+
+QTEST_GUILESS_MAIN(CacheGCTaskTest)
+
+#include "tst_CacheGCTask.moc"
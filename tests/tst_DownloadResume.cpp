@@ -0,0 +1,177 @@
+#include <QTest>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include "TestUtil.h"
+#include "LocalHttpServer.h"
+
+#include "Env.h"
+#include "FileSystem.h"
+#include "net/HttpMetaCache.h"
+#include "net/CacheDownload.h"
+#include "net/MD5EtagDownload.h"
+#include "net/NetJob.h"
+
+class DownloadResumeTest : public QObject
+{
+	Q_OBJECT
+private:
+	QByteArray makeData(int size, quint32 seed = 42)
+	{
+		QByteArray data;
+		data.reserve(size);
+		for (int i = 0; i < size; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			data.append(char(seed >> 16));
+		}
+		return data;
+	}
+
+	QString md5(const QByteArray &data)
+	{
+		return QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex();
+	}
+
+	/// runs the action to completion, true if it succeeded
+	bool run(NetActionPtr action)
+	{
+		QSignalSpy succeeded(action.get(), SIGNAL(succeeded(int)));
+		QSignalSpy failed(action.get(), SIGNAL(failed(int)));
+		action->start();
+		QElapsedTimer timer;
+		timer.start();
+		while (succeeded.isEmpty() && failed.isEmpty() && timer.elapsed() < 60000)
+		{
+			QTest::qWait(10);
+		}
+		return !succeeded.isEmpty();
+	}
+
+	QTemporaryDir m_dir;
+
+private
+slots:
+	void initTestCase()
+	{
+		QVERIFY(m_dir.isValid());
+		QDir::setCurrent(m_dir.path());
+		ENV.initHttpMetaCache(m_dir.path(), m_dir.path());
+	}
+	void cleanupTestCase()
+	{
+		ENV.destroy();
+	}
+
+	void test_resume()
+	{
+		LocalHttpServer server;
+		QByteArray data = makeData(200 * 1024);
+		server.addFile("resume.bin", data);
+		server.breakAfter("resume.bin", 50000);
+
+		auto entry = ENV.metacache()->resolveEntry("general", "resume.bin");
+		auto dl = CacheDownload::make(server.url("resume.bin"), entry);
+		QVERIFY(!run(dl));
+		QCOMPARE(QFileInfo(entry->getFullPath() + ".part").size(), qint64(50000));
+
+		// the next attempt only asks for the rest
+		QVERIFY(run(dl));
+		QCOMPARE(server.ranges, QList<QByteArray>() << "" << "bytes=50000-");
+		QCOMPARE(FS::read(entry->getFullPath()), data);
+		QCOMPARE(entry->md5sum, md5(data));
+		QVERIFY(!QFile::exists(entry->getFullPath() + ".part"));
+	}
+
+	void test_resumeChangedFile()
+	{
+		LocalHttpServer server;
+		QByteArray data = makeData(200 * 1024);
+		server.addFile("changed.bin", data);
+		server.breakAfter("changed.bin", 50000);
+
+		auto entry = ENV.metacache()->resolveEntry("general", "changed.bin");
+		auto dl = CacheDownload::make(server.url("changed.bin"), entry);
+		QVERIFY(!run(dl));
+
+		// If-Range doesn't match anymore, so the server sends all of it with a 200
+		QByteArray changed = makeData(150 * 1024, 7);
+		server.addFile("changed.bin", changed);
+		QVERIFY(run(dl));
+		QCOMPARE(server.ranges.last(), QByteArray("bytes=50000-"));
+		QCOMPARE(FS::read(entry->getFullPath()), changed);
+		QCOMPARE(entry->md5sum, md5(changed));
+	}
+
+	void test_resumeUncached()
+	{
+		LocalHttpServer server;
+		QByteArray data = makeData(100 * 1024);
+		server.addFile("uncached.bin", data);
+		server.breakAfter("uncached.bin", 30000);
+
+		QString target = m_dir.path() + "/uncached/uncached.bin";
+		auto dl = MD5EtagDownload::make(server.url("uncached.bin"), target);
+		QVERIFY(!run(dl));
+		QCOMPARE(QFileInfo(target).size(), qint64(30000));
+		QVERIFY(run(dl));
+		QCOMPARE(server.ranges.last(), QByteArray("bytes=30000-"));
+		QCOMPARE(FS::read(target), data);
+	}
+
+	void test_retryDelays()
+	{
+		RetryPolicy policy;
+		policy.initialDelay = 100;
+		policy.maxDelay = 1000;
+		policy.jitter = 0;
+		QCOMPARE(policy.delayFor(1), 100);
+		QCOMPARE(policy.delayFor(2), 200);
+		QCOMPARE(policy.delayFor(3), 400);
+		QCOMPARE(policy.delayFor(4), 800);
+		QCOMPARE(policy.delayFor(5), 1000);
+		QCOMPARE(policy.delayFor(20), 1000);
+
+		// the randomized part only ever shortens the delay, by at most the jitter
+		policy.jitter = 0.5;
+		for (int i = 0; i < 100; i++)
+		{
+			int delay = policy.delayFor(3);
+			QVERIFY(delay >= 200 && delay <= 400);
+		}
+	}
+
+	void test_retryBackoff()
+	{
+		LocalHttpServer server;
+		NetJobPtr job(new NetJob("retries"));
+		RetryPolicy policy;
+		policy.maxRetries = 2;
+		policy.initialDelay = 100;
+		policy.jitter = 0;
+		job->setRetryPolicy(policy);
+		auto entry = ENV.metacache()->resolveEntry("general", "missing.bin");
+		job->addNetAction(CacheDownload::make(server.url("missing.bin"), entry));
+
+		QSignalSpy failed(job.get(), SIGNAL(failed(QString)));
+		job->start();
+		QTRY_COMPARE_WITH_TIMEOUT(failed.count(), 1, 10000);
+		QCOMPARE(server.requests["GET"], 3);
+
+		// every retry waits twice as long as the one before. Timers may fire a bit early.
+		auto timings = job->timings();
+		QCOMPARE(timings.size(), 3);
+		for (int retry = 1; retry < timings.size(); retry++)
+		{
+			qint64 waited = timings[retry].started - timings[retry - 1].finished;
+			QVERIFY2(waited >= policy.delayFor(retry) * 900,
+					 qPrintable(QString("retry %1 after %2 us").arg(retry).arg(waited)));
+		}
+	}
+};
+
+QTEST_GUILESS_MAIN(DownloadResumeTest)
+
+#include "tst_DownloadResume.moc"
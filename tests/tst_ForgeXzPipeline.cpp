@@ -0,0 +1,448 @@
+#include <QTest>
+#include <QTemporaryDir>
+#include <QTemporaryFile>
+#include <QElapsedTimer>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QDebug>
+#include <QtConcurrentRun>
+#include <QSignalSpy>
+#include "TestUtil.h"
+#include "LocalHttpServer.h"
+
+#include "Env.h"
+#include "net/HttpMetaCache.h"
+#include "forge/XzDecoder.h"
+#include "forge/ForgeXzDownload.h"
+#include "xz.h"
+#include "unpack200.h"
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+
+/*
+ * The benchmark runs over the .pack.xz files in $MULTIMC_FORGE_XZ_DIR, for example the
+ * libraries/ folder of an instance that installed forge. Without it, only the decoder is tested.
+ */
+class ForgeXzPipelineTest : public QObject
+{
+	Q_OBJECT
+private:
+	/// 'MultiMC ' twenty thousand times, xz compressed with a CRC64 check
+	QByteArray sample()
+	{
+		static const char data[] =
+			"\xfd\x37\x7a\x58\x5a\x00\x00\x04\xe6\xd6\xb4\x46\x02\x00\x21\x01\x16\x00\x00\x00\x74\x2f\xe5\xa3"
+			"\xe2\x70\xff\x00\x65\x5d\x00\x26\x9d\x49\x87\x77\xb4\xa8\xb1\x34\x75\x59\x71\x69\x88\x15\xfd\xf9"
+			"\x15\xf0\xb1\x6a\x1f\xc9\x96\xa3\xb3\x39\x66\xfc\x9b\x7b\x45\xc3\xc4\xf6\xcb\xc2\x5a\x1d\x13\x2e"
+			"\xb3\x1e\xcb\x8c\xbc\x0b\x22\x45\x1f\x15\xf4\x4f\xe5\x77\x77\xd5\x7a\xf5\x89\x71\xa5\xd2\x3d\x2b"
+			"\x48\xc3\x0d\x44\xba\xe5\xd2\x0a\x1e\xf2\xa9\x08\xf5\x44\xdb\x03\xba\x65\xb3\x73\x3d\xd1\x36\xd6"
+			"\x77\x8b\xeb\xe8\x05\xb9\xdc\x96\xf5\x95\xf7\x00\x00\x00\x00\x00\x3d\x67\x44\x92\xb7\x9c\x22\x31"
+			"\x00\x01\x81\x01\x80\xe2\x09\x00\xac\x33\x24\xbd\xb1\xc4\x67\xfb\x02\x00\x00\x00\x00\x04\x59\x5a";
+		return QByteArray(data, sizeof(data) - 1);
+	}
+	QByteArray decodeInChunks(const QByteArray &input, int chunk, bool *ok)
+	{
+		QByteArray output;
+		XzDecoder decoder([&output](const char *data, size_t size)
+		{
+			output.append(data, size);
+			return true;
+		});
+		*ok = true;
+		for (int pos = 0; pos < input.size() && *ok; pos += chunk)
+		{
+			*ok = decoder.feed(input.constData() + pos, qMin(chunk, input.size() - pos));
+		}
+		*ok = *ok && decoder.isFinished();
+		return output;
+	}
+
+	bool throws(std::function<void()> f)
+	{
+		try
+		{
+			f();
+		}
+		catch (std::runtime_error &)
+		{
+			return true;
+		}
+		return false;
+	}
+
+	QStringList forgeFiles()
+	{
+		QStringList files;
+		QString dir = qgetenv("MULTIMC_FORGE_XZ_DIR");
+		if (dir.isEmpty())
+			return files;
+		QDirIterator it(dir, QStringList() << "*.pack.xz", QDir::Files,
+						QDirIterator::Subdirectories);
+		while (it.hasNext())
+			files.append(it.next());
+		return files;
+	}
+
+	bool unpackFile(QFile &in, const QString &jarPath)
+	{
+		in.flush();
+		in.seek(0);
+		// unpack_200 closes its input, so it gets its own handle
+		FILE *file_in = fopen(QFile::encodeName(in.fileName()).constData(), "rb");
+		FILE *file_out = fopen(QFile::encodeName(jarPath).constData(), "wb");
+		if (!file_in || !file_out)
+		{
+			if (file_in)
+				fclose(file_in);
+			if (file_out)
+				fclose(file_out);
+			return false;
+		}
+		try
+		{
+			unpack_200(file_in, file_out);
+		}
+		catch (std::runtime_error &err)
+		{
+			qWarning() << "unpack200 failed:" << err.what();
+			return false;
+		}
+		return true;
+	}
+
+	/// what ForgeXzDownload did originally: .xz to disk, .pack to disk, then the jar
+	bool threePasses(const QByteArray &body, const QString &jarPath, qint64 &written)
+	{
+		QTemporaryFile xzFile;
+		if (!xzFile.open())
+			return false;
+		// arrives in pieces, like from the network
+		for (int pos = 0; pos < body.size(); pos += 16 * 1024)
+			written += xzFile.write(body.constData() + pos, qMin(16 * 1024, body.size() - pos));
+		xzFile.seek(0);
+
+		QTemporaryFile packFile;
+		if (!packFile.open())
+			return false;
+		const size_t buffer_size = 8196;
+		uint8_t in[buffer_size];
+		uint8_t out[buffer_size];
+		struct xz_buf b;
+		struct xz_dec *s = xz_dec_init(XZ_DYNALLOC, 1 << 26);
+		b.in = in;
+		b.in_pos = 0;
+		b.in_size = 0;
+		b.out = out;
+		b.out_pos = 0;
+		b.out_size = buffer_size;
+		enum xz_ret ret = XZ_OK;
+		while (ret == XZ_OK || ret == XZ_UNSUPPORTED_CHECK)
+		{
+			if (b.in_pos == b.in_size)
+			{
+				b.in_size = xzFile.read((char *)in, sizeof(in));
+				b.in_pos = 0;
+			}
+			ret = xz_dec_run(s, &b);
+			if (b.out_pos == sizeof(out) || ret != XZ_OK)
+			{
+				written += packFile.write((char *)out, b.out_pos);
+				b.out_pos = 0;
+			}
+		}
+		xz_dec_end(s);
+		if (ret != XZ_STREAM_END || !unpackFile(packFile, jarPath))
+			return false;
+		written += QFileInfo(jarPath).size();
+		return true;
+	}
+
+	/// what ForgeXzDownload does now: decode into memory while the data arrives, unpack from there
+	bool streaming(const QByteArray &body, const QString &jarPath, qint64 &written)
+	{
+		QByteArray pack;
+		XzDecoder decoder([&](const char *data, size_t size)
+		{
+			pack.append(data, size);
+			return true;
+		});
+		for (int pos = 0; pos < body.size(); pos += 16 * 1024)
+		{
+			if (!decoder.feed(body.constData() + pos, qMin(16 * 1024, body.size() - pos)))
+				return false;
+		}
+		if (!decoder.isFinished())
+			return false;
+		QFile jar(jarPath);
+		if (!jar.open(QIODevice::WriteOnly | QIODevice::Truncate))
+			return false;
+		try
+		{
+			unpack_200(pack.constData(), pack.size(), [&](const void *data, size_t size)
+			{
+				written += size;
+				return jar.write((const char *)data, size) == (qint64)size;
+			});
+		}
+		catch (std::runtime_error &err)
+		{
+			qWarning() << "unpack200 failed:" << err.what();
+			return false;
+		}
+		return true;
+	}
+
+private
+slots:
+	void cleanupTestCase()
+	{
+		ENV.destroy();
+	}
+
+	void test_decodeChunked_data()
+	{
+		QTest::addColumn<int>("chunk");
+		QTest::newRow("one byte") << 1;
+		QTest::newRow("small") << 7;
+		QTest::newRow("all at once") << 1024 * 1024;
+	}
+	void test_decodeChunked()
+	{
+		QFETCH(int, chunk);
+		bool ok = false;
+		QByteArray output = decodeInChunks(sample(), chunk, &ok);
+		QVERIFY(ok);
+		QCOMPARE(output, QByteArray("MultiMC ").repeated(20000));
+	}
+
+	void test_corrupt()
+	{
+		QByteArray data = sample();
+		data[80] = data[80] ^ 0x55;
+		bool ok = true;
+		decodeInChunks(data, 16, &ok);
+		QVERIFY(!ok);
+
+		XzDecoder decoder([](const char *, size_t) { return true; });
+		QVERIFY(!decoder.feed(QByteArray("<html>404</html>")));
+		QVERIFY(!decoder.errorString().isEmpty());
+	}
+
+	void test_truncated()
+	{
+		bool ok = true;
+		decodeInChunks(sample().left(100), 16, &ok);
+		QVERIFY(!ok);
+	}
+
+	void test_sinkFailure()
+	{
+		XzDecoder decoder([](const char *, size_t) { return false; });
+		QVERIFY(!decoder.feed(sample()));
+		QVERIFY(!decoder.isFinished());
+	}
+
+	// a plain jar goes through pack200 unchanged, which is enough to see the data flow
+	void test_unpackFromMemory()
+	{
+		QByteArray jar = QByteArray("PK\x03\x04") + QByteArray("MultiMC ").repeated(20000);
+		QByteArray output;
+		unpack_200(jar.constData(), jar.size(), [&](const void *data, size_t size)
+		{
+			output.append((const char *)data, size);
+			return true;
+		});
+		QCOMPARE(output, jar);
+
+		// the same through a source callback, a few bytes at a time
+		output.clear();
+		int pos = 0;
+		unpack_200([&](void *buf, int64_t maxlen) -> int64_t
+		{
+			int len = qMin<int64_t>(qMin(13, jar.size() - pos), maxlen);
+			memcpy(buf, jar.constData() + pos, len);
+			pos += len;
+			return len;
+		},
+		[&](const void *data, size_t size)
+		{
+			output.append((const char *)data, size);
+			return true;
+		});
+		QCOMPARE(output, jar);
+	}
+
+	// the smallest real archive: a header with all counts zero and no bands
+	void test_unpackStats()
+	{
+		QByteArray pack("\xca\xfe\xd0\x0d\x07\x96\x00", 7);
+		pack.append(QByteArray(12, '\0'));
+		QByteArray output;
+		unpack_200_stats stats;
+		unpack_200(pack.constData(), pack.size(), [&](const void *data, size_t size)
+		{
+			output.append((const char *)data, size);
+			return true;
+		},
+		UNPACK_200_DEFLATE, &stats);
+		// an empty jar is still a zip file
+		QVERIFY(output.size() >= 22);
+		QVERIFY(stats.allocated > 0);
+		QVERIFY(stats.peak > 0);
+		QVERIFY(stats.peak_reserved >= stats.peak);
+		QVERIFY(stats.blocks > 0);
+	}
+
+	void test_unpackConcurrently()
+	{
+		QList<QFuture<bool>> results;
+		for (int i = 0; i < 8; i++)
+		{
+			results.append(QtConcurrent::run([i]()
+			{
+				QByteArray jar = QByteArray("PK\x03\x04") + QByteArray(200000 + i, char('a' + i));
+				QByteArray output;
+				unpack_200(jar.constData(), jar.size(), [&](const void *data, size_t size)
+				{
+					output.append((const char *)data, size);
+					return true;
+				});
+				return output == jar;
+			}));
+		}
+		for (auto result : results)
+		{
+			QVERIFY(result.result());
+		}
+	}
+
+	void test_unpackErrors()
+	{
+		auto ignore = [](const void *, size_t) { return true; };
+		QByteArray garbage("<html>404</html>");
+		QVERIFY(throws([&]() { unpack_200(garbage.constData(), garbage.size(), ignore); }));
+
+		QByteArray truncated("\xca\xfe\xd0\x0d\x07\x96", 6);
+		QVERIFY(throws([&]() { unpack_200(truncated.constData(), truncated.size(), ignore); }));
+
+		QByteArray jar = QByteArray("PK\x03\x04") + QByteArray(1000, 'x');
+		auto refuse = [](const void *, size_t) { return false; };
+		QVERIFY(throws([&]() { unpack_200(jar.constData(), jar.size(), refuse); }));
+
+		auto broken = [](void *, int64_t) -> int64_t { return -1; };
+		QVERIFY(throws([&]() { unpack_200(broken, ignore); }));
+	}
+
+	void test_benchmark()
+	{
+		QStringList files = forgeFiles();
+		if (files.isEmpty())
+		{
+			QSKIP("Set MULTIMC_FORGE_XZ_DIR to a folder with forge .pack.xz files");
+		}
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		qint64 oldTime = 0, newTime = 0, oldWritten = 0, newWritten = 0, input = 0;
+		QElapsedTimer timer;
+		for (auto file : files)
+		{
+			QByteArray body = TestsInternal::readFile(file);
+			input += body.size();
+			QString oldJar = dir.path() + "/old.jar";
+			QString newJar = dir.path() + "/new.jar";
+
+			timer.start();
+			QVERIFY2(threePasses(body, oldJar, oldWritten), qPrintable(file));
+			oldTime += timer.nsecsElapsed();
+
+			timer.start();
+			QVERIFY2(streaming(body, newJar, newWritten), qPrintable(file));
+			newTime += timer.nsecsElapsed();
+
+			QCOMPARE(TestsInternal::readFile(newJar), TestsInternal::readFile(oldJar));
+		}
+		qDebug("%d files, %lld bytes downloaded", files.size(), input);
+		qDebug("three passes: %lld ms, %lld bytes written", oldTime / 1000000, oldWritten);
+		qDebug("in memory:    %lld ms, %lld bytes written", newTime / 1000000, newWritten);
+		QVERIFY(newWritten < oldWritten);
+	}
+
+	void test_compressionBenchmark()
+	{
+		QStringList files = forgeFiles();
+		if (files.isEmpty())
+		{
+			QSKIP("Set MULTIMC_FORGE_XZ_DIR to a folder with forge .pack.xz files");
+		}
+		QList<QByteArray> packs;
+		for (auto file : files)
+		{
+			bool ok = false;
+			packs.append(decodeInChunks(TestsInternal::readFile(file), 64 * 1024, &ok));
+			QVERIFY2(ok, qPrintable(file));
+		}
+		const char *names[] = {"deflate", "parallel deflate", "store"};
+		unpack_200_compression modes[] = {UNPACK_200_DEFLATE, UNPACK_200_DEFLATE_PARALLEL,
+										  UNPACK_200_STORE};
+		QList<QByteArray> reference;
+		for (int mode = 0; mode < 3; mode++)
+		{
+			qint64 written = 0;
+			QElapsedTimer timer;
+			timer.start();
+			for (int i = 0; i < packs.size(); i++)
+			{
+				QByteArray jar;
+				unpack_200(packs[i].constData(), packs[i].size(), [&](const void *data, size_t size)
+				{
+					jar.append((const char *)data, size);
+					return true;
+				},
+				modes[mode]);
+				written += jar.size();
+				if (modes[mode] == UNPACK_200_DEFLATE)
+					reference.append(jar);
+				else if (modes[mode] == UNPACK_200_DEFLATE_PARALLEL)
+					QCOMPARE(jar, reference[i]);
+			}
+			qDebug("%-16s %lld ms, %lld bytes of jars", names[mode], timer.elapsed(), written);
+		}
+	}
+
+	void test_failedUnpackKeepsJar()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		ENV.initHttpMetaCache(dir.path(), dir.path());
+		auto entry = ENV.metacache()->resolveEntry("libraries", "forge/thing.jar");
+		QString jar = entry->getFullPath();
+		QDir().mkpath(QFileInfo(jar).absolutePath());
+		{
+			QFile old(jar);
+			QVERIFY(old.open(QIODevice::WriteOnly));
+			old.write("the old jar");
+		}
+
+		// a fine .xz, but what is in it isn't pack200
+		LocalHttpServer server;
+		server.addFile("thing.jar.pack.xz", sample());
+		auto dl = ForgeXzDownload::make("thing.jar", entry);
+		ForgeMirror mirror;
+		mirror.name = "local";
+		mirror.mirror_url = server.url("").toString();
+		QList<ForgeMirror> mirrors;
+		mirrors.append(mirror);
+		dl->setMirrors(mirrors);
+		QSignalSpy failed(dl.get(), SIGNAL(failed(int)));
+		dl->start();
+		QTRY_COMPARE(failed.count(), 1);
+
+		QCOMPARE(TestsInternal::readFile(jar), QByteArray("the old jar"));
+		QVERIFY(!QFile::exists(jar + ".part"));
+	}
+};
+
+QTEST_GUILESS_MAIN(ForgeXzPipelineTest)
+
+#include "tst_ForgeXzPipeline.moc"
@@ -0,0 +1,169 @@
+#include <QTest>
+#include <QTemporaryDir>
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QFile>
+#include <QDir>
+#include <utime.h>
+#include <ctime>
+#include "TestUtil.h"
+
+#include "Env.h"
+#include "net/HttpMetaCache.h"
+#include <pathutils.h>
+
+class HttpMetaCacheTest : public QObject
+{
+	Q_OBJECT
+private:
+	void write(const QString &path, const QByteArray &data)
+	{
+		QDir().mkpath(QFileInfo(path).absolutePath());
+		QFile file(path);
+		QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+		QCOMPARE(file.write(data), qint64(data.size()));
+	}
+
+	/// a file the cache knows about. Returns its full path.
+	QString addEntry(const QString &path, const QByteArray &data)
+	{
+		auto metacache = ENV.metacache();
+		QString fullPath = PathCombine(metacache->getBasePath("general"), path);
+		write(fullPath, data);
+		auto entry = metacache->resolveEntry("general", path);
+		entry->md5sum = QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex();
+		entry->local_changed_timestamp =
+			QFileInfo(fullPath).lastModified().toUTC().toMSecsSinceEpoch();
+		entry->stale = false;
+		metacache->updateEntry(entry);
+		return fullPath;
+	}
+
+	/// the file looks changed to the cache, whether it is or not
+	void touch(const QString &path, int seconds)
+	{
+		struct utimbuf times;
+		times.actime = times.modtime = std::time(nullptr) + seconds;
+		QCOMPARE(utime(QFile::encodeName(path).constData(), &times), 0);
+	}
+
+	QTemporaryDir m_dir;
+
+private
+slots:
+	void initTestCase()
+	{
+		QVERIFY(m_dir.isValid());
+		QDir::setCurrent(m_dir.path());
+		ENV.initHttpMetaCache(m_dir.path(), m_dir.path());
+	}
+	void cleanupTestCase()
+	{
+		ENV.destroy();
+	}
+
+	void test_unchanged()
+	{
+		addEntry("unchanged.bin", "nothing happened to this one");
+		// nothing to hash, so the answer comes right away
+		MetaEntryPtr result;
+		ENV.metacache()->resolveEntryAsync("general", "unchanged.bin",
+										   [&](MetaEntryPtr entry) { result = entry; });
+		QVERIFY(result);
+		QVERIFY(!result->stale);
+	}
+
+	void test_touched()
+	{
+		QString path = addEntry("touched.bin", "same data, new timestamp");
+		touch(path, 100);
+		MetaEntryPtr result;
+		ENV.metacache()->resolveEntryAsync("general", "touched.bin",
+										   [&](MetaEntryPtr entry) { result = entry; });
+		// hashed on the worker pool, the answer comes later
+		QVERIFY(!result);
+		QTRY_VERIFY(result);
+		QVERIFY(!result->stale);
+		QCOMPARE(result->local_changed_timestamp,
+				 QFileInfo(path).lastModified().toUTC().toMSecsSinceEpoch());
+	}
+
+	void test_changed()
+	{
+		QString path = addEntry("changed.bin", "what the cache remembers");
+		write(path, "what somebody else put there");
+		touch(path, 200);
+		MetaEntryPtr result;
+		ENV.metacache()->resolveEntryAsync("general", "changed.bin",
+										   [&](MetaEntryPtr entry) { result = entry; });
+		QTRY_VERIFY(result);
+		QVERIFY(result->stale);
+		QCOMPARE(ENV.metacache()->getEntry("general", "changed.bin"), result);
+	}
+
+	void test_batchOrder()
+	{
+		QStringList paths;
+		QList<bool> stale;
+		for (int i = 0; i < 12; i++)
+		{
+			QString name = QString("batch%1.bin").arg(i);
+			QString path = addEntry(name, "batch file " + QByteArray::number(i));
+			// every third one changed, the others were only touched or left alone
+			if (i % 3 == 0)
+				write(path, "changed " + QByteArray::number(i));
+			if (i % 3 != 2)
+				touch(path, 300 + i);
+			paths.append(name);
+			stale.append(i % 3 == 0);
+		}
+		paths.append("unknown.bin");
+		stale.append(true);
+
+		QList<MetaEntryPtr> result;
+		bool done = false;
+		ENV.metacache()->resolveEntriesAsync("general", paths, [&](QList<MetaEntryPtr> entries)
+		{
+			result = entries;
+			done = true;
+		});
+		QTRY_VERIFY(done);
+		QCOMPARE(result.size(), paths.size());
+		for (int i = 0; i < paths.size(); i++)
+		{
+			QCOMPARE(result[i]->path, paths[i]);
+			QCOMPARE(result[i]->stale, stale[i]);
+		}
+	}
+
+	void test_syncResolveWhileHashing()
+	{
+		QString path = addEntry("raced.bin", "before");
+		write(path, "after, and longer");
+		touch(path, 400);
+		MetaEntryPtr result;
+		int calls = 0;
+		ENV.metacache()->resolveEntryAsync("general", "raced.bin", [&](MetaEntryPtr entry)
+		{
+			result = entry;
+			calls++;
+		});
+		QVERIFY(!result);
+
+		// a synchronous resolve gets there first and throws the entry out
+		auto sync = ENV.metacache()->resolveEntry("general", "raced.bin");
+		QVERIFY(sync->stale);
+
+		// the async one notices and answers with what the cache has now, once
+		QTRY_VERIFY(result);
+		QVERIFY(result->stale);
+		QCOMPARE(result->path, QString("raced.bin"));
+		QTest::qWait(50);
+		QCOMPARE(calls, 1);
+	}
+};
+
+QTEST_GUILESS_MAIN(HttpMetaCacheTest)
+
+#include "tst_HttpMetaCache.moc"
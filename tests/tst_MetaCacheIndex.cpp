@@ -0,0 +1,164 @@
+#include <QTest>
+#include <QTemporaryDir>
+#include <QSet>
+#include <QFileInfo>
+#include "TestUtil.h"
+
+#include "FileSystem.h"
+#include "net/MetaCacheIndex.h"
+#include "net/MetaCacheJournal.h"
+#include "net/HttpMetaCache.h"
+
+class MetaCacheIndexTest : public QObject
+{
+	Q_OBJECT
+private:
+	MetaCacheIndex::Record makeRecord(QString base, QString path, qint64 timestamp)
+	{
+		MetaCacheIndex::Record record;
+		record.base = base;
+		record.path = path;
+		record.md5sum = "md5 of " + path;
+		record.etag = "\"etag of " + path + "\"";
+		record.local_changed_timestamp = timestamp;
+		record.last_access_timestamp = timestamp * 1000;
+		return record;
+	}
+
+private
+slots:
+	void test_roundTrip()
+	{
+		QTemporaryDir dir;
+		QString path = dir.path() + "/metacache.idx";
+		QList<MetaCacheIndex::Record> records;
+		for (int i = 0; i < 1000; i++)
+		{
+			records.append(makeRecord(i % 2 ? "libraries" : "asset_objects",
+									  QString("some/path/%1.jar").arg(i), i));
+		}
+		records.append(makeRecord("versions", QString::fromUtf8("\xc3\xa4/1.8.jar"), -1));
+		FS::write(path, MetaCacheIndex::serialize(records));
+
+		MetaCacheIndex index;
+		QVERIFY(index.open(path));
+		QCOMPARE(index.count(), records.size());
+
+		MetaCacheIndex::Record found;
+		QVERIFY(index.find("libraries", "some/path/7.jar", found));
+		QCOMPARE(found.md5sum, QString("md5 of some/path/7.jar"));
+		QCOMPARE(found.local_changed_timestamp, qint64(7));
+		QCOMPARE(found.last_access_timestamp, qint64(7000));
+		QVERIFY(index.find("versions", QString::fromUtf8("\xc3\xa4/1.8.jar"), found));
+		QCOMPARE(found.local_changed_timestamp, qint64(-1));
+		QVERIFY(found.remote_changed_timestamp.isEmpty());
+		// right path, wrong base
+		QVERIFY(!index.find("asset_objects", "some/path/7.jar", found));
+		QVERIFY(!index.find("libraries", "nothing", found));
+
+		// records come out sorted, but all of them
+		QSet<QString> paths;
+		for (int i = 0; i < index.count(); i++)
+		{
+			paths.insert(index.at(i).path);
+		}
+		QCOMPARE(paths.size(), records.size());
+	}
+	void test_rejectsGarbage()
+	{
+		QTemporaryDir dir;
+		QString path = dir.path() + "/metacache.idx";
+		MetaCacheIndex index;
+		QVERIFY(!index.open(path));
+
+		FS::write(path, "{\"version\": \"1\", \"entries\": []}");
+		QVERIFY(!index.open(path));
+
+		// header claims more records than there are
+		QByteArray data = MetaCacheIndex::serialize({makeRecord("a", "b", 1)});
+		data[8] = 2;
+		FS::write(path, data);
+		QVERIFY(!index.open(path));
+	}
+	void test_journalReplay()
+	{
+		QTemporaryDir dir;
+		QString path = dir.path() + "/metacache.journal";
+		qint64 firstTwo = 0;
+		{
+			MetaCacheJournal journal;
+			QList<MetaCacheJournal::Change> changes;
+			QVERIFY(journal.open(path, changes));
+			QVERIFY(changes.isEmpty());
+			QVERIFY(journal.append(MetaCacheJournal::Put, makeRecord("libraries", "a.jar", 1)));
+			QVERIFY(journal.append(MetaCacheJournal::Remove, makeRecord("libraries", "b.jar", 2)));
+			firstTwo = journal.size();
+			QVERIFY(journal.append(MetaCacheJournal::Put, makeRecord("versions", "c.jar", 3)));
+			QCOMPARE(journal.count(), 3);
+			// out of the process right away, synced to the disk when asked to
+			QCOMPARE(QFileInfo(path).size(), journal.size());
+			QVERIFY(journal.sync());
+		}
+		// the process died in the middle of writing the next change
+		{
+			QFile file(path);
+			QVERIFY(file.open(QIODevice::Append));
+			file.write(QByteArray("\x40\x00\x00\x00\x12\x34half", 10));
+		}
+		MetaCacheJournal journal;
+		QList<MetaCacheJournal::Change> changes;
+		QVERIFY(journal.open(path, changes));
+		QCOMPARE(changes.size(), 3);
+		QCOMPARE(changes[1].operation, MetaCacheJournal::Remove);
+		QCOMPARE(changes[1].record.path, QString("b.jar"));
+		QCOMPARE(changes[2].record.md5sum, QString("md5 of c.jar"));
+		QCOMPARE(changes[2].record.local_changed_timestamp, qint64(3));
+		QCOMPARE(changes[2].record.last_access_timestamp, qint64(3000));
+		QCOMPARE(QFileInfo(path).size(), journal.size());
+
+		// the first two made it into the index
+		QVERIFY(journal.dropFront(firstTwo));
+		QCOMPARE(journal.count(), 1);
+		QVERIFY(journal.append(MetaCacheJournal::Put, makeRecord("versions", "d.jar", 4)));
+		changes.clear();
+		QVERIFY(journal.open(path, changes));
+		QCOMPARE(changes.size(), 2);
+		QCOMPARE(changes[0].record.path, QString("c.jar"));
+		QCOMPARE(changes[1].record.path, QString("d.jar"));
+	}
+
+	void test_migrateWithJournal()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QString path = dir.path() + "/metacache";
+		FS::write(path, "{\"version\": \"1\", \"entries\": [{\"base\": \"libraries\", "
+						"\"path\": \"a.jar\", \"md5sum\": \"md5 of a.jar\"}]}");
+		{
+			MetaCacheJournal journal;
+			QList<MetaCacheJournal::Change> changes;
+			QVERIFY(journal.open(path + ".journal", changes));
+			QVERIFY(journal.append(MetaCacheJournal::Put, makeRecord("libraries", "b.jar", 2)));
+		}
+		{
+			HttpMetaCache cache(path);
+			cache.addBase("libraries", dir.path() + "/libraries");
+			cache.Load();
+		}
+
+		// the old index and the journal both went into the new index, nothing is left over
+		QVERIFY(!QFile::exists(path));
+		QCOMPARE(QFileInfo(path + ".journal").size(), qint64(0));
+		MetaCacheIndex index;
+		QVERIFY(index.open(path + ".idx"));
+		MetaCacheIndex::Record record;
+		QVERIFY(index.find("libraries", "a.jar", record));
+		QCOMPARE(record.md5sum, QString("md5 of a.jar"));
+		QVERIFY(index.find("libraries", "b.jar", record));
+		QCOMPARE(record.md5sum, QString("md5 of b.jar"));
+	}
+};
+
+QTEST_GUILESS_MAIN(MetaCacheIndexTest)
+
+#include "tst_MetaCacheIndex.moc"
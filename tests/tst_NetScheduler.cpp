@@ -0,0 +1,584 @@
+#include <QTest>
+#include <QTimer>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include "TestUtil.h"
+#include "LocalHttpServer.h"
+
+#include "Env.h"
+#include "net/NetScheduler.h"
+#include "net/NetJob.h"
+#include "net/MD5EtagDownload.h"
+
+class DummyAction : public NetAction
+{
+	Q_OBJECT
+public:
+	DummyAction(QUrl url, int *running, int *peak) : m_running(running), m_peak(peak)
+	{
+		m_url = url;
+	}
+
+	QString coalescingKey() const override
+	{
+		return m_key;
+	}
+	QString m_key;
+	/// ms of local work after the transfer, 0 for none
+	int m_local_work = 0;
+	/// fail instead of succeeding, with whatever is in m_timing
+	bool m_fail = false;
+
+public
+slots:
+	void start() override
+	{
+		(*m_running)++;
+		*m_peak = qMax(*m_peak, *m_running);
+		m_status = Job_InProgress;
+		QTimer::singleShot(5, this, SLOT(transfer()));
+	}
+	void transfer()
+	{
+		if (!m_local_work)
+		{
+			finish();
+			return;
+		}
+		emit transferDone(m_index_within_job);
+		QTimer::singleShot(m_local_work, this, SLOT(finish()));
+	}
+	void finish()
+	{
+		(*m_running)--;
+		if (m_fail)
+		{
+			m_status = Job_Failed;
+			emit failed(m_index_within_job);
+			return;
+		}
+		m_status = Job_Finished;
+		emit netActionProgress(m_index_within_job, 100, 100);
+		emit succeeded(m_index_within_job);
+	}
+
+protected
+slots:
+	void downloadProgress(qint64, qint64) override {}
+	void downloadError(QNetworkReply::NetworkError) override {}
+	void downloadFinished() override {}
+	void downloadReadyRead() override {}
+
+private:
+	int *m_running;
+	int *m_peak;
+};
+
+class NetSchedulerTest : public QObject
+{
+	Q_OBJECT
+private:
+	/// download a job of many small files and one big one, the big one last. Returns the timing
+	/// of every part, in the order they were added. Empty if the job didn't succeed.
+	QList<NetActionTiming> runMixedJob(LocalHttpServer &server, const QString &target,
+									   bool withHints)
+	{
+		NetJobPtr job(new NetJob("mixed"));
+		for (int i = 0; i < 20; i++)
+		{
+			QString name = QString("small%1.bin").arg(i);
+			auto dl = MD5EtagDownload::make(server.url(name), target + "/" + name);
+			if (withHints)
+				dl->m_size_hint = 5 * 1024;
+			job->addNetAction(dl);
+		}
+		auto big = MD5EtagDownload::make(server.url("big.bin"), target + "/big.bin");
+		if (withHints)
+			big->m_size_hint = 200 * 1024;
+		job->addNetAction(big);
+
+		QSignalSpy succeeded(job.get(), SIGNAL(succeeded()));
+		QElapsedTimer timer;
+		timer.start();
+		job->start();
+		while (succeeded.isEmpty() && timer.elapsed() < 60000)
+		{
+			QTest::qWait(10);
+		}
+		if (succeeded.isEmpty())
+			return {};
+		QList<NetActionTiming> timings;
+		for (int i = 0; i <= 20; i++)
+			timings.append(NetActionTiming());
+		for (auto &timing : job->timings())
+			timings[timing.index] = timing;
+		return timings;
+	}
+
+private
+slots:
+	void cleanupTestCase()
+	{
+		ENV.destroy();
+	}
+
+	void test_hostLimit()
+	{
+		NetScheduler scheduler;
+		scheduler.setHostLimits(1, 3);
+		int runningA = 0, peakA = 0;
+		int runningB = 0, peakB = 0;
+		for (int i = 0; i < 10; i++)
+		{
+			scheduler.enqueue(std::make_shared<DummyAction>(QUrl("http://a.example.com/" + QString::number(i)), &runningA, &peakA));
+			scheduler.enqueue(std::make_shared<DummyAction>(QUrl("http://b.example.com/" + QString::number(i)), &runningB, &peakB));
+		}
+		QTRY_COMPARE(scheduler.globalStats().completed, 20);
+		QVERIFY(peakA <= 3);
+		QVERIFY(peakB <= 3);
+
+		auto stats = scheduler.hostStats();
+		QCOMPARE(stats.size(), 2);
+		for (auto host : stats)
+		{
+			QCOMPARE(host.completed, 10);
+			QCOMPARE(host.bytes, qint64(1000));
+			QCOMPARE(host.active, 0);
+			QCOMPARE(host.queued, 0);
+		}
+	}
+	void test_globalLimit()
+	{
+		NetScheduler scheduler;
+		scheduler.setGlobalLimits(2, 2);
+		int running = 0, peak = 0;
+		for (int i = 0; i < 10; i++)
+		{
+			scheduler.enqueue(std::make_shared<DummyAction>(QUrl(QString("http://host%1.example.com/").arg(i)), &running, &peak));
+		}
+		QTRY_COMPARE(scheduler.globalStats().completed, 10);
+		QCOMPARE(peak, 2);
+	}
+	void test_transferDone()
+	{
+		NetScheduler scheduler;
+		scheduler.setGlobalLimits(1, 1);
+		scheduler.setHostLimits(1, 1);
+		int running = 0, peak = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			auto action = std::make_shared<DummyAction>(QUrl("http://a.example.com/" + QString::number(i)), &running, &peak);
+			action->m_local_work = 100;
+			scheduler.enqueue(action);
+		}
+		QTRY_COMPARE(scheduler.globalStats().completed, 4);
+		// the next transfer started while the previous action was still busy
+		QVERIFY(peak > 1);
+		QCOMPARE(scheduler.globalStats().active, 0);
+	}
+	void test_dequeue()
+	{
+		NetScheduler scheduler;
+		int running = 0, peak = 0;
+		auto action = std::make_shared<DummyAction>(QUrl("http://a.example.com/"), &running, &peak);
+		scheduler.enqueue(action);
+		QCOMPARE(scheduler.globalStats().queued, 1);
+		QVERIFY(scheduler.dequeue(action));
+		QVERIFY(!scheduler.dequeue(action));
+		QTest::qWait(20);
+		QCOMPARE(peak, 0);
+	}
+	void test_coalescing()
+	{
+		NetScheduler scheduler;
+		int running = 0, peak = 0;
+		int succeeded = 0;
+		QList<std::shared_ptr<DummyAction>> actions;
+		for (int i = 0; i < 3; i++)
+		{
+			auto action = std::make_shared<DummyAction>(QUrl("http://a.example.com/lib.jar"), &running, &peak);
+			action->m_key = "/cache/libraries/lib.jar";
+			action->m_index_within_job = i;
+			connect(action.get(), &NetAction::succeeded, [&succeeded](int) { succeeded++; });
+			actions.append(action);
+			scheduler.enqueue(action);
+		}
+		QCOMPARE(scheduler.coalescedCount(), 2);
+		QTRY_COMPARE(succeeded, 3);
+		// only one of them did the transfer
+		QCOMPARE(scheduler.globalStats().completed, 1);
+		QCOMPARE(peak, 1);
+		QCOMPARE(scheduler.coalescedCount(), 0);
+		for (auto action : actions)
+		{
+			QCOMPARE(action->m_status, Job_Finished);
+		}
+	}
+	void test_coalescingDequeue()
+	{
+		NetScheduler scheduler;
+		int running = 0, peak = 0;
+		auto first = std::make_shared<DummyAction>(QUrl("http://a.example.com/lib.jar"), &running, &peak);
+		auto second = std::make_shared<DummyAction>(QUrl("http://a.example.com/lib.jar"), &running, &peak);
+		first->m_key = second->m_key = "/cache/libraries/lib.jar";
+		scheduler.enqueue(first);
+		scheduler.enqueue(second);
+		// the one waiting takes over when the first one goes away
+		QVERIFY(scheduler.dequeue(first));
+		QCOMPARE(scheduler.coalescedCount(), 0);
+		QTRY_COMPARE(scheduler.globalStats().completed, 1);
+		QCOMPARE(second->m_status, Job_Finished);
+		QCOMPARE(first->m_status, Job_NotStarted);
+	}
+	void test_timing()
+	{
+		NetScheduler scheduler;
+		int running = 0, peak = 0;
+		auto action = std::make_shared<DummyAction>(QUrl("http://a.example.com/file"), &running, &peak);
+		action->m_index_within_job = 3;
+		scheduler.enqueue(action);
+		QVERIFY(action->m_timing.queued >= 0);
+		QTRY_COMPARE(action->m_status, Job_Finished);
+		auto timing = action->m_timing;
+		QVERIFY(timing.started >= timing.queued);
+		QVERIFY(timing.first_byte >= timing.started);
+		QVERIFY(timing.finished >= timing.first_byte);
+		QCOMPARE(timing.bytes, qint64(100));
+		QCOMPARE(timing.index, 3);
+		QCOMPARE(timing.url, QString("http://a.example.com/file"));
+		QCOMPARE(timing.result, NetActionTiming::Downloaded);
+	}
+	void test_timingCoalesced()
+	{
+		NetScheduler scheduler;
+		int running = 0, peak = 0;
+		auto first = std::make_shared<DummyAction>(QUrl("http://a.example.com/lib.jar"), &running, &peak);
+		auto second = std::make_shared<DummyAction>(QUrl("http://a.example.com/lib.jar"), &running, &peak);
+		first->m_key = second->m_key = "/cache/libraries/lib.jar";
+		scheduler.enqueue(first);
+		scheduler.enqueue(second);
+		QTRY_COMPARE(second->m_status, Job_Finished);
+		QCOMPARE(first->m_timing.result, NetActionTiming::Downloaded);
+		QCOMPARE(second->m_timing.result, NetActionTiming::Coalesced);
+		QCOMPARE(second->m_timing.bytes, qint64(0));
+	}
+	void test_queueOrder()
+	{
+		NetScheduler scheduler;
+		scheduler.setGlobalLimits(1, 1);
+		scheduler.setHostLimits(1, 1);
+		int running = 0, peak = 0;
+		QStringList order;
+		auto add = [&](QString name, int priority, qint64 size)
+		{
+			auto action = std::make_shared<DummyAction>(QUrl("http://a.example.com/" + name), &running, &peak);
+			action->m_priority = priority;
+			action->m_size_hint = size;
+			connect(action.get(), &NetAction::succeeded, [&order, name](int) { order.append(name); });
+			scheduler.enqueue(action);
+		};
+		add("small", NetAction::NormalPriority, 10);
+		add("unknown", NetAction::NormalPriority, -1);
+		add("big", NetAction::NormalPriority, 1000);
+		add("small2", NetAction::NormalPriority, 10);
+		add("critical", NetAction::CriticalPriority, 1);
+		add("low", NetAction::LowPriority, 100000);
+		QTRY_COMPARE(order.size(), 6);
+		QCOMPARE(order, QStringList({"critical", "big", "small", "small2", "unknown", "low"}));
+	}
+	void test_bigFirstInMixedJob()
+	{
+		// two connections at 200 KiB/s each. Started last, the big file is all that's left
+		// for its final second. Started first, the small ones are done alongside it.
+		// Without size hints the scheduler has to go by insertion order.
+		ENV.netScheduler()->setGlobalLimits(2, 2);
+		ENV.netScheduler()->setHostLimits(2, 2);
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+
+		QByteArray small(5 * 1024, 's');
+		QByteArray big(200 * 1024, 'b');
+
+		LocalHttpServer fifoServer(200 * 1024);
+		LocalHttpServer hintedServer(200 * 1024);
+		for (auto server : {&fifoServer, &hintedServer})
+		{
+			for (int i = 0; i < 20; i++)
+				server->addFile(QString("small%1.bin").arg(i), small);
+			server->addFile("big.bin", big);
+		}
+
+		auto fifo = runMixedJob(fifoServer, dir.path() + "/fifo", false);
+		auto hinted = runMixedJob(hintedServer, dir.path() + "/hinted", true);
+		QCOMPARE(fifo.size(), 21);
+		QCOMPARE(hinted.size(), 21);
+		QCOMPARE(fifoServer.getOrder.last(), QString("big.bin"));
+		QCOMPARE(hintedServer.getOrder.first(), QString("big.bin"));
+
+		// the scheduler's own clock says when each part started, whatever the machine's load
+		for (int i = 0; i < 20; i++)
+		{
+			QVERIFY(fifo[i].started >= 0);
+			QVERIFY(fifo[i].started <= fifo.last().started);
+			QVERIFY(hinted[i].started >= hinted.last().started);
+		}
+	}
+	void test_adaptLimiter()
+	{
+		NetScheduler::Limiter limiter;
+		limiter.setBounds(2, 8);
+		limiter.limit = 4;
+
+		// nobody had to wait, so a faster interval says nothing about the limit
+		limiter.window_bytes = 1000;
+		QVERIFY(!limiter.adapt(1.0));
+		limiter.window_bytes = 2000;
+		QVERIFY(!limiter.adapt(1.0));
+		QCOMPARE(limiter.limit, 4);
+		QCOMPARE(limiter.window_bytes, qint64(0));
+
+		// more than 10% faster than the interval before: one more connection
+		limiter.saturated = true;
+		limiter.window_bytes = 2500;
+		QVERIFY(limiter.adapt(1.0));
+		QCOMPARE(limiter.limit, 5);
+		QVERIFY(!limiter.saturated);
+
+		// about the same rate: leave it alone
+		limiter.saturated = true;
+		limiter.window_bytes = 2600;
+		QVERIFY(!limiter.adapt(1.0));
+		QCOMPARE(limiter.limit, 5);
+
+		// dropped below 75% of the interval before: one less
+		limiter.saturated = true;
+		limiter.window_bytes = 1000;
+		QVERIFY(limiter.adapt(1.0));
+		QCOMPARE(limiter.limit, 4);
+
+		// never more than the maximum
+		limiter.limit = 8;
+		limiter.saturated = true;
+		limiter.window_bytes = 5000;
+		QVERIFY(!limiter.adapt(1.0));
+		QCOMPARE(limiter.limit, 8);
+
+		// the server got slow to answer: back off by a quarter, whatever the rate did
+		limiter.min_latency = 10;
+		limiter.latency = 50;
+		limiter.saturated = true;
+		limiter.window_bytes = 10000;
+		QVERIFY(limiter.adapt(1.0));
+		QCOMPARE(limiter.limit, 6);
+
+		// but never below the minimum
+		limiter.limit = 2;
+		limiter.saturated = true;
+		QVERIFY(!limiter.adapt(1.0));
+		QCOMPARE(limiter.limit, 2);
+	}
+	void test_failuresLowerHostLimit()
+	{
+		NetScheduler scheduler;
+		scheduler.setHostLimits(1, 6);
+		int running = 0, peak = 0;
+		auto fail = [&](int http_status, QNetworkReply::NetworkError error, int limit)
+		{
+			auto action = std::make_shared<DummyAction>(QUrl("http://a.example.com/"), &running, &peak);
+			action->m_fail = true;
+			action->m_timing.http_status = http_status;
+			action->m_timing.error = error;
+			int failed = scheduler.globalStats().failed;
+			scheduler.enqueue(action);
+			QTRY_COMPARE(scheduler.globalStats().failed, failed + 1);
+			QCOMPARE(scheduler.hostStats().first().limit, limit);
+		};
+		// the host is fine, the requests or what was done with the data were not
+		fail(404, QNetworkReply::ContentNotFoundError, 6);
+		fail(200, QNetworkReply::NoError, 6);
+		fail(403, QNetworkReply::ContentAccessDenied, 6);
+		// the host is in trouble
+		fail(503, QNetworkReply::ServiceUnavailableError, 5);
+		fail(0, QNetworkReply::TimeoutError, 4);
+		fail(0, QNetworkReply::ConnectionRefusedError, 3);
+	}
+	void test_abortJob()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		// slow enough to still be running when the job is aborted
+		LocalHttpServer server(50 * 1024);
+		NetJobPtr job(new NetJob("abort"));
+		for (int i = 0; i < 10; i++)
+		{
+			QString name = QString("file%1.bin").arg(i);
+			server.addFile(name, QByteArray(500 * 1024, 'x'));
+			job->addNetAction(MD5EtagDownload::make(server.url(name), dir.path() + "/" + name));
+		}
+		QVERIFY(job->canAbort());
+		QSignalSpy aborted(job.get(), SIGNAL(aborted()));
+		QSignalSpy failed(job.get(), SIGNAL(failed(QString)));
+		QSignalSpy succeeded(job.get(), SIGNAL(succeeded()));
+		job->start();
+		QTRY_VERIFY(server.requests["GET"] > 0);
+		QTest::qWait(100);
+
+		QVERIFY(job->abort());
+		QCOMPARE(aborted.size(), 1);
+		QVERIFY(job->wasAborted());
+		QVERIFY(!job->isRunning());
+		QVERIFY(!job->abort());
+
+		// nothing keeps going in the background
+		QTRY_COMPARE(ENV.netScheduler()->globalStats().active, 0);
+		QCOMPARE(ENV.netScheduler()->globalStats().queued, 0);
+		QTest::qWait(100);
+		QCOMPARE(failed.size(), 0);
+		QCOMPARE(succeeded.size(), 0);
+		QCOMPARE(QDir(dir.path()).entryList(QDir::Files), QStringList());
+	}
+	void test_destroyRunningJob()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		LocalHttpServer server(50 * 1024);
+		// few enough slots that most parts are still queued
+		ENV.netScheduler()->setHostLimits(2, 2);
+		NetJobPtr job(new NetJob("destroyed"));
+		for (int i = 0; i < 10; i++)
+		{
+			QString name = QString("file%1.bin").arg(i);
+			server.addFile(name, QByteArray(500 * 1024, 'x'));
+			job->addNetAction(MD5EtagDownload::make(server.url(name), dir.path() + "/" + name));
+		}
+		job->start();
+		QTRY_VERIFY(server.requests["GET"] > 0);
+		QVERIFY(ENV.netScheduler()->globalStats().queued > 0);
+
+		// dropped without an abort, the scheduler must not keep its parts
+		job.reset();
+		QCOMPARE(ENV.netScheduler()->globalStats().queued, 0);
+		QTRY_COMPARE(ENV.netScheduler()->globalStats().active, 0);
+		QTest::qWait(100);
+		QCOMPARE(QDir(dir.path()).entryList(QDir::Files), QStringList());
+	}
+	void test_jobProgress()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		// slow enough for every part to report progress many times
+		LocalHttpServer server(100 * 1024);
+		NetJobPtr job(new NetJob("progress"));
+		RetryPolicy policy;
+		policy.maxRetries = 0;
+		job->setRetryPolicy(policy);
+		int partProgress = 0;
+		for (int i = 0; i < 10; i++)
+		{
+			QString name = QString("file%1.bin").arg(i);
+			server.addFile(name, QByteArray(50 * 1024, 'p'));
+			auto part = MD5EtagDownload::make(server.url(name), dir.path() + "/" + name);
+			connect(part.get(), &NetAction::netActionProgress, [&partProgress]() { partProgress++; });
+			job->addNetAction(part);
+		}
+		job->addNetAction(
+			MD5EtagDownload::make(server.url("missing.bin"), dir.path() + "/missing.bin"));
+
+		QSignalSpy progress(job.get(), SIGNAL(progress(qint64, qint64)));
+		QSignalSpy files(job.get(), SIGNAL(filesProgress(int, int, int)));
+		QSignalSpy failed(job.get(), SIGNAL(failed(QString)));
+		QElapsedTimer timer;
+		timer.start();
+		job->start();
+		QVERIFY(failed.wait(30000));
+		qint64 elapsed = timer.elapsed();
+
+		// at most once per interval, however often the parts report
+		qDebug() << partProgress << "part updates became" << progress.size() << "in" << elapsed
+				 << "ms";
+		QVERIFY(partProgress > progress.size());
+		QVERIFY(progress.size() <= elapsed / 100 + 3);
+		QCOMPARE(files.size(), progress.size());
+
+		// the counts only go up, and the last ones are final
+		int done = 0;
+		for (auto &args : files)
+		{
+			QVERIFY(args[0].toInt() >= done);
+			done = args[0].toInt();
+			QCOMPARE(args[2].toInt(), 11);
+		}
+		QCOMPARE(files.last()[0].toInt(), 10);
+		QCOMPARE(files.last()[1].toInt(), 1);
+	}
+	void test_rateLimit()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		const qint64 limit = 256 * 1024;
+		const qint64 size = 768 * 1024;
+		// the server could do much more than the limit
+		LocalHttpServer server;
+		server.addFile("limited.bin", QByteArray(size, 'r'));
+		ENV.netScheduler()->setRateLimit(limit);
+
+		NetJobPtr job(new NetJob("limited"));
+		job->addNetAction(
+			MD5EtagDownload::make(server.url("limited.bin"), dir.path() + "/limited.bin"));
+		QSignalSpy succeeded(job.get(), SIGNAL(succeeded()));
+		QElapsedTimer timer;
+		timer.start();
+		job->start();
+		QVERIFY(succeeded.wait(30000));
+		qint64 elapsed = timer.elapsed();
+		ENV.netScheduler()->setRateLimit(0);
+
+		// a reply's read buffer and the burst allowance can come in without waiting for tokens
+		const qint64 burst = 2 * 64 * 1024;
+		qDebug() << size << "bytes at" << limit << "B/s took" << elapsed << "ms";
+		QVERIFY(elapsed >= (size - burst) * 1000 / limit);
+		QVERIFY(elapsed <= 3 * size * 1000 / limit);
+	}
+	void test_rateLimitWeights()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		const qint64 size = 384 * 1024;
+		LocalHttpServer server;
+		server.addFile("heavy.bin", QByteArray(size, 'h'));
+		server.addFile("light.bin", QByteArray(size, 'l'));
+		ENV.netScheduler()->setRateLimit(256 * 1024);
+
+		NetJobPtr heavy(new NetJob("heavy"));
+		heavy->addNetAction(
+			MD5EtagDownload::make(server.url("heavy.bin"), dir.path() + "/heavy.bin"));
+		heavy->setBandwidthWeight(3);
+		NetJobPtr light(new NetJob("light"));
+		light->addNetAction(
+			MD5EtagDownload::make(server.url("light.bin"), dir.path() + "/light.bin"));
+		light->setBandwidthWeight(1);
+
+		qint64 lightWhenHeavyDone = -1;
+		connect(heavy.get(), &NetJob::succeeded, [&]()
+		{
+			lightWhenHeavyDone = QFileInfo(dir.path() + "/light.bin").size();
+		});
+		QSignalSpy lightDone(light.get(), SIGNAL(succeeded()));
+		heavy->start();
+		light->start();
+		QVERIFY(lightDone.wait(30000));
+		ENV.netScheduler()->setRateLimit(0);
+
+		// a quarter of the bandwidth got the light one about a third of the way
+		qDebug() << "light one had" << lightWhenHeavyDone << "of" << size << "bytes";
+		QVERIFY(lightWhenHeavyDone >= 0);
+		QVERIFY(lightWhenHeavyDone >= size / 10);
+		QVERIFY(lightWhenHeavyDone <= size * 6 / 10);
+	}
+};
+
+QTEST_GUILESS_MAIN(NetSchedulerTest)
+
+#include "tst_NetScheduler.moc"
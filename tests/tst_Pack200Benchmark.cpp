@@ -0,0 +1,239 @@
+#include <QTest>
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <quazip.h>
+#include <quazipfile.h>
+#include "TestUtil.h"
+
+#include "forge/XzDecoder.h"
+#include "unpack200.h"
+#include <stdexcept>
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+/*
+ * Throughput and memory use of the forge library pipeline, on the fixtures in pack200/.
+ * Each stage runs repeatedly for a little while and reports MB/s of output and the peak
+ * resident set size. The output is compared with the golden jars every time, so a change to
+ * the unpacker that alters its output fails here. pack200/make_fixtures.py writes the fixtures.
+ */
+class Pack200BenchmarkTest : public QObject
+{
+	Q_OBJECT
+private:
+	/// how long each stage is repeated for
+	static const int MEASURE_MS = 200;
+
+	QByteArray decode(const QByteArray &xz)
+	{
+		QByteArray output;
+		XzDecoder decoder([&output](const char *data, size_t size)
+		{
+			output.append(data, size);
+			return true;
+		});
+		if (!decoder.feed(xz) || !decoder.isFinished())
+		{
+			qWarning() << "xz decoding failed:" << decoder.errorString();
+			return QByteArray();
+		}
+		return output;
+	}
+
+	QByteArray fixture(const QString &name)
+	{
+		return decode(MULTIMC_GET_TEST_FILE("pack200/" + name + ".xz"));
+	}
+
+	QByteArray unpack(const QByteArray &pack, unpack_200_compression compression,
+					  unpack_200_stats *stats = nullptr)
+	{
+		QByteArray jar;
+		try
+		{
+			unpack_200(pack.constData(), pack.size(), [&jar](const void *data, size_t size)
+			{
+				jar.append((const char *)data, size);
+				return true;
+			},
+			compression, stats);
+		}
+		catch (std::runtime_error &err)
+		{
+			qWarning() << "unpack200 failed:" << err.what();
+			return QByteArray();
+		}
+		return jar;
+	}
+
+	/// the jar entries, in order, as name and contents
+	QList<QPair<QString, QByteArray>> entries(QByteArray jar)
+	{
+		QList<QPair<QString, QByteArray>> result;
+		QBuffer buffer(&jar);
+		QuaZip zip(&buffer);
+		if (!zip.open(QuaZip::mdUnzip))
+			return result;
+		for (bool more = zip.goToFirstFile(); more; more = zip.goToNextFile())
+		{
+			QuaZipFile file(&zip);
+			file.open(QIODevice::ReadOnly);
+			result.append(qMakePair(zip.getCurrentFileName(), file.readAll()));
+		}
+		return result;
+	}
+
+	/// Linux can reset the peak. Elsewhere it is the peak of the whole run so far.
+	void resetPeakRss()
+	{
+#ifdef Q_OS_LINUX
+		QFile clear("/proc/self/clear_refs");
+		if (clear.open(QIODevice::WriteOnly))
+			clear.write("5");
+#endif
+	}
+
+	/// peak resident set size in KiB, or -1 if it can't be measured here
+	qint64 peakRss()
+	{
+#ifdef Q_OS_LINUX
+		QFile status("/proc/self/status");
+		if (status.open(QIODevice::ReadOnly))
+		{
+			for (auto line : status.readAll().split('\n'))
+			{
+				if (line.startsWith("VmHWM:"))
+					return line.mid(6).trimmed().split(' ').first().toLongLong();
+			}
+		}
+#endif
+#ifdef Q_OS_UNIX
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+			return -1;
+#ifdef Q_OS_MAC
+		// bytes instead of KiB
+		usage.ru_maxrss /= 1024;
+#endif
+		return usage.ru_maxrss;
+#else
+		return -1;
+#endif
+	}
+
+	/// repeat run until MEASURE_MS have passed, report throughput for 'bytes' of output per run
+	template <typename F> bool measure(const char *stage, qint64 bytes, F run)
+	{
+		resetPeakRss();
+		QElapsedTimer timer;
+		timer.start();
+		int runs = 0;
+		do
+		{
+			if (!run())
+				return false;
+			runs++;
+		} while (timer.elapsed() < MEASURE_MS);
+		double seconds = timer.nsecsElapsed() / 1e9;
+		qDebug("%-24s %8.1f MB/s, %d runs, peak RSS %lld KiB", stage,
+			   bytes * runs / seconds / (1024 * 1024), runs, peakRss());
+		return true;
+	}
+
+	void addFixtures()
+	{
+		QTest::addColumn<QString>("name");
+		QTest::newRow("resources") << "resources";
+		QTest::newRow("classes") << "classes";
+	}
+
+private
+slots:
+	void test_xzDecode_data()
+	{
+		addFixtures();
+	}
+	void test_xzDecode()
+	{
+		QFETCH(QString, name);
+		QByteArray xz = MULTIMC_GET_TEST_FILE("pack200/" + name + ".pack.xz");
+		QVERIFY(!xz.isEmpty());
+		QByteArray pack = decode(xz);
+		QVERIFY(!pack.isEmpty());
+
+		// xz checks its own output, a CRC64 in this case
+		QVERIFY(measure("xz decode", pack.size(), [&]()
+		{
+			return decode(xz).size() == pack.size();
+		}));
+	}
+
+	void test_unpack_data()
+	{
+		addFixtures();
+	}
+	void test_unpack()
+	{
+		QFETCH(QString, name);
+		QByteArray pack = fixture(name + ".pack");
+		QByteArray golden = fixture(name + ".jar");
+		QVERIFY(!pack.isEmpty());
+		QVERIFY(!golden.isEmpty());
+
+		// stored jars don't depend on the zlib version, so they must match exactly
+		unpack_200_stats stats;
+		QVERIFY(measure("unpack, store", golden.size(), [&]()
+		{
+			return unpack(pack, UNPACK_200_STORE, &stats) == golden;
+		}));
+		qDebug("%-24s %d KiB peak, %d KiB reserved", "unpacker memory", (int)(stats.peak / 1024),
+			   (int)(stats.peak_reserved / 1024));
+
+		auto goldenEntries = entries(golden);
+		QVERIFY(!goldenEntries.isEmpty());
+		QByteArray deflated;
+		QVERIFY(measure("unpack, deflate", golden.size(), [&]()
+		{
+			deflated = unpack(pack, UNPACK_200_DEFLATE);
+			return !deflated.isEmpty();
+		}));
+		QVERIFY(entries(deflated) == goldenEntries);
+		QVERIFY(measure("unpack, parallel deflate", golden.size(), [&]()
+		{
+			return unpack(pack, UNPACK_200_DEFLATE_PARALLEL) == deflated;
+		}));
+	}
+
+	void test_pipeline_data()
+	{
+		addFixtures();
+	}
+	void test_pipeline()
+	{
+		QFETCH(QString, name);
+		QByteArray xz = MULTIMC_GET_TEST_FILE("pack200/" + name + ".pack.xz");
+		QByteArray golden = fixture(name + ".jar");
+		QVERIFY(!xz.isEmpty());
+		QVERIFY(!golden.isEmpty());
+
+		QVERIFY(measure("xz + unpack, store", golden.size(), [&]()
+		{
+			return unpack(decode(xz), UNPACK_200_STORE) == golden;
+		}));
+		// what ForgeXzDownload does
+		auto goldenEntries = entries(golden);
+		QByteArray jar;
+		QVERIFY(measure("xz + unpack, parallel", golden.size(), [&]()
+		{
+			jar = unpack(decode(xz), UNPACK_200_DEFLATE_PARALLEL);
+			return !jar.isEmpty();
+		}));
+		QVERIFY(entries(jar) == goldenEntries);
+	}
+};
+
+QTEST_GUILESS_MAIN(Pack200BenchmarkTest)
+
+#include "tst_Pack200Benchmark.moc"
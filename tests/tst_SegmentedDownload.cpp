@@ -0,0 +1,146 @@
+#include <QTest>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
+#include "TestUtil.h"
+#include "LocalHttpServer.h"
+
+#include "Env.h"
+#include "FileSystem.h"
+#include "net/HttpMetaCache.h"
+#include "net/CacheDownload.h"
+#include "net/SegmentedDownload.h"
+#include "net/NetScheduler.h"
+#include "net/NetJob.h"
+
+class SegmentedDownloadTest : public QObject
+{
+	Q_OBJECT
+private:
+	QByteArray makeData(int size)
+	{
+		QByteArray data;
+		data.reserve(size);
+		quint32 seed = 42;
+		for (int i = 0; i < size; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			data.append(char(seed >> 16));
+		}
+		return data;
+	}
+
+	/// runs the action to completion and returns the wall time in ms, -1 on failure
+	qint64 run(NetActionPtr action)
+	{
+		QSignalSpy succeeded(action.get(), SIGNAL(succeeded(int)));
+		QSignalSpy failed(action.get(), SIGNAL(failed(int)));
+		QElapsedTimer timer;
+		timer.start();
+		action->start();
+		while (succeeded.isEmpty() && failed.isEmpty() && timer.elapsed() < 60000)
+		{
+			QTest::qWait(10);
+		}
+		return succeeded.isEmpty() ? -1 : timer.elapsed();
+	}
+
+	QTemporaryDir m_dir;
+
+private
+slots:
+	void initTestCase()
+	{
+		QVERIFY(m_dir.isValid());
+		QDir::setCurrent(m_dir.path());
+		ENV.initHttpMetaCache(m_dir.path(), m_dir.path());
+	}
+	void cleanupTestCase()
+	{
+		ENV.destroy();
+	}
+
+	void test_smallFileUsesSingleConnection()
+	{
+		LocalHttpServer server;
+		QByteArray data = makeData(1000);
+		server.addFile("small.bin", data);
+
+		auto entry = ENV.metacache()->resolveEntry("general", "small.bin");
+		auto dl = SegmentedDownload::make(server.url("small.bin"), entry, 1024 * 1024, 4);
+		QVERIFY(run(dl) >= 0);
+		QCOMPARE(server.requests["GET"], 1);
+		QCOMPARE(FS::read(entry->getFullPath()), data);
+	}
+
+	void test_segmented()
+	{
+		LocalHttpServer server;
+		QByteArray data = makeData(3 * 1024 * 1024 + 17);
+		server.addFile("big.bin", data);
+
+		auto entry = ENV.metacache()->resolveEntry("general", "big.bin");
+		auto dl = SegmentedDownload::make(server.url("big.bin"), entry, 1024 * 1024, 4);
+		QVERIFY(run(dl) >= 0);
+		QCOMPARE(server.requests["HEAD"], 1);
+		QCOMPARE(server.requests["GET"], 4);
+		QCOMPARE(FS::read(entry->getFullPath()), data);
+		QCOMPARE(entry->md5sum, QString(QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex()));
+		QVERIFY(!entry->stale);
+		QVERIFY(!QFile::exists(entry->getFullPath() + ".part"));
+	}
+
+	void test_segmentedFasterThanSingle()
+	{
+		// a server that gives every connection 4 MiB/s, like many CDNs do
+		LocalHttpServer server(4 * 1024 * 1024);
+		QByteArray data = makeData(8 * 1024 * 1024);
+		server.addFile("single.bin", data);
+		server.addFile("segmented.bin", data);
+
+		auto singleEntry = ENV.metacache()->resolveEntry("general", "single.bin");
+		qint64 single = run(CacheDownload::make(server.url("single.bin"), singleEntry));
+		QVERIFY(single >= 0);
+
+		auto segmentedEntry = ENV.metacache()->resolveEntry("general", "segmented.bin");
+		qint64 segmented = run(SegmentedDownload::make(server.url("segmented.bin"), segmentedEntry));
+		QVERIFY(segmented >= 0);
+
+		qDebug() << "8 MiB at 4 MiB/s per connection: single" << single << "ms, segmented"
+				 << segmented << "ms";
+		QCOMPARE(FS::read(segmentedEntry->getFullPath()), data);
+		// one connection can't beat the throttle. Four would take a quarter of the time,
+		// half leaves room for a slow machine.
+		QVERIFY2(single >= 1800, qPrintable(QString("single took %1 ms").arg(single)));
+		QVERIFY2(segmented * 2 < single,
+				 qPrintable(QString("segmented took %1 ms, single %2 ms").arg(segmented).arg(single)));
+	}
+
+	void test_hostLimit()
+	{
+		// the segments are connections like any other and wait for their turn. With only one
+		// allowed, the download does them one after another in its own slot.
+		ENV.netScheduler()->setHostLimits(1, 1);
+		LocalHttpServer server;
+		QByteArray data = makeData(2 * 1024 * 1024);
+		server.addFile("limited.bin", data);
+
+		auto entry = ENV.metacache()->resolveEntry("general", "limited.bin");
+		NetJobPtr job(new NetJob("limited"));
+		job->addNetAction(SegmentedDownload::make(server.url("limited.bin"), entry, 1024 * 1024, 4));
+		QSignalSpy succeeded(job.get(), SIGNAL(succeeded()));
+		job->start();
+		QVERIFY(succeeded.wait(60000));
+		ENV.netScheduler()->setHostLimits(1, 16);
+
+		QCOMPARE(server.requests["GET"], 4);
+		QCOMPARE(server.peakConnections, 1);
+		QCOMPARE(FS::read(entry->getFullPath()), data);
+		QTRY_COMPARE(ENV.netScheduler()->globalStats().active, 0);
+		QCOMPARE(ENV.netScheduler()->globalStats().queued, 0);
+	}
+};
+
+QTEST_GUILESS_MAIN(SegmentedDownloadTest)
+
+#include "tst_SegmentedDownload.moc"